@@ -72,7 +72,9 @@
 #define configCPU_CLOCK_HZ                  ( ( unsigned long ) 120000000 )
 #define configTICK_RATE_HZ                  ( ( portTickType ) 1000 )
 #define configMINIMAL_STACK_SIZE            ( ( unsigned short ) 200 )
-#define configTOTAL_HEAP_SIZE               ( ( size_t ) ( 65535 ) )
+#define configTOTAL_HEAP_SIZE               ( ( size_t ) ( 24576 ) ) // only lwIP's tcpip thread and mailboxes (see "sys mem")
+#define configSUPPORT_STATIC_ALLOCATION     1 // application tasks, queues and buffers are static
+#define configSUPPORT_DYNAMIC_ALLOCATION    1 // used by the lwIP port
 #define configMAX_TASK_NAME_LEN             ( 15 )
 #define configUSE_TRACE_FACILITY            1
 #define configUSE_16_BIT_TICKS              0
@@ -3,16 +3,36 @@
 #ifndef TASKS_CLI_H_
 #define TASKS_CLI_H_
 
-#define MAX_TOK_LEN (16) // maximal token length
+#include <stdint.h>
+#include <stddef.h>
 
-typedef char CliToken_Type[MAX_TOK_LEN];
-
-#define MAX_TOKEN_N (8) // maximal token count for a single command
-#define MAX_HELP_LEN (96) // maximal help line length for a single command
+typedef const char * CliToken_Type; // token (points into the line being processed)
 
 typedef int (*fnCliCallback)(const CliToken_Type * ppArgs, uint8_t argc); // function prototype for a callbacks
 
-
-void cli_register_command(char *pCmdParsHelp, uint8_t cmdTokCnt, uint8_t minArgCnt, fnCliCallback pCB); // register a new command
+// command definition (tables of these are meant to be const, so that they reside in flash)
+struct CliCommand
+{
+    const char * pCmd; // command tokens separated by single spaces (e.g. "ptp servo offset")
+    const char * pHelp; // arguments and description (printed after the command)
+    uint8_t minArgCnt; // minimal number of parameters
+    fnCliCallback pCB; // processing callback function
+};
+
+// table of commands
+//
+// Commands must be sorted by their tokens (plain strcmp() order of pCmd does it as long as tokens consist of
+// characters above space) and no command may be the token-wise prefix of another one in the same table. Lookup is
+// then a binary search narrowing the table token by token, like walking a prefix trie.
+struct CliCommandTable
+{
+    const struct CliCommand * pCmds; // commands
+    uint16_t cmdCnt; // number of commands
+    struct CliCommandTable * pNext; // next registered table (managed by the CLI)
+};
+
+#define CLI_COMMAND_TABLE(cmds) { (cmds), sizeof(cmds) / sizeof((cmds)[0]), NULL } // table initializer
+
+void cli_register_table(struct CliCommandTable * pTable); // register a table of commands (registering the same table again has no effect)
 
 #endif /* TASKS_CLI_H_ */
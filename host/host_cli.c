@@ -0,0 +1,89 @@
+/* (C) András Wiesner, 2021 */
+
+#include "host_cli.h"
+
+#include <string.h>
+
+#include "cli.h"
+
+#define HOST_CLI_LINE_LENGTH (512)
+#define HOST_CLI_MAX_TOKENS (16)
+
+static struct CliCommandTable *spCliTables; // registered tables
+
+// store command table
+void cli_register_table(struct CliCommandTable *pTable)
+{
+    const struct CliCommandTable *pIter;
+    for (pIter = spCliTables; pIter != NULL; pIter = pIter->pNext)
+    {
+        if (pIter == pTable)
+        {
+            return;
+        }
+    }
+
+    pTable->pNext = spCliTables;
+    spCliTables = pTable;
+}
+
+// match command tokens against the beginning of the line, returns number of matched tokens (0 if no match)
+static uint32_t host_cli_match(const char *pCmd, const CliToken_Type *ppTok, uint32_t tokCnt)
+{
+    char pCmdTok[HOST_CLI_LINE_LENGTH];
+    strncpy(pCmdTok, pCmd, sizeof(pCmdTok) - 1);
+    pCmdTok[sizeof(pCmdTok) - 1] = '\0';
+
+    uint32_t k = 0;
+    char *pSave;
+    char *pCTok = strtok_r(pCmdTok, " ", &pSave);
+    while (pCTok != NULL)
+    {
+        if (k >= tokCnt || strcmp(pCTok, ppTok[k]))
+        {
+            return 0;
+        }
+
+        k++;
+        pCTok = strtok_r(NULL, " ", &pSave);
+    }
+
+    return k;
+}
+
+// run command line
+int host_cli_run(const char *pLine)
+{
+    char pBuf[HOST_CLI_LINE_LENGTH];
+    CliToken_Type ppTok[HOST_CLI_MAX_TOKENS];
+    uint32_t tokCnt = 0;
+
+    strncpy(pBuf, pLine, sizeof(pBuf) - 1);
+    pBuf[sizeof(pBuf) - 1] = '\0';
+
+    // split line into tokens
+    char *pSave;
+    char *pTok = strtok_r(pBuf, " ", &pSave);
+    while (pTok != NULL && tokCnt < HOST_CLI_MAX_TOKENS)
+    {
+        ppTok[tokCnt++] = pTok;
+        pTok = strtok_r(NULL, " ", &pSave);
+    }
+
+    // look for the command in every table
+    const struct CliCommandTable *pTable;
+    for (pTable = spCliTables; pTable != NULL; pTable = pTable->pNext)
+    {
+        uint16_t i;
+        for (i = 0; i < pTable->cmdCnt; i++)
+        {
+            uint32_t k = host_cli_match(pTable->pCmds[i].pCmd, ppTok, tokCnt);
+            if (k > 0 && (tokCnt - k) >= pTable->pCmds[i].minArgCnt)
+            {
+                return pTable->pCmds[i].pCB(&ppTok[k], tokCnt - k);
+            }
+        }
+    }
+
+    return -1;
+}
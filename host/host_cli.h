@@ -0,0 +1,11 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef HOST_HOST_CLI_H_
+#define HOST_HOST_CLI_H_
+
+// Host side of cli.h: registered command tables are searched by the PC tools to execute command lines given
+// as arguments (e.g. -c "ptp servo params 0.2 0.9").
+
+int host_cli_run(const char * pLine); // run command line, returns the result of the callback or -1 if no command matches
+
+#endif /* HOST_HOST_CLI_H_ */
@@ -0,0 +1,243 @@
+/* (C) András Wiesner, 2021 */
+
+#include "host_osc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+
+#define HOST_OSC_FLICKER_GAIN (0.72) // scales the sum of flicker sections to the requested Allan deviation floor
+
+// configuration keys
+struct HostOscKey
+{
+    const char *pKey; // key
+    size_t offset; // offset of the double field in struct HostOscParams
+};
+
+static const struct HostOscKey spKeys[] = {
+    { "aging_ppb_per_day", offsetof(struct HostOscParams, aging_ppbPerDay) },
+    { "flicker_fm_adev", offsetof(struct HostOscParams, flickerFm) },
+    { "freq_offset_ppb", offsetof(struct HostOscParams, freqOffset_ppb) },
+    { "random_walk_fm_adev", offsetof(struct HostOscParams, randomWalkFm) },
+    { "step_s", offsetof(struct HostOscParams, step_s) },
+    { "temp_amplitude_ppb", offsetof(struct HostOscParams, tempAmplitude_ppb) },
+    { "temp_period_s", offsetof(struct HostOscParams, tempPeriod_s) },
+    { "temp_tau_s", offsetof(struct HostOscParams, tempTau_s) },
+    { "temp_wander_ppb", offsetof(struct HostOscParams, tempWander_ppb) },
+    { "white_fm_adev", offsetof(struct HostOscParams, whiteFm) },
+    { "white_pm_ns", offsetof(struct HostOscParams, whitePm_ns) },
+};
+
+// --------------------------
+
+// load parameters from configuration file
+bool host_osc_load(struct HostOscParams *pParams, const char *pFileName)
+{
+    FILE *pFile = fopen(pFileName, "r");
+    if (pFile == NULL)
+    {
+        fprintf(stderr, "Cannot open oscillator model '%s'\n", pFileName);
+        return false;
+    }
+
+    memset(pParams, 0, sizeof(struct HostOscParams));
+    pParams->step_s = 0.1;
+    pParams->seed = 1;
+
+    const char *pName = strrchr(pFileName, '/');
+    snprintf(pParams->name, sizeof(pParams->name), "%s", (pName != NULL) ? pName + 1 : pFileName);
+
+    char pLine[256];
+    uint32_t lineNum = 0;
+    bool ok = true;
+    while (ok && fgets(pLine, sizeof(pLine), pFile) != NULL)
+    {
+        lineNum++;
+
+        char *pComment = strchr(pLine, '#');
+        if (pComment != NULL)
+        {
+            *pComment = '\0';
+        }
+
+        char pKey[64], pValue[64], tail;
+        int n = sscanf(pLine, " %63[a-z0-9_] = %63s %c", pKey, pValue, &tail);
+        if (n <= 0)
+        {
+            continue; // empty line
+        }
+
+        ok = false;
+        if (n == 2)
+        {
+            char *pEnd;
+            if (!strcmp(pKey, "seed"))
+            {
+                pParams->seed = strtoull(pValue, &pEnd, 0);
+                ok = (*pEnd == '\0' && pParams->seed != 0);
+            }
+            else
+            {
+                uint8_t i;
+                for (i = 0; i < sizeof(spKeys) / sizeof(spKeys[0]); i++)
+                {
+                    if (!strcmp(pKey, spKeys[i].pKey))
+                    {
+                        double *pField = (double*) ((uint8_t*) pParams + spKeys[i].offset);
+                        *pField = strtod(pValue, &pEnd);
+                        ok = (*pEnd == '\0');
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "%s:%u: invalid line\n", pFileName, lineNum);
+        }
+    }
+
+    fclose(pFile);
+
+    if (ok && (pParams->step_s <= 0 || (pParams->tempAmplitude_ppb != 0 && pParams->tempPeriod_s <= 0)
+            || (pParams->tempWander_ppb != 0 && pParams->tempTau_s <= 0)))
+    {
+        fprintf(stderr, "%s: step_s, temp_period_s and temp_tau_s must be positive when used\n", pFileName);
+        ok = false;
+    }
+
+    return ok;
+}
+
+// --------------------------
+
+// random number generator (xorshift64*)
+static double host_osc_uniform(struct HostOsc *pOsc)
+{
+    pOsc->rng ^= pOsc->rng >> 12;
+    pOsc->rng ^= pOsc->rng << 25;
+    pOsc->rng ^= pOsc->rng >> 27;
+    return ((pOsc->rng * 0x2545F4914F6CDD1Dull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// normally distributed random number (Box-Muller)
+static double host_osc_gauss(struct HostOsc *pOsc)
+{
+    double u1 = host_osc_uniform(pOsc), u2 = host_osc_uniform(pOsc);
+    return sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * M_PI * u2);
+}
+
+// compute frequency error of the step starting at tStep
+static void host_osc_new_step(struct HostOsc *pOsc)
+{
+    const struct HostOscParams *pP = &pOsc->params;
+    double step = pP->step_s, t = (pOsc->tStep - pOsc->t0) / 1E+09;
+
+    // deterministic components
+    double y_ppb = pP->freqOffset_ppb + pP->aging_ppbPerDay * t / 86400.0;
+    if (pP->tempAmplitude_ppb != 0)
+    {
+        y_ppb += pP->tempAmplitude_ppb * sin(2.0 * M_PI * t / pP->tempPeriod_s);
+    }
+
+    // random temperature wander (first-order Gauss-Markov)
+    if (pP->tempWander_ppb != 0)
+    {
+        double a = exp(-step / pP->tempTau_s);
+        pOsc->tempRandom = a * pOsc->tempRandom + pP->tempWander_ppb * sqrt(1.0 - a * a) * host_osc_gauss(pOsc);
+        y_ppb += pOsc->tempRandom;
+    }
+
+    double y = y_ppb * 1E-09;
+
+    // white FM: step averages are independent
+    y += pP->whiteFm / sqrt(step) * host_osc_gauss(pOsc);
+
+    // flicker FM: first-order sections with time constants of step * 2^k, equal power per octave
+    if (pP->flickerFm != 0)
+    {
+        double sum = 0;
+        uint8_t k;
+        for (k = 0; k < HOST_OSC_FLICKER_STAGES; k++)
+        {
+            double a = pOsc->pFlickerPole[k];
+            pOsc->pFlicker[k] = a * pOsc->pFlicker[k] + sqrt(1.0 - a * a) * host_osc_gauss(pOsc);
+            sum += pOsc->pFlicker[k];
+        }
+        y += HOST_OSC_FLICKER_GAIN * pP->flickerFm * sum;
+    }
+
+    // random walk FM: ADEV(tau) = sigma * sqrt(tau)
+    pOsc->rw += pP->randomWalkFm * sqrt(3.0 * step) * host_osc_gauss(pOsc);
+    y += pOsc->rw;
+
+    pOsc->y = y;
+}
+
+// initialize model
+void host_osc_init(struct HostOsc *pOsc, const struct HostOscParams *pParams, int64_t t0_ns)
+{
+    memset(pOsc, 0, sizeof(struct HostOsc));
+    pOsc->params = *pParams;
+    pOsc->rng = (pParams->seed != 0) ? pParams->seed : 1;
+    pOsc->t0 = pOsc->tStep = pOsc->tPm = t0_ns;
+    pOsc->step_ns = (int64_t) (pParams->step_s * 1E+09);
+    if (pOsc->step_ns <= 0)
+    {
+        pOsc->step_ns = 1;
+    }
+
+    // start flicker sections from their stationary distribution
+    uint8_t k;
+    for (k = 0; k < HOST_OSC_FLICKER_STAGES; k++)
+    {
+        pOsc->pFlickerPole[k] = exp(-1.0 / (double) (1u << k));
+        pOsc->pFlicker[k] = host_osc_gauss(pOsc);
+    }
+    pOsc->tempRandom = pParams->tempWander_ppb * host_osc_gauss(pOsc);
+
+    host_osc_new_step(pOsc);
+}
+
+// get phase error at a virtual time
+double host_osc_phase(int64_t t_ns, void *pArg)
+{
+    struct HostOsc *pOsc = (struct HostOsc*) pArg;
+
+    // integrate frequency over the completed steps
+    while (t_ns >= pOsc->tStep + pOsc->step_ns)
+    {
+        pOsc->x_ns += pOsc->y * pOsc->step_ns;
+        pOsc->tStep += pOsc->step_ns;
+        host_osc_new_step(pOsc);
+    }
+
+    // new white PM sample on every new reading time
+    if (t_ns != pOsc->tPm && pOsc->params.whitePm_ns != 0)
+    {
+        pOsc->pm_ns = pOsc->params.whitePm_ns * host_osc_gauss(pOsc);
+        pOsc->tPm = t_ns;
+    }
+
+    double dt = (t_ns > pOsc->tStep) ? (double) (t_ns - pOsc->tStep) : 0.0;
+    return pOsc->x_ns + pOsc->y * dt + pOsc->pm_ns;
+}
+
+// get current frequency error
+double host_osc_freq_ppb(const struct HostOsc *pOsc)
+{
+    return pOsc->y * 1E+09;
+}
+
+// print parameters
+void host_osc_print(const struct HostOscParams *pP)
+{
+    printf("Oscillator '%s': offset: %g ppb, aging: %g ppb/day, temperature: %g ppb / %g s + %g ppb (tau: %g s)\n", pP->name, pP->freqOffset_ppb,
+           pP->aging_ppbPerDay, pP->tempAmplitude_ppb, pP->tempPeriod_s, pP->tempWander_ppb, pP->tempTau_s);
+    printf("    ADEV WFM: %g, FFM: %g, RWFM: %g, WPM: %g ns, step: %g s, seed: %llu\n", pP->whiteFm, pP->flickerFm, pP->randomWalkFm, pP->whitePm_ns,
+           pP->step_s, (unsigned long long) pP->seed);
+}
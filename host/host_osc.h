@@ -0,0 +1,72 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef HOST_HOST_OSC_H_
+#define HOST_HOST_OSC_H_
+
+// Oscillator models for the virtual timestamping clock (see host_clock_set_oscillator())
+//
+// The fractional frequency error of the oscillator is the sum of
+//   - a constant offset,
+//   - linear aging,
+//   - temperature-like wander: a sinusoid (e.g. air conditioning cycle) and a slow random process
+//     (first-order Gauss-Markov with the given correlation time),
+//   - white, flicker and random walk frequency noise,
+// it is held constant for one model step and integrated into the phase. White phase noise (timestamping
+// jitter) is added to every phase reading. Noise levels are given as Allan deviations: white and random walk
+// FM at 1 s averaging time, flicker FM as the flat floor it produces. Models are deterministic for a seed.
+//
+// Parameters are read from configuration files of "key = value" lines ('#' starts a comment), see
+// host/osc/*.osc for XO, TCXO and OCXO classes. Keys (missing ones are zero, except step_s):
+//
+//   freq_offset_ppb, aging_ppb_per_day, temp_amplitude_ppb, temp_period_s, temp_wander_ppb, temp_tau_s,
+//   white_fm_adev, flicker_fm_adev, random_walk_fm_adev, white_pm_ns, step_s (default: 0.1), seed
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HOST_OSC_FLICKER_STAGES (20) // first-order sections approximating flicker noise (one per octave)
+#define HOST_OSC_NAME_LENGTH (32) // maximal length of a model name
+
+// oscillator model parameters
+struct HostOscParams
+{
+    char name[HOST_OSC_NAME_LENGTH]; // model name (file name without path)
+    double freqOffset_ppb; // constant frequency offset
+    double aging_ppbPerDay; // linear frequency drift
+    double tempAmplitude_ppb; // amplitude of the sinusoidal wander
+    double tempPeriod_s; // period of the sinusoidal wander
+    double tempWander_ppb; // deviation of the random wander
+    double tempTau_s; // correlation time of the random wander
+    double whiteFm; // Allan deviation of white FM at 1 s
+    double flickerFm; // flicker floor of Allan deviation
+    double randomWalkFm; // Allan deviation of random walk FM at 1 s
+    double whitePm_ns; // deviation of white phase noise
+    double step_s; // model step (frequency is constant within)
+    uint64_t seed; // random seed
+};
+
+// oscillator model state
+struct HostOsc
+{
+    struct HostOscParams params; // parameters
+    uint64_t rng; // random generator state
+    int64_t t0; // start of the model [ns]
+    int64_t tStep; // start of the current step [ns]
+    int64_t step_ns; // step length [ns]
+    double x_ns; // phase error at the start of the current step
+    double y; // fractional frequency error in the current step
+    double rw; // random walk FM component
+    double tempRandom; // random temperature component
+    double pFlicker[HOST_OSC_FLICKER_STAGES]; // states of the flicker sections
+    double pFlickerPole[HOST_OSC_FLICKER_STAGES]; // poles of the flicker sections
+    int64_t tPm; // time of the last white PM sample
+    double pm_ns; // last white PM sample
+};
+
+bool host_osc_load(struct HostOscParams * pParams, const char * pFileName); // load parameters from configuration file (errors are printed)
+void host_osc_init(struct HostOsc * pOsc, const struct HostOscParams * pParams, int64_t t0_ns); // initialize model starting at the given virtual time
+double host_osc_phase(int64_t t_ns, void * pArg); // phase error [ns] at a virtual time not earlier than the previous one (fnHostOscPhase, pArg: struct HostOsc)
+double host_osc_freq_ppb(const struct HostOsc * pOsc); // current frequency error [ppb]
+void host_osc_print(const struct HostOscParams * pParams); // print parameters
+
+#endif /* HOST_HOST_OSC_H_ */
@@ -0,0 +1,396 @@
+/* (C) András Wiesner, 2021 */
+
+#include "host_port.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "uart_comm.h"
+#include "ptp.h"
+#include "hw_port/ptp_port_host.h"
+
+#define HOST_NS_PER_TICK (1000000000 / configTICK_RATE_HZ)
+#define HOST_NVS_SIZE (6144) // size of the file-backed storage (same as the EEPROM of the TM4C1294) [bytes]
+
+// virtual hardware clock
+struct HostClock
+{
+    int64_t clock_ns; // clock reading at the current virtual time
+    double frac_ns; // fractional nanoseconds accumulated
+    uint32_t addend; // addend register
+    uint32_t addendInit; // addend running the clock at nominal rate
+    double freqErr; // relative frequency error of the oscillator
+    fnHostOscPhase pOscPhase; // oscillator model
+    void *pOscArg; // argument of the oscillator model
+    double oscPhase_ns; // phase error of the oscillator model at the current virtual time
+    bool steering; // corrections are applied
+};
+
+// environment of a thread
+struct HostEnv
+{
+    int64_t time_ns; // virtual time
+    struct HostClock clock; // timestamping clock
+    struct netif netif; // network interface
+    fnHostUdpSend pUdpHook; // transmit hook
+    void *pUdpHookArg; // argument of transmit hook
+    bool quiet; // console output suppressed
+    const char *pNvsFile; // file backing the non-volatile storage (NULL: no storage)
+};
+
+static __thread struct HostEnv sDefaultEnv = { .clock = { .steering = true } }; // environment used when none is selected
+static __thread struct HostEnv *spEnv; // selected environment
+
+// get environment of the calling thread
+static inline struct HostEnv* host_env()
+{
+    return (spEnv != NULL) ? spEnv : &sDefaultEnv;
+}
+
+// --------------------------
+
+// advance clock to the virtual time
+static void host_clock_advance(int64_t t_ns)
+{
+    struct HostEnv *pE = host_env();
+    struct HostClock *pC = &pE->clock;
+    int64_t dt = t_ns - pE->time_ns;
+
+    // oscillator periods elapsed in excess of the nominal ones
+    double dx = 0;
+    if (pC->pOscPhase != NULL)
+    {
+        double phase = pC->pOscPhase(t_ns, pC->pOscArg);
+        dx = phase - pC->oscPhase_ns;
+        pC->oscPhase_ns = phase;
+    }
+
+    if (!pC->steering || pC->addendInit == 0)
+    {
+        pC->frac_ns += dt * pC->freqErr + dx;
+    }
+    else
+    {
+        pC->frac_ns += (dt + dx) * ((double) pC->addend / pC->addendInit * (1.0 + pC->freqErr)) - dt;
+    }
+
+    int64_t whole = (int64_t) pC->frac_ns;
+    pC->clock_ns += dt + whole;
+    pC->frac_ns -= whole;
+
+    pE->time_ns = t_ns;
+}
+
+// create environment
+struct HostEnv* host_env_create()
+{
+    struct HostEnv *pE = (struct HostEnv*) calloc(1, sizeof(struct HostEnv));
+    if (pE != NULL)
+    {
+        pE->clock.steering = true;
+    }
+
+    return pE;
+}
+
+// release environment
+void host_env_destroy(struct HostEnv *pE)
+{
+    if (spEnv == pE)
+    {
+        spEnv = NULL;
+    }
+
+    free(pE);
+}
+
+// select environment of the calling thread
+void host_env_select(struct HostEnv *pE)
+{
+    spEnv = pE;
+}
+
+// get size of an environment
+size_t host_env_size()
+{
+    return sizeof(struct HostEnv);
+}
+
+// reset selected environment
+void host_port_reset()
+{
+    struct HostEnv *pE = host_env();
+
+    memset(pE, 0, sizeof(struct HostEnv));
+    pE->clock.steering = true;
+}
+
+// advance virtual time
+void host_set_time(int64_t t_ns)
+{
+    if (t_ns > host_env()->time_ns)
+    {
+        host_clock_advance(t_ns);
+    }
+}
+
+// get virtual time
+int64_t host_get_time()
+{
+    return host_env()->time_ns;
+}
+
+// get virtual interface
+struct netif* host_netif_default()
+{
+    return &host_env()->netif;
+}
+
+// set addresses of the virtual interface
+void host_set_netif(const uint8_t *pHwAddr, uint32_t ipAddr)
+{
+    struct HostEnv *pE = host_env();
+
+    memcpy(pE->netif.hwaddr, pHwAddr, sizeof(pE->netif.hwaddr));
+    pE->netif.ip_addr.addr = ipAddr;
+}
+
+// set transmit hook
+void host_set_udp_hook(fnHostUdpSend pCB, void *pArg)
+{
+    struct HostEnv *pE = host_env();
+
+    pE->pUdpHook = pCB;
+    pE->pUdpHookArg = pArg;
+}
+
+// enable/disable clock corrections
+void host_clock_set_steering(bool en)
+{
+    host_env()->clock.steering = en;
+}
+
+// set oscillator frequency error
+void host_clock_set_freq_error(double err_ppb)
+{
+    host_env()->clock.freqErr = err_ppb * 1E-09;
+}
+
+// set oscillator model
+void host_clock_set_oscillator(fnHostOscPhase pPhase, void *pArg)
+{
+    struct HostEnv *pE = host_env();
+
+    pE->clock.pOscPhase = pPhase;
+    pE->clock.pOscArg = pArg;
+    pE->clock.oscPhase_ns = (pPhase != NULL) ? pPhase(pE->time_ns, pArg) : 0;
+}
+
+// shift the clock
+void host_clock_step(int64_t d_ns)
+{
+    host_env()->clock.clock_ns += d_ns;
+}
+
+// suppress console output
+void host_set_quiet(bool quiet)
+{
+    host_env()->quiet = quiet;
+}
+
+// --------------------------
+
+// console output
+bool UART_printf(const char *pFmt, ...)
+{
+    if (host_env()->quiet)
+    {
+        return true;
+    }
+
+    va_list args;
+    va_start(args, pFmt);
+    vprintf(pFmt, args);
+    va_end(args);
+
+    return true;
+}
+
+// --------------------------
+
+TickType_t xTaskGetTickCount()
+{
+    return (TickType_t) (host_env()->time_ns / HOST_NS_PER_TICK);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    (void) ticks;
+}
+
+// --------------------------
+
+uint32_t ipaddr_addr(const char *pStr)
+{
+    unsigned int a, b, c, d;
+    char tail;
+    if (sscanf(pStr, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4 || a > 255 || b > 255 || c > 255 || d > 255)
+    {
+        return IPADDR_NONE;
+    }
+
+    uint8_t p[4] = { a, b, c, d };
+    uint32_t addr;
+    memcpy(&addr, p, 4);
+    return addr;
+}
+
+struct pbuf* pbuf_alloc(pbuf_layer layer, uint16_t length, pbuf_type type)
+{
+    (void) layer;
+    (void) type;
+
+    struct pbuf *p = (struct pbuf*) calloc(1, sizeof(struct pbuf) + length);
+    if (p == NULL)
+    {
+        return NULL;
+    }
+
+    p->payload = (uint8_t*) (p + 1);
+    p->len = p->tot_len = length;
+    return p;
+}
+
+uint8_t pbuf_free(struct pbuf *p)
+{
+    free(p);
+    return 1;
+}
+
+err_t udp_sendto(struct udp_pcb *pcb, struct pbuf *p, struct ip_addr *dst_ip, uint16_t dst_port)
+{
+    struct HostEnv *pE = host_env();
+
+    // timestamp transmission like the MAC does
+    struct TimestampI t;
+    ptphw_host_gettime(&t);
+    p->time_s = (uint32_t) t.sec;
+    p->time_ns = (uint32_t) t.nanosec;
+
+    if (pE->pUdpHook != NULL)
+    {
+        pE->pUdpHook(pcb, p, dst_ip, dst_port, pE->pUdpHookArg);
+    }
+
+    return ERR_OK;
+}
+
+// set file backing the non-volatile storage
+void host_set_nvs_file(const char *pFileName)
+{
+    host_env()->pNvsFile = pFileName;
+}
+
+// load image of the storage (unwritten bytes read as 0xff)
+static void host_nvs_load(uint8_t *pImage)
+{
+    memset(pImage, 0xff, HOST_NVS_SIZE);
+
+    FILE *pF = fopen(host_env()->pNvsFile, "rb");
+    if (pF != NULL)
+    {
+        size_t n = fread(pImage, 1, HOST_NVS_SIZE, pF);
+        (void) n;
+        fclose(pF);
+    }
+}
+
+// --------------------------
+
+void ptphw_host_init(uint32_t increment, uint32_t addend)
+{
+    struct HostEnv *pE = host_env();
+
+    (void) increment;
+    pE->clock.addend = addend; // may differ from the nominal one (learned frequency)
+    pE->clock.addendInit = PTP_ADDEND_INIT;
+    pE->clock.clock_ns = pE->time_ns;
+    pE->clock.frac_ns = 0;
+}
+
+void ptphw_host_update_clock(int32_t s, int32_t ns)
+{
+    struct HostEnv *pE = host_env();
+
+    if (pE->clock.steering)
+    {
+        pE->clock.clock_ns += (int64_t) s * NANO_PREFIX + ns;
+    }
+}
+
+void ptphw_host_set_addend(uint32_t addend)
+{
+    host_env()->clock.addend = addend;
+}
+
+void ptphw_host_gettime(struct TimestampI *pTime)
+{
+    struct HostEnv *pE = host_env();
+
+    pTime->sec = pE->clock.clock_ns / NANO_PREFIX;
+    pTime->nanosec = pE->clock.clock_ns % NANO_PREFIX;
+}
+
+uint32_t ptphw_host_cycle_counter()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((uint64_t) ts.tv_sec * NANO_PREFIX + ts.tv_nsec);
+}
+
+uint32_t ptphw_host_nvs_init()
+{
+    return (host_env()->pNvsFile != NULL) ? HOST_NVS_SIZE : 0;
+}
+
+void ptphw_host_nvs_read(uint32_t addr, uint32_t *pWords, uint32_t size)
+{
+    uint8_t pImage[HOST_NVS_SIZE];
+
+    if (host_env()->pNvsFile == NULL || addr + size > HOST_NVS_SIZE)
+    {
+        memset(pWords, 0xff, size);
+        return;
+    }
+
+    host_nvs_load(pImage);
+    memcpy(pWords, pImage + addr, size);
+}
+
+int ptphw_host_nvs_write(uint32_t addr, const uint32_t *pWords, uint32_t size)
+{
+    uint8_t pImage[HOST_NVS_SIZE];
+
+    if (host_env()->pNvsFile == NULL || addr + size > HOST_NVS_SIZE)
+    {
+        return -1;
+    }
+
+    host_nvs_load(pImage);
+    memcpy(pImage + addr, pWords, size);
+
+    FILE *pF = fopen(host_env()->pNvsFile, "wb");
+    if (pF == NULL)
+    {
+        return -1;
+    }
+
+    size_t n = fwrite(pImage, 1, HOST_NVS_SIZE, pF);
+    return (fclose(pF) == 0 && n == HOST_NVS_SIZE) ? 0 : -1;
+}
@@ -0,0 +1,44 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef HOST_HOST_PORT_H_
+#define HOST_HOST_PORT_H_
+
+// Virtual environment for running the PTP engine on a PC (build with -DPTP_PORT_HOST -Ihost/include)
+//
+// The engine sees a virtual time instead of the OS tick and the hardware clock: the tick count and the
+// timestamping clock only advance when the driving tool calls host_set_time() (timeouts are handled by
+// ptp_poll(), which the tool calls like the PTP task does). Transmitted
+// datagrams get their TX timestamp from the virtual clock and are handed to a hook. Every thread has its own
+// environment, so independent engine instances may run in parallel threads. Further environments can be
+// created and selected, so a thread can drive many instances, each having its own time and clock
+// (an environment may be driven by any thread, but only by one at a time).
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "utils/lwiplib.h"
+
+typedef void (*fnHostUdpSend)(struct udp_pcb * pPCB, struct pbuf * pPBuf, const struct ip_addr * pAddr, uint16_t port, void * pArg); // transmit hook
+typedef double (*fnHostOscPhase)(int64_t t_ns, void * pArg); // phase error of the oscillator at a virtual time [ns] (see host_osc.h)
+
+struct HostEnv; // environment (virtual time, clock, network interface)
+
+struct HostEnv * host_env_create(); // create environment
+void host_env_destroy(struct HostEnv * pEnv); // release environment
+void host_env_select(struct HostEnv * pEnv); // select environment of the calling thread (NULL: default environment of the thread)
+size_t host_env_size(); // get size of an environment
+
+void host_port_reset(); // reset virtual time, clock and network interface of the selected environment
+void host_set_time(int64_t t_ns); // advance virtual time [ns] (going backwards is ignored)
+int64_t host_get_time(); // get virtual time [ns]
+void host_set_netif(const uint8_t * pHwAddr, uint32_t ipAddr); // set MAC and IP (network byte order) address of the virtual interface
+void host_set_udp_hook(fnHostUdpSend pCB, void * pArg); // set hook receiving transmitted datagrams (buffers are owned by the engine)
+void host_clock_set_steering(bool en); // apply clock corrections (true, default) or let the clock follow the virtual time exactly
+void host_clock_set_freq_error(double err_ppb); // set frequency error of the oscillator driving the clock
+void host_clock_set_oscillator(fnHostOscPhase pPhase, void * pArg); // drive the clock by an oscillator model on top of the frequency error (NULL: ideal oscillator)
+void host_clock_step(int64_t d_ns); // shift the clock (e.g. initial phase error, not counted as correction)
+void host_set_quiet(bool quiet); // suppress console output of the engine
+void host_set_nvs_file(const char * pFileName); // back the non-volatile storage by a file (NULL: no storage, default)
+
+#endif /* HOST_HOST_PORT_H_ */
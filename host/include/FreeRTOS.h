@@ -0,0 +1,29 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+// Host replacement of the FreeRTOS kernel subset used by the PTP engine (see host/host_port.c). Every thread
+// runs its own engine instances in virtual time, so critical sections are empty.
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdFALSE ((BaseType_t) 0)
+#define pdTRUE ((BaseType_t) 1)
+#define pdPASS (pdTRUE)
+#define pdFAIL (pdFALSE)
+
+#define portMAX_DELAY ((TickType_t) 0xffffffffUL)
+
+#define configTICK_RATE_HZ (1000)
+#define pdMS_TO_TICKS(ms) ((TickType_t) (((TickType_t) (ms) * (TickType_t) configTICK_RATE_HZ) / (TickType_t) 1000))
+
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+#endif /* HOST_FREERTOS_H_ */
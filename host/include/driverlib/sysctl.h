@@ -0,0 +1,8 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef HOST_SYSCTL_H_
+#define HOST_SYSCTL_H_
+
+// empty on the host, peripherals are not touched by the portable modules
+
+#endif /* HOST_SYSCTL_H_ */
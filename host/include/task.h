@@ -0,0 +1,11 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef HOST_TASK_H_
+#define HOST_TASK_H_
+
+#include "FreeRTOS.h"
+
+TickType_t xTaskGetTickCount(); // tick count of the virtual time
+void vTaskDelay(TickType_t ticks); // does not block, virtual time is advanced by the driving tool only
+
+#endif /* HOST_TASK_H_ */
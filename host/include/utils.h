@@ -0,0 +1,18 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef HOST_UTILS_H_
+#define HOST_UTILS_H_
+
+// Host replacement of the project's utils.h for building portable modules into the tools in host/
+// (put host/include in front of the project root on the include path).
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#define MSG(...) printf(__VA_ARGS__)
+
+#define CLILOG(en, ...) { if (en) printf(__VA_ARGS__); }
+
+#define LIMIT(x,l) (x < -l ? -l : (x > l ? l : x))
+
+#endif /* HOST_UTILS_H_ */
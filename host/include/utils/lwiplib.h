@@ -0,0 +1,66 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef HOST_LWIPLIB_H_
+#define HOST_LWIPLIB_H_
+
+// Host replacement of the lwIP subset used by the PTP engine (see host/host_port.c). Buffers are single
+// heap blocks, transmitted datagrams are passed to a hook of the driving tool.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "FreeRTOS.h"
+#include "task.h" // pulled in by the lwIP port of the firmware as well
+
+typedef int8_t err_t;
+#define ERR_OK (0)
+#define ERR_MEM (-1)
+
+// IPv4 address (network byte order)
+struct ip_addr {
+    uint32_t addr;
+};
+typedef struct ip_addr ip_addr_t;
+
+#define IPADDR_NONE ((uint32_t) 0xffffffffUL)
+#define ip_addr_cmp(a, b) ((a)->addr == (b)->addr)
+#define ip4_addr1(a) (((const uint8_t *) (a))[0])
+#define ip4_addr2(a) (((const uint8_t *) (a))[1])
+#define ip4_addr3(a) (((const uint8_t *) (a))[2])
+#define ip4_addr4(a) (((const uint8_t *) (a))[3])
+
+uint32_t ipaddr_addr(const char * pStr); // parse dotted decimal address (IPADDR_NONE on failure)
+
+// packet buffer (time_s and time_ns hold the hardware timestamp like in the Tiva port of lwIP)
+struct pbuf {
+    struct pbuf * next;
+    void * payload;
+    uint16_t tot_len, len;
+    uint32_t time_s, time_ns;
+};
+
+typedef enum { PBUF_TRANSPORT, PBUF_IP, PBUF_LINK, PBUF_RAW } pbuf_layer;
+typedef enum { PBUF_RAM, PBUF_ROM, PBUF_REF, PBUF_POOL } pbuf_type;
+
+struct pbuf * pbuf_alloc(pbuf_layer layer, uint16_t length, pbuf_type type);
+uint8_t pbuf_free(struct pbuf * p);
+
+// UDP connection
+struct udp_pcb {
+    uint16_t local_port; // bound port
+};
+
+err_t udp_sendto(struct udp_pcb * pcb, struct pbuf * p, struct ip_addr * dst_ip, uint16_t dst_port);
+
+// network interface
+struct netif {
+    struct ip_addr ip_addr;
+    uint8_t hwaddr[6];
+};
+
+struct netif * host_netif_default(); // interface of the calling thread
+#define netif_default (host_netif_default())
+
+#endif /* HOST_LWIPLIB_H_ */
@@ -0,0 +1,8 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef HOST_UARTSTDIO_H_
+#define HOST_UARTSTDIO_H_
+
+// empty on the host, console output goes through UART_printf() (see host/host_port.c)
+
+#endif /* HOST_UARTSTDIO_H_ */
@@ -0,0 +1,828 @@
+/* (C) András Wiesner, 2021 */
+
+// Offline ingestion of PTP captures
+//
+// PTP over UDP/IPv4 is read from pcap or pcapng files (Ethernet with VLAN tags, Linux cooked or raw IPv4
+// link layer, e.g. `tcpdump -j adapter_unsynced --time-stamp-precision=nano -w ptp.pcap udp port 319 or 320`
+// or the pcapng export of `ptp capture send`) and fed into the engine in virtual time:
+//
+// 1. Parser benchmark: the message codec functions (ptp_extract_header(), ptp_extract_timestamps(),
+//    ptp_read_delay_resp_id_data()) are run over every message, throughput is reported in messages/second.
+// 2. Replay: the messages are processed by ptp_process_packet() with the capture timestamps as RX timestamps
+//    (t2, t4 of the master), virtual time follows the capture so timeouts, BMCA and unicast negotiation behave
+//    like on the field. The engine impersonates a slave of the capture: Delay_Resps addressed to it are
+//    rewritten to answer the Delay_Reqs of the engine and the TX timestamp of the slave's captured Delay_Req
+//    becomes t3 (without one the TX timestamp is taken from the virtual clock). Masters sending Sync without
+//    an Announce in the capture get two synthetic Announces, so the BMCA can select them. Runs are
+//    deterministic: the same capture and options reproduce the same log. Datagrams the engine sends to ports
+//    other than the PTP ones (telemetry, capture export) are forwarded to the network of the PC.
+//
+// Build (from the project root):
+//
+//   gcc -O2 -DPTP_PORT_HOST -Ihost/include -I. -o ptp_pcap host/ptp_pcap.c host/host_port.c host/host_cli.c
+//       ptp*.c timeutils.c servo/pd_controller.c -lm
+//
+// Usage: ptp_pcap [-n repeat] [-s clockIdentity] [-c "command"]... capture.pcap
+//
+//   -n: number of passes of the parser benchmark (default: 100)
+//   -s: clockIdentity of the slave to impersonate (16 hex digits, default: requester of the first Delay_Resp)
+//   -c: run a CLI command before the replay (e.g. -c "ptp log def on", -c "ptp domain 0 1")
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "ptp.h"
+#include "ptp_instance.h"
+#include "host_port.h"
+#include "host_cli.h"
+
+#define PCAP_MAX_SOURCES (16) // maximal number of tracked message sources
+#define PCAP_DEFAULT_REPEAT (100) // default number of parser benchmark passes
+#define PCAP_ANNOUNCE_LENGTH (64)
+
+// message read from the capture
+struct PcapMsg
+{
+    int64_t t_ns; // capture timestamp
+    struct ip_addr srcAddr, dstAddr; // IP addresses
+    uint16_t dstPort; // UDP destination port
+    uint16_t len; // PTP message length
+    uint8_t *pData; // PTP message
+};
+
+// messages of a capture
+struct PcapMsgList
+{
+    struct PcapMsg *pMsgs; // messages
+    uint32_t cnt, size; // number of messages and size of the array
+    uint32_t frames; // frames read
+    uint32_t skipped; // frames not carrying PTP over UDP/IPv4
+};
+
+// --------------------------
+
+// read integer of a capture of either byte order
+static uint32_t pcap_u32(const uint8_t *p, bool swap)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t pcap_u16(const uint8_t *p, bool swap)
+{
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return swap ? __builtin_bswap16(v) : v;
+}
+
+// read big endian integer of a frame
+static uint16_t pcap_be16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+// decode frame and store PTP message
+static void pcap_add_frame(struct PcapMsgList *pList, uint32_t linkType, const uint8_t *pFrame, uint32_t len, int64_t t_ns)
+{
+    pList->frames++;
+
+    // strip link layer
+    uint16_t etherType = 0x0800;
+    switch (linkType)
+    {
+    case 1: // Ethernet
+        if (len < 14)
+        {
+            pList->skipped++;
+            return;
+        }
+
+        etherType = pcap_be16(pFrame + 12);
+        pFrame += 14;
+        len -= 14;
+        while ((etherType == 0x8100 || etherType == 0x88a8) && len >= 4) // VLAN tags
+        {
+            etherType = pcap_be16(pFrame + 2);
+            pFrame += 4;
+            len -= 4;
+        }
+        break;
+    case 113: // Linux cooked
+        if (len < 16)
+        {
+            pList->skipped++;
+            return;
+        }
+
+        etherType = pcap_be16(pFrame + 14);
+        pFrame += 16;
+        len -= 16;
+        break;
+    case 101: // raw IP
+    case 228: // IPv4
+        break;
+    default:
+        pList->skipped++;
+        return;
+    }
+
+    // IPv4 and UDP headers
+    if (etherType != 0x0800 || len < 20 || (pFrame[0] >> 4) != 4 || pFrame[9] != 17 || (pcap_be16(pFrame + 6) & 0x3fff) != 0)
+    {
+        pList->skipped++;
+        return;
+    }
+
+    uint32_t ihl = (pFrame[0] & 0x0f) * 4;
+    if (len < ihl + 8)
+    {
+        pList->skipped++;
+        return;
+    }
+
+    const uint8_t *pUdp = pFrame + ihl;
+    uint16_t dstPort = pcap_be16(pUdp + 2);
+    uint32_t ptpLen = pcap_be16(pUdp + 4) - 8;
+    if ((dstPort != PTP_PORT0 && dstPort != PTP_PORT1) || ptpLen > len - ihl - 8 || ptpLen < PTP_HEADER_LENGTH)
+    {
+        pList->skipped++;
+        return;
+    }
+
+    // store message
+    if (pList->cnt == pList->size)
+    {
+        pList->size = (pList->size == 0) ? 1024 : 2 * pList->size;
+        pList->pMsgs = (struct PcapMsg*) realloc(pList->pMsgs, pList->size * sizeof(struct PcapMsg));
+        if (pList->pMsgs == NULL)
+        {
+            fprintf(stderr, "Out of memory!\n");
+            exit(1);
+        }
+    }
+
+    struct PcapMsg *pMsg = &pList->pMsgs[pList->cnt++];
+    pMsg->t_ns = t_ns;
+    memcpy(&pMsg->srcAddr.addr, pFrame + 12, 4);
+    memcpy(&pMsg->dstAddr.addr, pFrame + 16, 4);
+    pMsg->dstPort = dstPort;
+    pMsg->len = ptpLen;
+    pMsg->pData = (uint8_t*) malloc(ptpLen);
+    memcpy(pMsg->pData, pUdp + 8, ptpLen);
+}
+
+// read classic pcap file
+static bool pcap_read_classic(struct PcapMsgList *pList, const uint8_t *p, size_t size)
+{
+    uint32_t magic;
+    memcpy(&magic, p, 4);
+
+    bool swap = (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1);
+    bool nano = (magic == 0xa1b23c4d || magic == 0x4d3cb2a1);
+    if (size < 24)
+    {
+        return false;
+    }
+
+    uint32_t linkType = pcap_u32(p + 20, swap) & 0x0fffffff;
+    size_t pos = 24;
+    while (pos + 16 <= size)
+    {
+        uint32_t sec = pcap_u32(p + pos, swap);
+        uint32_t frac = pcap_u32(p + pos + 4, swap);
+        uint32_t capLen = pcap_u32(p + pos + 8, swap);
+        pos += 16;
+        if (capLen > size - pos)
+        {
+            return false;
+        }
+
+        pcap_add_frame(pList, linkType, p + pos, capLen, (int64_t) sec * NANO_PREFIX + (nano ? frac : frac * 1000ll));
+        pos += capLen;
+    }
+
+    return true;
+}
+
+// read pcapng file
+static bool pcap_read_ng(struct PcapMsgList *pList, const uint8_t *p, size_t size)
+{
+    uint32_t pLinkType[16]; // link type per interface
+    uint64_t pUnitsPerSec[16]; // timestamp resolution per interface
+    uint32_t ifCnt = 0;
+    bool swap = false;
+    int64_t lastTime = 0;
+
+    size_t pos = 0;
+    while (pos + 12 <= size)
+    {
+        uint32_t type = pcap_u32(p + pos, swap);
+
+        // Section Header Block determines byte order
+        if (type == 0x0a0d0d0a)
+        {
+            swap = (pcap_u32(p + pos + 8, false) == 0x4d3c2b1a);
+            ifCnt = 0;
+        }
+
+        uint32_t blockLen = pcap_u32(p + pos + 4, swap);
+        if (blockLen < 12 || blockLen > size - pos)
+        {
+            return false;
+        }
+
+        const uint8_t *pBody = p + pos + 8;
+        uint32_t bodyLen = blockLen - 12;
+
+        if (type == 0x00000001 && bodyLen >= 8 && ifCnt < 16) // Interface Description Block
+        {
+            pLinkType[ifCnt] = pcap_u16(pBody, swap);
+            pUnitsPerSec[ifCnt] = 1000000;
+
+            // look for if_tsresol
+            uint32_t opt = 8;
+            while (opt + 4 <= bodyLen)
+            {
+                uint16_t code = pcap_u16(pBody + opt, swap), optLen = pcap_u16(pBody + opt + 2, swap);
+                if (code == 0)
+                {
+                    break;
+                }
+
+                if (code == 9 && optLen >= 1)
+                {
+                    uint8_t res = pBody[opt + 4];
+                    uint64_t units = 1;
+                    uint8_t k;
+                    for (k = 0; k < (res & 0x7f) && units < 1000000000000000000ull; k++)
+                    {
+                        units *= (res & 0x80) ? 2 : 10;
+                    }
+                    pUnitsPerSec[ifCnt] = units;
+                }
+
+                opt += 4 + ((optLen + 3) & ~3);
+            }
+
+            ifCnt++;
+        }
+        else if (type == 0x00000006 && bodyLen >= 20) // Enhanced Packet Block
+        {
+            uint32_t ifId = pcap_u32(pBody, swap);
+            uint64_t ts = ((uint64_t) pcap_u32(pBody + 4, swap) << 32) | pcap_u32(pBody + 8, swap);
+            uint32_t capLen = pcap_u32(pBody + 12, swap);
+            if (ifId < ifCnt && capLen <= bodyLen - 20)
+            {
+                uint64_t units = pUnitsPerSec[ifId];
+                lastTime = (int64_t) (ts / units) * NANO_PREFIX + (int64_t) ((ts % units) * NANO_PREFIX / units);
+                pcap_add_frame(pList, pLinkType[ifId], pBody + 20, capLen, lastTime);
+            }
+        }
+        else if (type == 0x00000003 && bodyLen >= 4 && ifCnt > 0) // Simple Packet Block (no timestamp)
+        {
+            uint32_t capLen = pcap_u32(pBody, swap);
+            pcap_add_frame(pList, pLinkType[0], pBody + 4, (capLen < bodyLen - 4) ? capLen : bodyLen - 4, lastTime);
+        }
+
+        pos += blockLen;
+    }
+
+    return true;
+}
+
+// read capture file of any supported format
+static bool pcap_read_file(struct PcapMsgList *pList, const char *pFileName)
+{
+    FILE *pF = fopen(pFileName, "rb");
+    if (pF == NULL)
+    {
+        return false;
+    }
+
+    fseek(pF, 0, SEEK_END);
+    long size = ftell(pF);
+    fseek(pF, 0, SEEK_SET);
+
+    uint8_t *p = (uint8_t*) malloc(size > 0 ? size : 1);
+    bool ok = (size >= 4) && (fread(p, 1, size, pF) == (size_t) size);
+    fclose(pF);
+
+    if (ok)
+    {
+        uint32_t magic;
+        memcpy(&magic, p, 4);
+        if (magic == 0x0a0d0d0a)
+        {
+            ok = pcap_read_ng(pList, p, size);
+        }
+        else if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1 || magic == 0xa1b23c4d || magic == 0x4d3cb2a1)
+        {
+            ok = pcap_read_classic(pList, p, size);
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+
+    free(p);
+    return ok;
+}
+
+// --------------------------
+
+// get current time of the PC [ns]
+static int64_t pcap_wall_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * NANO_PREFIX + ts.tv_nsec;
+}
+
+// run message codec over every message, returns a checksum keeping the work from being optimized out
+static uint64_t pcap_parse_all(const struct PcapMsgList *pList)
+{
+    uint64_t sum = 0;
+    uint32_t i;
+    for (i = 0; i < pList->cnt; i++)
+    {
+        const struct PcapMsg *pMsg = &pList->pMsgs[i];
+        struct PTPHeader header;
+        struct TimestampI ts;
+        struct Delay_RespIdentification id;
+
+        ptp_extract_header(&header, pMsg->pData);
+        sum += header.sequenceID + header.correction_ns;
+
+        if (pMsg->len < PTP_HEADER_LENGTH + 10)
+        {
+            continue;
+        }
+
+        switch (header.messageID)
+        {
+        case PTPIDDelay_Resp:
+            if (pMsg->len >= PTP_HEADER_LENGTH + 20)
+            {
+                ptp_read_delay_resp_id_data(&id, pMsg->pData);
+                sum += id.requestingSourceClockIdentity + id.requestingSourcePortIdentity;
+            }
+            // fall through
+        case PTPIDSync:
+        case PTPIDDelay_Req:
+        case PTPIDFollow_Up:
+        case PTPIDAnnounce:
+            ptp_extract_timestamps(&ts, pMsg->pData, 1);
+            sum += ts.sec + ts.nanosec;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return sum;
+}
+
+// --------------------------
+
+// message source seen in the capture
+struct PcapSource
+{
+    uint64_t clockIdentity; // clockIdentity (network byte order)
+    uint16_t portID; // port number
+    uint8_t domainNumber; // domain
+    bool announced; // Announce has been seen
+};
+
+// Delay_Req of the engine waiting for its counterpart in the capture (per domain)
+struct PcapDelayReq
+{
+    struct pbuf *pPBuf; // buffer of the Delay_Req (kept by the engine until the next one is sent)
+    uint16_t sequenceID; // sequenceID of the engine's Delay_Req
+    uint16_t capSequenceID; // sequenceID of the slave's captured Delay_Req
+    bool pending; // Delay_Req is waiting for a response
+    bool bound; // captured Delay_Req has been assigned
+};
+
+// replay state
+struct PcapReplay
+{
+    struct PTPInstance *pInst; // engine
+    int sock; // socket forwarding datagrams not sent to PTP ports
+    uint64_t slaveId; // clockIdentity of the impersonated slave (network byte order)
+    struct PcapDelayReq pDelayReqs[256]; // Delay_Reqs per domain
+    struct PcapSource pSources[PCAP_MAX_SOURCES]; // message sources
+    uint32_t sourceCnt; // number of sources
+    struct {
+        uint32_t delayReqs; // Delay_Reqs sent by the engine
+        uint32_t t3Captured; // t3 taken from the capture
+        uint32_t delayResps; // Delay_Resps rewritten for the engine
+        uint32_t announces; // synthetic Announces injected
+    } cnt;
+};
+
+// hook of transmitted datagrams: Delay_Reqs of the engine are matched to the captured ones
+static void pcap_udp_sent(struct udp_pcb *pPCB, struct pbuf *pPBuf, const struct ip_addr *pAddr, uint16_t port, void *pArg)
+{
+    struct PcapReplay *pR = (struct PcapReplay*) pArg;
+    struct PTPHeader header;
+
+    // forward telemetry and capture exports
+    if (port != PTP_PORT0 && port != PTP_PORT1)
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = pAddr->addr;
+        addr.sin_port = htons(port);
+        sendto(pR->sock, pPBuf->payload, pPBuf->len, 0, (struct sockaddr*) &addr, sizeof(addr));
+        return;
+    }
+
+    if (port != PTP_PORT0 || pPBuf->len < PTP_HEADER_LENGTH)
+    {
+        return;
+    }
+
+    ptp_extract_header(&header, pPBuf->payload);
+    if (header.messageID == PTPIDDelay_Req)
+    {
+        struct PcapDelayReq *pDR = &pR->pDelayReqs[header.subdomainNumber];
+        pDR->pPBuf = pPBuf;
+        pDR->sequenceID = header.sequenceID;
+        pDR->pending = true;
+        pDR->bound = false;
+        pR->cnt.delayReqs++;
+    }
+}
+
+// get source entry of a message (NULL if the table is full)
+static struct PcapSource* pcap_get_source(struct PcapReplay *pR, const struct PTPHeader *pHeader)
+{
+    uint32_t i;
+    for (i = 0; i < pR->sourceCnt; i++)
+    {
+        struct PcapSource *pS = &pR->pSources[i];
+        if (pS->clockIdentity == pHeader->clockIdentity && pS->portID == pHeader->sourcePortID && pS->domainNumber == pHeader->subdomainNumber)
+        {
+            return pS;
+        }
+    }
+
+    if (pR->sourceCnt == PCAP_MAX_SOURCES)
+    {
+        return NULL;
+    }
+
+    struct PcapSource *pS = &pR->pSources[pR->sourceCnt++];
+    pS->clockIdentity = pHeader->clockIdentity;
+    pS->portID = pHeader->sourcePortID;
+    pS->domainNumber = pHeader->subdomainNumber;
+    pS->announced = false;
+    return pS;
+}
+
+// feed message into the engine
+static void pcap_feed(struct PcapReplay *pR, uint8_t *pData, uint16_t len, int64_t t_ns, struct ip_addr *pSrcAddr)
+{
+    struct pbuf *pPBuf = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    memcpy(pPBuf->payload, pData, len);
+    pPBuf->time_s = (uint32_t) (t_ns / NANO_PREFIX);
+    pPBuf->time_ns = (uint32_t) (t_ns % NANO_PREFIX);
+
+    ptp_process_packet(pR->pInst, pPBuf, pSrcAddr);
+    pbuf_free(pPBuf);
+}
+
+// inject Announces on behalf of a master that has not sent any
+static void pcap_inject_announces(struct PcapReplay *pR, const struct PTPHeader *pSyncHeader, int64_t t_ns, struct ip_addr *pSrcAddr)
+{
+    struct PTPHeader header = *pSyncHeader;
+    uint8_t pAnn[PCAP_ANNOUNCE_LENGTH];
+
+    header.messageID = PTPIDAnnounce;
+    header.messageLength = PCAP_ANNOUNCE_LENGTH;
+    header.correction_ns = 0;
+    header.correction_subns = 0;
+    header.control = PTPCONOther;
+    header.logMessagePeriod = 1;
+
+    memset(pAnn, 0, sizeof(pAnn));
+    pAnn[47] = 128; // priority1
+    pAnn[48] = 248; // clockClass
+    pAnn[49] = 0xfe; // clockAccuracy
+    pAnn[50] = pAnn[51] = 0xff; // offsetScaledLogVariance
+    pAnn[52] = 128; // priority2
+    memcpy(&pAnn[53], &pSyncHeader->clockIdentity, 8); // grandmasterIdentity
+    pAnn[63] = 0xa0; // timeSource: internal oscillator
+
+    uint8_t i;
+    for (i = 0; i < PTP_FOREIGN_MASTER_THRESHOLD; i++)
+    {
+        header.sequenceID = i;
+        ptp_construct_binary_header(pAnn, &header);
+        pcap_feed(pR, pAnn, sizeof(pAnn), t_ns, pSrcAddr);
+        pR->cnt.announces++;
+    }
+}
+
+// replay a single message
+static void pcap_replay_msg(struct PcapReplay *pR, struct PcapMsg *pMsg)
+{
+    struct PTPHeader header;
+    ptp_extract_header(&header, pMsg->pData);
+
+    struct PcapDelayReq *pDR = &pR->pDelayReqs[header.subdomainNumber];
+
+    switch (header.messageID)
+    {
+    case PTPIDAnnounce:
+    {
+        struct PcapSource *pS = pcap_get_source(pR, &header);
+        if (pS != NULL)
+        {
+            pS->announced = true;
+        }
+        break;
+    }
+    case PTPIDSync:
+    {
+        struct PcapSource *pS = pcap_get_source(pR, &header);
+        if (pS != NULL && !pS->announced)
+        {
+            pcap_inject_announces(pR, &header, pMsg->t_ns, &pMsg->srcAddr);
+            pS->announced = true;
+        }
+        break;
+    }
+    case PTPIDDelay_Req:
+        // transmission of the impersonated slave: its timestamp is the t3 of the engine
+        if (header.clockIdentity == pR->slaveId)
+        {
+            if (pDR->pending && !pDR->bound)
+            {
+                pDR->pPBuf->time_s = (uint32_t) (pMsg->t_ns / NANO_PREFIX);
+                pDR->pPBuf->time_ns = (uint32_t) (pMsg->t_ns % NANO_PREFIX);
+                pDR->capSequenceID = header.sequenceID;
+                pDR->bound = true;
+                pR->cnt.t3Captured++;
+            }
+            return;
+        }
+        break;
+    case PTPIDDelay_Resp:
+        // answer to the impersonated slave is turned into an answer to the engine
+        if (pMsg->len >= PTP_HEADER_LENGTH + 20)
+        {
+            struct Delay_RespIdentification id;
+            ptp_read_delay_resp_id_data(&id, pMsg->pData);
+            if (id.requestingSourceClockIdentity == pR->slaveId && pDR->pending && (!pDR->bound || header.sequenceID == pDR->capSequenceID))
+            {
+                uint64_t ownId = ptp_get_clock_identity(pR->pInst);
+                memcpy(pMsg->pData + 44, &ownId, 8);
+                pMsg->pData[52] = 0;
+                pMsg->pData[53] = 1; // requestingSourcePortIdentity
+                pMsg->pData[30] = pDR->sequenceID >> 8;
+                pMsg->pData[31] = pDR->sequenceID & 0xff;
+                pDR->pending = false;
+                pR->cnt.delayResps++;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    pcap_feed(pR, pMsg->pData, pMsg->len, pMsg->t_ns, &pMsg->srcAddr);
+}
+
+// handle timeouts like the PTP task loop does, returns time of its next wake-up (INT64_MAX: none)
+static int64_t pcap_poll(struct PcapReplay *pR)
+{
+    uint32_t wait = ptp_poll(pR->pInst);
+    return (wait == portMAX_DELAY) ? INT64_MAX : (host_get_time() + (int64_t) wait * (NANO_PREFIX / configTICK_RATE_HZ));
+}
+
+// find clockIdentity of the slave to impersonate (requester of the first Delay_Resp)
+static uint64_t pcap_find_slave(const struct PcapMsgList *pList)
+{
+    uint32_t i;
+    for (i = 0; i < pList->cnt; i++)
+    {
+        const struct PcapMsg *pMsg = &pList->pMsgs[i];
+        if ((pMsg->pData[0] & 0x0f) == PTPIDDelay_Resp && pMsg->len >= PTP_HEADER_LENGTH + 20)
+        {
+            uint64_t id;
+            memcpy(&id, pMsg->pData + 44, 8);
+            return id;
+        }
+    }
+
+    return 0;
+}
+
+// parse clockIdentity given as hex digits (separators are skipped)
+static bool pcap_parse_clock_identity(const char *pStr, uint64_t *pId)
+{
+    uint8_t *p = (uint8_t*) pId;
+    uint8_t n = 0;
+    for (; *pStr != '\0'; pStr++)
+    {
+        char c = *pStr;
+        uint8_t v;
+        if (c >= '0' && c <= '9')
+        {
+            v = c - '0';
+        }
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+        {
+            v = (c | 0x20) - 'a' + 10;
+        }
+        else
+        {
+            continue;
+        }
+
+        if (n == 16)
+        {
+            return false;
+        }
+
+        p[n / 2] = (n % 2 == 0) ? (v << 4) : (p[n / 2] | v);
+        n++;
+    }
+
+    return n == 16;
+}
+
+// --------------------------
+
+int main(int argc, char *argv[])
+{
+    const char *pFileName = NULL;
+    const char *ppCmds[32];
+    uint32_t cmdCnt = 0;
+    uint32_t repeat = PCAP_DEFAULT_REPEAT;
+    uint64_t slaveId = 0;
+
+    // process arguments
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+        {
+            repeat = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+        {
+            if (!pcap_parse_clock_identity(argv[++i], &slaveId))
+            {
+                fprintf(stderr, "Invalid clockIdentity: '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc && cmdCnt < sizeof(ppCmds) / sizeof(ppCmds[0]))
+        {
+            ppCmds[cmdCnt++] = argv[++i];
+        }
+        else
+        {
+            pFileName = argv[i];
+        }
+    }
+
+    if (pFileName == NULL)
+    {
+        fprintf(stderr, "Usage: %s [-n repeat] [-s clockIdentity] [-c \"command\"]... capture.pcap\n", argv[0]);
+        return 1;
+    }
+
+    // load capture
+    struct PcapMsgList list = { 0 };
+    if (!pcap_read_file(&list, pFileName))
+    {
+        fprintf(stderr, "Cannot read capture '%s'!\n", pFileName);
+        return 1;
+    }
+
+    printf("%u frames read, %u PTP messages, %u frames skipped\n", list.frames, list.cnt, list.skipped);
+    if (list.cnt == 0)
+    {
+        return 1;
+    }
+
+    // parser benchmark
+    int64_t start = pcap_wall_time();
+    uint64_t sum = 0;
+    uint32_t r;
+    for (r = 0; r < repeat; r++)
+    {
+        sum += pcap_parse_all(&list);
+    }
+    int64_t elapsed = pcap_wall_time() - start;
+
+    printf("Parser: %u messages in %.3f ms, %.0f messages/s (checksum: %016llx)\n", list.cnt * repeat, elapsed / 1E+06,
+           (elapsed > 0) ? (double) list.cnt * repeat * NANO_PREFIX / elapsed : 0.0, (unsigned long long) sum);
+
+    // impersonated slave determines the identity of the engine
+    if (slaveId == 0)
+    {
+        slaveId = pcap_find_slave(&list);
+    }
+
+    const uint8_t *pId = (const uint8_t*) &slaveId;
+    uint8_t pMAC[6] = { pId[0], pId[1], pId[2], pId[5], pId[6], pId[7] };
+    if (slaveId == 0)
+    {
+        memcpy(pMAC, (uint8_t[] ) { 0x02, 0, 0, 0, 0, 1 }, 6); // locally administered placeholder
+    }
+
+    // set up virtual environment following the capture
+    static struct PcapReplay replay;
+    host_port_reset();
+    host_set_time(list.pMsgs[0].t_ns);
+    host_set_netif(pMAC, ipaddr_addr("10.0.0.2"));
+    host_clock_set_steering(false); // timestamps come from the capture, corrections have no effect on them
+    host_set_udp_hook(pcap_udp_sent, &replay);
+
+    static struct udp_pcb pPCB[2] = { { PTP_PORT0 }, { PTP_PORT1 } };
+    static struct udp_pcb *ppPCBs[2] = { &pPCB[0], &pPCB[1] };
+
+    struct PTPArena arena;
+    void *pMem = malloc(ptp_instance_size());
+    ptp_arena_init(&arena, pMem, ptp_instance_size());
+
+    replay.pInst = ptp_create_instance(&arena);
+    replay.slaveId = slaveId;
+    replay.sock = socket(AF_INET, SOCK_DGRAM, 0);
+    ptp_init(replay.pInst, ppPCBs);
+    ptp_register_cli_commands(replay.pInst);
+
+    for (i = 0; i < (int) cmdCnt; i++)
+    {
+        if (host_cli_run(ppCmds[i]) < 0)
+        {
+            fprintf(stderr, "Unknown command or bad parameter: '%s'\n", ppCmds[i]);
+            return 1;
+        }
+    }
+
+    // replay capture in virtual time
+    int64_t nextPeriodic = list.pMsgs[0].t_ns, nextPoll = INT64_MAX;
+    struct PTPEvLogRecord rec;
+    start = pcap_wall_time();
+    for (r = 0; r < list.cnt; r++)
+    {
+        struct PcapMsg *pMsg = &list.pMsgs[r];
+
+        // periodic housekeeping and deadline wake-ups of the PTP task
+        while (nextPeriodic <= pMsg->t_ns || nextPoll <= pMsg->t_ns)
+        {
+            if (nextPeriodic <= nextPoll)
+            {
+                host_set_time(nextPeriodic);
+                ptp_periodic(replay.pInst);
+                nextPeriodic += PTP_PERIODIC_INTERVAL_MS * 1000000ll;
+            }
+            else
+            {
+                host_set_time(nextPoll);
+            }
+
+            nextPoll = pcap_poll(&replay);
+        }
+
+        host_set_time(pMsg->t_ns);
+        pcap_replay_msg(&replay, pMsg);
+        nextPoll = pcap_poll(&replay);
+
+        // drain event log like the drain task does
+        while (ptp_evlog_pop(ptp_get_event_log(replay.pInst), &rec))
+        {
+            ptp_evlog_print(&rec);
+        }
+    }
+    elapsed = pcap_wall_time() - start;
+
+    // report
+    printf("\nReplay: %u messages in %.3f ms, %.0f messages/s\n", list.cnt, elapsed / 1E+06, (elapsed > 0) ? (double) list.cnt * NANO_PREFIX / elapsed : 0.0);
+    printf("Impersonated slave: ");
+    for (i = 0; i < 8; i++)
+    {
+        printf("%02x", pId[i]);
+    }
+    printf("\nDelay_Req sent: %u, t3 from capture: %u, Delay_Resp answered: %u, synthetic Announces: %u\n\n", replay.cnt.delayReqs,
+           replay.cnt.t3Captured, replay.cnt.delayResps, replay.cnt.announces);
+
+    ptp_periodic(replay.pInst);
+    ptp_stats_print(&replay.pInst->stats);
+    ptp_metrics_print(&replay.pInst->metrics);
+
+    return 0;
+}
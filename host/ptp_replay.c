@@ -0,0 +1,223 @@
+/* (C) András Wiesner, 2021 */
+
+// Offline replay of synchronization traces
+//
+// Traces are recorded on the device by `ptp log trace on` (see ptp_trace.h) and cut out of a serial console
+// capture. Every traced cycle is fed through the correction arithmetic of the device (ptp_correction.c) and
+// the clock servo, then the resulting addend is compared with the one applied on the device. Records of
+// decimated operation carry the window fit fed to the servo, which is used as is (t1..t4 only belong to the
+// last sample of the window). Replaying a trace with a modified servo shows how its output would have differed
+// on the same field data.
+//
+// Build (from the project root, no FMA contraction to keep float results identical to the device):
+//
+//   gcc -O2 -ffp-contract=off -Ihost/include -I. -o ptp_replay host/ptp_replay.c host/host_cli.c ptp_correction.c
+//       ptp_trace.c timeutils.c servo/pd_controller.c -lm
+//
+// Usage: ptp_replay [-v] [-c "servo command"]... capture.log
+//
+//   -v: print every replayed cycle
+//   -c: run a CLI command of the servo before replaying (e.g. -c "ptp servo params 0.2 0.9")
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host_cli.h"
+#include "ptp_correction.h"
+#include "ptp_trace.h"
+
+// servo under test (same interface as the PTP_SERVO_... defines in ptp.h)
+#include "servo/pd_controller.h"
+
+#define REPLAY_SERVO_STATE_TYPE struct PdCtrlState
+#define REPLAY_SERVO_INIT() pd_ctrl_init()
+#define REPLAY_SERVO_RESET(pS) pd_ctrl_reset(pS)
+#define REPLAY_SERVO_RUN(pS, d) pd_ctrl_run(pS, d)
+
+// --------------------------
+
+#define REPLAY_LINE_LENGTH (512)
+#define REPLAY_DOMAINS (256)
+
+// --------------------------
+
+// replay statistics
+struct ReplayStats
+{
+    uint32_t lines; // lines read
+    uint32_t records; // trace records replayed
+    uint32_t compared; // addend values compared
+    uint32_t mismatches; // addend values differing from the device
+    uint32_t coarseMismatches; // cycles where the decision of jumping the clock differs
+    uint32_t seqGaps; // missing records (detected through sequenceID)
+};
+
+int main(int argc, char *argv[])
+{
+    bool verbose = false;
+    const char *pFileName = NULL;
+    float addendPerPpb = 0;
+    bool headerSeen = false;
+
+    static REPLAY_SERVO_STATE_TYPE pServos[REPLAY_DOMAINS];
+    static bool pSeqValid[REPLAY_DOMAINS];
+    static uint16_t pLastSeq[REPLAY_DOMAINS];
+
+    REPLAY_SERVO_INIT();
+
+    // process arguments
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-v"))
+        {
+            verbose = true;
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+        {
+            if (host_cli_run(argv[++i]) < 0)
+            {
+                fprintf(stderr, "Unknown command or bad parameter: '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else
+        {
+            pFileName = argv[i];
+        }
+    }
+
+    if (pFileName == NULL)
+    {
+        fprintf(stderr, "Usage: %s [-v] [-c \"servo command\"]... capture.log\n", argv[0]);
+        return 1;
+    }
+
+    FILE *pF = fopen(pFileName, "r");
+    if (pF == NULL)
+    {
+        perror(pFileName);
+        return 1;
+    }
+
+    for (i = 0; i < REPLAY_DOMAINS; i++)
+    {
+        REPLAY_SERVO_RESET(&pServos[i]);
+    }
+
+    struct ReplayStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    char pLine[REPLAY_LINE_LENGTH];
+    struct PTPEvLogRecord rec;
+    clock_t start = clock();
+
+    while (fgets(pLine, sizeof(pLine), pF) != NULL)
+    {
+        stats.lines++;
+
+        // header: format version and addend tuning factor
+        unsigned version, bits;
+        if (sscanf(pLine, PTP_TRACE_HEADER_PREFIX " %u %x", &version, &bits) == 2)
+        {
+            if (version != PTP_TRACE_VERSION)
+            {
+                fprintf(stderr, "Unsupported trace version %u (line %u)\n", version, stats.lines);
+                return 1;
+            }
+
+            uint32_t bits32 = bits;
+            memcpy(&addendPerPpb, &bits32, sizeof(addendPerPpb));
+            headerSeen = true;
+            continue;
+        }
+
+        if (!ptp_trace_parse_line(&rec, pLine))
+        {
+            continue;
+        }
+
+        if (!headerSeen)
+        {
+            fprintf(stderr, "Trace record before header (line %u)\n", stats.lines);
+            return 1;
+        }
+
+        stats.records++;
+
+        // detect lost records (Sync sequenceIDs are assumed to increase by one, decimated records are a window apart
+        // and windows restart after a clock jump, so they are not checked)
+        bool decimated = (rec.flags & PTP_EVLOG_FLAG_DECIMATED) != 0;
+        if (!decimated && pSeqValid[rec.domainNumber] && (uint16_t) (rec.sequenceID - pLastSeq[rec.domainNumber]) != 1)
+        {
+            stats.seqGaps += (uint16_t) (rec.sequenceID - pLastSeq[rec.domainNumber] - 1);
+        }
+        pSeqValid[rec.domainNumber] = !decimated;
+        pLastSeq[rec.domainNumber] = rec.sequenceID;
+
+        // rebuild cycle data
+        struct SyncCycleData sync;
+        struct TimestampI d, offset = { 0, rec.ppsOffset };
+        sync.t1.sec = rec.t[0].sec;
+        sync.t1.nanosec = rec.t[0].nanosec;
+        sync.t2.sec = rec.t[1].sec;
+        sync.t2.nanosec = rec.t[1].nanosec;
+        sync.t3.sec = rec.t[2].sec;
+        sync.t3.nanosec = rec.t[2].nanosec;
+        sync.t4.sec = rec.t[3].sec;
+        sync.t4.nanosec = rec.t[3].nanosec;
+        sync.corrFollowUp = rec.corrFollowUp;
+        sync.corrDelayResp = rec.corrDelayResp;
+
+        // same steps as ptp_perform_correction() (decimated: the recorded window fit)
+        if (decimated)
+        {
+            d.sec = rec.offset.sec;
+            d.nanosec = rec.offset.nanosec;
+        }
+        else
+        {
+            ptp_corr_time_difference(&d, &sync, &offset);
+        }
+
+        bool coarse = (d.sec != 0);
+        if (coarse != ((rec.flags & PTP_EVLOG_FLAG_COARSE) != 0))
+        {
+            stats.coarseMismatches++;
+        }
+
+        float corr_ppb = 0;
+        uint32_t addend = rec.addendPrev;
+        if (!coarse)
+        {
+            corr_ppb = REPLAY_SERVO_RUN(&pServos[rec.domainNumber], nsI(&d));
+
+            if (rec.flags & PTP_EVLOG_FLAG_ACTIVE)
+            {
+                addend = ptp_corr_tune_addend(rec.addendPrev, corr_ppb, addendPerPpb);
+                stats.compared++;
+                if (addend != rec.addend)
+                {
+                    stats.mismatches++;
+                }
+            }
+        }
+
+        if (verbose)
+        {
+            printf("%u %u %lld %.3f 0x%08X 0x%08X%s\n", rec.domainNumber, rec.sequenceID, (long long) nsI(&d), corr_ppb, rec.addend, addend,
+                   (addend != rec.addend && (rec.flags & PTP_EVLOG_FLAG_ACTIVE) && !coarse) ? " *" : "");
+        }
+    }
+
+    double elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+    fclose(pF);
+
+    printf("Records: %u, compared: %u, addend mismatches: %u, coarse decision mismatches: %u, lost records: %u\n", stats.records,
+           stats.compared, stats.mismatches, stats.coarseMismatches, stats.seqGaps);
+    printf("Replay time: %.3f s (%.0f records/s)\n", elapsed, (elapsed > 0) ? stats.records / elapsed : 0.0);
+
+    return (stats.mismatches == 0 && stats.coarseMismatches == 0) ? 0 : 2;
+}
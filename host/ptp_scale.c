@@ -0,0 +1,972 @@
+/* (C) András Wiesner, 2021 */
+
+// Scale harness: thousands of slaves served by one master
+//
+// N independent instances of the PTP engine run as slaves of a simulated master in virtual time, each in its
+// own host environment (host/host_port.h). The master and the slaves are connected through an in-process
+// fabric: multicast messages are delivered to every slave (and Delay_Reqs to the master as well), unicast
+// messages only to their addressee, every delivery taking the fabric latency. The master answers Delay_Reqs,
+// grants every unicast negotiation request and sends Sync, Follow_Up and Announce either to the multicast
+// group or, in unicast mode, to every slave holding a grant.
+//
+// Slaves are sharded across threads. Time advances in windows as long as the fabric latency (conservative
+// synchronization: nothing sent in a window can arrive before its end), empty stretches are skipped. In
+// every window each thread processes the slaves of its shard having events in the window and then steals
+// slaves from the other shards; messages sent meanwhile are collected per thread and merged into the
+// receivers' queues between windows.
+//
+// For every transport mode and slave count a line reports message rates at the master and on the slave
+// access links, the CPU time spent per slave (inside ptp_process_packet() and in total) and the memory
+// footprint per slave, so the cost of the multicast E2E design can be compared to the hybrid and unicast
+// alternatives as N grows.
+//
+// Build (from the project root):
+//
+//   gcc -O2 -DPTP_PORT_HOST -Ihost/include -I. -o ptp_scale host/ptp_scale.c host/host_port.c host/host_cli.c
+//       ptp*.c timeutils.c servo/pd_controller.c -lm -lpthread
+//
+// Usage: ptp_scale [-N n1,n2...] [-m mcast,hybrid,ucast] [-t duration_s] [-T threads] [-i logSync] [-L latency_ns]
+//
+//   -N slave counts (default: 10,100,1000)    -m transport modes (default: mcast,hybrid,ucast)
+//   -t simulated time [s] (default: 60)       -T threads (default: number of cores)
+//   -i log2 Sync interval (default: 0)        -L fabric latency [ns] (default: 20000)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "ptp.h"
+#include "ptp_instance.h"
+#include "ptp_unicast.h"
+#include "host_port.h"
+
+#define SCALE_T0_S (1600000000ll) // time at the start of the simulation [s]
+#define SCALE_MAX_MSG (96) // longest message exchanged
+#define SCALE_MAX_SLAVES (1 << 20) // maximal number of slaves
+#define SCALE_MAX_THREADS (256) // maximal number of threads
+#define SCALE_MASTER (0xffffffff) // sender index of the master
+#define SCALE_ALL (0xff) // message is delivered regardless of grants
+#define SCALE_FOLLOW_UP_NS (20000) // Follow_Up is sent after Sync by this much
+#define SCALE_ANNOUNCE_NS (2000000000ll) // Announce interval
+#define SCALE_STEAL_CHUNK (8) // slaves taken from a work list at once
+#define SCALE_GRANT_DURATION_S (300) // duration of unicast grants
+
+// message in flight
+struct ScaleMsg
+{
+    int64_t t; // arrival time
+    uint32_t src; // sender slave (SCALE_MASTER: master)
+    uint32_t dst; // receiver slave (unicast messages)
+    uint32_t order; // sending order within the sender thread
+    uint8_t grant; // delivered only to slaves holding this grant (PTPUnicastMsg, SCALE_ALL: to every slave)
+    uint8_t len; // message length
+    uint8_t pData[SCALE_MAX_MSG]; // message
+};
+
+// growing message list
+struct ScaleMsgList
+{
+    struct ScaleMsg *pMsgs; // messages
+    uint32_t cnt, size; // number of messages and allocated size
+};
+
+// slave
+struct ScaleSlave
+{
+    struct HostEnv *pEnv; // virtual environment
+    struct PTPInstance *pInst; // engine instance
+    struct ip_addr addr; // IP address
+    uint32_t idx; // index
+    struct ScaleMsgList inbox; // unicast messages sorted by arrival
+    uint32_t inboxHead; // first unprocessed message of the inbox
+    int64_t next; // time of the next event (except multicast arrivals)
+    int64_t nextPeriodic; // time of the next periodic call
+    int64_t nextPoll; // time the PTP task wakes up for its nearest deadline (INT64_MAX: none)
+    uint8_t grants; // unicast grants held (bit mask of PTPUnicastMsg)
+};
+
+// counters of a thread
+struct ScaleCounters
+{
+    uint64_t masterRx; // messages received by the master
+    uint64_t masterTx; // messages sent by the master (copies of unicast messages counted separately)
+    uint64_t slaveRx; // messages delivered to slaves
+    uint64_t slaveTx; // messages sent by slaves
+    uint64_t busy_ns; // time spent processing slaves
+    uint64_t processed; // slaves processed in windows
+    uint64_t steals; // slaves processed from the work list of an other thread
+};
+
+// thread
+struct ScaleThread
+{
+    pthread_t thread; // thread handle
+    uint32_t id; // index
+    uint32_t first, last; // shard: slaves [first, last)
+    struct ScaleMsgList unicastOut, multicastOut; // messages sent in the current window
+    uint32_t order; // sending order counter
+    uint32_t *pWork; // slaves to process in the current window
+    uint32_t workCnt; // number of slaves in the work list
+    atomic_uint cursor; // next item of the work list
+    int64_t partialMin; // earliest event of the shard
+    struct ScaleCounters cnt; // counters
+};
+
+// harness state
+struct Scale
+{
+    // configuration
+    uint32_t slaveCnt, threadCnt; // number of slaves and threads
+    enum PTPTransportMode mode; // transport mode of the slaves
+    int8_t logSync; // log2 Sync interval
+    int64_t latency; // fabric latency [ns]
+    int64_t tEnd; // end of simulation
+
+    // network
+    struct ScaleSlave *pSlaves; // slaves
+    struct ScaleThread *pThreads; // threads
+    struct ScaleMsgList multicast; // multicast messages in flight sorted by arrival
+    struct ip_addr masterAddr, mcastAddr; // master and multicast group addresses
+    uint64_t masterId; // master clockIdentity (network byte order)
+
+    // master
+    int64_t nextSync, nextFollowUp, nextAnnounce; // next transmissions
+    uint16_t syncSeq, announceSeq; // sequenceIDs
+
+    // window
+    pthread_barrier_t barrier; // window phase barrier
+    int64_t windowEnd; // end of the current window
+    uint64_t windows; // number of windows processed
+};
+
+static struct Scale sScale;
+static __thread struct ScaleThread *spThread; // thread running on the calling thread
+
+static struct udp_pcb sPCB[2] = { { PTP_PORT0 }, { PTP_PORT1 } };
+static struct udp_pcb *spPCBs[2] = { &sPCB[0], &sPCB[1] };
+
+// --------------------------
+
+// append message to a list
+static struct ScaleMsg* scale_push(struct ScaleMsgList *pL)
+{
+    if (pL->cnt == pL->size)
+    {
+        pL->size = (pL->size == 0) ? 16 : 2 * pL->size;
+        pL->pMsgs = (struct ScaleMsg*) realloc(pL->pMsgs, pL->size * sizeof(struct ScaleMsg));
+    }
+
+    return &pL->pMsgs[pL->cnt++];
+}
+
+// is message a earlier than b?
+static bool scale_earlier(const struct ScaleMsg *pA, const struct ScaleMsg *pB)
+{
+    if (pA->t != pB->t)
+    {
+        return pA->t < pB->t;
+    }
+
+    return (pA->src != pB->src) ? (pA->src < pB->src) : (pA->order < pB->order);
+}
+
+static int scale_compare_msgs(const void *pA, const void *pB)
+{
+    return scale_earlier((const struct ScaleMsg*) pA, (const struct ScaleMsg*) pB) ? -1 : 1;
+}
+
+// queue message for sending
+static struct ScaleMsg* scale_send(struct ScaleMsgList *pL, int64_t t, uint32_t src, uint32_t dst, uint8_t grant, const void *pData, uint8_t len)
+{
+    struct ScaleMsg *pMsg = scale_push(pL);
+    pMsg->t = t;
+    pMsg->src = src;
+    pMsg->dst = dst;
+    pMsg->order = spThread->order++;
+    pMsg->grant = grant;
+    pMsg->len = len;
+    memcpy(pMsg->pData, pData, len);
+    return pMsg;
+}
+
+// --------------------------
+
+// fill in header of a master message
+static void scale_master_header(uint8_t *pMsg, uint8_t messageID, uint16_t len, uint16_t seq, uint8_t control, int8_t logPeriod)
+{
+    struct PTPHeader header;
+    memset(&header, 0, sizeof(header));
+    header.messageID = messageID;
+    header.versionPTP = 2;
+    header.messageLength = len;
+    header.flags.PTP_TWO_STEP = (messageID == PTPIDSync);
+    header.flags.PTP_UNICAST = (sScale.mode == PTPTM_UNICAST);
+    header.clockIdentity = sScale.masterId;
+    header.sourcePortID = 1;
+    header.sequenceID = seq;
+    header.control = control;
+    header.logMessagePeriod = logPeriod;
+
+    memset(pMsg, 0, len);
+    ptp_construct_binary_header(pMsg, &header);
+}
+
+// write timestamp of the master
+static void scale_master_timestamp(uint8_t *pMsg, int64_t t)
+{
+    struct TimestampI ts = { t / NANO_PREFIX, t % NANO_PREFIX };
+    ptp_write_binary_timestamps(pMsg, &ts, 1);
+}
+
+// multicast or unicast (to every slave holding the grant) message of the master
+static void scale_master_send(int64_t t, uint8_t grant, const uint8_t *pMsg, uint8_t len)
+{
+    scale_send(&spThread->multicastOut, t + sScale.latency, SCALE_MASTER, 0, (sScale.mode == PTPTM_UNICAST) ? grant : SCALE_ALL, pMsg, len);
+    if (sScale.mode != PTPTM_UNICAST)
+    {
+        spThread->cnt.masterTx++;
+    }
+}
+
+// send periodic messages of the master due before the end of the window
+static void scale_master_periodic(int64_t windowEnd)
+{
+    uint8_t pMsg[64];
+    int64_t syncInterval = (sScale.logSync >= 0) ? (NANO_PREFIX << sScale.logSync) : (NANO_PREFIX >> -sScale.logSync);
+
+    while (sScale.nextSync < windowEnd)
+    {
+        scale_master_header(pMsg, PTPIDSync, PTP_DELAY_REQ_PCKT_SIZE, sScale.syncSeq, PTPCONSync, sScale.logSync);
+        scale_master_send(sScale.nextSync, PTPUCSync, pMsg, PTP_DELAY_REQ_PCKT_SIZE);
+        sScale.nextFollowUp = sScale.nextSync + SCALE_FOLLOW_UP_NS;
+        sScale.nextSync += syncInterval;
+    }
+
+    if (sScale.nextFollowUp < windowEnd)
+    {
+        scale_master_header(pMsg, PTPIDFollow_Up, PTP_DELAY_REQ_PCKT_SIZE, sScale.syncSeq++, PTPCONFollow_Up, sScale.logSync);
+        scale_master_timestamp(pMsg, sScale.nextFollowUp - SCALE_FOLLOW_UP_NS);
+        scale_master_send(sScale.nextFollowUp, PTPUCSync, pMsg, PTP_DELAY_REQ_PCKT_SIZE);
+        sScale.nextFollowUp = INT64_MAX;
+    }
+
+    while (sScale.nextAnnounce < windowEnd)
+    {
+        scale_master_header(pMsg, PTPIDAnnounce, sizeof(pMsg), sScale.announceSeq++, PTPCONOther, 1);
+        scale_master_timestamp(pMsg, sScale.nextAnnounce);
+        pMsg[45] = 37; // currentUtcOffset
+        pMsg[47] = 128; // priority1
+        pMsg[48] = 6; // clockClass
+        pMsg[49] = 0x21; // clockAccuracy
+        pMsg[50] = 0x4e;
+        pMsg[51] = 0x5d; // offsetScaledLogVariance
+        pMsg[52] = 128; // priority2
+        memcpy(&pMsg[53], &sScale.masterId, 8); // grandmasterIdentity
+        pMsg[63] = 0x20; // timeSource
+        scale_master_send(sScale.nextAnnounce, PTPUCAnnounce, pMsg, sizeof(pMsg));
+        sScale.nextAnnounce += SCALE_ANNOUNCE_NS;
+    }
+}
+
+// answer Signaling: grant requests, acknowledge cancellations
+static void scale_master_signaling(struct ScaleSlave *pSlave, int64_t t, const uint8_t *pReq, uint8_t len)
+{
+    static const uint8_t spMsgTypes[PTPUC_N] = { PTPIDAnnounce, PTPIDSync, PTPIDDelay_Resp };
+    uint8_t pTLVs[SCALE_MAX_MSG - 44];
+    uint8_t *p = pTLVs;
+    uint16_t offset = 44;
+
+    while (offset + 6 <= len && p + 12 <= pTLVs + sizeof(pTLVs))
+    {
+        uint16_t tlvType = (pReq[offset] << 8) | pReq[offset + 1];
+        uint16_t tlvLen = (pReq[offset + 2] << 8) | pReq[offset + 3];
+        const uint8_t *pV = pReq + offset + 4;
+        offset += 4 + tlvLen;
+        if (offset > len)
+        {
+            break;
+        }
+
+        uint8_t k = 0;
+        while (k < PTPUC_N && spMsgTypes[k] != (pV[0] >> 4))
+        {
+            k++;
+        }
+
+        if (k == PTPUC_N)
+        {
+            continue;
+        }
+
+        if (tlvType == PTPTLVRequestUnicast)
+        {
+            // grant with the interval of the master
+            int8_t logInterval = (k == PTPUCAnnounce) ? 1 : sScale.logSync;
+            uint32_t duration = SCALE_GRANT_DURATION_S;
+            p[0] = 0;
+            p[1] = PTPTLVGrantUnicast;
+            p[2] = 0;
+            p[3] = 8;
+            p[4] = pV[0];
+            p[5] = (uint8_t) logInterval;
+            p[6] = duration >> 24;
+            p[7] = duration >> 16;
+            p[8] = duration >> 8;
+            p[9] = duration;
+            p[10] = 0;
+            p[11] = 1; // renewal invited
+            p += 12;
+            pSlave->grants |= (1 << k);
+        }
+        else if (tlvType == PTPTLVCancelUnicast)
+        {
+            p[0] = 0;
+            p[1] = PTPTLVAckCancelUnicast;
+            p[2] = 0;
+            p[3] = 2;
+            p[4] = pV[0];
+            p[5] = 0;
+            p += 6;
+            pSlave->grants &= ~(1 << k);
+        }
+    }
+
+    if (p == pTLVs)
+    {
+        return;
+    }
+
+    uint8_t pMsg[SCALE_MAX_MSG];
+    uint8_t msgLen = 44 + (p - pTLVs);
+    scale_master_header(pMsg, PTPIDSignaling, msgLen, (pReq[30] << 8) | pReq[31], PTPCONOther, 0x7f);
+    pMsg[6] |= 0x04; // unicast
+    memcpy(pMsg + 34, pReq + 20, 10); // targetPortIdentity
+    memcpy(pMsg + 44, pTLVs, p - pTLVs);
+
+    scale_send(&spThread->unicastOut, t + sScale.latency, SCALE_MASTER, pSlave->idx, SCALE_ALL, pMsg, msgLen);
+    spThread->cnt.masterTx++;
+}
+
+// master receives message of a slave
+static void scale_master_receive(struct ScaleSlave *pSlave, int64_t t, const uint8_t *pReq, uint8_t len, bool multicast)
+{
+    spThread->cnt.masterRx++;
+
+    if (len < PTP_HEADER_LENGTH)
+    {
+        return;
+    }
+
+    switch (pReq[0] & 0x0f)
+    {
+    case PTPIDDelay_Req:
+    {
+        uint8_t pMsg[PTP_DELAY_REQ_PCKT_SIZE + 10];
+        scale_master_header(pMsg, PTPIDDelay_Resp, sizeof(pMsg), (pReq[30] << 8) | pReq[31], PTPCONelay_Resp, sScale.logSync);
+        pMsg[4] = pReq[4]; // domainNumber
+        pMsg[6] = (pMsg[6] & ~0x04) | (multicast ? 0 : 0x04);
+        scale_master_timestamp(pMsg, t);
+        memcpy(&pMsg[44], &pReq[20], 10); // requestingPortIdentity
+
+        if (multicast)
+        {
+            scale_send(&spThread->multicastOut, t + sScale.latency, SCALE_MASTER, 0, SCALE_ALL, pMsg, sizeof(pMsg));
+        }
+        else
+        {
+            scale_send(&spThread->unicastOut, t + sScale.latency, SCALE_MASTER, pSlave->idx, SCALE_ALL, pMsg, sizeof(pMsg));
+        }
+        spThread->cnt.masterTx++;
+        break;
+    }
+    case PTPIDSignaling:
+        scale_master_signaling(pSlave, t, pReq, len);
+        break;
+    default:
+        break;
+    }
+}
+
+// --------------------------
+
+// hook of messages sent by the slaves
+static void scale_slave_sent(struct udp_pcb *pPCB, struct pbuf *pPBuf, const struct ip_addr *pAddr, uint16_t port, void *pArg)
+{
+    struct ScaleSlave *pSlave = (struct ScaleSlave*) pArg;
+    int64_t t = host_get_time();
+    uint8_t len = (pPBuf->len < SCALE_MAX_MSG) ? pPBuf->len : SCALE_MAX_MSG;
+    bool multicast = (pAddr->addr == sScale.mcastAddr.addr);
+
+    spThread->cnt.slaveTx++;
+
+    // the master answers right away, its answer leaves at the arrival of the request
+    scale_master_receive(pSlave, t + sScale.latency, (const uint8_t*) pPBuf->payload, len, multicast);
+
+    // multicast messages reach the other slaves as well
+    if (multicast)
+    {
+        scale_send(&spThread->multicastOut, t + sScale.latency, pSlave->idx, 0, SCALE_ALL, pPBuf->payload, len);
+    }
+}
+
+// deliver message to a slave
+static void scale_slave_deliver(struct ScaleSlave *pSlave, const struct ScaleMsg *pMsg)
+{
+    host_set_time(pMsg->t);
+
+    uint8_t pData[SCALE_MAX_MSG];
+    memcpy(pData, pMsg->pData, pMsg->len);
+
+    struct TimestampI ts;
+    ptphw_host_gettime(&ts);
+
+    struct pbuf pb = { .payload = pData, .len = pMsg->len, .tot_len = pMsg->len, .time_s = (uint32_t) ts.sec, .time_ns = (uint32_t) ts.nanosec };
+    struct ip_addr srcAddr = (pMsg->src == SCALE_MASTER) ? sScale.masterAddr : sScale.pSlaves[pMsg->src].addr;
+
+    ptp_process_packet(pSlave->pInst, &pb, &srcAddr);
+    spThread->cnt.slaveRx++;
+    if (pMsg->src == SCALE_MASTER && pMsg->grant != SCALE_ALL)
+    {
+        spThread->cnt.masterTx++; // unicast copy of a periodic master message
+    }
+}
+
+// handle timeouts like the PTP task loop does and get its next wake-up
+static void scale_slave_poll(struct ScaleSlave *pSlave)
+{
+    uint32_t wait = ptp_poll(pSlave->pInst);
+    pSlave->nextPoll = (wait == portMAX_DELAY) ? INT64_MAX : (host_get_time() + (int64_t) wait * (NANO_PREFIX / configTICK_RATE_HZ));
+}
+
+// process events of a slave until the end of the window
+static void scale_slave_process(struct ScaleSlave *pSlave, int64_t windowEnd)
+{
+    const struct ScaleMsgList *pMc = &sScale.multicast;
+    uint32_t mc = 0;
+
+    host_env_select(pSlave->pEnv);
+
+    while (true)
+    {
+        // skip multicast messages not for this slave
+        while (mc < pMc->cnt && pMc->pMsgs[mc].t < windowEnd
+                && (pMc->pMsgs[mc].src == pSlave->idx || (pMc->pMsgs[mc].grant != SCALE_ALL && !(pSlave->grants & (1 << pMc->pMsgs[mc].grant)))))
+        {
+            mc++;
+        }
+
+        const struct ScaleMsg *pNext = (mc < pMc->cnt && pMc->pMsgs[mc].t < windowEnd) ? &pMc->pMsgs[mc] : NULL;
+        const struct ScaleMsg *pUc = (pSlave->inboxHead < pSlave->inbox.cnt) ? &pSlave->inbox.pMsgs[pSlave->inboxHead] : NULL;
+        if (pUc != NULL && pUc->t < windowEnd && (pNext == NULL || scale_earlier(pUc, pNext)))
+        {
+            pNext = pUc;
+        }
+
+        // periodic call comes first, then the wake-up for a deadline
+        if (pSlave->nextPeriodic < windowEnd && (pNext == NULL || pSlave->nextPeriodic <= pNext->t))
+        {
+            host_set_time(pSlave->nextPeriodic);
+            ptp_periodic(pSlave->pInst);
+            scale_slave_poll(pSlave);
+            pSlave->nextPeriodic += PTP_PERIODIC_INTERVAL_MS * 1000000ll;
+            continue;
+        }
+
+        if (pSlave->nextPoll < windowEnd && (pNext == NULL || pSlave->nextPoll <= pNext->t))
+        {
+            host_set_time(pSlave->nextPoll);
+            scale_slave_poll(pSlave);
+            continue;
+        }
+
+        if (pNext == NULL)
+        {
+            break;
+        }
+
+        scale_slave_deliver(pSlave, pNext);
+        scale_slave_poll(pSlave);
+        if (pNext == pUc)
+        {
+            pSlave->inboxHead++;
+        }
+        else
+        {
+            mc++;
+        }
+    }
+
+    if (pSlave->inboxHead == pSlave->inbox.cnt)
+    {
+        pSlave->inboxHead = pSlave->inbox.cnt = 0;
+    }
+
+    pSlave->next = pSlave->nextPeriodic;
+    if (pSlave->inboxHead < pSlave->inbox.cnt && pSlave->inbox.pMsgs[pSlave->inboxHead].t < pSlave->next)
+    {
+        pSlave->next = pSlave->inbox.pMsgs[pSlave->inboxHead].t;
+    }
+    pSlave->next = (pSlave->nextPoll < pSlave->next) ? pSlave->nextPoll : pSlave->next;
+
+    host_env_select(NULL);
+}
+
+// insert unicast message into the inbox of a slave
+static void scale_slave_enqueue(struct ScaleSlave *pSlave, const struct ScaleMsg *pMsg)
+{
+    struct ScaleMsgList *pL = &pSlave->inbox;
+    scale_push(pL);
+
+    uint32_t i = pL->cnt - 1;
+    while (i > pSlave->inboxHead && scale_earlier(pMsg, &pL->pMsgs[i - 1]))
+    {
+        pL->pMsgs[i] = pL->pMsgs[i - 1];
+        i--;
+    }
+    pL->pMsgs[i] = *pMsg;
+
+    pSlave->next = (pMsg->t < pSlave->next) ? pMsg->t : pSlave->next;
+}
+
+// --------------------------
+
+// process work list of a thread
+static void scale_process_work(struct ScaleThread *pT, bool stolen, int64_t windowEnd)
+{
+    while (true)
+    {
+        uint32_t i = atomic_fetch_add(&pT->cursor, SCALE_STEAL_CHUNK);
+        if (i >= pT->workCnt)
+        {
+            break;
+        }
+
+        uint32_t end = (i + SCALE_STEAL_CHUNK < pT->workCnt) ? i + SCALE_STEAL_CHUNK : pT->workCnt;
+        spThread->cnt.processed += end - i;
+        if (stolen)
+        {
+            spThread->cnt.steals += end - i;
+        }
+
+        for (; i < end; i++)
+        {
+            scale_slave_process(&sScale.pSlaves[pT->pWork[i]], windowEnd);
+        }
+    }
+}
+
+// get monotonic time [ns]
+static int64_t scale_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * NANO_PREFIX + ts.tv_nsec;
+}
+
+// thread running windows
+static void* scale_thread(void *pArg)
+{
+    struct ScaleThread *pT = (struct ScaleThread*) pArg;
+    struct Scale *pS = &sScale;
+    spThread = pT;
+
+    while (true)
+    {
+        // phase 1: merge messages of the last window into the inboxes of the shard
+        uint32_t u, k;
+        for (u = 0; u < pS->threadCnt; u++)
+        {
+            const struct ScaleMsgList *pOut = &pS->pThreads[u].unicastOut;
+            for (k = 0; k < pOut->cnt; k++)
+            {
+                if (pOut->pMsgs[k].dst >= pT->first && pOut->pMsgs[k].dst < pT->last)
+                {
+                    scale_slave_enqueue(&pS->pSlaves[pOut->pMsgs[k].dst], &pOut->pMsgs[k]);
+                }
+            }
+        }
+
+        if (pT->id == 0)
+        {
+            // drop delivered multicast messages, add new ones
+            struct ScaleMsgList *pMc = &pS->multicast;
+            uint32_t keep = 0;
+            for (k = 0; k < pMc->cnt; k++)
+            {
+                if (pMc->pMsgs[k].t >= pS->windowEnd)
+                {
+                    pMc->pMsgs[keep++] = pMc->pMsgs[k];
+                }
+            }
+            pMc->cnt = keep;
+
+            for (u = 0; u < pS->threadCnt; u++)
+            {
+                const struct ScaleMsgList *pOut = &pS->pThreads[u].multicastOut;
+                for (k = 0; k < pOut->cnt; k++)
+                {
+                    *scale_push(pMc) = pOut->pMsgs[k];
+                }
+            }
+            qsort(pMc->pMsgs, pMc->cnt, sizeof(struct ScaleMsg), scale_compare_msgs);
+        }
+
+        pthread_barrier_wait(&pS->barrier);
+
+        // phase 2: find earliest event of the shard
+        pT->unicastOut.cnt = pT->multicastOut.cnt = 0;
+        int64_t min = INT64_MAX;
+        for (k = pT->first; k < pT->last; k++)
+        {
+            min = (pS->pSlaves[k].next < min) ? pS->pSlaves[k].next : min;
+        }
+
+        if (pT->id == 0)
+        {
+            int64_t master = (pS->nextSync < pS->nextAnnounce) ? pS->nextSync : pS->nextAnnounce;
+            master = (pS->nextFollowUp < master) ? pS->nextFollowUp : master;
+            min = (master < min) ? master : min;
+            if (pS->multicast.cnt > 0 && pS->multicast.pMsgs[0].t < min)
+            {
+                min = pS->multicast.pMsgs[0].t;
+            }
+        }
+        pT->partialMin = min;
+
+        pthread_barrier_wait(&pS->barrier);
+
+        // phase 3: open window, collect slaves having events in it
+        min = INT64_MAX;
+        for (u = 0; u < pS->threadCnt; u++)
+        {
+            min = (pS->pThreads[u].partialMin < min) ? pS->pThreads[u].partialMin : min;
+        }
+
+        if (min >= pS->tEnd)
+        {
+            break;
+        }
+
+        int64_t windowEnd = min + pS->latency;
+        bool mcInWindow = (pS->multicast.cnt > 0 && pS->multicast.pMsgs[0].t < windowEnd);
+
+        pT->workCnt = 0;
+        for (k = pT->first; k < pT->last; k++)
+        {
+            if (mcInWindow || pS->pSlaves[k].next < windowEnd)
+            {
+                pT->pWork[pT->workCnt++] = k;
+            }
+        }
+        atomic_store(&pT->cursor, 0);
+
+        if (pT->id == 0)
+        {
+            scale_master_periodic(windowEnd);
+        }
+
+        pthread_barrier_wait(&pS->barrier);
+
+        // phase 4: process own shard, then help the others
+        int64_t start = scale_now();
+        scale_process_work(pT, false, windowEnd);
+        for (u = 1; u < pS->threadCnt; u++)
+        {
+            scale_process_work(&pS->pThreads[(pT->id + u) % pS->threadCnt], true, windowEnd);
+        }
+        pT->cnt.busy_ns += scale_now() - start;
+
+        pthread_barrier_wait(&pS->barrier);
+
+        if (pT->id == 0)
+        {
+            pS->windowEnd = windowEnd;
+            pS->windows++;
+        }
+    }
+
+    return NULL;
+}
+
+// --------------------------
+
+// get heap memory in use [bytes]
+static uint64_t scale_heap_in_use()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// create slave
+static void scale_create_slave(struct ScaleSlave *pSlave, uint32_t idx, int64_t t0)
+{
+    memset(pSlave, 0, sizeof(struct ScaleSlave));
+    pSlave->idx = idx;
+    pSlave->pEnv = host_env_create();
+    host_env_select(pSlave->pEnv);
+
+    uint8_t pMAC[6] = { 0x02, 0x00, 0x00, idx >> 16, idx >> 8, idx };
+    uint8_t pIP[4] = { 10, 1 + (idx >> 16), idx >> 8, idx };
+    memcpy(&pSlave->addr.addr, pIP, 4);
+
+    host_set_time(t0);
+    host_set_netif(pMAC, pSlave->addr.addr);
+    host_set_udp_hook(scale_slave_sent, pSlave);
+    host_set_quiet(true);
+
+    // spread oscillator frequency errors over +-20 ppm
+    uint32_t h = idx * 2654435761u;
+    host_clock_set_freq_error((double) (h % 40001) - 20000.0);
+
+    struct PTPArena arena;
+    ptp_arena_init(&arena, malloc(ptp_instance_size()), ptp_instance_size());
+    pSlave->pInst = ptp_create_instance(&arena);
+    ptp_init(pSlave->pInst, spPCBs);
+    ptp_set_transport_mode(pSlave->pInst, sScale.mode);
+    if (sScale.mode == PTPTM_UNICAST)
+    {
+        ptp_unicast_add_master(&pSlave->pInst->unicast, &sScale.masterAddr);
+    }
+
+    pSlave->nextPeriodic = t0 + (PTP_PERIODIC_INTERVAL_MS * 1000000ll);
+    pSlave->nextPoll = INT64_MAX;
+    pSlave->next = pSlave->nextPeriodic;
+
+    host_env_select(NULL);
+}
+
+// release slave
+static void scale_destroy_slave(struct ScaleSlave *pSlave)
+{
+    free(pSlave->pInst);
+    host_env_destroy(pSlave->pEnv);
+    free(pSlave->inbox.pMsgs);
+}
+
+// get time error of a slave [ns]
+static int64_t scale_time_error(struct ScaleSlave *pSlave)
+{
+    struct TimestampI ts;
+    host_env_select(pSlave->pEnv);
+    ptphw_host_gettime(&ts);
+    int64_t te = nsI(&ts) - host_get_time();
+    host_env_select(NULL);
+    return te;
+}
+
+static int scale_compare_i64(const void *pA, const void *pB)
+{
+    int64_t a = *(const int64_t*) pA, b = *(const int64_t*) pB;
+    return (a > b) - (a < b);
+}
+
+// run one configuration and print its line
+static void scale_run(double duration_s)
+{
+    struct Scale *pS = &sScale;
+    int64_t t0 = SCALE_T0_S * NANO_PREFIX;
+    uint32_t i;
+
+    // set up network
+    uint64_t heapBefore = scale_heap_in_use();
+    pS->pSlaves = (struct ScaleSlave*) calloc(pS->slaveCnt, sizeof(struct ScaleSlave));
+    pS->pThreads = (struct ScaleThread*) calloc(pS->threadCnt, sizeof(struct ScaleThread));
+    for (i = 0; i < pS->slaveCnt; i++)
+    {
+        scale_create_slave(&pS->pSlaves[i], i, t0);
+    }
+    uint64_t heapAfter = scale_heap_in_use();
+
+    pS->tEnd = t0 + (int64_t) (duration_s * 1E+09);
+    pS->nextSync = t0 + 100000000ll;
+    pS->nextFollowUp = INT64_MAX;
+    pS->nextAnnounce = t0;
+    pS->syncSeq = pS->announceSeq = 0;
+    pS->windowEnd = t0;
+    pS->windows = 0;
+    pS->multicast.cnt = 0;
+
+    for (i = 0; i < pS->threadCnt; i++)
+    {
+        struct ScaleThread *pT = &pS->pThreads[i];
+        pT->id = i;
+        pT->first = (uint64_t) pS->slaveCnt * i / pS->threadCnt;
+        pT->last = (uint64_t) pS->slaveCnt * (i + 1) / pS->threadCnt;
+        pT->pWork = (uint32_t*) malloc((pT->last - pT->first + 1) * sizeof(uint32_t));
+    }
+
+    // run
+    pthread_barrier_init(&pS->barrier, NULL, pS->threadCnt);
+    int64_t start = scale_now();
+    for (i = 1; i < pS->threadCnt; i++)
+    {
+        pthread_create(&pS->pThreads[i].thread, NULL, scale_thread, &pS->pThreads[i]);
+    }
+    scale_thread(&pS->pThreads[0]);
+    for (i = 1; i < pS->threadCnt; i++)
+    {
+        pthread_join(pS->pThreads[i].thread, NULL);
+    }
+    double wall_s = (scale_now() - start) / 1E+09;
+    pthread_barrier_destroy(&pS->barrier);
+    spThread = NULL;
+
+    // collect counters
+    struct ScaleCounters cnt;
+    memset(&cnt, 0, sizeof(cnt));
+    for (i = 0; i < pS->threadCnt; i++)
+    {
+        struct ScaleThread *pT = &pS->pThreads[i];
+        cnt.masterRx += pT->cnt.masterRx;
+        cnt.masterTx += pT->cnt.masterTx;
+        cnt.slaveRx += pT->cnt.slaveRx;
+        cnt.slaveTx += pT->cnt.slaveTx;
+        cnt.busy_ns += pT->cnt.busy_ns;
+        cnt.steals += pT->cnt.steals;
+        cnt.processed += pT->cnt.processed;
+        free(pT->pWork);
+        free(pT->unicastOut.pMsgs);
+        free(pT->multicastOut.pMsgs);
+    }
+
+    uint64_t engine_ns = 0;
+    int64_t *pTE = (int64_t*) malloc(pS->slaveCnt * sizeof(int64_t));
+    for (i = 0; i < pS->slaveCnt; i++)
+    {
+        engine_ns += pS->pSlaves[i].pInst->load.cycles;
+        pTE[i] = llabs(scale_time_error(&pS->pSlaves[i]));
+    }
+    qsort(pTE, pS->slaveCnt, sizeof(int64_t), scale_compare_i64);
+
+    // print line
+    static const char *spModes[] = { "mcast", "hybrid", "ucast" };
+    double perSlaveSec = (double) pS->slaveCnt * duration_s;
+    printf("%-6s %7u %3u %8.2f %8.0f %10.1f %10.1f %12.0f %9.2f %8.2f %8.2f %8.1f %9.0f %9.0f %8lld %10lld\n", spModes[pS->mode], pS->slaveCnt,
+           pS->threadCnt, wall_s, duration_s / wall_s, cnt.masterRx / duration_s, cnt.masterTx / duration_s, cnt.slaveRx / duration_s,
+           cnt.slaveRx / perSlaveSec, engine_ns / perSlaveSec / 1000.0, cnt.busy_ns / perSlaveSec / 1000.0,
+           100.0 * cnt.steals / ((cnt.processed > 0) ? cnt.processed : 1),
+           (double) (ptp_instance_size() + host_env_size() + sizeof(struct ScaleSlave)), (double) (heapAfter - heapBefore) / pS->slaveCnt,
+           (long long) pTE[pS->slaveCnt / 2], (long long) pTE[pS->slaveCnt - 1]);
+    fflush(stdout);
+
+    // release network
+    free(pTE);
+    for (i = 0; i < pS->slaveCnt; i++)
+    {
+        scale_destroy_slave(&pS->pSlaves[i]);
+    }
+    free(pS->pSlaves);
+    free(pS->pThreads);
+    free(pS->multicast.pMsgs);
+    pS->multicast.pMsgs = NULL;
+    pS->multicast.size = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct Scale *pS = &sScale;
+    const char *pCounts = "10,100,1000", *pModes = "mcast,hybrid,ucast";
+    double duration_s = 60;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    pS->threadCnt = (cores > 0) ? cores : 1;
+    pS->latency = 20000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "N:m:t:T:i:L:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'N':
+            pCounts = optarg;
+            break;
+        case 'm':
+            pModes = optarg;
+            break;
+        case 't':
+            duration_s = atof(optarg);
+            break;
+        case 'T':
+            pS->threadCnt = atoi(optarg);
+            break;
+        case 'i':
+            pS->logSync = atoi(optarg);
+            break;
+        case 'L':
+            pS->latency = atoll(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-N n1,n2...] [-m mcast,hybrid,ucast] [-t duration_s] [-T threads] [-i logSync] [-L latency_ns]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (duration_s <= 0 || pS->threadCnt == 0 || pS->threadCnt > SCALE_MAX_THREADS || pS->latency <= 0)
+    {
+        fprintf(stderr, "Invalid parameters.\n");
+        return 1;
+    }
+
+    const uint8_t pMasterId[8] = { 0x00, 0x1b, 0x19, 0xff, 0xfe, 0x00, 0x00, 0x01 };
+    memcpy(&pS->masterId, pMasterId, 8);
+    pS->masterAddr.addr = ipaddr_addr("10.0.0.1");
+    pS->mcastAddr.addr = ipaddr_addr(PTP_IGMP_DEFAULT);
+
+    printf("Simulated time: %.0f s, fabric latency: %lld ns, log2 Sync interval: %d\n\n", duration_s, (long long) pS->latency, pS->logSync);
+    printf("%-6s %7s %3s %8s %8s %10s %10s %12s %9s %8s %8s %8s %9s %9s %8s %10s\n", "mode", "slaves", "thr", "wall[s]", "speedup", "mst_rx/s",
+           "mst_tx/s", "slave_rx/s", "rx/slv/s", "eng_us", "tot_us", "steal%", "B/slave", "heap/slv", "TE_p50", "TE_max");
+
+    // run every combination
+    char pModeList[64];
+    snprintf(pModeList, sizeof(pModeList), "%s", pModes);
+    char *pModeSave, *pMode;
+    for (pMode = strtok_r(pModeList, ",", &pModeSave); pMode != NULL; pMode = strtok_r(NULL, ",", &pModeSave))
+    {
+        if (!strcmp(pMode, "mcast"))
+        {
+            pS->mode = PTPTM_MULTICAST;
+        }
+        else if (!strcmp(pMode, "hybrid"))
+        {
+            pS->mode = PTPTM_HYBRID;
+        }
+        else if (!strcmp(pMode, "ucast"))
+        {
+            pS->mode = PTPTM_UNICAST;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown mode: '%s'\n", pMode);
+            return 1;
+        }
+
+        char pCountList[128];
+        snprintf(pCountList, sizeof(pCountList), "%s", pCounts);
+        char *pCountSave, *pCount;
+        for (pCount = strtok_r(pCountList, ",", &pCountSave); pCount != NULL; pCount = strtok_r(NULL, ",", &pCountSave))
+        {
+            pS->slaveCnt = atoi(pCount);
+            if (pS->slaveCnt == 0 || pS->slaveCnt > SCALE_MAX_SLAVES)
+            {
+                fprintf(stderr, "Invalid slave count: '%s'\n", pCount);
+                return 1;
+            }
+
+            scale_run(duration_s);
+        }
+    }
+
+    printf("\nmst_rx/s, mst_tx/s: messages received and sent by the master (unicast copies counted one by one)\n");
+    printf("slave_rx/s, rx/slv/s: messages delivered to slave access links in total and per slave\n");
+    printf("eng_us, tot_us: CPU time per slave and simulated second inside ptp_process_packet() and in total [us]\n");
+    printf("steal%%: slave windows processed by other threads than their owner\n");
+    printf("B/slave, heap/slv: instance, environment and harness state per slave, heap allocated per slave [bytes]\n");
+    printf("TE_p50, TE_max: median and maximal absolute time error of the slaves at the end [ns]\n");
+
+    return 0;
+}
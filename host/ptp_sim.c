@@ -0,0 +1,791 @@
+/* (C) András Wiesner, 2021 */
+
+// Discrete-event simulation of a slave behind a packet network
+//
+// A master with an ideal clock sends two-step Sync/Follow_Up and Announce messages to a slave running the
+// PTP engine and servo of the firmware in virtual time (see host/host_port.h), and answers its Delay_Reqs.
+// The network between them is a chain of store-and-forward switches. The queueing delay of every switch
+// follows a G.8261-style model: competing traffic of traffic model 1 or 2 (frame size mix) loads every
+// switch port according to a load profile. A PTP frame finds the port busy with the probability of the
+// load, then waits for the residual of the frame in transmission and a geometrically distributed number of
+// queued frames. Queues are FIFO, so messages of a direction are never reordered. Link asymmetry and
+// random packet loss can be added. The time error of the slave clock is sampled every second and
+// percentiles are reported. Runs are deterministic for a given seed, hours of network time take seconds.
+//
+// Load profiles (peak load given by -l, base load is PTP_SIM_BASE_LOAD):
+//   const: peak load all the time
+//   step: peak load in the first half of every period, base load in the second half (sudden load changes)
+//   sine: sinusoidal variation between base and peak load (slowly varying load)
+//
+// Build (from the project root):
+//
+//   gcc -O2 -DPTP_PORT_HOST -Ihost/include -I. -o ptp_sim host/ptp_sim.c host/host_port.c host/host_cli.c host/host_osc.c
+//       ptp*.c timeutils.c servo/pd_controller.c -lm
+//
+// Usage: ptp_sim [options] [-c "command"]...
+//
+//   -t duration [s] (default: 3600)         -w warm-up excluded from statistics [s] (default: 300)
+//   -i log2 Sync interval (default: 0)       -n number of switches (default: 5)
+//   -l peak load forward[,reverse] (0..0.95, default: 0.4)
+//   -m traffic model (1 or 2, default: 1)    -p load profile (const|step|sine, default: const)
+//   -P profile period [s] (default: 600)     -r link rate [bit/s] (default: 1e9)
+//   -a asymmetry, extra delay of the master->slave direction [ns] (default: 0)
+//   -L packet loss probability (default: 0)  -f oscillator frequency error [ppb] (default: 10000, 0 with -x)
+//   -x file: oscillator model of the slave (see host/host_osc.h and host/osc/*.osc)
+//   -o initial time error of the slave [ns] (default: 0)
+//   -s random seed (default: 1)              -O file: write time error and oscillator frequency samples as CSV
+//   -E file: non-volatile storage of the slave (learned frequency is kept there between runs)
+//   -v: print engine output                  -c: run a CLI command before the simulation
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "ptp.h"
+#include "ptp_instance.h"
+#include "host_port.h"
+#include "host_cli.h"
+#include "host_osc.h"
+
+#define PTP_SIM_T0_S (1600000000ll) // master time at the start of the simulation [s]
+#define PTP_SIM_MAX_MSG (64) // longest message exchanged
+#define PTP_SIM_BASE_LOAD (0.1) // base load of the step and sine profiles
+#define PTP_SIM_MAX_LOAD (0.95) // loads are limited to this
+#define PTP_SIM_LINK_DELAY_NS (500) // propagation delay of a link
+#define PTP_SIM_FOLLOW_UP_NS (20000) // Follow_Up is sent after Sync by this much
+#define PTP_SIM_ANNOUNCE_NS (2000000000ll) // Announce interval
+#define PTP_SIM_SAMPLE_NS (1000000000ll) // time error sampling interval
+#define PTP_SIM_IFG_BYTES (20) // preamble and inter-frame gap
+#define PTP_SIM_PTP_FRAME_OVERHEAD (46) // Ethernet, IPv4 and UDP headers around a PTP message
+
+// event kinds
+enum SimEventKind
+{
+    SEK_SYNC, // master sends Sync and Follow_Up
+    SEK_ANNOUNCE, // master sends Announce
+    SEK_TO_SLAVE, // message arrives at the slave
+    SEK_TO_MASTER, // message arrives at the master
+    SEK_PERIODIC, // periodic housekeeping of the PTP task
+    SEK_POLL, // PTP task wakes up for its nearest deadline
+    SEK_SAMPLE // time error is sampled
+};
+
+// event
+struct SimEvent
+{
+    int64_t t; // time of the event
+    uint64_t order; // insertion order (events of the same time keep it)
+    uint8_t kind; // SimEventKind
+    uint8_t len; // message length
+    uint8_t pData[PTP_SIM_MAX_MSG]; // message
+};
+
+// load profiles
+enum SimProfile
+{
+    SP_CONST, SP_STEP, SP_SINE
+};
+
+// network between master and slave (direction 0: master->slave, 1: slave->master)
+struct SimNetwork
+{
+    uint32_t hops; // number of switches
+    double load[2]; // peak load per direction
+    uint8_t trafficModel; // G.8261 traffic model (1 or 2)
+    enum SimProfile profile; // load profile
+    double period_s; // profile period
+    double linkRate; // link rate [bit/s]
+    int64_t asymmetry_ns; // extra delay of the master->slave direction
+    double loss; // packet loss probability
+    int64_t lastArrival[2]; // arrival of the last message per direction (FIFO order)
+    uint32_t sent[2], lost[2]; // message counters
+};
+
+// simulation state
+struct Sim
+{
+    struct SimEvent *pHeap; // event queue (binary heap)
+    uint32_t eventCnt, heapSize; // number of events and size of the heap
+    uint64_t order; // insertion counter
+    uint64_t rng; // random generator state
+    struct SimNetwork net; // network
+    struct PTPInstance *pInst; // slave
+    uint64_t masterId; // master clockIdentity (network byte order)
+    struct ip_addr masterAddr; // master IP address
+    uint16_t syncSeq, announceSeq; // master sequenceIDs
+    int8_t logSync; // log2 Sync interval
+    int64_t pollAt; // time of the scheduled PTP task wake-up (INT64_MAX: none)
+};
+
+// --------------------------
+
+// random number generator (xorshift64*)
+static uint64_t sim_rand(struct Sim *pS)
+{
+    pS->rng ^= pS->rng >> 12;
+    pS->rng ^= pS->rng << 25;
+    pS->rng ^= pS->rng >> 27;
+    return pS->rng * 0x2545F4914F6CDD1Dull;
+}
+
+// uniform random number in [0, 1)
+static double sim_uniform(struct Sim *pS)
+{
+    return (sim_rand(pS) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// --------------------------
+
+// insert event
+static struct SimEvent* sim_schedule(struct Sim *pS, int64_t t, uint8_t kind)
+{
+    if (pS->eventCnt == pS->heapSize)
+    {
+        pS->heapSize = (pS->heapSize == 0) ? 256 : 2 * pS->heapSize;
+        pS->pHeap = (struct SimEvent*) realloc(pS->pHeap, pS->heapSize * sizeof(struct SimEvent));
+    }
+
+    // sift up
+    struct SimEvent ev = { .t = t, .order = pS->order++, .kind = kind, .len = 0 };
+    uint32_t i = pS->eventCnt++;
+    while (i > 0)
+    {
+        uint32_t parent = (i - 1) / 2;
+        const struct SimEvent *pP = &pS->pHeap[parent];
+        if (pP->t < t || (pP->t == t && pP->order < ev.order))
+        {
+            break;
+        }
+        pS->pHeap[i] = *pP;
+        i = parent;
+    }
+
+    pS->pHeap[i] = ev;
+    return &pS->pHeap[i];
+}
+
+// remove earliest event
+static void sim_pop(struct Sim *pS, struct SimEvent *pEv)
+{
+    *pEv = pS->pHeap[0];
+    struct SimEvent last = pS->pHeap[--pS->eventCnt];
+
+    // sift down
+    uint32_t i = 0;
+    while (true)
+    {
+        uint32_t c = 2 * i + 1;
+        if (c >= pS->eventCnt)
+        {
+            break;
+        }
+
+        if (c + 1 < pS->eventCnt
+                && (pS->pHeap[c + 1].t < pS->pHeap[c].t || (pS->pHeap[c + 1].t == pS->pHeap[c].t && pS->pHeap[c + 1].order < pS->pHeap[c].order)))
+        {
+            c++;
+        }
+
+        if (last.t < pS->pHeap[c].t || (last.t == pS->pHeap[c].t && last.order < pS->pHeap[c].order))
+        {
+            break;
+        }
+
+        pS->pHeap[i] = pS->pHeap[c];
+        i = c;
+    }
+
+    pS->pHeap[i] = last;
+}
+
+// --------------------------
+
+// transmission time of a frame [ns]
+static double sim_frame_time(const struct SimNetwork *pN, uint32_t len)
+{
+    return (len + PTP_SIM_IFG_BYTES) * 8 * 1E+09 / pN->linkRate;
+}
+
+// size of a competing frame according to the traffic model
+static uint32_t sim_frame_size(struct Sim *pS)
+{
+    double u = sim_uniform(pS);
+    if (pS->net.trafficModel == 2)
+    {
+        return (u < 0.6) ? 64 : ((u < 0.7) ? 576 : 1518); // 60% 64 B, 10% 576 B, 30% 1518 B
+    }
+    else
+    {
+        return (u < 0.8) ? 1518 : ((u < 0.95) ? 576 : 64); // 80% 1518 B, 15% 576 B, 5% 64 B
+    }
+}
+
+// load of a direction at a given time
+static double sim_load(const struct SimNetwork *pN, uint8_t dir, int64_t t)
+{
+    double peak = pN->load[dir];
+    double phase = fmod((t / 1E+09 - PTP_SIM_T0_S) / pN->period_s, 1.0);
+    double load;
+
+    switch (pN->profile)
+    {
+    case SP_STEP:
+        load = (phase < 0.5) ? peak : PTP_SIM_BASE_LOAD;
+        break;
+    case SP_SINE:
+        load = PTP_SIM_BASE_LOAD + (peak - PTP_SIM_BASE_LOAD) * (1.0 - cos(2.0 * M_PI * phase)) / 2.0;
+        break;
+    default:
+        load = peak;
+        break;
+    }
+
+    return (load > PTP_SIM_MAX_LOAD) ? PTP_SIM_MAX_LOAD : ((load < 0) ? 0 : load);
+}
+
+// queueing delay of a switch port [ns]
+static double sim_queue_delay(struct Sim *pS, double load)
+{
+    if (sim_uniform(pS) >= load)
+    {
+        return 0; // port is idle
+    }
+
+    double d = sim_uniform(pS) * sim_frame_time(&pS->net, sim_frame_size(pS)); // residual of the frame in transmission
+    while (sim_uniform(pS) < load)
+    {
+        d += sim_frame_time(&pS->net, sim_frame_size(pS)); // queued frames
+    }
+
+    return d;
+}
+
+// send message through the network, returns false if it gets lost
+static bool sim_send(struct Sim *pS, uint8_t dir, int64_t t, const uint8_t *pMsg, uint8_t len)
+{
+    struct SimNetwork *pN = &pS->net;
+
+    pN->sent[dir]++;
+    if (sim_uniform(pS) < pN->loss)
+    {
+        pN->lost[dir]++;
+        return false;
+    }
+
+    // propagation, store-and-forward and queueing delays
+    double load = sim_load(pN, dir, t);
+    double d = (pN->hops + 1) * (PTP_SIM_LINK_DELAY_NS + sim_frame_time(pN, len + PTP_SIM_PTP_FRAME_OVERHEAD));
+    uint32_t i;
+    for (i = 0; i < pN->hops; i++)
+    {
+        d += sim_queue_delay(pS, load);
+    }
+
+    if (dir == 0)
+    {
+        d += pN->asymmetry_ns;
+    }
+
+    // FIFO: no overtaking within a direction
+    int64_t arrival = t + (int64_t) d;
+    if (arrival <= pN->lastArrival[dir])
+    {
+        arrival = pN->lastArrival[dir] + 1;
+    }
+    pN->lastArrival[dir] = arrival;
+
+    struct SimEvent *pEv = sim_schedule(pS, arrival, (dir == 0) ? SEK_TO_SLAVE : SEK_TO_MASTER);
+    memcpy(pEv->pData, pMsg, len);
+    pEv->len = len;
+    return true;
+}
+
+// --------------------------
+
+// fill in header of a master message
+static void sim_master_header(struct Sim *pS, uint8_t *pMsg, uint8_t messageID, uint16_t len, uint16_t seq, uint8_t control, int8_t logPeriod,
+                              bool twoStep)
+{
+    struct PTPHeader header;
+    memset(&header, 0, sizeof(header));
+    header.messageID = messageID;
+    header.versionPTP = 2;
+    header.messageLength = len;
+    header.flags.PTP_TWO_STEP = twoStep;
+    header.clockIdentity = pS->masterId;
+    header.sourcePortID = 1;
+    header.sequenceID = seq;
+    header.control = control;
+    header.logMessagePeriod = logPeriod;
+
+    memset(pMsg, 0, len);
+    ptp_construct_binary_header(pMsg, &header);
+}
+
+// write timestamp of the master
+static void sim_master_timestamp(uint8_t *pMsg, int64_t t)
+{
+    struct TimestampI ts = { t / NANO_PREFIX, t % NANO_PREFIX };
+    ptp_write_binary_timestamps(pMsg, &ts, 1);
+}
+
+// send Sync and Follow_Up
+static void sim_master_sync(struct Sim *pS, int64_t t)
+{
+    uint8_t pMsg[PTP_DELAY_REQ_PCKT_SIZE];
+    uint16_t seq = pS->syncSeq++;
+
+    sim_master_header(pS, pMsg, PTPIDSync, sizeof(pMsg), seq, PTPCONSync, pS->logSync, true);
+    sim_send(pS, 0, t, pMsg, sizeof(pMsg));
+
+    sim_master_header(pS, pMsg, PTPIDFollow_Up, sizeof(pMsg), seq, PTPCONFollow_Up, pS->logSync, false);
+    sim_master_timestamp(pMsg, t);
+    sim_send(pS, 0, t + PTP_SIM_FOLLOW_UP_NS, pMsg, sizeof(pMsg));
+}
+
+// send Announce
+static void sim_master_announce(struct Sim *pS, int64_t t)
+{
+    uint8_t pMsg[64];
+
+    sim_master_header(pS, pMsg, PTPIDAnnounce, sizeof(pMsg), pS->announceSeq++, PTPCONOther, 1, false);
+    sim_master_timestamp(pMsg, t);
+    pMsg[44] = 0;
+    pMsg[45] = 37; // currentUtcOffset
+    pMsg[47] = 128; // priority1
+    pMsg[48] = 6; // clockClass: locked to primary reference
+    pMsg[49] = 0x21; // clockAccuracy: 100 ns
+    pMsg[50] = 0x4e;
+    pMsg[51] = 0x5d; // offsetScaledLogVariance
+    pMsg[52] = 128; // priority2
+    memcpy(&pMsg[53], &pS->masterId, 8); // grandmasterIdentity
+    pMsg[63] = 0x20; // timeSource: GNSS
+
+    sim_send(pS, 0, t, pMsg, sizeof(pMsg));
+}
+
+// answer Delay_Req
+static void sim_master_delay_req(struct Sim *pS, const struct SimEvent *pEv)
+{
+    uint8_t pMsg[PTP_DELAY_REQ_PCKT_SIZE + 10];
+    const uint8_t *pReq = pEv->pData;
+
+    if (pEv->len < PTP_HEADER_LENGTH || (pReq[0] & 0x0f) != PTPIDDelay_Req)
+    {
+        return;
+    }
+
+    sim_master_header(pS, pMsg, PTPIDDelay_Resp, sizeof(pMsg), (pReq[30] << 8) | pReq[31], PTPCONelay_Resp, pS->logSync, false);
+    pMsg[4] = pReq[4]; // domainNumber
+    sim_master_timestamp(pMsg, pEv->t);
+    memcpy(&pMsg[44], &pReq[20], 10); // requestingPortIdentity
+
+    sim_send(pS, 0, pEv->t, pMsg, sizeof(pMsg));
+}
+
+// hook of messages sent by the slave
+static void sim_slave_sent(struct udp_pcb *pPCB, struct pbuf *pPBuf, const struct ip_addr *pAddr, uint16_t port, void *pArg)
+{
+    struct Sim *pS = (struct Sim*) pArg;
+
+    if (port == PTP_PORT0 && pPBuf->len <= PTP_SIM_MAX_MSG)
+    {
+        sim_send(pS, 1, host_get_time(), (const uint8_t*) pPBuf->payload, pPBuf->len);
+    }
+}
+
+// deliver message to the slave
+static void sim_slave_receive(struct Sim *pS, const struct SimEvent *pEv)
+{
+    struct TimestampI ts;
+    ptphw_host_gettime(&ts); // hardware RX timestamp
+
+    struct pbuf *pPBuf = pbuf_alloc(PBUF_TRANSPORT, pEv->len, PBUF_RAM);
+    memcpy(pPBuf->payload, pEv->pData, pEv->len);
+    pPBuf->time_s = (uint32_t) ts.sec;
+    pPBuf->time_ns = (uint32_t) ts.nanosec;
+
+    ptp_process_packet(pS->pInst, pPBuf, &pS->masterAddr);
+    pbuf_free(pPBuf);
+}
+
+// handle timeouts like the PTP task loop does and schedule its next wake-up
+static void sim_slave_poll(struct Sim *pS, int64_t t)
+{
+    uint32_t wait = ptp_poll(pS->pInst);
+    int64_t at = (wait == portMAX_DELAY) ? INT64_MAX : (t + (int64_t) wait * (NANO_PREFIX / configTICK_RATE_HZ));
+
+    // a pending earlier wake-up recomputes the deadline anyway
+    if (at < pS->pollAt || pS->pollAt <= t)
+    {
+        pS->pollAt = at;
+        if (at != INT64_MAX)
+        {
+            sim_schedule(pS, at, SEK_POLL);
+        }
+    }
+}
+
+// get time error of the slave clock [ns]
+static int64_t sim_time_error()
+{
+    struct TimestampI ts;
+    ptphw_host_gettime(&ts);
+    return nsI(&ts) - host_get_time();
+}
+
+// --------------------------
+
+static int sim_compare_i64(const void *pA, const void *pB)
+{
+    int64_t a = *(const int64_t*) pA, b = *(const int64_t*) pB;
+    return (a > b) - (a < b);
+}
+
+// print percentiles of sorted samples
+static void sim_print_percentiles(const char *pName, const int64_t *pSamples, uint32_t n)
+{
+    static const double spPercentiles[] = { 50, 90, 99, 99.9 };
+
+    printf("%s [ns]:", pName);
+    uint8_t i;
+    for (i = 0; i < sizeof(spPercentiles) / sizeof(spPercentiles[0]); i++)
+    {
+        uint32_t k = (uint32_t) ceil(spPercentiles[i] / 100.0 * n) - 1;
+        printf(" p%g: %lld,", spPercentiles[i], (long long) pSamples[(k < n) ? k : n - 1]);
+    }
+    printf(" max: %lld\n", (long long) pSamples[n - 1]);
+}
+
+// parse load option ("peak" or "forward,reverse")
+static bool sim_parse_load(const char *pStr, double *pLoad)
+{
+    char *pEnd;
+    pLoad[0] = pLoad[1] = strtod(pStr, &pEnd);
+    if (*pEnd == ',')
+    {
+        pLoad[1] = strtod(pEnd + 1, &pEnd);
+    }
+
+    return *pEnd == '\0' && pLoad[0] >= 0 && pLoad[0] <= PTP_SIM_MAX_LOAD && pLoad[1] >= 0 && pLoad[1] <= PTP_SIM_MAX_LOAD;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct Sim sim;
+    struct Sim *pS = &sim;
+    const char *ppCmds[32];
+    uint32_t cmdCnt = 0;
+    double duration_s = 3600, warmup_s = 300, freqErr_ppb = 10000;
+    int64_t initOffset_ns = 0;
+    const char *pCsvName = NULL, *pOscName = NULL, *pNvsName = NULL;
+    bool freqErrSet = false;
+    bool verbose = false;
+
+    // defaults
+    pS->net.hops = 5;
+    pS->net.load[0] = pS->net.load[1] = 0.4;
+    pS->net.trafficModel = 1;
+    pS->net.profile = SP_CONST;
+    pS->net.period_s = 600;
+    pS->net.linkRate = 1E+09;
+    pS->rng = 1;
+
+    // process arguments
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        const char *pOpt = argv[i], *pVal = (i + 1 < argc) ? argv[i + 1] : NULL;
+        bool ok = (pVal != NULL);
+
+        if (!strcmp(pOpt, "-v"))
+        {
+            verbose = true;
+            continue;
+        }
+        else if (ok && !strcmp(pOpt, "-t"))
+        {
+            duration_s = atof(pVal);
+        }
+        else if (ok && !strcmp(pOpt, "-w"))
+        {
+            warmup_s = atof(pVal);
+        }
+        else if (ok && !strcmp(pOpt, "-i"))
+        {
+            pS->logSync = atoi(pVal);
+        }
+        else if (ok && !strcmp(pOpt, "-n"))
+        {
+            pS->net.hops = atoi(pVal);
+        }
+        else if (ok && !strcmp(pOpt, "-l"))
+        {
+            ok = sim_parse_load(pVal, pS->net.load);
+        }
+        else if (ok && !strcmp(pOpt, "-m"))
+        {
+            pS->net.trafficModel = atoi(pVal);
+            ok = (pS->net.trafficModel == 1 || pS->net.trafficModel == 2);
+        }
+        else if (ok && !strcmp(pOpt, "-p"))
+        {
+            pS->net.profile = !strcmp(pVal, "step") ? SP_STEP : (!strcmp(pVal, "sine") ? SP_SINE : SP_CONST);
+            ok = !strcmp(pVal, "const") || pS->net.profile != SP_CONST;
+        }
+        else if (ok && !strcmp(pOpt, "-P"))
+        {
+            pS->net.period_s = atof(pVal);
+            ok = pS->net.period_s > 0;
+        }
+        else if (ok && !strcmp(pOpt, "-r"))
+        {
+            pS->net.linkRate = atof(pVal);
+            ok = pS->net.linkRate > 0;
+        }
+        else if (ok && !strcmp(pOpt, "-a"))
+        {
+            pS->net.asymmetry_ns = atoll(pVal);
+        }
+        else if (ok && !strcmp(pOpt, "-L"))
+        {
+            pS->net.loss = atof(pVal);
+        }
+        else if (ok && !strcmp(pOpt, "-f"))
+        {
+            freqErr_ppb = atof(pVal);
+            freqErrSet = true;
+        }
+        else if (ok && !strcmp(pOpt, "-o"))
+        {
+            initOffset_ns = atoll(pVal);
+        }
+        else if (ok && !strcmp(pOpt, "-s"))
+        {
+            pS->rng = strtoull(pVal, NULL, 0);
+            ok = (pS->rng != 0);
+        }
+        else if (ok && !strcmp(pOpt, "-x"))
+        {
+            pOscName = pVal;
+        }
+        else if (ok && !strcmp(pOpt, "-O"))
+        {
+            pCsvName = pVal;
+        }
+        else if (ok && !strcmp(pOpt, "-E"))
+        {
+            pNvsName = pVal;
+        }
+        else if (ok && !strcmp(pOpt, "-c") && cmdCnt < sizeof(ppCmds) / sizeof(ppCmds[0]))
+        {
+            ppCmds[cmdCnt++] = pVal;
+        }
+        else
+        {
+            ok = false;
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "Invalid option: '%s' (see the description at the beginning of ptp_sim.c)\n", pOpt);
+            return 1;
+        }
+        i++;
+    }
+
+    // set up slave
+    int64_t t0 = PTP_SIM_T0_S * NANO_PREFIX;
+    host_port_reset();
+    host_set_time(t0);
+    host_set_netif((const uint8_t[] ) { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 }, ipaddr_addr("10.0.0.2"));
+    host_set_udp_hook(sim_slave_sent, pS);
+    host_set_quiet(!verbose);
+    host_set_nvs_file(pNvsName);
+
+    static struct udp_pcb pPCB[2] = { { PTP_PORT0 }, { PTP_PORT1 } };
+    static struct udp_pcb *ppPCBs[2] = { &pPCB[0], &pPCB[1] };
+
+    struct PTPArena arena;
+    ptp_arena_init(&arena, malloc(ptp_instance_size()), ptp_instance_size());
+    pS->pInst = ptp_create_instance(&arena);
+    ptp_init(pS->pInst, ppPCBs);
+    ptp_register_cli_commands(pS->pInst);
+
+    static struct HostOsc osc;
+    struct HostOscParams oscParams;
+    if (pOscName != NULL)
+    {
+        if (!host_osc_load(&oscParams, pOscName))
+        {
+            return 1;
+        }
+
+        host_osc_init(&osc, &oscParams, t0);
+        host_clock_set_oscillator(host_osc_phase, &osc);
+        freqErr_ppb = freqErrSet ? freqErr_ppb : 0;
+    }
+
+    host_clock_set_freq_error(freqErr_ppb);
+    host_clock_step(initOffset_ns);
+
+    for (i = 0; i < (int) cmdCnt; i++)
+    {
+        if (host_cli_run(ppCmds[i]) < 0)
+        {
+            fprintf(stderr, "Unknown command or bad parameter: '%s'\n", ppCmds[i]);
+            return 1;
+        }
+    }
+
+    // set up master
+    const uint8_t pMasterId[8] = { 0x00, 0x1b, 0x19, 0xff, 0xfe, 0x00, 0x00, 0x01 };
+    memcpy(&pS->masterId, pMasterId, 8);
+    pS->masterAddr.addr = ipaddr_addr("10.0.0.1");
+
+    int64_t syncInterval = (pS->logSync >= 0) ? (NANO_PREFIX << pS->logSync) : (NANO_PREFIX >> -pS->logSync);
+    int64_t tEnd = t0 + (int64_t) (duration_s * 1E+09), tWarmup = t0 + (int64_t) (warmup_s * 1E+09);
+
+    sim_schedule(pS, t0, SEK_ANNOUNCE);
+    sim_schedule(pS, t0 + syncInterval / 2, SEK_SYNC);
+    sim_schedule(pS, t0, SEK_PERIODIC);
+    sim_schedule(pS, t0 + PTP_SIM_SAMPLE_NS, SEK_SAMPLE);
+
+    uint32_t sampleCnt = 0, sampleSize = (uint32_t) (duration_s * 1E+09 / PTP_SIM_SAMPLE_NS) + 1;
+    int64_t *pSamples = (int64_t*) malloc(sampleSize * sizeof(int64_t));
+    FILE *pCsv = (pCsvName != NULL) ? fopen(pCsvName, "w") : NULL;
+    if (pCsv != NULL)
+    {
+        fprintf(pCsv, "t_s,time_error_ns,osc_ppb\n");
+    }
+
+    // run simulation
+    struct timespec wallStart, wallEnd;
+    clock_gettime(CLOCK_MONOTONIC, &wallStart);
+
+    struct SimEvent ev;
+    struct PTPEvLogRecord rec;
+    uint64_t events = 0;
+    while (pS->eventCnt > 0)
+    {
+        sim_pop(pS, &ev);
+        if (ev.t > tEnd)
+        {
+            break;
+        }
+
+        host_set_time(ev.t);
+        events++;
+
+        switch (ev.kind)
+        {
+        case SEK_SYNC:
+            sim_master_sync(pS, ev.t);
+            sim_schedule(pS, ev.t + syncInterval, SEK_SYNC);
+            break;
+        case SEK_ANNOUNCE:
+            sim_master_announce(pS, ev.t);
+            sim_schedule(pS, ev.t + PTP_SIM_ANNOUNCE_NS, SEK_ANNOUNCE);
+            break;
+        case SEK_TO_SLAVE:
+            sim_slave_receive(pS, &ev);
+            sim_slave_poll(pS, ev.t);
+            break;
+        case SEK_TO_MASTER:
+            sim_master_delay_req(pS, &ev);
+            break;
+        case SEK_PERIODIC:
+            ptp_periodic(pS->pInst);
+            sim_schedule(pS, ev.t + PTP_PERIODIC_INTERVAL_MS * 1000000ll, SEK_PERIODIC);
+            sim_slave_poll(pS, ev.t);
+            break;
+        case SEK_POLL:
+            if (ev.t == pS->pollAt) // wake-ups superseded by an earlier one are stale
+            {
+                sim_slave_poll(pS, ev.t);
+            }
+            break;
+        case SEK_SAMPLE:
+        {
+            int64_t te = sim_time_error();
+            if (ev.t >= tWarmup && sampleCnt < sampleSize)
+            {
+                pSamples[sampleCnt++] = te;
+            }
+
+            if (pCsv != NULL)
+            {
+                fprintf(pCsv, "%.0f,%lld,%.3f\n", (ev.t - t0) / 1E+09, (long long) te,
+                        freqErr_ppb + ((pOscName != NULL) ? host_osc_freq_ppb(&osc) : 0.0));
+            }
+
+            sim_schedule(pS, ev.t + PTP_SIM_SAMPLE_NS, SEK_SAMPLE);
+            break;
+        }
+        default:
+            break;
+        }
+
+        // drain event log like the drain task does
+        while (ptp_evlog_pop(ptp_get_event_log(pS->pInst), &rec))
+        {
+            ptp_evlog_print(&rec);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+    double wall_s = (wallEnd.tv_sec - wallStart.tv_sec) + (wallEnd.tv_nsec - wallStart.tv_nsec) / 1E+09;
+
+    if (pCsv != NULL)
+    {
+        fclose(pCsv);
+    }
+
+    // report
+    if (pOscName != NULL)
+    {
+        host_osc_print(&oscParams);
+    }
+    printf("Simulated %.0f s in %.3f s (%.0fx real time, %llu events)\n", duration_s, wall_s, (wall_s > 0) ? duration_s / wall_s : 0.0,
+           (unsigned long long) events);
+    printf("Messages master->slave: %u (lost: %u), slave->master: %u (lost: %u)\n", pS->net.sent[0], pS->net.lost[0], pS->net.sent[1],
+           pS->net.lost[1]);
+
+    if (sampleCnt == 0)
+    {
+        printf("No time error samples after the warm-up.\n");
+        return 0;
+    }
+
+    double sum = 0, sumSq = 0;
+    uint32_t k;
+    for (k = 0; k < sampleCnt; k++)
+    {
+        sum += pSamples[k];
+        sumSq += (double) pSamples[k] * pSamples[k];
+    }
+
+    double mean = sum / sampleCnt;
+    printf("Time error after %.0f s warm-up (%u samples): mean: %.1f ns, std: %.1f ns\n", warmup_s, sampleCnt, mean,
+           sqrt(fmax(sumSq / sampleCnt - mean * mean, 0)));
+
+    qsort(pSamples, sampleCnt, sizeof(int64_t), sim_compare_i64);
+    printf("Time error range [ns]: min: %lld, max: %lld\n", (long long) pSamples[0], (long long) pSamples[sampleCnt - 1]);
+
+    for (k = 0; k < sampleCnt; k++)
+    {
+        pSamples[k] = llabs(pSamples[k]);
+    }
+    qsort(pSamples, sampleCnt, sizeof(int64_t), sim_compare_i64);
+    sim_print_percentiles("|Time error|", pSamples, sampleCnt);
+
+    if (verbose)
+    {
+        host_set_quiet(false);
+        ptp_stats_print(&pS->pInst->stats);
+    }
+
+    return 0;
+}
@@ -0,0 +1,335 @@
+/* (C) András Wiesner, 2021 */
+
+// Collector of the telemetry stream
+//
+// Datagrams sent by `ptp telemetry <ip> [port]` (format described in ptp_telemetry.h) are received and their
+// records are written into a CSV file, a columnar file or both. The columnar file is meant for large captures:
+// records are buffered into row groups and every column of a row group is stored contiguously, so a column
+// can be loaded without parsing the others (e.g. numpy.frombuffer() over the byte range of the column).
+// Columnar layout (little-endian):
+//
+//   file header: "PTPC", version (uint8), number of columns (uint8),
+//                per column: type (uint8, TELEM_TYPE_...), name length (uint8), name
+//   row group:   number of rows (uint32), then every column as an array of values of its type
+//
+// Build (from the project root):
+//
+//   gcc -O2 -DPTP_PORT_HOST -Ihost/include -I. -o ptp_telemetry_rx host/ptp_telemetry_rx.c ptp_telemetry.c
+//       host/host_port.c host/host_cli.c
+//
+// Usage: ptp_telemetry_rx [-p port] [-c file.csv] [-o file.ptpc] [-n records]
+//
+//   -p: UDP port to listen on (default: PTP_TELEMETRY_PORT)
+//   -c: write CSV file
+//   -o: write columnar file
+//   -n: exit after receiving this many records (default: run until interrupted)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "ptp_telemetry.h"
+
+#define TELEM_ROW_GROUP (4096) // rows buffered per row group of the columnar file
+
+// column types of the columnar file
+enum TelemColumnType
+{
+    TELEM_TYPE_U8 = 1, TELEM_TYPE_U16, TELEM_TYPE_U32, TELEM_TYPE_I32, TELEM_TYPE_I64, TELEM_TYPE_F32, TELEM_TYPE_U64
+};
+
+// buffered rows
+struct TelemRows
+{
+    uint64_t clockIdentity[TELEM_ROW_GROUP];
+    uint32_t datagram[TELEM_ROW_GROUP];
+    uint8_t domainNumber[TELEM_ROW_GROUP];
+    uint16_t sequenceID[TELEM_ROW_GROUP];
+    uint32_t t1_s[TELEM_ROW_GROUP];
+    uint32_t t1_ns[TELEM_ROW_GROUP];
+    int64_t offset_ns[TELEM_ROW_GROUP];
+    int32_t delay_ns[TELEM_ROW_GROUP];
+    float corr_ppb[TELEM_ROW_GROUP];
+    uint32_t addend[TELEM_ROW_GROUP];
+    int32_t servoState[TELEM_ROW_GROUP];
+    uint8_t flags[TELEM_ROW_GROUP];
+    uint32_t cnt;
+};
+
+// column descriptor
+struct TelemColumn
+{
+    const char *pName; // column name
+    uint8_t type; // TELEM_TYPE_...
+    uint8_t size; // size of a value
+    size_t offset; // offset of the column array in TelemRows
+};
+
+#define TELEM_COLUMN(name, type, field) { name, type, sizeof(((struct TelemRows*) 0)->field[0]), offsetof(struct TelemRows, field) }
+
+static const struct TelemColumn spColumns[] = {
+    TELEM_COLUMN("clock_id", TELEM_TYPE_U64, clockIdentity),
+    TELEM_COLUMN("datagram", TELEM_TYPE_U32, datagram),
+    TELEM_COLUMN("domain", TELEM_TYPE_U8, domainNumber),
+    TELEM_COLUMN("sequence_id", TELEM_TYPE_U16, sequenceID),
+    TELEM_COLUMN("t1_s", TELEM_TYPE_U32, t1_s),
+    TELEM_COLUMN("t1_ns", TELEM_TYPE_U32, t1_ns),
+    TELEM_COLUMN("offset_ns", TELEM_TYPE_I64, offset_ns),
+    TELEM_COLUMN("delay_ns", TELEM_TYPE_I32, delay_ns),
+    TELEM_COLUMN("corr_ppb", TELEM_TYPE_F32, corr_ppb),
+    TELEM_COLUMN("addend", TELEM_TYPE_U32, addend),
+    TELEM_COLUMN("servo_state", TELEM_TYPE_I32, servoState),
+    TELEM_COLUMN("flags", TELEM_TYPE_U8, flags),
+};
+
+#define TELEM_COLUMN_CNT (sizeof(spColumns) / sizeof(spColumns[0]))
+
+// sender seen on the stream
+struct TelemSender
+{
+    uint64_t clockIdentity; // clockIdentity (network byte order)
+    uint32_t nextSequence; // expected datagram sequence number
+    uint32_t lost; // datagrams lost
+};
+
+static volatile sig_atomic_t sStop; // interrupted
+
+// --------------------------
+
+static void telem_on_signal(int sig)
+{
+    (void) sig;
+    sStop = 1;
+}
+
+// write columnar file header
+static void telem_write_col_header(FILE *pF)
+{
+    uint8_t pHdr[6] = { 'P', 'T', 'P', 'C', 1, TELEM_COLUMN_CNT };
+    fwrite(pHdr, 1, sizeof(pHdr), pF);
+
+    uint8_t i;
+    for (i = 0; i < TELEM_COLUMN_CNT; i++)
+    {
+        uint8_t pDesc[2] = { spColumns[i].type, strlen(spColumns[i].pName) };
+        fwrite(pDesc, 1, 2, pF);
+        fwrite(spColumns[i].pName, 1, pDesc[1], pF);
+    }
+}
+
+// write buffered rows as a row group (host is little-endian)
+static void telem_write_row_group(FILE *pF, struct TelemRows *pRows)
+{
+    if (pF == NULL || pRows->cnt == 0)
+    {
+        return;
+    }
+
+    fwrite(&pRows->cnt, 4, 1, pF);
+
+    uint8_t i;
+    for (i = 0; i < TELEM_COLUMN_CNT; i++)
+    {
+        fwrite((const uint8_t*) pRows + spColumns[i].offset, spColumns[i].size, pRows->cnt, pF);
+    }
+
+    pRows->cnt = 0;
+}
+
+// write record as a CSV line
+static void telem_write_csv(FILE *pF, const struct PTPTelemetryHeader *pHdr, const struct PTPTelemetryRecord *pRec)
+{
+    const uint8_t *pId = (const uint8_t*) &pHdr->clockIdentity;
+    fprintf(pF, "%02x%02x%02x%02x%02x%02x%02x%02x,%u,%u,%u,%u,%u,%lld,%d,%.3f,%u,%d,%u\n", pId[0], pId[1], pId[2], pId[3], pId[4], pId[5],
+            pId[6], pId[7], pHdr->sequence, pRec->domainNumber, pRec->sequenceID, pRec->t1_s, pRec->t1_ns, (long long) pRec->offset_ns,
+            pRec->delay_ns, pRec->corr_ppb, pRec->addend, pRec->servoState, pRec->flags);
+}
+
+int main(int argc, char *argv[])
+{
+    uint16_t port = PTP_TELEMETRY_PORT;
+    const char *pCsvName = NULL, *pColName = NULL;
+    uint64_t maxRecords = 0;
+
+    // process arguments
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-p") && i + 1 < argc)
+        {
+            port = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+        {
+            pCsvName = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+        {
+            pColName = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+        {
+            maxRecords = strtoull(argv[++i], NULL, 0);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-p port] [-c file.csv] [-o file.ptpc] [-n records]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // open outputs
+    FILE *pCsv = NULL, *pCol = NULL;
+    if (pCsvName != NULL)
+    {
+        pCsv = fopen(pCsvName, "w");
+        if (pCsv == NULL)
+        {
+            perror(pCsvName);
+            return 1;
+        }
+        fprintf(pCsv, "clock_id,datagram,domain,sequence_id,t1_s,t1_ns,offset_ns,delay_ns,corr_ppb,addend,servo_state,flags\n");
+    }
+
+    if (pColName != NULL)
+    {
+        pCol = fopen(pColName, "wb");
+        if (pCol == NULL)
+        {
+            perror(pColName);
+            return 1;
+        }
+        telem_write_col_header(pCol);
+    }
+
+    // open socket
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (sock < 0 || bind(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = telem_on_signal; // no SA_RESTART: recv() returns on interrupt
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    fprintf(stderr, "Listening on UDP port %u...\n", port);
+
+    // receive datagrams
+    static struct TelemRows rows;
+    static struct TelemSender pSenders[64];
+    uint32_t senderCnt = 0;
+    uint64_t records = 0, datagrams = 0, invalid = 0;
+    uint8_t pBuf[2048];
+
+    while (!sStop && (maxRecords == 0 || records < maxRecords))
+    {
+        ssize_t len = recv(sock, pBuf, sizeof(pBuf), 0);
+        if (len < 0)
+        {
+            continue;
+        }
+
+        struct PTPTelemetryHeader hdr;
+        if (!ptp_telemetry_decode_header(&hdr, pBuf, len))
+        {
+            invalid++;
+            continue;
+        }
+        datagrams++;
+
+        // detect lost datagrams per sender
+        uint32_t k;
+        for (k = 0; k < senderCnt && pSenders[k].clockIdentity != hdr.clockIdentity; k++)
+        {
+        }
+
+        if (k == senderCnt && senderCnt < sizeof(pSenders) / sizeof(pSenders[0]))
+        {
+            pSenders[senderCnt].clockIdentity = hdr.clockIdentity;
+            pSenders[senderCnt].nextSequence = hdr.sequence;
+            senderCnt++;
+        }
+
+        if (k < senderCnt)
+        {
+            pSenders[k].lost += hdr.sequence - pSenders[k].nextSequence;
+            pSenders[k].nextSequence = hdr.sequence + 1;
+        }
+
+        // store records
+        uint16_t r;
+        for (r = 0; r < hdr.recordCnt; r++)
+        {
+            struct PTPTelemetryRecord rec;
+            ptp_telemetry_decode(&rec, pBuf + PTP_TELEMETRY_HEADER_SIZE + r * hdr.recordSize);
+            records++;
+
+            if (pCsv != NULL)
+            {
+                telem_write_csv(pCsv, &hdr, &rec);
+            }
+
+            if (pCol != NULL)
+            {
+                uint32_t n = rows.cnt++;
+                rows.clockIdentity[n] = hdr.clockIdentity;
+                rows.datagram[n] = hdr.sequence;
+                rows.domainNumber[n] = rec.domainNumber;
+                rows.sequenceID[n] = rec.sequenceID;
+                rows.t1_s[n] = rec.t1_s;
+                rows.t1_ns[n] = rec.t1_ns;
+                rows.offset_ns[n] = rec.offset_ns;
+                rows.delay_ns[n] = rec.delay_ns;
+                rows.corr_ppb[n] = rec.corr_ppb;
+                rows.addend[n] = rec.addend;
+                rows.servoState[n] = rec.servoState;
+                rows.flags[n] = rec.flags;
+
+                if (rows.cnt == TELEM_ROW_GROUP)
+                {
+                    telem_write_row_group(pCol, &rows);
+                }
+            }
+        }
+    }
+
+    // flush outputs
+    telem_write_row_group(pCol, &rows);
+    if (pCol != NULL)
+    {
+        fclose(pCol);
+    }
+
+    if (pCsv != NULL)
+    {
+        fclose(pCsv);
+    }
+
+    close(sock);
+
+    // summary
+    fprintf(stderr, "Records: %llu, datagrams: %llu, invalid datagrams: %llu\n", (unsigned long long) records, (unsigned long long) datagrams,
+            (unsigned long long) invalid);
+    uint32_t k;
+    for (k = 0; k < senderCnt; k++)
+    {
+        const uint8_t *pId = (const uint8_t*) &pSenders[k].clockIdentity;
+        fprintf(stderr, "Sender %02x%02x%02x%02x%02x%02x%02x%02x: lost datagrams: %u\n", pId[0], pId[1], pId[2], pId[3], pId[4], pId[5], pId[6],
+                pId[7], pSenders[k].lost);
+    }
+
+    return 0;
+}
@@ -0,0 +1,22 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef HW_PORT_PTP_PORT_HOST_H_
+#define HW_PORT_PTP_PORT_HOST_H_
+
+#include <stdint.h>
+
+#include "timeutils.h"
+
+// Virtual timestamping hardware of the PC tools (implemented in host/host_port.c). The clock runs in the
+// virtual time of the calling thread, it advances only when the driving tool calls host_set_time().
+
+void ptphw_host_init(uint32_t increment, uint32_t addend); // initialize virtual clock
+void ptphw_host_update_clock(int32_t s, int32_t ns); // jump virtual clock
+void ptphw_host_set_addend(uint32_t addend); // tune virtual clock
+void ptphw_host_gettime(struct TimestampI * pTime); // read virtual clock
+uint32_t ptphw_host_cycle_counter(); // free running nanosecond counter of the PC
+uint32_t ptphw_host_nvs_init(); // open file-backed storage (see host_set_nvs_file()), returns its size in bytes (0: none)
+void ptphw_host_nvs_read(uint32_t addr, uint32_t * pWords, uint32_t size); // read storage (unwritten bytes read as 0xff)
+int ptphw_host_nvs_write(uint32_t addr, const uint32_t * pWords, uint32_t size); // write storage, returns 0 on success
+
+#endif /* HW_PORT_PTP_PORT_HOST_H_ */
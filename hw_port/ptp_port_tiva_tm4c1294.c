@@ -9,6 +9,16 @@
 #include "driverlib/gpio.h"
 #include "inc/hw_memmap.h"
 #include "driverlib/pin_map.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/eeprom.h"
+#include "inc/hw_types.h"
+
+// Cortex-M4 debug registers for cycle counting
+#define DEMCR (0xE000EDFC) // Debug Exception and Monitor Control Register
+#define DEMCR_TRCENA (1 << 24)
+#define DWT_CTRL (0xE0001000) // Data Watchpoint and Trace control register
+#define DWT_CTRL_CYCCNTENA (1 << 0)
+#define DWT_CYCCNT (0xE0001004) // cycle counter
 
 void ptphw_init(uint32_t increment, uint32_t addend) {
     // init clock
@@ -24,4 +34,45 @@ void ptphw_init(uint32_t increment, uint32_t addend) {
     GPIOPinTypePWM(GPIO_PORTG_AHB_BASE, GPIO_PIN_0);
     GPIOPinConfigure(GPIO_PG0_EN0PPS);
     EMACTimestampPPSSimpleModeSet(EMAC0_BASE, EMAC_PPS_1HZ);
+
+    // enable cycle counter
+    ptphw_cycle_counter_enable();
+}
+
+void ptphw_gettime(struct TimestampI * pTime) {
+    uint32_t s, ns;
+    EMACTimestampSysTimeGet(EMAC0_BASE, &s, &ns);
+    pTime->sec = s;
+    pTime->nanosec = ns;
+}
+
+void ptphw_cycle_counter_enable() {
+    // the counter is free running, it's never reset as others may be measuring intervals
+    HWREG(DEMCR) |= DEMCR_TRCENA;
+    HWREG(DWT_CTRL) |= DWT_CTRL_CYCCNTENA;
+}
+
+uint32_t ptphw_cycle_counter() {
+    return HWREG(DWT_CYCCNT);
+}
+
+uint32_t ptphw_nvs_init() {
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_EEPROM0);
+    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_EEPROM0)) {
+    }
+
+    // a failed init means an interrupted write could not be recovered, the EEPROM is not used then
+    if (EEPROMInit() != EEPROM_INIT_OK) {
+        return 0;
+    }
+
+    return EEPROMSizeGet();
+}
+
+void ptphw_nvs_read(uint32_t addr, uint32_t * pWords, uint32_t size) {
+    EEPROMRead(pWords, addr, size);
+}
+
+int ptphw_nvs_write(uint32_t addr, const uint32_t * pWords, uint32_t size) {
+    return (EEPROMProgram((uint32_t *) pWords, addr, size) == 0) ? 0 : -1;
 }
@@ -3,6 +3,16 @@
 #ifndef HW_PORT_PTP_PORT_TIVA_TM4C1294_C_
 #define HW_PORT_PTP_PORT_TIVA_TM4C1294_C_
 
+#include <stdint.h>
+
+#include "timeutils.h"
+
 void ptphw_init(); // initialize PTP hardware
+void ptphw_gettime(struct TimestampI * pTime); // read hardware clock
+void ptphw_cycle_counter_enable(); // enable CPU cycle counter
+uint32_t ptphw_cycle_counter(); // read CPU cycle counter
+uint32_t ptphw_nvs_init(); // initialize EEPROM, returns its size in bytes (0: unusable)
+void ptphw_nvs_read(uint32_t addr, uint32_t * pWords, uint32_t size); // read EEPROM (addr and size are multiples of 4)
+int ptphw_nvs_write(uint32_t addr, const uint32_t * pWords, uint32_t size); // program EEPROM (addr and size are multiples of 4), returns 0 on success
 
 #endif /* HW_PORT_PTP_PORT_TIVA_TM4C1294_C_ */
@@ -268,8 +268,8 @@
 //*****************************************************************************
 //#define LWIP_NETIF_HOSTNAME             0
 //#define LWIP_NETIF_API                  0
-//#define LWIP_NETIF_STATUS_CALLBACK        0
-//#define LWIP_NETIF_LINK_CALLBACK        0
+#define LWIP_NETIF_STATUS_CALLBACK      1           // default is 0
+#define LWIP_NETIF_LINK_CALLBACK        1           // default is 0
 //#define LWIP_NETIF_HWADDRHINT           0
 
 //*****************************************************************************
@@ -16,6 +16,14 @@
 // task management
 #include "tasks/user_tasks.h"
 
+// memory budget
+#include "sysmem.h"
+
+// memory of kernel tasks (handed over by the hooks below)
+static StaticTask_t sIdleTCB, sTimerTCB;
+static StackType_t spIdleStack[configMINIMAL_STACK_SIZE];
+static StackType_t spTimerStack[configTIMER_TASK_STACK_DEPTH];
+
 // global initialization
 void init() {
 	OSC_init(); // initializing oscillator
@@ -24,6 +32,9 @@ void init() {
 
 // task registration
 void reg_tasks() {
+	SYSMEM_register("Kernel idle", configIDLE_TASK_NAME, configMINIMAL_STACK_SIZE, sizeof(sIdleTCB));
+	SYSMEM_register("Kernel timers", configTIMER_SERVICE_TASK_NAME, configTIMER_TASK_STACK_DEPTH, sizeof(sTimerTCB));
+
 	reg_task_eth(); // registering eth task
 	reg_task_cli(); // registering cli task
 }
@@ -64,6 +75,20 @@ vApplicationStackOverflowHook(xTaskHandle *pxTask, char *pcTaskName)
     }
 }
 
+// memory of the idle task
+void vApplicationGetIdleTaskMemory(StaticTask_t **ppTCB, StackType_t **ppStack, uint32_t *pStackSize) {
+	*ppTCB = &sIdleTCB;
+	*ppStack = spIdleStack;
+	*pStackSize = configMINIMAL_STACK_SIZE;
+}
+
+// memory of the timer service task
+void vApplicationGetTimerTaskMemory(StaticTask_t **ppTCB, StackType_t **ppStack, uint32_t *pStackSize) {
+	*ppTCB = &sTimerTCB;
+	*ppStack = spTimerStack;
+	*pStackSize = configTIMER_TASK_STACK_DEPTH;
+}
+
 // runtime statistics...
 volatile unsigned long g_vulRunTimeStatsCountValue;
 
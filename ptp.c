@@ -1,79 +1,71 @@
 /* (C) András Wiesner, 2020 */
 
 #include "ptp.h"
+#include "ptp_bmca.h"
+#include "ptp_unicast.h"
+#include "ptp_master.h"
+#include "ptp_domain.h"
+#include "ptp_instance.h"
 #include "utils.h"
-#include "timers.h"
 
 #include "cli.h"
+#include "ptp_trace.h"
 
-// state machine states
-enum FSMState
-{
-    SIdle, SWaitFollowUp, SWaitDelayResp
-};
-
-// global state
-static struct
-{
-    enum FSMState state; // state
-    uint16_t sequenceID, delay_reqSequenceID; // last sequency IDs
-
-} sState;
-
-static struct SyncCycleData sSyncData; // full dataset for performing synchronization
-
-// PPS subsystem options
-static struct
-{
-    struct TimestampI offset; // PPS signal offset
-} sOptions;
-
-static struct PTPHeader sDelayReqHeader; // header for sending Delay_Reg messages
-static uint64_t sClockIdentity; // clockIdentity calculated from MAC address
-
-static struct ip_addr sDefPTPAddr;  // default PTP IP address
-static struct pbuf *spDelayReqPBuf; // TODO: ....
-static struct udp_pcb **spPCBs;     // PCBs for sending packets
-
-static TimerHandle_t sResponseTimer = NULL; // timer for sync dropout detection
+static struct PTPInstance *spCliInst; // instance the CLI commands operate on
 
 // --------------------------
 
-// logging
-static bool log_en = false;
-static bool log_corr = false;
-
 // enable/disable general logging
-void ptp_log_en(bool en)
+void ptp_log_en(struct PTPInstance *pInst, bool en)
 {
-    if (en && !log_en)
+    if (en && !pInst->logEn)
     {
         MSG("\n\nT1 [s] | T1 [ns] | T4 [s] | T4 [ns] | Dt [s] | Dt [ns] | Dt [tick] | Addend\n\n");
     }
 
-    log_en = en;
+    pInst->logEn = en;
 }
 
 // enable/disable logging of correction field values
-void ptp_log_corr_field_en(bool en)
+void ptp_log_corr_field_en(struct PTPInstance *pInst, bool en)
 {
-    log_corr = en;
+    pInst->logCorr = en;
 }
 
-// --------------------------
+// enable/disable binary tracing of synchronization cycles
+void ptp_log_trace_en(struct PTPInstance *pInst, bool en)
+{
+    if (en && !pInst->logTrace)
+    {
+        char pLine[PTP_TRACE_HEADER_LENGTH];
+        ptp_trace_format_header(pLine, PTP_ADDEND_CORR_PER_PPB_F);
+        MSG("%s\n", pLine);
+    }
 
-void ptp_reset();
-void ptp_reset_state(TimerHandle_t xTimer);
+    pInst->logTrace = en;
+}
 
 // --------------------------
 
 #define RESP_TIMEOUT (2000) // allowed maximal Delay_Resp response time
-void ptp_create_response_timer()
+
+// start deadline expiring after the given number of OS ticks
+static void ptp_deadline_arm(struct PTPDeadline *pDl, uint32_t now, uint32_t ticks)
 {
-    sResponseTimer = xTimerCreate("resptimer", pdMS_TO_TICKS(RESP_TIMEOUT), // timeout
-                                  false, // timer operates in single shot mode
-                                  (void*) 1, // ID
-                                  ptp_reset_state); // callback-function
+    pDl->tick = now + ticks;
+    pDl->armed = true;
+}
+
+// get OS ticks left until deadline (0: expired, portMAX_DELAY: not armed)
+static uint32_t ptp_deadline_remaining(const struct PTPDeadline *pDl, uint32_t now)
+{
+    if (!pDl->armed)
+    {
+        return portMAX_DELAY;
+    }
+
+    int32_t left = (int32_t) (pDl->tick - now);
+    return (left > 0) ? (uint32_t) left : 0;
 }
 
 // print clock identity
@@ -91,9 +83,9 @@ void ptp_print_clock_identity(uint64_t clockID)
 }
 
 // create clock identity based on MAC address
-void ptp_create_clock_identity()
+void ptp_create_clock_identity(struct PTPInstance *pInst)
 {
-    uint8_t *p = (uint8_t*) &sClockIdentity;
+    uint8_t *p = (uint8_t*) &pInst->clockIdentity;
     // construct clockIdentity
     memcpy(p, netif_default->hwaddr, 3); // first 3 octets of MAC address
     p[3] = 0xff;
@@ -101,7 +93,13 @@ void ptp_create_clock_identity()
     memcpy(&p[5], &netif_default->hwaddr[3], 3); // last 3 octets of MAC address
 
     // display ID
-    ptp_print_clock_identity(sClockIdentity);
+    ptp_print_clock_identity(pInst->clockIdentity);
+}
+
+// get own clockIdentity
+uint64_t ptp_get_clock_identity(const struct PTPInstance *pInst)
+{
+    return pInst->clockIdentity;
 }
 
 // clear flag structure
@@ -111,34 +109,93 @@ void ptp_clear_flags(struct PTPFlags *pFlags)
 }
 
 // initialize Delay_Req header
-void ptp_init_delay_req_header()
+void ptp_init_delay_req_header(struct PTPInstance *pInst, struct PTPHeader *pHeader, uint8_t domainNumber)
+{
+    pHeader->messageID = PTPIDDelay_Req;
+    pHeader->transportSpecific = 0;
+    pHeader->versionPTP = 2;     // PTPv2
+    pHeader->messageLength = 44;
+    pHeader->subdomainNumber = domainNumber;
+    ptp_clear_flags(&(pHeader->flags)); // no flags
+    pHeader->correction_ns = 0;
+    pHeader->correction_subns = 0;
+
+    memcpy(&pHeader->clockIdentity, &pInst->clockIdentity, 8);
+
+    pHeader->sourcePortID = 1;
+    pHeader->sequenceID = 0; // will change in every synch cycle
+    pHeader->control = PTPCONDelay_Req;
+    pHeader->logMessagePeriod = 0x7f;
+}
+
+// reset synchronization state of a domain (BMCA and servo are left intact)
+void ptp_reset_domain_sync(struct PTPDomain *pDomain)
 {
-    sDelayReqHeader.messageID = PTPIDDelay_Req;
-    sDelayReqHeader.transportSpecific = 0;
-    sDelayReqHeader.versionPTP = 2;     // PTPv2
-    sDelayReqHeader.messageLength = 44;
-    sDelayReqHeader.subdomainNumber = 0;
-    ptp_clear_flags(&(sDelayReqHeader.flags)); // no flags
-    sDelayReqHeader.correction_ns = 0;
-    sDelayReqHeader.correction_subns = 0;
+    pDomain->state = SIdle;
+    pDomain->offsetValid = false;
+    memset(&pDomain->decim, 0, sizeof(pDomain->decim));
+    pDomain->responseDeadline.armed = false;
+    pDomain->syncDeadline.armed = false;
+}
+
+// initialize a domain
+void ptp_init_domain(struct PTPInstance *pInst, struct PTPDomain *pDomain, uint8_t domainNumber)
+{
+    // release Delay_Req buffer of a previous run
+    if (pDomain->pDelayReqPBuf != NULL)
+    {
+        pbuf_free(pDomain->pDelayReqPBuf);
+        pDomain->pDelayReqPBuf = NULL;
+    }
+
+    pDomain->domainNumber = domainNumber;
+    pDomain->pStats = &pInst->stats;
+    pDomain->delay_reqSequenceID = 0;
+    ptp_init_delay_req_header(pInst, &pDomain->delayReqHeader, domainNumber);
+    ptp_reset_domain_sync(pDomain);
+    ptp_bmca_reset(&pDomain->bmca, domainNumber);
+    PTP_SERVO_RESET(&pDomain->servo);
+}
 
-    memcpy(&sDelayReqHeader.clockIdentity, &sClockIdentity, 8);
+// find tracked domain by domain number
+static struct PTPDomain* ptp_find_domain(struct PTPInstance *pInst, uint8_t domainNumber)
+{
+    uint8_t i;
+    for (i = 0; i < pInst->domainCnt; i++)
+    {
+        if (pInst->domains[i].domainNumber == domainNumber)
+        {
+            return &pInst->domains[i];
+        }
+    }
+
+    return NULL;
+}
 
-    sDelayReqHeader.sourcePortID = 1;
-    sDelayReqHeader.sequenceID = 0; // will change in every synch cycle
-    sDelayReqHeader.control = PTPCONDelay_Req;
-    sDelayReqHeader.logMessagePeriod = 0x7f;
+// reset receive and processing load counters
+void ptp_reset_load_counters(struct PTPInstance *pInst)
+{
+    memset(&pInst->load, 0, sizeof(pInst->load));
+    pInst->load.startTick = xTaskGetTickCount();
 }
 
-// create pbuf for sending Delay_Reqs
-void ptp_init_delay_req()
+// pass request to the task running the instance (the synchronization path is never changed under it)
+static void ptp_post_request(struct PTPInstance *pInst, const struct PTPRequest *pReq)
 {
-    spDelayReqPBuf = NULL;
+    if (pInst->pRequestHook != NULL)
+    {
+        pInst->pRequestHook(pInst, pReq);
+    }
+    else
+    {
+        ptp_handle_request(pInst, pReq);
+    }
 }
 
 static int CB_reset(const CliToken_Type *ppArgs, uint8_t argc)
 {
-    ptp_reset();
+    struct PTPRequest req = { PTPRQ_RESET };
+    ptp_post_request(spCliInst, &req);
     MSG("> PTP reset!\n");
     return 0;
 }
@@ -147,10 +204,10 @@ static int CB_offset(const CliToken_Type *ppArgs, uint8_t argc)
 {
     if (argc > 0)
     {
-        ptp_set_clock_offset(atoi(ppArgs[0]));
+        ptp_set_clock_offset(spCliInst, atoi(ppArgs[0]));
     }
 
-    MSG("> PTP clock offset: %d ns\n", ptp_get_clock_offset());
+    MSG("> PTP clock offset: %d ns\n", ptp_get_clock_offset(spCliInst));
     return 0;
 }
 
@@ -174,9 +231,11 @@ static int CB_log(const CliToken_Type *ppArgs, uint8_t argc)
         }
 
         if (!strcmp(ppArgs[0], "def")) {
-            ptp_log_en(logEn);
+            ptp_log_en(spCliInst, logEn);
         } else if (!strcmp(ppArgs[0], "corr")) {
-            ptp_log_corr_field_en(logEn);
+            ptp_log_corr_field_en(spCliInst, logEn);
+        } else if (!strcmp(ppArgs[0], "trace")) {
+            ptp_log_trace_en(spCliInst, logEn);
         } else {
             return -1;
         }
@@ -190,55 +249,275 @@ static int CB_log(const CliToken_Type *ppArgs, uint8_t argc)
     return 0;
 }
 
-// register cli commands
-static void ptp_register_cli_commands()
+static int CB_mode(const CliToken_Type *ppArgs, uint8_t argc)
 {
-    cli_register_command("ptp reset \t\t\tReset PTP subsystem", 2, 0, CB_reset);
-    cli_register_command("ptp servo offset [offset_ns] \t\t\tSet or query clock offset", 3, 0, CB_offset);
-    cli_register_command("ptp log {def|corr} {on|off} \t\t\tTurn on or off logging", 2, 2, CB_log);
+    static const char *spModeNames[] = { "mcast", "hybrid", "ucast" };
+
+    if (argc > 0)
+    {
+        uint8_t i;
+        for (i = 0; i < sizeof(spModeNames) / sizeof(spModeNames[0]); i++)
+        {
+            if (!strcmp(ppArgs[0], spModeNames[i]))
+            {
+                break;
+            }
+        }
+
+        if (i == sizeof(spModeNames) / sizeof(spModeNames[0]))
+        {
+            return -1;
+        }
+
+        struct PTPRequest req = { PTPRQ_SET_MODE };
+        req.mode = (enum PTPTransportMode) i;
+        ptp_post_request(spCliInst, &req);
+
+        MSG("> PTP transport mode: %s\n", spModeNames[i]);
+        return 0;
+    }
+
+    MSG("> PTP transport mode: %s\n", spModeNames[ptp_get_transport_mode(spCliInst)]);
+    return 0;
+}
+
+static int CB_decim(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    if (argc > 0)
+    {
+        int n = atoi(ppArgs[0]);
+        if (n < 1 || n > PTP_MAX_DECIMATION)
+        {
+            return -1;
+        }
+
+        struct PTPRequest req = { PTPRQ_SET_DECIMATION };
+        req.decimation = n;
+        ptp_post_request(spCliInst, &req);
+
+        MSG("> Servo decimation: %u Follow_Up(s)/servo run\n", n);
+        return 0;
+    }
+
+    MSG("> Servo decimation: %u Follow_Up(s)/servo run\n", ptp_get_decimation(spCliInst));
+    return 0;
+}
+
+static int CB_load(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPInstance *pInst = spCliInst;
+
+    if (argc > 0 && !strcmp(ppArgs[0], "reset"))
+    {
+        struct PTPRequest req = { PTPRQ_RESET_LOAD };
+        ptp_post_request(pInst, &req);
+        return 0;
+    }
+
+    float elapsed = (xTaskGetTickCount() - pInst->load.startTick) / (float) configTICK_RATE_HZ;
+    if (elapsed <= 0)
+    {
+        return 0;
+    }
+
+    char pL[96];
+    sprintf(pL, "%.1f s, %.2f pkt/s, %.1f B/s, CPU: %.4f %%", elapsed, pInst->load.rxPackets / elapsed, pInst->load.rxBytes / elapsed,
+            (100.0f * pInst->load.cycles) / (elapsed * PTP_CYCLE_FREQ_HZ));
+    MSG("> PTP load: %s\n", pL);
+    MSG("> Packets: %u, cycles/packet: %u\n", pInst->load.rxPackets, pInst->load.rxPackets ? (uint32_t) (pInst->load.cycles / pInst->load.rxPackets) : 0);
+
+    return 0;
+}
+
+static int CB_stats(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    if (argc > 0 && !strcmp(ppArgs[0], "reset"))
+    {
+        struct PTPRequest req = { PTPRQ_RESET_STATS };
+        ptp_post_request(spCliInst, &req);
+        return 0;
+    }
+
+    ptp_stats_print(&spCliInst->stats);
+    return 0;
+}
+
+static int CB_metrics(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    if (argc > 0 && !strcmp(ppArgs[0], "reset"))
+    {
+        struct PTPRequest req = { PTPRQ_RESET_METRICS };
+        ptp_post_request(spCliInst, &req);
+        return 0;
+    }
+
+    ptp_metrics_print(&spCliInst->metrics);
+    return 0;
+}
+
+static int CB_evlog(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    ptp_evlog_print_status(&spCliInst->evlog);
+    return 0;
+}
+
+static int CB_memory(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    const struct PTPInstance *pInst = spCliInst;
+
+    // every buffer of the engine is part of the instance, its size is fixed at build time
+    MSG("> PTP instance: %u B\n", sizeof(*pInst));
+    MSG("> Domains: %u B (%u x %u B, BMCA and servo included)\n", sizeof(pInst->domains), PTP_MAX_DOMAINS, sizeof(pInst->domains[0]));
+    MSG("> Statistics: %u B, metrics: %u B, event log: %u B\n", sizeof(pInst->stats), sizeof(pInst->metrics), sizeof(pInst->evlog));
+    MSG("> Capture: %u B, telemetry: %u B\n", sizeof(pInst->capture), sizeof(pInst->telemetry));
+    MSG("> Unicast: %u B, master: %u B, frequency store: %u B\n", sizeof(pInst->unicast), sizeof(pInst->master), sizeof(pInst->freqStore));
+
+    return 0;
+}
+
+static int CB_bmca(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPInstance *pInst = spCliInst;
+    uint8_t i;
+    for (i = 0; i < pInst->domainCnt; i++)
+    {
+        MSG("Domain %u:\n", pInst->domains[i].domainNumber);
+        ptp_bmca_print(&pInst->domains[i].bmca);
+    }
+
+    return 0;
+}
+
+static int CB_domain(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    static const char *spStateNames[] = { "idle", "wait Follow_Up", "wait Delay_Resp" };
+    struct PTPInstance *pInst = spCliInst;
+
+    // set tracked domains (domains are reinitialized by the PTP task)
+    if (argc > 0)
+    {
+        struct PTPRequest req = { PTPRQ_SET_DOMAINS };
+        MSG("> Tracking domain(s):");
+        for (req.domainCnt = 0; req.domainCnt < argc && req.domainCnt < PTP_MAX_DOMAINS; req.domainCnt++)
+        {
+            req.pDomainNumbers[req.domainCnt] = atoi(ppArgs[req.domainCnt]);
+            MSG(" %u", req.pDomainNumbers[req.domainCnt]);
+        }
+        MSG("\n");
+
+        ptp_post_request(pInst, &req);
+        return 0;
+    }
+
+    // print domain states
+    uint8_t i;
+    for (i = 0; i < pInst->domainCnt; i++)
+    {
+        const struct PTPDomain *pDomain = &pInst->domains[i];
+        MSG("%c domain %u: %s, ", (i == pInst->activeDomain) ? '*' : ' ', pDomain->domainNumber, spStateNames[pDomain->state]);
+        if (ptp_domain_is_usable(pDomain))
+        {
+            MSG("offset: %d ns, support: %u\n", (int32_t) pDomain->offset_ns, pDomain->support);
+        }
+        else
+        {
+            MSG("no valid offset\n");
+        }
+    }
+
+    return 0;
+}
+
+// cli commands (sorted)
+static const struct CliCommand spCliCmds[] = {
+    { "ptp bmca", "\t\t\tPrint foreign master tables (*: parent, Q: qualified)", 0, CB_bmca },
+    { "ptp domain", "[d0 d1 d2] \t\t\tSet or query tracked domains (*: drives the clock)", 0, CB_domain },
+    { "ptp evlog", "\t\t\tPrint event log counters", 0, CB_evlog },
+    { "ptp load", "[reset] \t\t\tPrint or reset receive and CPU load counters", 0, CB_load },
+    { "ptp log", "{def|corr|trace} {on|off} \t\t\tTurn on or off logging", 2, CB_log },
+    { "ptp memory", "\t\t\tPrint memory used by the parts of the PTP instance", 0, CB_memory },
+    { "ptp metrics", "[reset] \t\t\tPrint or reset offset and path delay statistics, ADEV, TDEV and MTIE", 0, CB_metrics },
+    { "ptp mode", "[mcast|hybrid|ucast] \t\t\tSet or query transport mode", 0, CB_mode },
+    { "ptp reset", "\t\t\tReset PTP subsystem", 0, CB_reset },
+    { "ptp servo decim", "[n] \t\t\tSet or query number of Follow_Ups averaged per servo run (1: full cycle per Sync)", 0, CB_decim },
+    { "ptp servo offset", "[offset_ns] \t\t\tSet or query clock offset", 0, CB_offset },
+    { "ptp stats", "[reset] \t\t\tPrint or reset message counters and timing histograms", 0, CB_stats },
+};
+
+static struct CliCommandTable sCliTable = CLI_COMMAND_TABLE(spCliCmds);
+
+// register cli commands operating on the passed instance
+void ptp_register_cli_commands(struct PTPInstance *pInst)
+{
+    spCliInst = pInst;
+
+    cli_register_table(&sCliTable);
+
+    ptp_unicast_register_cli_commands(&pInst->unicast);
+    ptp_master_register_cli_commands(&pInst->master);
+    ptp_capture_register_cli_commands(&pInst->capture);
+    ptp_telemetry_register_cli_commands(&pInst->telemetry);
+    ptp_freqstore_register_cli_commands(&pInst->freqStore);
+}
+
+// get event log of an instance (records are consumed by the drain task)
+struct PTPEventLog* ptp_get_event_log(struct PTPInstance *pInst)
+{
+    return &pInst->evlog;
+}
+
+// get memory needed for an instance
+size_t ptp_instance_size()
+{
+    return sizeof(struct PTPInstance);
+}
+
+// allocate instance from arena, the instance is zero-filled (defaults)
+struct PTPInstance* ptp_create_instance(struct PTPArena *pArena)
+{
+    return (struct PTPInstance*) ptp_arena_alloc(pArena, sizeof(struct PTPInstance));
 }
 
 // initialize PTP module
-void ptp_init(struct udp_pcb *pPCBs[])
+void ptp_init(struct PTPInstance *pInst, struct udp_pcb *pPCBs[])
 {
     // create clock identity
-    ptp_create_clock_identity();
+    ptp_create_clock_identity(pInst);
 
     // seed the randomizer
-    srand(sClockIdentity);
+    srand(pInst->clockIdentity);
 
-    // create pbuf used to send Delay_Reqs
-    ptp_init_delay_req();
+    // fill in default destination IP address
+    pInst->defPTPAddr.addr = ipaddr_addr(PTP_IGMP_DEFAULT);
 
-    // construct header for sending Delay_Req messages
-    ptp_init_delay_req_header();
+    pInst->pPCBs = pPCBs;
 
-    // fill in default destination IP address
-    sDefPTPAddr.addr = ipaddr_addr(PTP_IGMP_DEFAULT);
+    // reset options
+    pInst->options.offset.nanosec = 0;
 
-    spPCBs = pPCBs;
+    // initialize unicast negotiation
+    ptp_unicast_init(&pInst->unicast, pPCBs, pInst->clockIdentity);
+    ptp_unicast_enable(&pInst->unicast, pInst->options.mode == PTPTM_UNICAST);
 
-    // reset state machine to IDLE
-    sState.state = SIdle;
-    sState.delay_reqSequenceID = 0;
+    // set sender identity of the telemetry stream
+    ptp_telemetry_init(&pInst->telemetry, pInst->clockIdentity);
 
-    // reset options
-    sOptions.offset.nanosec = 0;
+    // reset load counters and statistics
+    ptp_reset_load_counters(pInst);
+    ptp_stats_reset(&pInst->stats);
+    ptp_metrics_reset(&pInst->metrics);
 
-    // initialize hardware
-    PTP_HW_INIT(PTP_INCREMENT_NSEC, PTP_ADDEND_INIT);
+    // load learned oscillator frequency
+    ptp_freqstore_init(&pInst->freqStore);
+
+    // initialize hardware (clock starts on the learned frequency if there's one)
+    PTP_HW_INIT(PTP_INCREMENT_NSEC, ptp_freqstore_get_addend(&pInst->freqStore, PTP_ADDEND_INIT));
 
     // initialize controller
     PTP_SERVO_INIT();
 
-    // reset PTP subsystem
-    ptp_reset();
-
-    // create droup detecting timer
-    ptp_create_response_timer();
-
-    // register cli commands
-    ptp_register_cli_commands();
+    // reset PTP subsystem (domains are initialized here)
+    ptp_reset(pInst);
 }
 
 // Network->Host byte order conversion for 64-bit values
@@ -273,6 +552,30 @@ void ptp_load_flags(struct PTPFlags *pFlags, uint16_t bitfield)
     pFlags->PTP_LI_61 = (bitfield >> 0) & 1;
 }
 
+// store ptp flags into bitfield
+uint16_t ptp_write_flags(struct PTPFlags *pFlags)
+{
+    uint16_t bitfield = 0;
+
+    bitfield |= pFlags->PTP_SECURITY << 15;
+    bitfield |= pFlags->PTP_ProfileSpecific_2 << 14;
+    bitfield |= pFlags->PTP_ProfileSpecific_1 << 13;
+
+    bitfield |= pFlags->PTP_UNICAST << 10;
+    bitfield |= pFlags->PTP_TWO_STEP << 9;
+    bitfield |= pFlags->PTP_ALTERNATE_MASTER << 8;
+
+    bitfield |= pFlags->FREQUENCY_TRACEABLE << 5;
+    bitfield |= pFlags->TIME_TRACEABLE << 4;
+
+    bitfield |= pFlags->PTP_TIMESCALE << 3;
+    bitfield |= pFlags->PTP_UTC_REASONABLE << 2;
+    bitfield |= pFlags->PTP_LI_59 << 1;
+    bitfield |= pFlags->PTP_LI_61 << 0;
+
+    return bitfield;
+}
+
 // extract fields from a PTP header
 void ptp_extract_header(struct PTPHeader *pHeader, void *pPayload)
 {
@@ -320,8 +623,8 @@ void ptp_construct_binary_header(void *pData, struct PTPHeader *pHeader)
     uint16_t sourcePortID = htons(pHeader->sourcePortID);
     uint16_t sequenceID = htons(pHeader->sequenceID);
 
-    // fill in flags FIXME
-    uint16_t flags = 0; // TODO: convert from header fields
+    // fill in flags
+    uint16_t flags = htons(ptp_write_flags(&pHeader->flags));
 
     // fill in correction value
     uint64_t correction = htonll((pHeader->correction_ns << 16) | (pHeader->correction_subns)); // TODO: ...
@@ -341,8 +644,6 @@ void ptp_construct_binary_header(void *pData, struct PTPHeader *pHeader)
     memcpy(p + 33, &pHeader->logMessagePeriod, 1);
 }
 
-#define PTP_HEADER_LENGTH (34)
-
 // extract n timestamps from a message
 void ptp_extract_timestamps(struct TimestampI *ts, void *pPayload, uint8_t n)
 {
@@ -395,31 +696,91 @@ void ptp_write_binary_timestamps(void *pPayload, struct TimestampI *ts, uint8_t
     }
 }
 
-// construct and send Delay_Req message (NON-REENTRANT!)
-void ptp_send_delay_req_message()
+// get Delay_Req destination according to transport mode (NULL: default multicast address)
+static const struct ip_addr* ptp_get_delay_req_addr(const struct PTPInstance *pInst, const struct PTPDomain *pDomain)
 {
-    static struct TimestampI timestamp = { 0, 0 }; // timestamp appended at the end of packet
+    const struct PTPForeignMaster *pParent;
+
+    switch (pInst->options.mode)
+    {
+    case PTPTM_HYBRID:
+        return &pDomain->syncSrcAddr;
+    case PTPTM_UNICAST:
+        pParent = ptp_bmca_get_parent(&pDomain->bmca);
+        return (pParent != NULL) ? &pParent->addr : NULL;
+    default:
+        return NULL;
+    }
+}
+
+// construct and send Delay_Req message
+void ptp_send_delay_req_message(struct PTPInstance *pInst, struct PTPDomain *pDomain)
+{
+    struct TimestampI timestamp = { 0, 0 }; // timestamp appended at the end of packet
+    struct PTPHeader *pHeader = &pDomain->delayReqHeader;
 
     // release buffer if in use
-    if (spDelayReqPBuf != NULL)
+    if (pDomain->pDelayReqPBuf != NULL)
     {
-        pbuf_free(spDelayReqPBuf);
+        pbuf_free(pDomain->pDelayReqPBuf);
     }
 
     // allocate pbuf
-    spDelayReqPBuf = pbuf_alloc(PBUF_TRANSPORT, PTP_DELAY_REQ_PCKT_SIZE, PBUF_RAM);
+    pDomain->pDelayReqPBuf = pbuf_alloc(PBUF_TRANSPORT, PTP_DELAY_REQ_PCKT_SIZE, PBUF_RAM);
+    if (pDomain->pDelayReqPBuf == NULL)
+    {
+        pInst->stats.txFailed++;
+        return;
+    }
 
     // increment sequenceID
-    sDelayReqHeader.sequenceID = ++sState.delay_reqSequenceID;
+    pHeader->sequenceID = ++pDomain->delay_reqSequenceID;
+
+    // Delay_Req goes to the master directly in hybrid and unicast modes
+    const struct ip_addr *pDestAddr = ptp_get_delay_req_addr(pInst, pDomain);
+    pHeader->flags.PTP_UNICAST = (pDestAddr != NULL);
+    if (pDestAddr == NULL)
+    {
+        pDestAddr = &pInst->defPTPAddr;
+    }
 
     // fill in header
-    ptp_construct_binary_header(spDelayReqPBuf->payload, &sDelayReqHeader);
+    ptp_construct_binary_header(pDomain->pDelayReqPBuf->payload, pHeader);
 
     // fill in timestamp
-    ptp_write_binary_timestamps(spDelayReqPBuf->payload, &timestamp, 1);
+    ptp_write_binary_timestamps(pDomain->pDelayReqPBuf->payload, &timestamp, 1);
+
+    // capture frame (timestamp is filled in once known)
+    pDomain->delayReqFrameNo = ptp_capture_frame(&pInst->capture, PTPCDTx, pDomain->pDelayReqPBuf, &netif_default->ip_addr, pDestAddr);
 
     // send message
-    udp_sendto(spPCBs[0], spDelayReqPBuf, &sDefPTPAddr, PTP_PORT0);
+    udp_sendto(pInst->pPCBs[0], pDomain->pDelayReqPBuf, (struct ip_addr*) pDestAddr, PTP_PORT0);
+    pInst->stats.txDelayReq++;
+}
+
+// extract Announce message body
+void ptp_extract_announce_body(struct PTPAnnounceBody *pAnn, void *pPayload)
+{
+    uint8_t *p = (uint8_t*) pPayload;
+
+    // origin timestamp
+    ptp_extract_timestamps(&pAnn->originTimestamp, pPayload, 1);
+
+    // copy fields
+    memcpy(&pAnn->currentUTCOffset, p + 44, 2);
+    memcpy(&pAnn->priority1, p + 47, 1);
+    memcpy(&pAnn->grandmasterClockQuality.clockClass, p + 48, 1);
+    memcpy(&pAnn->grandmasterClockQuality.clockAccuracy, p + 49, 1);
+    memcpy(&pAnn->grandmasterClockQuality.offsetScaledLogVariance, p + 50, 2);
+    memcpy(&pAnn->priority2, p + 52, 1);
+    memcpy(&pAnn->grandmasterClockIdentity, p + 53, 8); // kept in network byte order like every clockIdentity
+    memcpy(&pAnn->localStepsRemoved, p + 61, 2);
+    memcpy(&pAnn->timeSource, p + 63, 1);
+
+    // network->host
+    pAnn->currentUTCOffset = ntohs(pAnn->currentUTCOffset);
+    pAnn->grandmasterClockQuality.offsetScaledLogVariance = ntohs(pAnn->grandmasterClockQuality.offsetScaledLogVariance);
+    pAnn->localStepsRemoved = ntohs(pAnn->localStepsRemoved);
 }
 
 // extract Delay_Resp data
@@ -434,104 +795,721 @@ void ptp_read_delay_resp_id_data(struct Delay_RespIdentification *pDRData, void
 }
 
 // set PPS offset
-void ptp_set_clock_offset(int32_t offset)
+void ptp_set_clock_offset(struct PTPInstance *pInst, int32_t offset)
 {
-    nsToTsI(&sOptions.offset, offset);
+    nsToTsI(&pInst->options.offset, offset);
 }
 
 // get PPS offset
-int32_t ptp_get_clock_offset()
+int32_t ptp_get_clock_offset(struct PTPInstance *pInst)
 {
-    return nsI(&sOptions.offset);
+    return nsI(&pInst->options.offset);
 }
 
-// value of addend register
-static uint32_t addend;
+// set transport mode
+void ptp_set_transport_mode(struct PTPInstance *pInst, enum PTPTransportMode mode)
+{
+    pInst->options.mode = mode;
+    ptp_unicast_enable(&pInst->unicast, mode == PTPTM_UNICAST);
+    ptp_master_set_multicast(&pInst->master, mode != PTPTM_UNICAST);
+}
+
+// set number of Follow_Ups averaged per servo run
+void ptp_set_decimation(struct PTPInstance *pInst, uint8_t n)
+{
+    pInst->options.decimation = n;
+
+    // restart synchronization in the new operation
+    uint8_t i;
+    for (i = 0; i < pInst->domainCnt; i++)
+    {
+        ptp_reset_domain_sync(&pInst->domains[i]);
+    }
+}
+
+// get number of Follow_Ups averaged per servo run
+uint8_t ptp_get_decimation(const struct PTPInstance *pInst)
+{
+    return (pInst->options.decimation > 1) ? pInst->options.decimation : 1;
+}
+
+// get transport mode
+enum PTPTransportMode ptp_get_transport_mode(const struct PTPInstance *pInst)
+{
+    return pInst->options.mode;
+}
+
+// route requests of the CLI through the PTP task
+void ptp_set_request_hook(struct PTPInstance *pInst, fnPTPRequestHook pHook)
+{
+    pInst->pRequestHook = pHook;
+}
+
+// apply request (in the task running the instance)
+void ptp_handle_request(struct PTPInstance *pInst, const struct PTPRequest *pReq)
+{
+    switch (pReq->code)
+    {
+    case PTPRQ_RESET:
+        ptp_reset(pInst);
+        break;
+    case PTPRQ_SET_DOMAINS:
+        memcpy(pInst->options.pDomainNumbers, pReq->pDomainNumbers, sizeof(pInst->options.pDomainNumbers));
+        pInst->options.domainCnt = pReq->domainCnt;
+        ptp_reset(pInst);
+        break;
+    case PTPRQ_SET_DECIMATION:
+        ptp_set_decimation(pInst, pReq->decimation);
+        break;
+    case PTPRQ_RESET_METRICS:
+        ptp_metrics_reset(&pInst->metrics);
+        break;
+    case PTPRQ_RESET_STATS:
+        ptp_stats_reset(&pInst->stats);
+        break;
+    case PTPRQ_SET_MODE:
+        ptp_set_transport_mode(pInst, pReq->mode);
+        break;
+    case PTPRQ_RESET_LOAD:
+        ptp_reset_load_counters(pInst);
+        break;
+    }
+}
 
 // reset PTP subsystem
-void ptp_reset()
+void ptp_reset(struct PTPInstance *pInst)
 {
-    // reset state machine
-    sState.state = SIdle;
-    sState.delay_reqSequenceID = 0;
+    // (re)initialize tracked domains
+    if (pInst->options.domainCnt == 0)
+    {
+        pInst->options.pDomainNumbers[0] = 0;
+        pInst->options.domainCnt = 1;
+    }
+
+    uint8_t i;
+    for (i = 0; i < pInst->options.domainCnt; i++)
+    {
+        ptp_init_domain(pInst, &pInst->domains[i], pInst->options.pDomainNumbers[i]);
+    }
+
+    pInst->domainCnt = pInst->options.domainCnt;
+    pInst->activeDomain = 0;
 
-    // reset addend to initial value
-    addend = PTP_ADDEND_INIT;
+    // master serves the first tracked domain
+    ptp_master_init(&pInst->master, pInst->pPCBs, pInst->clockIdentity, pInst->domains[0].domainNumber);
+    ptp_master_set_multicast(&pInst->master, pInst->options.mode != PTPTM_UNICAST);
 
-    // reset controller
-    PTP_SERVO_RESET();
+    // reset addend to initial value (the learned one if stored)
+    pInst->addend = ptp_freqstore_get_addend(&pInst->freqStore, PTP_ADDEND_INIT);
 }
 
-// perform clock correction based on gathered timestamps (NON-REENTRANT!)
-void ptp_perform_correction()
+// pause transport on link loss
+void ptp_pause(struct PTPInstance *pInst)
 {
-    // timestamps and time intervals
-    struct TimestampI d, syncMa, syncSl, delReqSl, delReqMa;
+    if (pInst->transport.paused)
+    {
+        return;
+    }
+
+    // cycles in progress won't complete, the clock keeps running on the learned addend meanwhile
+    uint8_t i;
+    for (i = 0; i < pInst->domainCnt; i++)
+    {
+        ptp_reset_domain_sync(&pInst->domains[i]);
+    }
 
-    // copy timestamps to assign then with meaningful names
-    syncMa = sSyncData.t1;
-    syncSl = sSyncData.t2;
-    delReqSl = sSyncData.t3;
-    delReqMa = sSyncData.t4;
+    pInst->transport.paused = true;
+    pInst->transport.pauseTick = xTaskGetTickCount();
+    pInst->transport.relockPending = false;
 
-    // compute difference between master and slave clock
-    subTime(&d, &syncSl, &syncMa); // t2 - t1 ...
-    subTime(&d, &d, &delReqMa); // - t4 ...
-    addTime(&d, &d, &delReqSl); // + t3
-    divTime(&d, &d, 2); // division by 2
+    MSG("PTP transport paused (addend: %u)\n", pInst->addend);
+}
+
+// resume transport paused by ptp_pause()
+void ptp_resume(struct PTPInstance *pInst)
+{
+    if (!pInst->transport.paused)
+    {
+        return;
+    }
+
+    pInst->transport.paused = false;
+    pInst->transport.resumeTick = xTaskGetTickCount();
+    pInst->transport.relockPending = true;
 
-    // substract offset
-    subTime(&d, &d, &sOptions.offset);
+    // foreign masters didn't have the chance to announce, they are given their full receipt timeout again
+    uint8_t i;
+    for (i = 0; i < pInst->domainCnt; i++)
+    {
+        ptp_bmca_skip_pause(&pInst->domains[i].bmca, pInst->transport.resumeTick - pInst->transport.pauseTick);
+    }
+
+    MSG("PTP transport resumed after %u ms\n", (pInst->transport.resumeTick - pInst->transport.pauseTick) * 1000 / configTICK_RATE_HZ);
+}
 
-    // normalize time difference (eliminate malformed time value issues)
-    normTime(&d);
+// is transport paused?
+bool ptp_is_paused(const struct PTPInstance *pInst)
+{
+    return pInst->transport.paused;
+}
+
+// note OS tick of link-up
+void ptp_mark_link_up(struct PTPInstance *pInst, uint32_t linkUpTick)
+{
+    pInst->transport.linkUpTick = linkUpTick;
+    pInst->transport.firstSyncPending = true;
+}
+
+// restart synchronization after the parent has changed (addend is kept)
+void ptp_handle_parent_change(struct PTPDomain *pDomain)
+{
+    ptp_reset_domain_sync(pDomain);
+    PTP_SERVO_RESET(&pDomain->servo);
+}
+
+// run domain voting and log switchovers
+static void ptp_select_active_domain(struct PTPInstance *pInst)
+{
+    int active = ptp_domain_vote(pInst->domains, pInst->domainCnt, pInst->activeDomain);
+    if (active != pInst->activeDomain)
+    {
+        struct TimestampI t;
+        PTP_HW_GET_TIME(&t);
+        MSG("[%u.%09u] Domain switchover: %u -> %u (support: %u -> %u)\n", (uint32_t) t.sec, t.nanosec, pInst->domains[pInst->activeDomain].domainNumber,
+            pInst->domains[active].domainNumber, pInst->domains[pInst->activeDomain].support, pInst->domains[active].support);
+
+        pInst->activeDomain = active;
+    }
+}
+
+// copy timestamp into event log format
+static void ptp_log_time(struct PTPEvLogTime *pT, const struct TimestampI *pTs)
+{
+    pT->sec = (int32_t) pTs->sec;
+    pT->nanosec = pTs->nanosec;
+}
+
+// write synchronization cycle record into the event log
+static void ptp_log_cycle(struct PTPInstance *pInst, const struct PTPDomain *pDomain, const struct TimestampI *pD, int32_t d_ticks, uint32_t addendPrev,
+                          uint8_t flags)
+{
+    struct PTPEvLogRecord *pRec = ptp_evlog_reserve(&pInst->evlog);
+    if (pRec == NULL)
+    {
+        return; // ring is full, overflow has been counted
+    }
+
+    ptp_log_time(&pRec->t[0], &pDomain->syncData.t1);
+    ptp_log_time(&pRec->t[1], &pDomain->syncData.t2);
+    ptp_log_time(&pRec->t[2], &pDomain->syncData.t3);
+    ptp_log_time(&pRec->t[3], &pDomain->syncData.t4);
+    ptp_log_time(&pRec->offset, pD);
+    pRec->offsetTicks = d_ticks;
+    pRec->addendPrev = addendPrev;
+    pRec->addend = pInst->addend;
+    pRec->ppsOffset = pInst->options.offset.nanosec;
+    pRec->corrFollowUp = pDomain->syncData.corrFollowUp;
+    pRec->corrDelayResp = pDomain->syncData.corrDelayResp;
+    pRec->sequenceID = pDomain->sequenceID;
+    pRec->domainNumber = pDomain->domainNumber;
+    pRec->flags = flags | (pInst->logEn ? PTP_EVLOG_FLAG_LOG_DEF : 0) | (pInst->logCorr ? PTP_EVLOG_FLAG_LOG_CORR : 0)
+            | (pInst->logTrace ? PTP_EVLOG_FLAG_LOG_TRACE : 0);
+
+    ptp_evlog_commit(&pInst->evlog);
+}
+
+// append synchronization cycle to the telemetry stream
+static void ptp_stream_cycle(struct PTPInstance *pInst, const struct PTPDomain *pDomain, struct TimestampI *pD, uint8_t flags)
+{
+    if (!ptp_telemetry_is_enabled(&pInst->telemetry))
+    {
+        return;
+    }
+
+    struct TimestampI delay;
+    ptp_corr_mean_path_delay(&delay, &pDomain->syncData);
+
+    struct PTPTelemetryRecord rec;
+    rec.offset_ns = nsI(pD);
+    rec.t1_s = (uint32_t) pDomain->syncData.t1.sec;
+    rec.t1_ns = pDomain->syncData.t1.nanosec;
+    rec.delay_ns = (int32_t) nsI(&delay);
+    rec.corr_ppb = (flags & PTP_TELEMETRY_FLAG_COARSE) ? 0 : pDomain->corr_ppb;
+    rec.addend = pInst->addend;
+    rec.servoState = PTP_SERVO_GET_STATE(&pDomain->servo);
+    rec.sequenceID = pDomain->sequenceID;
+    rec.domainNumber = pDomain->domainNumber;
+    rec.flags = flags;
+
+    ptp_telemetry_add(&pInst->telemetry, &rec, pInst->pPCBs[1]);
+}
+
+// account time elapsed since the reception of the message completing a servo input
+static void ptp_account_rx_to_servo(struct PTPInstance *pInst, const struct pbuf *pPBuf)
+{
+    struct TimestampI now, rxTime = { pPBuf->time_s, pPBuf->time_ns };
+    PTP_HW_GET_TIME(&now);
+    subTime(&now, &now, &rxTime);
+    normTime(&now);
+    if (now.sec >= 0 && now.nanosec >= 0)
+    {
+        ptp_stats_hist_add(&pInst->stats.rxToServoNs, (now.sec > 0) ? 0xffffffff : (uint32_t) now.nanosec);
+    }
+}
+
+// steer the clock by the passed master - slave time difference (decimated: difference is not derived from t1..t4 alone)
+static void ptp_apply_correction(struct PTPInstance *pInst, struct PTPDomain *pDomain, struct TimestampI *pD, bool decimated)
+{
+    struct TimestampI d = *pD;
+    uint32_t addendPrev = pInst->addend;
 
     // translate time difference into clock tick unit
     int32_t d_ticks = tsToTick(&d, PTP_CLOCK_TICK_FREQ_HZ);
 
+    // store offset estimate of the domain
+    pDomain->offset_ns = nsI(&d);
+    pDomain->offsetTick = xTaskGetTickCount();
+    pDomain->offsetValid = true;
+
+    // only the active domain steers the clock
+    bool active = (pDomain == &pInst->domains[pInst->activeDomain]);
+    bool coarse = (d.sec != 0);
+
     // if time difference is at least one second, then jump the clock
-    if (d.sec != 0)
+    if (coarse)
+    {
+        if (active)
+        {
+            PTP_UPDATE_CLOCK(d.sec, d.nanosec); // jump the clock by difference
+
+            MSG("Time difference is over 1s, performing coarse correction!\n");
+        }
+    }
+    else
+    {
+        // run controller (inactive domains run their servo too, so that they can take over smoothly)
+        float corr_ppb = PTP_SERVO_RUN(&pDomain->servo, nsI(&d));
+        pDomain->corr_ppb = corr_ppb;
+
+        if (active)
+        {
+            // feed quality metrics with the time error and the mean path delay
+            struct TimestampI delay;
+            ptp_corr_mean_path_delay(&delay, &pDomain->syncData);
+            ptp_metrics_add(&pInst->metrics, nsI(&d), nsI(&delay), xTaskGetTickCount());
+
+            // compute addend value
+            pInst->addend = ptp_corr_tune_addend(pInst->addend, corr_ppb, PTP_ADDEND_CORR_PER_PPB_F);
+
+            // write addend into hardware
+            PTP_SET_ADDEND(pInst->addend);
+
+            // report time needed to get back in sync after a link loss
+            if (pInst->transport.relockPending && nsI(&d) > -PTP_RELOCK_NS && nsI(&d) < PTP_RELOCK_NS)
+            {
+                pInst->transport.relockPending = false;
+                MSG("Relocked %u ms after resuming (time error: %d ns)\n", (xTaskGetTickCount() - pInst->transport.resumeTick) * 1000 / configTICK_RATE_HZ,
+                    (int32_t) nsI(&d));
+            }
+        }
+    }
+
+    // learn the frequency of the oscillator while locked
+    if (active)
+    {
+        ptp_freqstore_feed(&pInst->freqStore, nsI(&d), pInst->addend);
+    }
+
+    // record cycle into the event log (formatted by the drain task)
+    ptp_log_cycle(pInst, pDomain, &d, d_ticks, addendPrev,
+                  (active ? PTP_EVLOG_FLAG_ACTIVE : 0) | (coarse ? PTP_EVLOG_FLAG_COARSE : 0) | (decimated ? PTP_EVLOG_FLAG_DECIMATED : 0));
+    ptp_stream_cycle(pInst, pDomain, &d, (active ? PTP_TELEMETRY_FLAG_ACTIVE : 0) | (coarse ? PTP_TELEMETRY_FLAG_COARSE : 0));
+
+    // check that the active domain is still the best one
+    ptp_select_active_domain(pInst);
+}
+
+// perform clock correction based on gathered timestamps
+void ptp_perform_correction(struct PTPInstance *pInst, struct PTPDomain *pDomain)
+{
+    // compute difference between master and slave clock
+    struct TimestampI d;
+    ptp_corr_time_difference(&d, &pDomain->syncData, &pInst->options.offset);
+
+    ptp_apply_correction(pInst, pDomain, &d, false);
+}
+
+// get offset at the last sample of a window from a least-squares line fitted on the samples
+static int64_t ptp_decim_fit_end(const struct PTPDecimation *pDec)
+{
+    float n = pDec->cnt;
+    float mean = pDec->sum_ns / n;
+    float slope = (pDec->sumWeighted_ns - (n - 1) / 2 * pDec->sum_ns) / (n * (n * n - 1) / 12); // per sample
+    return (int64_t) (mean + slope * (n - 1) / 2);
+}
+
+// Decimated operation for high Sync rates: every Follow_Up yields an offset sample ((t2 - t1) - mean path delay)
+// and the servo is run on every `decimation` samples. The path delay is measured once per window without
+// blocking the task and is smoothed over PTP_DECIM_DELAY_FILTER measurements, so that a single delay sample
+// doesn't shift a whole window. No timer is started or stopped per message (a lost Delay_Resp is detected by
+// the next window).
+static void ptp_process_decimated(struct PTPInstance *pInst, struct PTPDomain *pDomain, struct PTPHeader *pHeader, struct pbuf *pPBuf,
+                                  struct ip_addr *pSrcAddr, bool ownDelayResp)
+{
+    struct PTPDecimation *pDec = &pDomain->decim;
+    struct TimestampI correctionField = { 0, 0 }, d;
+    uint32_t now = xTaskGetTickCount();
+
+    switch (pHeader->messageID)
+    {
+    case PTPIDSync:
+        pDomain->syncData.t2.sec = pPBuf->time_s;
+        pDomain->syncData.t2.nanosec = pPBuf->time_ns;
+        pDomain->sequenceID = pHeader->sequenceID;
+        pDomain->syncSrcAddr = *pSrcAddr;
+        ptp_stats_transition(&pInst->stats, pDomain, SWaitFollowUp);
+        break;
+
+    case PTPIDFollow_Up:
+        if (pDomain->state != SWaitFollowUp)
+        {
+            break;
+        }
+
+        if (pHeader->sequenceID != pDomain->sequenceID)
+        {
+            pInst->stats.seqMismatch++;
+            break;
+        }
+
+        // read t1 and substract correction field from t2
+        ptp_extract_timestamps(&pDomain->syncData.t1, pPBuf->payload, 1);
+        correctionField.nanosec = pHeader->correction_ns;
+        subTime(&pDomain->syncData.t2, &pDomain->syncData.t2, &correctionField);
+        normTime(&pDomain->syncData.t2);
+        pDomain->syncData.corrFollowUp = correctionField.nanosec;
+        ptp_stats_transition(&pInst->stats, pDomain, SIdle);
+
+        subTime(&d, &pDomain->syncData.t2, &pDomain->syncData.t1);
+        pDec->syncDiff_ns = nsI(&d);
+
+        // measure path delay once per window at a random sample (like the random wait of the full cycle, it spreads
+        // the Delay_Reqs of slaves), the measurement is restarted if the Delay_Resp got lost
+        if (pDec->cnt == pDec->delayReqAt && (!pDec->delayReqPending || (now - pDec->delayReqTick) >= pdMS_TO_TICKS(RESP_TIMEOUT)))
+        {
+            if (pDec->delayReqPending)
+            {
+                pInst->stats.timeouts++;
+            }
+
+            ptp_send_delay_req_message(pInst, pDomain);
+            pDec->delayReqPending = true;
+            pDec->delayReqTick = now;
+        }
+
+        if (!pDec->delayValid)
+        {
+            break;
+        }
+
+        int64_t d_ns = pDec->syncDiff_ns - pDec->delay_ns - nsI(&pInst->options.offset);
+        nsToTsI(&d, d_ns);
+
+        // jump the clock at once, path delay has to be measured again afterwards
+        if (d.sec != 0)
+        {
+            memset(pDec, 0, sizeof(struct PTPDecimation));
+            ptp_account_rx_to_servo(pInst, pPBuf);
+            ptp_apply_correction(pInst, pDomain, &d, true);
+            break;
+        }
+
+        // run servo on the offset at the end of the window fitted on its samples (a plain average would lag by half a window)
+        pDec->sum_ns += d_ns;
+        pDec->sumWeighted_ns += d_ns * pDec->cnt;
+        if (++pDec->cnt >= ptp_get_decimation(pInst))
+        {
+            nsToTsI(&d, ptp_decim_fit_end(pDec));
+            pDec->sum_ns = 0;
+            pDec->sumWeighted_ns = 0;
+            pDec->cnt = 0;
+            pDec->delayReqAt = rand() % ptp_get_decimation(pInst);
+            ptp_account_rx_to_servo(pInst, pPBuf);
+            ptp_apply_correction(pInst, pDomain, &d, true);
+        }
+        break;
+
+    case PTPIDDelay_Resp:
+        if (!ownDelayResp || !pDec->delayReqPending)
+        {
+            break;
+        }
+
+        if (pHeader->sequenceID != pDomain->delay_reqSequenceID || pDomain->pDelayReqPBuf == NULL)
+        {
+            pInst->stats.seqMismatch++;
+            break;
+        }
+
+        // store t3 and t4 (correction field substracted)
+        pDomain->syncData.t3.sec = pDomain->pDelayReqPBuf->time_s;
+        pDomain->syncData.t3.nanosec = pDomain->pDelayReqPBuf->time_ns;
+        ptp_capture_set_time(&pInst->capture, pDomain->delayReqFrameNo, pDomain->pDelayReqPBuf->time_s, pDomain->pDelayReqPBuf->time_ns);
+        ptp_extract_timestamps(&pDomain->syncData.t4, pPBuf->payload, 1);
+        correctionField.nanosec = pHeader->correction_ns;
+        subTime(&pDomain->syncData.t4, &pDomain->syncData.t4, &correctionField);
+        normTime(&pDomain->syncData.t4);
+        pDomain->syncData.corrDelayResp = correctionField.nanosec;
+
+        // mean path delay of the exchange and of the last Sync, smoothed
+        subTime(&d, &pDomain->syncData.t4, &pDomain->syncData.t3);
+        int64_t delay_ns = (pDec->syncDiff_ns + nsI(&d)) / 2;
+        pDec->delay_ns = pDec->delayValid ? (pDec->delay_ns + (delay_ns - pDec->delay_ns) / PTP_DECIM_DELAY_FILTER) : delay_ns;
+
+        pDec->delayReqPending = false;
+        pDec->delayValid = true;
+        break;
+
+    default:
+        break;
+    }
+}
+
+// restart Sync receipt timeout (PTP_SYNC_RECEIPT_TIMEOUT Sync intervals)
+static void ptp_arm_sync_receipt(struct PTPDomain *pDomain, const struct PTPHeader *pHeader, uint32_t now)
+{
+    // Sync interval is taken from the message; if it's not given (unicast), it is measured
+    int8_t logInterval = (int8_t) pHeader->logMessagePeriod;
+    uint32_t interval = pdMS_TO_TICKS(1000);
+    if (logInterval >= -7 && logInterval <= 7)
     {
-        PTP_UPDATE_CLOCK(d.sec, d.nanosec); // jump the clock by difference
+        interval = pdMS_TO_TICKS((logInterval >= 0) ? (1000 << logInterval) : (1000 >> (-logInterval)));
+    }
+    else if (pDomain->syncDeadline.armed && (now - pDomain->syncTick) > 0)
+    {
+        interval = now - pDomain->syncTick;
+    }
+
+    uint32_t timeout = PTP_SYNC_RECEIPT_TIMEOUT * interval;
+    if (timeout < pdMS_TO_TICKS(PTP_SYNC_RECEIPT_MIN_MS))
+    {
+        timeout = pdMS_TO_TICKS(PTP_SYNC_RECEIPT_MIN_MS);
+    }
+
+    pDomain->syncTick = now;
+    ptp_deadline_arm(&pDomain->syncDeadline, now, timeout);
+}
+
+// handle expired timeouts of a domain, returns OS ticks until the nearest deadline
+static uint32_t ptp_handle_timeouts(struct PTPInstance *pInst, struct PTPDomain *pDomain, uint32_t now)
+{
+    // reset state machine if message dropout occurs
+    if (ptp_deadline_remaining(&pDomain->responseDeadline, now) == 0)
+    {
+        pDomain->responseDeadline.armed = false;
+        pInst->stats.timeouts++;
+        ptp_stats_transition(&pInst->stats, pDomain, SIdle);
+        MSG("Response timeout expired (domain %u), state machine has been reset!\n", pDomain->domainNumber);
+    }
+
+    // Syncs have stopped coming
+    if (ptp_deadline_remaining(&pDomain->syncDeadline, now) == 0)
+    {
+        pInst->stats.syncTimeouts++;
+        ptp_reset_domain_sync(pDomain);
+        MSG("Sync receipt timeout expired (domain %u), synchronization has been reset!\n", pDomain->domainNumber);
+    }
 
-        MSG("Time difference is over 1s, performing coarse correction!\n");
+    // parent or other foreign masters have stopped announcing
+    uint8_t expired;
+    if (ptp_bmca_time_to_expiry(&pDomain->bmca, now) == 0)
+    {
+        if (ptp_bmca_expire(&pDomain->bmca, &expired))
+        {
+            ptp_handle_parent_change(pDomain);
+        }
+
+        pInst->stats.announceTimeouts += expired;
+    }
+
+    uint32_t wait = ptp_deadline_remaining(&pDomain->responseDeadline, now);
+    wait = MIN(wait, ptp_deadline_remaining(&pDomain->syncDeadline, now));
+    wait = MIN(wait, ptp_bmca_time_to_expiry(&pDomain->bmca, now));
+    return wait;
+}
+
+// periodic housekeeping
+void ptp_periodic(struct PTPInstance *pInst)
+{
+    // nothing is sent while the link is down, grants and foreign masters are reevaluated after resuming
+    if (pInst->transport.paused)
+    {
         return;
     }
 
-    // run controller
-    float corr_ppb = PTP_SERVO_RUN(nsI(&d));
+    struct PTPDomain *pActive = &pInst->domains[pInst->activeDomain];
 
-    // compute addend value
-    addend += corr_ppb * PTP_ADDEND_CORR_PER_PPB_F;
+    // a master doesn't negotiate with other masters (running grants are cancelled)
+    ptp_unicast_enable(&pInst->unicast, (pInst->options.mode == PTPTM_UNICAST) && !ptp_master_is_enabled(&pInst->master));
+    ptp_unicast_periodic(&pInst->unicast, ptp_bmca_get_parent(&pActive->bmca), pActive->domainNumber);
+    ptp_capture_periodic(&pInst->capture, pInst->pPCBs[1]);
+    ptp_telemetry_periodic(&pInst->telemetry, pInst->pPCBs[1]);
+    ptp_master_periodic(&pInst->master);
+    ptp_freqstore_periodic(&pInst->freqStore);
+}
 
-    // write addend into hardware
-    PTP_SET_ADDEND(addend);
+// handle expired timeouts and send due master messages
+uint32_t ptp_poll(struct PTPInstance *pInst)
+{
+    if (pInst->transport.paused)
+    {
+        return portMAX_DELAY;
+    }
 
-    // log on cli (if enabled)
-    CLILOG(log_en, "%d %d %d %d %d %d %d 0x%X\n", (int32_t )syncMa.sec, syncMa.nanosec, (int32_t )delReqMa.sec, delReqMa.nanosec, (int32_t ) d.sec, d.nanosec, d_ticks, addend);
+    uint32_t now = xTaskGetTickCount();
+    uint32_t wait = ptp_master_poll(&pInst->master);
 
+    uint8_t i;
+    for (i = 0; i < pInst->domainCnt; i++)
+    {
+        wait = MIN(wait, ptp_handle_timeouts(pInst, &pInst->domains[i], now));
+    }
+
+    return wait;
 }
 
-// reset state machine if message dropuot occures
-void ptp_reset_state(TimerHandle_t xTimer)
+// get minimum length of a message type (body fields read by the engine included)
+static uint16_t ptp_min_message_length(uint8_t messageID)
 {
-    sState.state = SIdle;
-    MSG("Response timeout expired, state machine has been reset!\n");
+    switch (messageID)
+    {
+    case PTPIDSync:
+        return PTP_SYNC_PCKT_SIZE;
+    case PTPIDDelay_Req:
+        return PTP_DELAY_REQ_PCKT_SIZE;
+    case PTPIDFollow_Up:
+        return PTP_FOLLOW_UP_PCKT_SIZE;
+    case PTPIDDelay_Resp:
+        return PTP_DELAY_RESP_PCKT_SIZE;
+    case PTPIDAnnounce:
+        return PTP_ANNOUNCE_PCKT_SIZE;
+    default:
+        return PTP_HEADER_LENGTH; // TLVs are checked by their processors
+    }
 }
 
-// packet processing (NON-REENTRANT!!)
-void ptp_process_packet(struct pbuf *pPBuf)
+// message processing
+static void ptp_process_message(struct PTPInstance *pInst, struct pbuf *pPBuf, struct ip_addr *pSrcAddr)
 {
-    static struct PTPHeader header;                      // PTP header
-    static struct Delay_RespIdentification delay_respID; // identification received in every Delay_Resp packet
+    struct PTPHeader header;                      // PTP header
+    struct Delay_RespIdentification delay_respID; // identification received in every Delay_Resp packet
+    struct PTPAnnounceBody announce; // body of Announce messages
     struct TimestampI correctionField;
 
     // header readout
+    if (pPBuf->len < PTP_HEADER_LENGTH)
+    {
+        pInst->stats.rxShort++;
+        return;
+    }
+
     ptp_extract_header(&header, pPBuf->payload);
+    pInst->stats.rxMsgs[header.messageID & (PTP_STATS_MSG_TYPES - 1)]++;
+
+    // drop truncated messages before any body access (trailing bytes beyond messageLength are ignored)
+    uint16_t len = MIN(pPBuf->len, header.messageLength);
+    if (len < ptp_min_message_length(header.messageID))
+    {
+        pInst->stats.rxShort++;
+        return;
+    }
 
     //MSG("%d\n", header.messageID);
 
-    switch (sState.state)
+    // a master answers Delay_Reqs and negotiation requests only
+    if (ptp_master_is_enabled(&pInst->master))
+    {
+        if (header.messageID == PTPIDDelay_Req)
+        {
+            ptp_master_process_delay_req(&pInst->master, pPBuf, pSrcAddr);
+        }
+        else if (header.messageID == PTPIDSignaling)
+        {
+            ptp_master_process_signaling(&pInst->master, pPBuf, pSrcAddr);
+        }
+
+        return;
+    }
+
+    // Signaling messages carry unicast negotiation TLVs
+    if (header.messageID == PTPIDSignaling)
+    {
+        ptp_unicast_process_signaling(&pInst->unicast, &header, pPBuf->payload, len, pSrcAddr);
+        return;
+    }
+
+    // drop messages of untracked domains
+    struct PTPDomain *pDomain = ptp_find_domain(pInst, header.subdomainNumber);
+    if (pDomain == NULL)
+    {
+        pInst->stats.rxUntracked++;
+        return;
+    }
+
+    // Announces are processed by the BMCA independently of the synchronization state
+    if (header.messageID == PTPIDAnnounce)
+    {
+        ptp_extract_announce_body(&announce, pPBuf->payload);
+        if (ptp_bmca_process_announce(&pDomain->bmca, &header, &announce, pSrcAddr))
+        {
+            ptp_handle_parent_change(pDomain);
+        }
+
+        return;
+    }
+
+    // count Delay_Resps addressed to other slaves (multicast fan-out)
+    bool ownDelayResp = false;
+    if (header.messageID == PTPIDDelay_Resp)
+    {
+        ptp_read_delay_resp_id_data(&delay_respID, pPBuf->payload);
+        ownDelayResp = (delay_respID.requestingSourceClockIdentity == pInst->clockIdentity
+                && delay_respID.requestingSourcePortIdentity == pDomain->delayReqHeader.sourcePortID);
+        if (!ownDelayResp)
+        {
+            pInst->stats.rxForeignDelayResp++;
+        }
+    }
+
+    // drop messages not sent by the selected parent before doing any timestamp processing
+    if (!ptp_bmca_is_parent(&pDomain->bmca, &header))
+    {
+        pInst->stats.rxNotParent++;
+        return;
+    }
+
+    // Syncs of the parent keep synchronization alive
+    if (header.messageID == PTPIDSync)
+    {
+        uint32_t now = xTaskGetTickCount();
+        ptp_arm_sync_receipt(pDomain, &header, now);
+
+        // report delay of getting back to work after the link came up
+        if (pInst->transport.firstSyncPending)
+        {
+            pInst->transport.firstSyncPending = false;
+            MSG("First Sync processed %u ms after link-up\n", (now - pInst->transport.linkUpTick) * 1000 / configTICK_RATE_HZ);
+        }
+    }
+
+    // high Sync rates are handled by the decimated operation
+    if (ptp_get_decimation(pInst) > 1)
+    {
+        ptp_process_decimated(pInst, pDomain, &header, pPBuf, pSrcAddr, ownDelayResp);
+        return;
+    }
+
+    switch (pDomain->state)
     {
     // wait for Sync message
     case SIdle:
@@ -540,17 +1518,18 @@ void ptp_process_packet(struct pbuf *pPBuf)
         if (header.messageID == PTPIDSync)
         {
             // save reception time
-            sSyncData.t2.sec = pPBuf->time_s;
-            sSyncData.t2.nanosec = pPBuf->time_ns;
+            pDomain->syncData.t2.sec = pPBuf->time_s;
+            pDomain->syncData.t2.nanosec = pPBuf->time_ns;
 
             // TODO: TWO_STEP handling
 
             // switch to next state
-            sState.sequenceID = header.sequenceID;
-            sState.state = SWaitFollowUp;
+            pDomain->sequenceID = header.sequenceID;
+            pDomain->syncSrcAddr = *pSrcAddr;
+            ptp_stats_transition(&pInst->stats, pDomain, SWaitFollowUp);
 
-            // start dropout timer
-            xTimerStart(sResponseTimer, 0);
+            // start dropout detection
+            ptp_deadline_arm(&pDomain->responseDeadline, xTaskGetTickCount(), pdMS_TO_TICKS(RESP_TIMEOUT));
 
 #if PRINT_STATE_TRANSITION_MESSAGES
             MSG("IDLE -> WAITFOLLOWUP\n");
@@ -565,82 +1544,88 @@ void ptp_process_packet(struct pbuf *pPBuf)
         if (header.messageID == PTPIDFollow_Up)
         {
             // check sequence ID if the response is ours
-            if (header.sequenceID == sState.sequenceID)
+            if (header.sequenceID == pDomain->sequenceID)
             {
                 // read t1
-                ptp_extract_timestamps(&sSyncData.t1, pPBuf->payload, 1);
+                ptp_extract_timestamps(&pDomain->syncData.t1, pPBuf->payload, 1);
 
                 // get correction field (substract from t2)
                 correctionField.sec = 0;
                 correctionField.nanosec = header.correction_ns; // TODO: subnanosec processing
 
-                subTime(&sSyncData.t2, &sSyncData.t2, &correctionField);
-                normTime(&sSyncData.t2);
+                subTime(&pDomain->syncData.t2, &pDomain->syncData.t2, &correctionField);
+                normTime(&pDomain->syncData.t2);
 
-                // log correction field (if enabled)
-                CLILOG(log_corr, "C [Follow_Up]: %d\n", correctionField.nanosec);
+                // store correction field for the event log
+                pDomain->syncData.corrFollowUp = correctionField.nanosec;
 
-                // delay Delay_Req transmission with a random amount of time
+                // delay Delay_Req transmission with a random amount of time (not accounted as processing time)
+                uint32_t blockStart = PTP_CYCLE_COUNTER();
                 vTaskDelay(pdMS_TO_TICKS(rand() % 500));
+                pInst->load.blockedCycles += PTP_CYCLE_COUNTER() - blockStart;
 
                 // send Delay_Req message
-                ptp_send_delay_req_message();
+                ptp_send_delay_req_message(pInst, pDomain);
 
                 // switch to next state
-                sState.state = SWaitDelayResp;
+                ptp_stats_transition(&pInst->stats, pDomain, SWaitDelayResp);
 
 #if PRINT_STATE_TRANSITION_MESSAGES
                 MSG("WAITFOLLOWUP -> WAITDELAYRESP\n");
 #endif
             }
-            /*else
-             {
-             sState.state = SIdle; // error, switch to IDLE
-             }*/
+            else
+            {
+                pInst->stats.seqMismatch++;
+            }
         }
 
         break;
 
         // wait for Delay_Resp message
     case SWaitDelayResp:
-        if (header.messageID == PTPIDDelay_Resp && header.sequenceID == sState.delay_reqSequenceID)
+        // process if sent to us as a response to our Delay_Req
+        if (header.messageID == PTPIDDelay_Resp && ownDelayResp)
         {
-
-            // read clock ID of requester
-            ptp_read_delay_resp_id_data(&delay_respID, pPBuf->payload);
-
-            // if sent to us as a response to our Delay_Req then continue processing
-            if (delay_respID.requestingSourceClockIdentity == sClockIdentity && delay_respID.requestingSourcePortIdentity == sDelayReqHeader.sourcePortID)
+            if (header.sequenceID != pDomain->delay_reqSequenceID || pDomain->pDelayReqPBuf == NULL)
+            {
+                pInst->stats.seqMismatch++;
+            }
+            else
             {
                 // print clockID
                 /*ptp_print_clock_identity(
                  delay_respID.requestingSourceClockIdentity);*/
 
                 // store t3
-                sSyncData.t3.sec = spDelayReqPBuf->time_s;
-                sSyncData.t3.nanosec = spDelayReqPBuf->time_ns;
+                pDomain->syncData.t3.sec = pDomain->pDelayReqPBuf->time_s;
+                pDomain->syncData.t3.nanosec = pDomain->pDelayReqPBuf->time_ns;
+                ptp_capture_set_time(&pInst->capture, pDomain->delayReqFrameNo, pDomain->pDelayReqPBuf->time_s, pDomain->pDelayReqPBuf->time_ns);
 
                 // store t4
-                ptp_extract_timestamps(&sSyncData.t4, pPBuf->payload, 1);
+                ptp_extract_timestamps(&pDomain->syncData.t4, pPBuf->payload, 1);
 
                 // substract correction field from t4
                 correctionField.sec = 0;
                 correctionField.nanosec = header.correction_ns;
 
-                subTime(&sSyncData.t4, &sSyncData.t4, &correctionField);
-                normTime(&sSyncData.t4);
+                subTime(&pDomain->syncData.t4, &pDomain->syncData.t4, &correctionField);
+                normTime(&pDomain->syncData.t4);
+
+                // store correction field for the event log
+                pDomain->syncData.corrDelayResp = correctionField.nanosec;
 
-                // log correction field (if enabled)
-                CLILOG(log_corr, "C [Del_Resp]: %d\n", correctionField.nanosec);
+                // account time elapsed since reception of the Delay_Resp
+                ptp_account_rx_to_servo(pInst, pPBuf);
 
                 // run clock correction algorithm
-                ptp_perform_correction();
+                ptp_perform_correction(pInst, pDomain);
 
                 // switch to IDLE state
-                sState.state = SIdle;
+                ptp_stats_transition(&pInst->stats, pDomain, SIdle);
 
-                // stop dropout detecting timer
-                xTimerStop(sResponseTimer, 0);
+                // stop dropout detection
+                pDomain->responseDeadline.armed = false;
 
 #if PRINT_STATE_TRANSITION_MESSAGES
                 MSG("WAITDELAYRESP -> IDLE\n\n");
@@ -651,3 +1636,29 @@ void ptp_process_packet(struct pbuf *pPBuf)
         break;
     }
 }
+
+// packet processing
+void ptp_process_packet(struct PTPInstance *pInst, struct pbuf *pPBuf, struct ip_addr *pSrcAddr)
+{
+    // packets still queued when the link was lost are dropped
+    if (pInst->transport.paused)
+    {
+        return;
+    }
+
+    uint32_t start = PTP_CYCLE_COUNTER();
+
+    // capture frame (destination is deduced from the unicast flag)
+    bool unicast = (pPBuf->len > 6) && (((uint8_t*) pPBuf->payload)[6] & 0x04);
+    ptp_capture_frame(&pInst->capture, PTPCDRx, pPBuf, pSrcAddr, unicast ? &netif_default->ip_addr : &pInst->defPTPAddr);
+
+    ptp_process_message(pInst, pPBuf, pSrcAddr);
+
+    // account load
+    uint32_t cycles = (PTP_CYCLE_COUNTER() - start) - pInst->load.blockedCycles;
+    pInst->load.rxPackets++;
+    pInst->load.rxBytes += pPBuf->tot_len;
+    pInst->load.cycles += cycles;
+    pInst->load.blockedCycles = 0;
+    ptp_stats_hist_add(&pInst->stats.procCycles, cycles);
+}
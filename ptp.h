@@ -11,12 +11,9 @@
 #include "utils/lwiplib.h"
 #include "utils/uartstdio.h"
 
-#include "driverlib/emac.h"
-#include "driverlib/gpio.h"
-#include "inc/hw_memmap.h"
-#include "driverlib/pin_map.h"
-
 #include "timeutils.h"
+#include "ptp_correction.h"
+#include "ptp_arena.h"
 
 // IP address of PTP-IGMP groups
 #define PTP_IGMP_DEFAULT ("224.0.1.129")
@@ -26,7 +23,12 @@
 #define PTP_PORT0 (319)
 #define PTP_PORT1 (320)
 
+#define PTP_HEADER_LENGTH (34)
+#define PTP_SYNC_PCKT_SIZE (44)
 #define PTP_DELAY_REQ_PCKT_SIZE (44)
+#define PTP_FOLLOW_UP_PCKT_SIZE (44)
+#define PTP_DELAY_RESP_PCKT_SIZE (54)
+#define PTP_ANNOUNCE_PCKT_SIZE (64)
 
 // DEBUG switch for printing state transisitions
 #define PRINT_STATE_TRANSITION_MESSAGES (0)
@@ -37,7 +39,9 @@ enum PTPMessageID
     PTPIDSync = 0,
     PTPIDDelay_Req = 1,
     PTPIDFollow_Up = 8,
-    PTPIDDelay_Resp = 9
+    PTPIDDelay_Resp = 9,
+    PTPIDAnnounce = 11,
+    PTPIDSignaling = 12
 };
 
 // PTP header control field values
@@ -45,7 +49,8 @@ enum PTPControl {
     PTPCONSync = 0,
     PTPCONDelay_Req = 1,
     PTPCONFollow_Up = 2,
-    PTPCONelay_Resp = 3
+    PTPCONelay_Resp = 3,
+    PTPCONOther = 5
 };
 
 // PTP flags structure
@@ -116,12 +121,30 @@ struct Delay_RespIdentification {
     uint16_t requestingSourcePortIdentity;
 };
 
-// Data to perform a full synchronization
-struct SyncCycleData {
-    struct TimestampI t1; // Sync transmission time by master clock
-    struct TimestampI t2; // Sync reception time by slave clock
-    struct TimestampI t3; // Delay_Req transmission time by slave clock
-    struct TimestampI t4; // Delay_Resp reception time by master clock
+// clock quality descriptor
+struct PTPClockQuality {
+    uint8_t clockClass;
+    uint8_t clockAccuracy;
+    uint16_t offsetScaledLogVariance;
+};
+
+// Announce message body
+struct PTPAnnounceBody {
+    struct TimestampI originTimestamp;
+    int16_t currentUTCOffset;
+    uint8_t priority1;
+    struct PTPClockQuality grandmasterClockQuality;
+    uint8_t priority2;
+    uint64_t grandmasterClockIdentity;
+    uint16_t localStepsRemoved;
+    uint8_t timeSource;
+};
+
+// transport modes
+enum PTPTransportMode {
+    PTPTM_MULTICAST = 0, // everything is multicast
+    PTPTM_HYBRID, // multicast Sync/Follow_Up, unicast Delay_Req/Delay_Resp
+    PTPTM_UNICAST // every message is unicast (negotiated)
 };
 
 // -------------------------------------------
@@ -134,29 +157,71 @@ struct SyncCycleData {
 // - PTP_INCREMENT_NSEC: hardware clock increment [ns]
 // - PTP_UPDATE_CLOCK(s,ns): function jumping clock by defined value (negative time value means jumping backward)
 // - PTP_SET_ADDEND(addend): function writing hardware clock addend register
+// - PTP_HW_GET_TIME(pTs): function reading hardware clock into a TimestampI structure
+// - PTP_CYCLE_COUNTER(): function returning a free running CPU cycle counter (used for load measurement)
+// - PTP_CYCLE_FREQ_HZ: frequency of the cycle counter [Hz]
+// - PTP_NVS_INIT(): function initializing non-volatile storage, returns its size in bytes (0: no storage)
+// - PTP_NVS_READ(addr, pWords, size): function reading size bytes from the storage (addr and size are multiples of 4)
+// - PTP_NVS_WRITE(addr, pWords, size): function writing size bytes to the storage, returns 0 on success
 //
 // Include the clock servo (controller) and define the following:
+// - PTP_SERVO_STATE_TYPE: type holding the state of a servo instance
 // - PTP_SERVO_INIT(): function initializing clock servo
-// - PTP_SERVO_RESET(): function reseting clock servo
-// - PTP_SERVO_RUN(d): function running the servo, input: master-slave time difference (error), return: clock tuning value in PPB
+// - PTP_SERVO_RESET(pS): function reseting a servo instance
+// - PTP_SERVO_RUN(pS, d): function running a servo instance, input: master-slave time difference (error), return: clock tuning value in PPB
+// - PTP_SERVO_GET_STATE(pS): function returning a 32-bit summary of the servo instance state (streamed by the telemetry)
+//
+//
+// Defining PTP_PORT_HOST selects the virtual hardware of the PC tools in host/ instead.
 //
 // -------------------------------------------
 
-#include "hw_port/ptp_port_tiva_tm4c1294.h"
-
 #define PTP_MAIN_OSCILLATOR_FREQ_HZ (25000000)
 #define PTP_INCREMENT_NSEC (50)
 
+#ifndef PTP_PORT_HOST
+
+#include "driverlib/emac.h"
+#include "driverlib/gpio.h"
+#include "inc/hw_memmap.h"
+#include "driverlib/pin_map.h"
+
+#include "hw_port/ptp_port_tiva_tm4c1294.h"
+
 #define PTP_HW_INIT(increment, addend) ptphw_init(increment, addend)
 #define PTP_UPDATE_CLOCK(s,ns) EMACTimestampSysTimeUpdate(EMAC0_BASE, labs(s), abs(ns), (s * NANO_PREFIX + ns) < 0)
 #define PTP_SET_ADDEND(addend) EMACTimestampAddendSet(EMAC0_BASE, addend)
+#define PTP_HW_GET_TIME(pTs) ptphw_gettime(pTs)
+#define PTP_CYCLE_COUNTER() ptphw_cycle_counter()
+#define PTP_CYCLE_FREQ_HZ (120000000)
+#define PTP_NVS_INIT() ptphw_nvs_init()
+#define PTP_NVS_READ(addr, pWords, size) ptphw_nvs_read(addr, pWords, size)
+#define PTP_NVS_WRITE(addr, pWords, size) ptphw_nvs_write(addr, pWords, size)
+
+#else
+
+#include "hw_port/ptp_port_host.h"
+
+#define PTP_HW_INIT(increment, addend) ptphw_host_init(increment, addend)
+#define PTP_UPDATE_CLOCK(s,ns) ptphw_host_update_clock(s, ns)
+#define PTP_SET_ADDEND(addend) ptphw_host_set_addend(addend)
+#define PTP_HW_GET_TIME(pTs) ptphw_host_gettime(pTs)
+#define PTP_CYCLE_COUNTER() ptphw_host_cycle_counter()
+#define PTP_CYCLE_FREQ_HZ (1000000000)
+#define PTP_NVS_INIT() ptphw_host_nvs_init()
+#define PTP_NVS_READ(addr, pWords, size) ptphw_host_nvs_read(addr, pWords, size)
+#define PTP_NVS_WRITE(addr, pWords, size) ptphw_host_nvs_write(addr, pWords, size)
+
+#endif
 
 #include "servo/pd_controller.h"
 
 
+#define PTP_SERVO_STATE_TYPE struct PdCtrlState
 #define PTP_SERVO_INIT() pd_ctrl_init()
-#define PTP_SERVO_RESET() pd_ctrl_reset()
-#define PTP_SERVO_RUN(d) pd_ctrl_run(d)
+#define PTP_SERVO_RESET(pS) pd_ctrl_reset(pS)
+#define PTP_SERVO_RUN(pS, d) pd_ctrl_run(pS, d)
+#define PTP_SERVO_GET_STATE(pS) pd_ctrl_get_state(pS)
 
 // -------------------------------------------
 // (End of customizable area)
@@ -170,12 +235,47 @@ struct SyncCycleData {
 
 // -------------------------------------------
 
-void ptp_init(struct udp_pcb * pPCBs[]); // initialize PTP subsystem
-void ptp_log_en(bool en); // enable/disable logging
-void ptp_log_corr_field_en(bool en); // enable/disable logging of correction fields
-void ptp_set_clock_offset(int32_t offset); // set PPS offset
-int32_t ptp_get_clock_offset(); // get PPS offset
-void ptp_reset(); // reset PTP subsystem
-void ptp_process_packet(struct pbuf * pPBuf); // process PTP packet
+// message codec functions shared by PTP submodules
+void ptp_construct_binary_header(void *pData, struct PTPHeader *pHeader); // construct binary header from header structure
+void ptp_extract_header(struct PTPHeader *pHeader, void *pPayload); // extract header structure from binary header
+void ptp_extract_timestamps(struct TimestampI *ts, void *pPayload, uint8_t n); // extract n timestamps following the header
+void ptp_write_binary_timestamps(void *pPayload, struct TimestampI *ts, uint8_t n); // write n timestamps following the header
+void ptp_read_delay_resp_id_data(struct Delay_RespIdentification *pDRData, void *pPayload); // extract requesting port identity of a Delay_Resp
+
+// PTP engine instance, every piece of state is kept in it (see ptp_instance.h)
+struct PTPInstance;
+struct PTPRequest;
+typedef void (*fnPTPRequestHook)(struct PTPInstance * pInst, const struct PTPRequest * pReq); // passes a request to the task running the instance
+
+size_t ptp_instance_size(); // get memory needed for an instance
+struct PTPInstance * ptp_create_instance(struct PTPArena * pArena); // allocate instance from arena (NULL if the arena is exhausted)
+void ptp_init(struct PTPInstance * pInst, struct udp_pcb * pPCBs[]); // initialize PTP subsystem
+void ptp_register_cli_commands(struct PTPInstance * pInst); // register CLI commands operating on the passed instance
+struct PTPEventLog * ptp_get_event_log(struct PTPInstance * pInst); // get event log of an instance (records are consumed by the drain task)
+uint64_t ptp_get_clock_identity(const struct PTPInstance * pInst); // get own clockIdentity (network byte order)
+void ptp_log_en(struct PTPInstance * pInst, bool en); // enable/disable logging
+void ptp_log_corr_field_en(struct PTPInstance * pInst, bool en); // enable/disable logging of correction fields
+void ptp_log_trace_en(struct PTPInstance * pInst, bool en); // enable/disable binary tracing of synchronization cycles
+void ptp_set_clock_offset(struct PTPInstance * pInst, int32_t offset); // set PPS offset
+int32_t ptp_get_clock_offset(struct PTPInstance * pInst); // get PPS offset
+void ptp_set_transport_mode(struct PTPInstance * pInst, enum PTPTransportMode mode); // set transport mode
+enum PTPTransportMode ptp_get_transport_mode(const struct PTPInstance * pInst); // get transport mode
+void ptp_set_decimation(struct PTPInstance * pInst, uint8_t n); // set number of Follow_Ups averaged per servo run (1: full synchronization cycle per Sync)
+uint8_t ptp_get_decimation(const struct PTPInstance * pInst); // get number of Follow_Ups averaged per servo run
+void ptp_reset(struct PTPInstance * pInst); // reset PTP subsystem
+void ptp_process_packet(struct PTPInstance * pInst, struct pbuf * pPBuf, struct ip_addr * pSrcAddr); // process PTP packet
+void ptp_periodic(struct PTPInstance * pInst); // periodic housekeeping (call at least every PTP_PERIODIC_INTERVAL_MS)
+uint32_t ptp_poll(struct PTPInstance * pInst); // handle expired timeouts and send due master messages, returns OS ticks until the next call is needed (portMAX_DELAY: not needed)
+void ptp_pause(struct PTPInstance * pInst); // pause transport on link loss (cycles in progress are dropped, clock, addend, servo and BMCA are kept)
+void ptp_resume(struct PTPInstance * pInst); // resume transport paused by ptp_pause()
+bool ptp_is_paused(const struct PTPInstance * pInst); // is transport paused?
+void ptp_mark_link_up(struct PTPInstance * pInst, uint32_t linkUpTick); // note OS tick of link-up, the delay of the first Sync processed afterwards is reported
+void ptp_set_request_hook(struct PTPInstance * pInst, fnPTPRequestHook pHook); // route requests of the CLI through the PTP task (NULL: apply them in place)
+void ptp_handle_request(struct PTPInstance * pInst, const struct PTPRequest * pReq); // apply request (call from the task running the instance)
+
+#define PTP_PERIODIC_INTERVAL_MS (250)
+#define PTP_MAX_DECIMATION (128) // maximal number of Follow_Ups averaged per servo run (1 s at 128 Hz Sync)
+#define PTP_DECIM_DELAY_FILTER (8) // path delay measurements are smoothed over about this many windows in decimated operation
+#define PTP_RELOCK_NS (1000) // synchronization is considered relocked after a pause once the time error gets below this
 
 #endif /* PTP */
@@ -0,0 +1,38 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_arena.h"
+
+#include <string.h>
+
+// assign memory area to arena
+void ptp_arena_init(struct PTPArena *pArena, void *pMem, size_t size)
+{
+    pArena->pMem = (uint8_t*) pMem;
+    pArena->size = size;
+    pArena->used = 0;
+}
+
+// allocate zero-filled block, blocks are never released individually
+void* ptp_arena_alloc(struct PTPArena *pArena, size_t size)
+{
+    // align beginning of the block relative to the arena's base address
+    uintptr_t base = (uintptr_t) pArena->pMem + pArena->used;
+    size_t pad = (PTP_ARENA_ALIGN - (base % PTP_ARENA_ALIGN)) % PTP_ARENA_ALIGN;
+
+    if (pad + size > pArena->size - pArena->used)
+    {
+        return NULL;
+    }
+
+    void *pBlock = pArena->pMem + pArena->used + pad;
+    pArena->used += pad + size;
+    memset(pBlock, 0, size);
+
+    return pBlock;
+}
+
+// get number of bytes left
+size_t ptp_arena_free_space(const struct PTPArena *pArena)
+{
+    return pArena->size - pArena->used;
+}
@@ -0,0 +1,22 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_ARENA_H
+#define PTP_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PTP_ARENA_ALIGN (8) // alignment of allocated blocks
+
+// caller-supplied memory area objects are carved from
+struct PTPArena {
+    uint8_t * pMem; // beginning of the memory area
+    size_t size; // size of the memory area
+    size_t used; // bytes already allocated
+};
+
+void ptp_arena_init(struct PTPArena * pArena, void * pMem, size_t size); // assign memory area to arena
+void * ptp_arena_alloc(struct PTPArena * pArena, size_t size); // allocate zero-filled block (NULL if the arena is exhausted)
+size_t ptp_arena_free_space(const struct PTPArena * pArena); // get number of bytes left
+
+#endif /* PTP_ARENA_H */
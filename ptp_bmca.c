@@ -0,0 +1,371 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_bmca.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "utils.h"
+
+// --------------------------
+
+// print port identity (clock identity is printed in network byte order)
+static void ptp_bmca_print_port_identity(uint64_t clockIdentity, uint16_t portID)
+{
+    uint8_t *p = (uint8_t*) &clockIdentity;
+    MSG("%02x%02x%02x.%02x%02x.%02x%02x%02x-%u", p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], portID);
+}
+
+// print a foreign master entry
+static void ptp_bmca_print_entry(const struct PTPForeignMaster *pFM)
+{
+    const struct PTPAnnounceBody *pA = &pFM->announce;
+
+    ptp_bmca_print_port_identity(pFM->clockIdentity, pFM->sourcePortID);
+    MSG(" (%u.%u.%u.%u) GM: ", ip4_addr1(&pFM->addr), ip4_addr2(&pFM->addr), ip4_addr3(&pFM->addr), ip4_addr4(&pFM->addr));
+    ptp_bmca_print_port_identity(pA->grandmasterClockIdentity, 0);
+    MSG(" p1: %u class: %u acc: 0x%02x var: 0x%04x p2: %u steps: %u\n", pA->priority1, pA->grandmasterClockQuality.clockClass,
+        pA->grandmasterClockQuality.clockAccuracy, pA->grandmasterClockQuality.offsetScaledLogVariance, pA->priority2, pA->localStepsRemoved);
+}
+
+// is the foreign master the selected parent?
+static bool ptp_bmca_is_parent_entry(const struct PTPBmcaState *pB, const struct PTPForeignMaster *pFM)
+{
+    return pB->parent.selected && pB->parent.clockIdentity == pFM->clockIdentity && pB->parent.sourcePortID == pFM->sourcePortID;
+}
+
+// print foreign master table
+void ptp_bmca_print(const struct PTPBmcaState *pB)
+{
+    uint8_t i;
+    for (i = 0; i < PTP_FOREIGN_MASTER_TABLE_SIZE; i++)
+    {
+        const struct PTPForeignMaster *pFM = &pB->foreignMasters[i];
+        if (pFM->valid)
+        {
+            MSG("%c%c ", ptp_bmca_is_parent_entry(pB, pFM) ? '*' : ' ', (pFM->announceCnt >= PTP_FOREIGN_MASTER_THRESHOLD) ? 'Q' : ' ');
+            ptp_bmca_print_entry(pFM);
+        }
+    }
+
+    if (!pB->parent.selected)
+    {
+        MSG("> No parent selected\n");
+    }
+}
+
+// --------------------------
+
+// drop every foreign master and the selected parent
+void ptp_bmca_reset(struct PTPBmcaState *pB, uint8_t domainNumber)
+{
+    memset(pB, 0, sizeof(struct PTPBmcaState));
+    pB->domainNumber = domainNumber;
+}
+
+// convert log2 message interval into OS ticks
+static uint32_t ptp_bmca_interval_to_ticks(int8_t logInterval)
+{
+    logInterval = LIMIT(logInterval, PTP_MAX_LOG_ANNOUNCE);
+    uint32_t ms = (logInterval >= 0) ? (1000 << logInterval) : (1000 >> (-logInterval));
+    return pdMS_TO_TICKS(ms);
+}
+
+// get Announce receipt timeout of a foreign master
+static uint32_t ptp_bmca_receipt_timeout(const struct PTPForeignMaster *pFM)
+{
+    // Announce interval is taken from the message; if it's not given (unicast), it is measured, until then the
+    // longest interval is assumed so that the second Announce can arrive
+    uint32_t interval = ptp_bmca_interval_to_ticks(PTP_MAX_LOG_ANNOUNCE);
+    if (pFM->logAnnounceInterval >= -PTP_MAX_LOG_ANNOUNCE && pFM->logAnnounceInterval <= PTP_MAX_LOG_ANNOUNCE)
+    {
+        interval = ptp_bmca_interval_to_ticks(pFM->logAnnounceInterval);
+    }
+    else if (pFM->rxInterval > 0)
+    {
+        interval = pFM->rxInterval;
+    }
+
+    return PTP_ANNOUNCE_RECEIPT_TIMEOUT * interval;
+}
+
+// remove foreign masters not heard from for PTP_ANNOUNCE_RECEIPT_TIMEOUT announce intervals, returns number of removed entries
+static uint8_t ptp_bmca_age(struct PTPBmcaState *pB, uint32_t now)
+{
+    uint8_t i, expired = 0;
+    for (i = 0; i < PTP_FOREIGN_MASTER_TABLE_SIZE; i++)
+    {
+        struct PTPForeignMaster *pFM = &pB->foreignMasters[i];
+        if (pFM->valid && (now - pFM->lastRxTick) > ptp_bmca_receipt_timeout(pFM))
+        {
+            pFM->valid = false;
+            expired++;
+        }
+    }
+
+    return expired;
+}
+
+// find foreign master entry belonging to message sender
+static struct PTPForeignMaster* ptp_bmca_lookup(const struct PTPBmcaState *pB, uint64_t clockIdentity, uint16_t sourcePortID)
+{
+    uint8_t i;
+    for (i = 0; i < PTP_FOREIGN_MASTER_TABLE_SIZE; i++)
+    {
+        const struct PTPForeignMaster *pFM = &pB->foreignMasters[i];
+        if (pFM->valid && pFM->clockIdentity == clockIdentity && pFM->sourcePortID == sourcePortID)
+        {
+            return (struct PTPForeignMaster*) pFM;
+        }
+    }
+
+    return NULL;
+}
+
+// get an empty slot; if the table is full, the least recently heard non-parent entry is evicted
+static struct PTPForeignMaster* ptp_bmca_alloc_entry(struct PTPBmcaState *pB, uint32_t now)
+{
+    struct PTPForeignMaster *pOldest = NULL;
+
+    uint8_t i;
+    for (i = 0; i < PTP_FOREIGN_MASTER_TABLE_SIZE; i++)
+    {
+        struct PTPForeignMaster *pFM = &pB->foreignMasters[i];
+        if (!pFM->valid)
+        {
+            return pFM;
+        }
+
+        if (ptp_bmca_is_parent_entry(pB, pFM))
+        {
+            continue;
+        }
+
+        if (pOldest == NULL || (now - pFM->lastRxTick) > (now - pOldest->lastRxTick))
+        {
+            pOldest = pFM;
+        }
+    }
+
+    return pOldest;
+}
+
+// compare clock identities as octet strings
+static int ptp_bmca_compare_identity(uint64_t a, uint64_t b)
+{
+    return memcmp(&a, &b, sizeof(uint64_t));
+}
+
+#define CMP_FIELD(a,b) if ((a) != (b)) { return ((a) < (b)) ? -1 : 1; }
+
+// dataset comparison algorithm (IEEE 1588-2008, 9.3.4)
+int ptp_bmca_compare(const struct PTPForeignMaster *pA, const struct PTPForeignMaster *pB)
+{
+    const struct PTPAnnounceBody *a = &pA->announce, *b = &pB->announce;
+
+    // different grandmasters: compare grandmaster attributes
+    if (a->grandmasterClockIdentity != b->grandmasterClockIdentity)
+    {
+        CMP_FIELD(a->priority1, b->priority1);
+        CMP_FIELD(a->grandmasterClockQuality.clockClass, b->grandmasterClockQuality.clockClass);
+        CMP_FIELD(a->grandmasterClockQuality.clockAccuracy, b->grandmasterClockQuality.clockAccuracy);
+        CMP_FIELD(a->grandmasterClockQuality.offsetScaledLogVariance, b->grandmasterClockQuality.offsetScaledLogVariance);
+        CMP_FIELD(a->priority2, b->priority2);
+        return ptp_bmca_compare_identity(a->grandmasterClockIdentity, b->grandmasterClockIdentity);
+    }
+
+    // same grandmaster: compare topology (a slave-only port never sends Announces, so the receiver can't be the sender)
+    CMP_FIELD(a->localStepsRemoved, b->localStepsRemoved);
+
+    // tie-break on sender port identity
+    int cmp = ptp_bmca_compare_identity(pA->clockIdentity, pB->clockIdentity);
+    if (cmp != 0)
+    {
+        return cmp;
+    }
+
+    CMP_FIELD(pA->sourcePortID, pB->sourcePortID);
+
+    return 0;
+}
+
+// log parent change
+static void ptp_bmca_log_switchover(const struct PTPBmcaState *pB, const struct PTPForeignMaster *pNew)
+{
+    struct TimestampI t;
+    PTP_HW_GET_TIME(&t);
+
+    MSG("[%u.%09u] BMCA (domain %u): parent ", (uint32_t) t.sec, t.nanosec, pB->domainNumber);
+    if (pB->parent.selected)
+    {
+        ptp_bmca_print_port_identity(pB->parent.clockIdentity, pB->parent.sourcePortID);
+    }
+    else
+    {
+        MSG("(none)");
+    }
+
+    MSG(" -> ");
+    if (pNew != NULL)
+    {
+        ptp_bmca_print_entry(pNew);
+    }
+    else
+    {
+        MSG("(none)\n");
+    }
+}
+
+// select best qualified foreign master as parent
+static bool ptp_bmca_select(struct PTPBmcaState *pB)
+{
+    struct PTPForeignMaster *pBest = NULL;
+
+    uint8_t i;
+    for (i = 0; i < PTP_FOREIGN_MASTER_TABLE_SIZE; i++)
+    {
+        struct PTPForeignMaster *pFM = &pB->foreignMasters[i];
+        if (pFM->valid && pFM->announceCnt >= PTP_FOREIGN_MASTER_THRESHOLD && (pBest == NULL || ptp_bmca_compare(pFM, pBest) < 0))
+        {
+            pBest = pFM;
+        }
+    }
+
+    // check if parent has changed
+    if ((pBest == NULL && !pB->parent.selected) || (pBest != NULL && ptp_bmca_is_parent_entry(pB, pBest)))
+    {
+        return false;
+    }
+
+    ptp_bmca_log_switchover(pB, pBest);
+
+    // store new parent
+    if (pBest != NULL)
+    {
+        pB->parent.clockIdentity = pBest->clockIdentity;
+        pB->parent.sourcePortID = pBest->sourcePortID;
+        pB->parent.selected = true;
+    }
+    else
+    {
+        pB->parent.selected = false;
+    }
+
+    return true;
+}
+
+// process Announce message
+bool ptp_bmca_process_announce(struct PTPBmcaState *pB, struct PTPHeader *pHeader, struct PTPAnnounceBody *pAnn, struct ip_addr *pSrcAddr)
+{
+    uint32_t now = xTaskGetTickCount();
+
+    // remove expired entries
+    ptp_bmca_age(pB, now);
+
+    // discard Announces passed through too many boundary clocks
+    if (pAnn->localStepsRemoved >= PTP_MAX_STEPS_REMOVED)
+    {
+        return ptp_bmca_select(pB);
+    }
+
+    // lookup sender in the table or create a new entry
+    struct PTPForeignMaster *pFM = ptp_bmca_lookup(pB, pHeader->clockIdentity, pHeader->sourcePortID);
+    if (pFM == NULL)
+    {
+        pFM = ptp_bmca_alloc_entry(pB, now);
+        if (pFM == NULL)
+        {
+            return ptp_bmca_select(pB);
+        }
+
+        pFM->clockIdentity = pHeader->clockIdentity;
+        pFM->sourcePortID = pHeader->sourcePortID;
+        pFM->announceCnt = 0;
+        pFM->rxInterval = 0;
+        pFM->valid = true;
+    }
+    else
+    {
+        // duplicates (e.g. arriving in the same tick) don't shrink the measured interval below the shortest one
+        uint32_t minInterval = ptp_bmca_interval_to_ticks(-PTP_MAX_LOG_ANNOUNCE);
+        pFM->rxInterval = ((now - pFM->lastRxTick) > minInterval) ? (now - pFM->lastRxTick) : minInterval;
+    }
+
+    // store dataset
+    pFM->addr = *pSrcAddr;
+    pFM->announce = *pAnn;
+    pFM->logAnnounceInterval = (int8_t) pHeader->logMessagePeriod;
+    pFM->lastRxTick = now;
+    if (pFM->announceCnt < PTP_FOREIGN_MASTER_THRESHOLD)
+    {
+        pFM->announceCnt++;
+    }
+
+    // run state decision
+    return ptp_bmca_select(pB);
+}
+
+// get OS ticks until the first foreign master expires
+uint32_t ptp_bmca_time_to_expiry(const struct PTPBmcaState *pB, uint32_t now)
+{
+    uint32_t left = portMAX_DELAY;
+
+    uint8_t i;
+    for (i = 0; i < PTP_FOREIGN_MASTER_TABLE_SIZE; i++)
+    {
+        const struct PTPForeignMaster *pFM = &pB->foreignMasters[i];
+        if (!pFM->valid)
+        {
+            continue;
+        }
+
+        // entry expires one tick after its timeout has fully elapsed
+        uint32_t age = now - pFM->lastRxTick, timeout = ptp_bmca_receipt_timeout(pFM) + 1;
+        uint32_t entryLeft = (age < timeout) ? (timeout - age) : 0;
+        if (entryLeft < left)
+        {
+            left = entryLeft;
+        }
+    }
+
+    return left;
+}
+
+// remove expired foreign masters and rerun the state decision
+bool ptp_bmca_expire(struct PTPBmcaState *pB, uint8_t *pExpired)
+{
+    *pExpired = ptp_bmca_age(pB, xTaskGetTickCount());
+    if (*pExpired == 0)
+    {
+        return false;
+    }
+
+    return ptp_bmca_select(pB);
+}
+
+// exclude a transport pause from the age of foreign masters
+void ptp_bmca_skip_pause(struct PTPBmcaState *pB, uint32_t pausedTicks)
+{
+    uint8_t i;
+    for (i = 0; i < PTP_FOREIGN_MASTER_TABLE_SIZE; i++)
+    {
+        pB->foreignMasters[i].lastRxTick += pausedTicks;
+    }
+}
+
+// does the message originate from the selected parent?
+bool ptp_bmca_is_parent(const struct PTPBmcaState *pB, struct PTPHeader *pHeader)
+{
+    return pB->parent.selected && pHeader->clockIdentity == pB->parent.clockIdentity && pHeader->sourcePortID == pB->parent.sourcePortID;
+}
+
+// get selected parent
+const struct PTPForeignMaster* ptp_bmca_get_parent(const struct PTPBmcaState *pB)
+{
+    if (!pB->parent.selected)
+    {
+        return NULL;
+    }
+
+    return ptp_bmca_lookup(pB, pB->parent.clockIdentity, pB->parent.sourcePortID);
+}
@@ -0,0 +1,51 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_BMCA_H
+#define PTP_BMCA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ptp.h"
+
+#define PTP_FOREIGN_MASTER_TABLE_SIZE (5) // maximal number of tracked foreign masters
+#define PTP_FOREIGN_MASTER_THRESHOLD (2) // Announces needed to qualify a foreign master
+#define PTP_ANNOUNCE_RECEIPT_TIMEOUT (3) // number of Announce intervals before a foreign master expires
+#define PTP_MAX_LOG_ANNOUNCE (7) // longest Announce interval accepted (log2 s)
+#define PTP_MAX_STEPS_REMOVED (255) // Announces with stepsRemoved reaching this are discarded
+
+// foreign master dataset entry
+struct PTPForeignMaster {
+    uint64_t clockIdentity; // sender's clock identity (network byte order)
+    uint16_t sourcePortID; // sender's port number
+    struct ip_addr addr; // sender's IP address
+    struct PTPAnnounceBody announce; // last Announce body received
+    int8_t logAnnounceInterval; // announce interval advertised by the sender (0x7F: not given, unicast)
+    uint8_t announceCnt; // number of Announces received (saturated at threshold)
+    uint32_t lastRxTick; // OS tick of last Announce reception
+    uint32_t rxInterval; // measured time between the last two Announces [ticks] (0: single Announce received)
+    bool valid; // entry is in use
+};
+
+// BMCA state of a single domain
+struct PTPBmcaState {
+    struct PTPForeignMaster foreignMasters[PTP_FOREIGN_MASTER_TABLE_SIZE]; // foreign master dataset
+    struct {
+        uint64_t clockIdentity; // parent's clock identity
+        uint16_t sourcePortID; // parent's port number
+        bool selected; // is there a parent selected?
+    } parent; // identification of the selected parent
+    uint8_t domainNumber; // domain the state belongs to (used for logging)
+};
+
+void ptp_bmca_reset(struct PTPBmcaState * pB, uint8_t domainNumber); // drop every foreign master and the selected parent
+bool ptp_bmca_process_announce(struct PTPBmcaState * pB, struct PTPHeader * pHeader, struct PTPAnnounceBody * pAnn, struct ip_addr * pSrcAddr); // update table with Announce, returns true if parent has changed
+uint32_t ptp_bmca_time_to_expiry(const struct PTPBmcaState * pB, uint32_t now); // get OS ticks until the first foreign master expires (portMAX_DELAY: table is empty)
+bool ptp_bmca_expire(struct PTPBmcaState * pB, uint8_t * pExpired); // remove foreign masters whose Announce receipt timeout has expired, returns true if parent has changed
+void ptp_bmca_skip_pause(struct PTPBmcaState * pB, uint32_t pausedTicks); // exclude a transport pause from the age of foreign masters (parent is kept over a link flap)
+bool ptp_bmca_is_parent(const struct PTPBmcaState * pB, struct PTPHeader * pHeader); // does the message originate from the selected parent?
+const struct PTPForeignMaster * ptp_bmca_get_parent(const struct PTPBmcaState * pB); // get selected parent (NULL if no parent is selected)
+int ptp_bmca_compare(const struct PTPForeignMaster * pA, const struct PTPForeignMaster * pB); // dataset comparison (<0: A is better, >0: B is better)
+void ptp_bmca_print(const struct PTPBmcaState * pB); // print foreign master table
+
+#endif /* PTP_BMCA_H */
@@ -0,0 +1,485 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_capture.h"
+
+#include <stdlib.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "utils.h"
+#include "cli.h"
+
+// Frames are written by the PTP task and read by the CLI task, each frame is copied inside a critical section.
+// Captures are exported as pcapng (LINKTYPE_IPV4, nanosecond timestamps) with IPv4 and UDP headers rebuilt
+// from the stored addresses.
+
+#define PCAPNG_LINKTYPE_IPV4 (228)
+#define PCAPNG_IP_UDP_HDR_LEN (28) // length of the rebuilt IPv4 and UDP headers
+#define PCAPNG_MAX_BLOCK_LEN (44 + PCAPNG_IP_UDP_HDR_LEN + PTP_CAPTURE_SNAPLEN) // longest block produced
+#define PTP_CAPTURE_DUMP_LINE (32) // bytes printed in a single dump line
+#define PTP_CAPTURE_DUMP_PREFIX "#P "
+
+static struct PTPCapture *spCliCapture; // capture the CLI commands operate on
+
+// --------------------------
+
+// drop captured frames
+void ptp_capture_clear(struct PTPCapture *pC)
+{
+    taskENTER_CRITICAL();
+    memset(pC->frames, 0, sizeof(pC->frames));
+    pC->head = 0;
+    pC->rejected = 0;
+    taskEXIT_CRITICAL();
+}
+
+// check frame against the filter
+static bool ptp_capture_filter(const struct PTPCapture *pC, const uint8_t *pMsg, uint16_t len)
+{
+    if (len < PTP_HEADER_LENGTH)
+    {
+        return false;
+    }
+
+    if (pC->filter.ignoredTypes & (1 << (pMsg[0] & 0x0F)))
+    {
+        return false;
+    }
+
+    if (pC->filter.clockIdEn && memcmp(&pMsg[20], pC->filter.pClockIdentity, 8))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+// capture frame
+uint32_t ptp_capture_frame(struct PTPCapture *pC, enum PTPCaptureDir dir, struct pbuf *pPBuf, const struct ip_addr *pSrcAddr,
+                           const struct ip_addr *pDstAddr)
+{
+    const uint8_t *pMsg = (const uint8_t*) pPBuf->payload;
+
+    if (pC->paused)
+    {
+        return PTP_CAPTURE_NONE;
+    }
+
+    if (!ptp_capture_filter(pC, pMsg, pPBuf->len))
+    {
+        pC->rejected++;
+        return PTP_CAPTURE_NONE;
+    }
+
+    taskENTER_CRITICAL();
+
+    uint32_t frameNo = pC->head;
+    struct PTPCaptureFrame *pF = &pC->frames[frameNo & (PTP_CAPTURE_LENGTH - 1)];
+    pF->frameNo = frameNo;
+    pF->time_s = pPBuf->time_s;
+    pF->time_ns = pPBuf->time_ns;
+    pF->srcAddr = *pSrcAddr;
+    pF->dstAddr = *pDstAddr;
+    pF->port = ((pMsg[0] & 0x0F) < PTPIDFollow_Up) ? PTP_PORT0 : PTP_PORT1; // event messages go to port 319
+    pF->origLen = pPBuf->tot_len;
+    pF->capLen = (pPBuf->len < PTP_CAPTURE_SNAPLEN) ? pPBuf->len : PTP_CAPTURE_SNAPLEN;
+    pF->dir = dir;
+    memcpy(pF->pData, pMsg, pF->capLen);
+    pC->head++;
+
+    taskEXIT_CRITICAL();
+
+    return frameNo;
+}
+
+// set timestamp of a frame still in the ring
+void ptp_capture_set_time(struct PTPCapture *pC, uint32_t frameNo, uint32_t time_s, uint32_t time_ns)
+{
+    struct PTPCaptureFrame *pF = &pC->frames[frameNo & (PTP_CAPTURE_LENGTH - 1)];
+
+    taskENTER_CRITICAL();
+    if (frameNo != PTP_CAPTURE_NONE && pF->frameNo == frameNo && (pC->head - frameNo) <= PTP_CAPTURE_LENGTH)
+    {
+        pF->time_s = time_s;
+        pF->time_ns = time_ns;
+    }
+    taskEXIT_CRITICAL();
+}
+
+// copy frame if it is still in the ring
+static bool ptp_capture_get(struct PTPCapture *pC, uint32_t frameNo, struct PTPCaptureFrame *pFrame)
+{
+    bool valid;
+
+    taskENTER_CRITICAL();
+    *pFrame = pC->frames[frameNo & (PTP_CAPTURE_LENGTH - 1)];
+    valid = (pFrame->frameNo == frameNo) && (pC->head - frameNo) <= PTP_CAPTURE_LENGTH && frameNo < pC->head;
+    taskEXIT_CRITICAL();
+
+    return valid;
+}
+
+// --------------------------
+
+static uint8_t* pcapng_put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t* pcapng_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+// write Section Header and Interface Description Blocks, returns length
+static uint16_t pcapng_write_header(uint8_t *pBuf)
+{
+    uint8_t *p = pBuf;
+
+    // Section Header Block
+    p = pcapng_put32(p, 0x0A0D0D0A); // block type
+    p = pcapng_put32(p, 28); // block length
+    p = pcapng_put32(p, 0x1A2B3C4D); // byte-order magic
+    p = pcapng_put16(p, 1); // version 1.0
+    p = pcapng_put16(p, 0);
+    p = pcapng_put32(p, 0xffffffff); // section length unspecified
+    p = pcapng_put32(p, 0xffffffff);
+    p = pcapng_put32(p, 28);
+
+    // Interface Description Block
+    p = pcapng_put32(p, 0x00000001); // block type
+    p = pcapng_put32(p, 32); // block length
+    p = pcapng_put16(p, PCAPNG_LINKTYPE_IPV4);
+    p = pcapng_put16(p, 0);
+    p = pcapng_put32(p, PCAPNG_IP_UDP_HDR_LEN + PTP_CAPTURE_SNAPLEN); // snaplen
+    p = pcapng_put16(p, 9); // if_tsresol: nanoseconds
+    p = pcapng_put16(p, 1);
+    p = pcapng_put32(p, 9);
+    p = pcapng_put32(p, 0); // opt_endofopt
+    p = pcapng_put32(p, 32);
+
+    return p - pBuf;
+}
+
+// write IPv4 and UDP headers preceding the stored message
+static uint8_t* pcapng_write_ip_udp(uint8_t *p, const struct PTPCaptureFrame *pF)
+{
+    uint8_t *pIP = p;
+    uint16_t ipLen = PCAPNG_IP_UDP_HDR_LEN + pF->origLen;
+
+    // IPv4 header (big endian)
+    memset(pIP, 0, 20);
+    pIP[0] = 0x45; // version 4, 20 byte header
+    pIP[2] = ipLen >> 8;
+    pIP[3] = ipLen;
+    pIP[8] = 1; // TTL
+    pIP[9] = 17; // UDP
+    memcpy(&pIP[12], &pF->srcAddr.addr, 4);
+    memcpy(&pIP[16], &pF->dstAddr.addr, 4);
+
+    // header checksum
+    uint32_t sum = 0;
+    uint8_t i;
+    for (i = 0; i < 20; i += 2)
+    {
+        sum += (pIP[i] << 8) | pIP[i + 1];
+    }
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = ~((sum & 0xffff) + (sum >> 16));
+    pIP[10] = sum >> 8;
+    pIP[11] = sum;
+
+    // UDP header (checksum is not computed)
+    uint8_t *pUDP = pIP + 20;
+    pUDP[0] = pUDP[2] = pF->port >> 8;
+    pUDP[1] = pUDP[3] = pF->port;
+    pUDP[4] = (8 + pF->origLen) >> 8;
+    pUDP[5] = 8 + pF->origLen;
+    pUDP[6] = pUDP[7] = 0;
+
+    return pUDP + 8;
+}
+
+// write Enhanced Packet Block of a frame, returns length
+static uint16_t pcapng_write_frame(uint8_t *pBuf, const struct PTPCaptureFrame *pF)
+{
+    uint16_t capLen = PCAPNG_IP_UDP_HDR_LEN + pF->capLen;
+    uint16_t padLen = (capLen + 3) & ~3;
+    uint16_t blockLen = 28 + padLen + 12 + 4;
+    uint64_t ts = (uint64_t) pF->time_s * NANO_PREFIX + pF->time_ns;
+
+    uint8_t *p = pBuf;
+    p = pcapng_put32(p, 0x00000006); // block type
+    p = pcapng_put32(p, blockLen);
+    p = pcapng_put32(p, 0); // interface ID
+    p = pcapng_put32(p, ts >> 32);
+    p = pcapng_put32(p, ts);
+    p = pcapng_put32(p, capLen);
+    p = pcapng_put32(p, PCAPNG_IP_UDP_HDR_LEN + pF->origLen);
+
+    // packet data
+    p = pcapng_write_ip_udp(p, pF);
+    memcpy(p, pF->pData, pF->capLen);
+    memset(p + pF->capLen, 0, padLen - capLen);
+    p += padLen - PCAPNG_IP_UDP_HDR_LEN;
+
+    // options
+    p = pcapng_put16(p, 2); // epb_flags: direction
+    p = pcapng_put16(p, 4);
+    p = pcapng_put32(p, (pF->dir == PTPCDRx) ? 1 : 2);
+    p = pcapng_put32(p, 0); // opt_endofopt
+    p = pcapng_put32(p, blockLen);
+
+    return p - pBuf;
+}
+
+// --------------------------
+
+// send block in a UDP datagram
+static void ptp_capture_send_block(struct PTPCapture *pC, struct udp_pcb *pPCB, const uint8_t *pBlock, uint16_t len)
+{
+    struct pbuf *pPBuf = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    if (pPBuf == NULL)
+    {
+        return;
+    }
+
+    memcpy(pPBuf->payload, pBlock, len);
+    udp_sendto(pPCB, pPBuf, &pC->export.addr, pC->export.port);
+    pbuf_free(pPBuf);
+}
+
+// perform pending UDP export
+void ptp_capture_periodic(struct PTPCapture *pC, struct udp_pcb *pPCB)
+{
+    uint8_t pBlock[PCAPNG_MAX_BLOCK_LEN];
+    struct PTPCaptureFrame frame;
+
+    if (!pC->export.pending)
+    {
+        return;
+    }
+    pC->export.pending = false;
+
+    // every block is sent in a separate datagram, the collector only has to concatenate them
+    ptp_capture_send_block(pC, pPCB, pBlock, pcapng_write_header(pBlock));
+
+    uint32_t n = (pC->head > PTP_CAPTURE_LENGTH) ? (pC->head - PTP_CAPTURE_LENGTH) : 0;
+    for (; n < pC->head; n++)
+    {
+        if (ptp_capture_get(pC, n, &frame))
+        {
+            ptp_capture_send_block(pC, pPCB, pBlock, pcapng_write_frame(pBlock, &frame));
+        }
+    }
+}
+
+// print block as hexadecimal lines (waits for room in the transmit buffer instead of dropping lines)
+static void ptp_capture_print_block(const uint8_t *pBlock, uint16_t len)
+{
+    static const char spHex[] = "0123456789ABCDEF";
+    char pLine[sizeof(PTP_CAPTURE_DUMP_PREFIX) + 2 * PTP_CAPTURE_DUMP_LINE + 1];
+
+    uint16_t i, k;
+    for (i = 0; i < len; i += PTP_CAPTURE_DUMP_LINE)
+    {
+        char *p = pLine;
+        strcpy(p, PTP_CAPTURE_DUMP_PREFIX);
+        p += sizeof(PTP_CAPTURE_DUMP_PREFIX) - 1;
+
+        for (k = i; k < len && k < i + PTP_CAPTURE_DUMP_LINE; k++)
+        {
+            *(p++) = spHex[pBlock[k] >> 4];
+            *(p++) = spHex[pBlock[k] & 0x0F];
+        }
+        *(p++) = '\n';
+        *p = '\0';
+
+        while (!MSG("%s", pLine))
+        {
+            vTaskDelay(1);
+        }
+    }
+}
+
+// --------------------------
+
+// print capture state and filter
+static void ptp_capture_print_status(const struct PTPCapture *pC)
+{
+    MSG("> Capture: %s, frames: %u (kept: %u), rejected: %u\n", pC->paused ? "off" : "on", pC->head,
+        (pC->head < PTP_CAPTURE_LENGTH) ? pC->head : PTP_CAPTURE_LENGTH, pC->rejected);
+
+    MSG("> Filter: message types:");
+    uint8_t i;
+    for (i = 0; i < 16; i++)
+    {
+        if (!(pC->filter.ignoredTypes & (1 << i)))
+        {
+            MSG(" %u", i);
+        }
+    }
+
+    if (pC->filter.clockIdEn)
+    {
+        MSG(", clockIdentity: ");
+        for (i = 0; i < 8; i++)
+        {
+            MSG("%02X", pC->filter.pClockIdentity[i]);
+        }
+    }
+
+    MSG("\n");
+}
+
+static int CB_dump(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPCapture *pC = spCliCapture;
+    uint8_t pBlock[PCAPNG_MAX_BLOCK_LEN];
+    struct PTPCaptureFrame frame;
+
+    ptp_capture_print_block(pBlock, pcapng_write_header(pBlock));
+
+    uint32_t head = pC->head;
+    uint32_t n = (head > PTP_CAPTURE_LENGTH) ? (head - PTP_CAPTURE_LENGTH) : 0;
+    for (; n < head; n++)
+    {
+        if (ptp_capture_get(pC, n, &frame))
+        {
+            ptp_capture_print_block(pBlock, pcapng_write_frame(pBlock, &frame));
+        }
+    }
+
+    return 0;
+}
+
+static int CB_filter(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPCapture *pC = spCliCapture;
+
+    if (argc > 0)
+    {
+        // message types: "all" or comma separated list
+        uint16_t ignored = 0;
+        if (strcmp(ppArgs[0], "all"))
+        {
+            ignored = 0xffff;
+            const char *p = ppArgs[0];
+            while (*p != '\0')
+            {
+                char *pEnd;
+                long type = strtol(p, &pEnd, 0);
+                if (pEnd == p || type < 0 || type > 15)
+                {
+                    return -1;
+                }
+
+                ignored &= ~(1 << type);
+                p = (*pEnd == ',') ? pEnd + 1 : pEnd;
+            }
+        }
+
+        // source clockIdentity: "any" or 16 hexadecimal digits
+        bool clockIdEn = false;
+        uint8_t pClockId[8];
+        if (argc > 1 && strcmp(ppArgs[1], "any"))
+        {
+            if (strlen(ppArgs[1]) != 16)
+            {
+                return -1;
+            }
+
+            uint8_t i;
+            for (i = 0; i < 8; i++)
+            {
+                char pByte[3] = { ppArgs[1][2 * i], ppArgs[1][2 * i + 1], '\0' };
+                char *pEnd;
+                pClockId[i] = strtoul(pByte, &pEnd, 16);
+                if (*pEnd != '\0')
+                {
+                    return -1;
+                }
+            }
+
+            clockIdEn = true;
+        }
+
+        pC->filter.ignoredTypes = ignored;
+        memcpy(pC->filter.pClockIdentity, pClockId, 8);
+        pC->filter.clockIdEn = clockIdEn;
+    }
+
+    ptp_capture_print_status(pC);
+    return 0;
+}
+
+static int CB_mode(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPCapture *pC = spCliCapture;
+
+    if (argc > 0)
+    {
+        if (!strcmp(ppArgs[0], "on"))
+        {
+            pC->paused = false;
+        }
+        else if (!strcmp(ppArgs[0], "off"))
+        {
+            pC->paused = true;
+        }
+        else if (!strcmp(ppArgs[0], "clear"))
+        {
+            ptp_capture_clear(pC);
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    ptp_capture_print_status(pC);
+    return 0;
+}
+
+static int CB_send(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPCapture *pC = spCliCapture;
+
+    struct ip_addr addr;
+    addr.addr = ipaddr_addr(ppArgs[0]);
+    if (addr.addr == IPADDR_NONE)
+    {
+        return -1;
+    }
+
+    pC->export.addr = addr;
+    pC->export.port = (argc > 1) ? atoi(ppArgs[1]) : PTP_CAPTURE_EXPORT_PORT;
+    pC->export.pending = true; // performed by the PTP task
+
+    return 0;
+}
+
+// cli commands (sorted)
+static const struct CliCommand spCliCmds[] = {
+    { "ptp capture dump", "\t\t\tPrint captured frames as pcapng (hex lines prefixed by '" PTP_CAPTURE_DUMP_PREFIX "')", 0, CB_dump },
+    { "ptp capture filter", "[{all|t0,t1...} [clockId|any]] \t\t\tSet or query capture filter", 0, CB_filter },
+    { "ptp capture mode", "[on|off|clear] \t\t\tControl or query packet capture", 0, CB_mode },
+    { "ptp capture send", "ip [port] \t\t\tSend captured frames as pcapng over UDP", 1, CB_send },
+};
+
+static struct CliCommandTable sCliTable = CLI_COMMAND_TABLE(spCliCmds);
+
+// register CLI commands operating on the passed capture
+void ptp_capture_register_cli_commands(struct PTPCapture *pC)
+{
+    spCliCapture = pC;
+
+    cli_register_table(&sCliTable);
+}
@@ -0,0 +1,57 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_CAPTURE_H
+#define PTP_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ptp.h"
+
+#define PTP_CAPTURE_LENGTH (32) // number of frames kept (power of 2)
+#define PTP_CAPTURE_SNAPLEN (64) // number of PTP message bytes kept per frame (covers every message except long Signalings)
+#define PTP_CAPTURE_EXPORT_PORT (5555) // default UDP port captures are exported to
+#define PTP_CAPTURE_NONE (0xffffffff) // frame number returned for frames rejected by the filter
+
+// frame directions
+enum PTPCaptureDir {
+    PTPCDRx = 0, PTPCDTx
+};
+
+// captured frame
+struct PTPCaptureFrame {
+    uint32_t frameNo; // sequence number of the frame in capture order
+    uint32_t time_s, time_ns; // hardware timestamp (TX frames are updated once the timestamp is known)
+    struct ip_addr srcAddr, dstAddr; // IP addresses
+    uint16_t port; // UDP port
+    uint16_t origLen; // length of the PTP message
+    uint8_t capLen; // number of bytes stored
+    uint8_t dir; // direction (PTPCaptureDir)
+    uint8_t pData[PTP_CAPTURE_SNAPLEN]; // beginning of the PTP message
+};
+
+// frame ring and filter (every field is valid zero-filled: capturing every message)
+struct PTPCapture {
+    struct PTPCaptureFrame frames[PTP_CAPTURE_LENGTH]; // frame storage
+    uint32_t head; // number of frames captured
+    uint32_t rejected; // frames rejected by the filter
+    bool paused; // capturing is paused
+    struct {
+        uint16_t ignoredTypes; // bitmask of ignored message types
+        bool clockIdEn; // filter on source clockIdentity
+        uint8_t pClockIdentity[8]; // accepted source clockIdentity
+    } filter; // capture filter
+    struct {
+        struct ip_addr addr; // collector address
+        uint16_t port; // collector port
+        bool pending; // export requested
+    } export; // UDP export request
+};
+
+void ptp_capture_clear(struct PTPCapture * pC); // drop captured frames (filter is kept)
+uint32_t ptp_capture_frame(struct PTPCapture * pC, enum PTPCaptureDir dir, struct pbuf * pPBuf, const struct ip_addr * pSrcAddr, const struct ip_addr * pDstAddr); // capture frame, returns frame number or PTP_CAPTURE_NONE
+void ptp_capture_set_time(struct PTPCapture * pC, uint32_t frameNo, uint32_t time_s, uint32_t time_ns); // set timestamp of a frame still in the ring
+void ptp_capture_periodic(struct PTPCapture * pC, struct udp_pcb * pPCB); // perform pending UDP export (call from the task processing packets)
+void ptp_capture_register_cli_commands(struct PTPCapture * pC); // register CLI commands operating on the passed capture
+
+#endif /* PTP_CAPTURE_H */
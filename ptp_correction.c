@@ -0,0 +1,41 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_correction.h"
+
+// compute master - slave time difference
+void ptp_corr_time_difference(struct TimestampI *pD, const struct SyncCycleData *pSync, const struct TimestampI *pOffset)
+{
+    // copy timestamps to assign then with meaningful names
+    struct TimestampI syncMa = pSync->t1, syncSl = pSync->t2, delReqSl = pSync->t3, delReqMa = pSync->t4, offset = *pOffset;
+
+    // compute difference between master and slave clock
+    subTime(pD, &syncSl, &syncMa); // t2 - t1 ...
+    subTime(pD, pD, &delReqMa); // - t4 ...
+    addTime(pD, pD, &delReqSl); // + t3
+    divTime(pD, pD, 2); // division by 2
+
+    // substract offset
+    subTime(pD, pD, &offset);
+
+    // normalize time difference (eliminate malformed time value issues)
+    normTime(pD);
+}
+
+// compute mean path delay
+void ptp_corr_mean_path_delay(struct TimestampI *pDelay, const struct SyncCycleData *pSync)
+{
+    struct TimestampI syncMa = pSync->t1, syncSl = pSync->t2, delReqSl = pSync->t3, delReqMa = pSync->t4, delayReq;
+
+    subTime(pDelay, &syncSl, &syncMa); // t2 - t1 ...
+    subTime(&delayReq, &delReqMa, &delReqSl); // + t4 - t3
+    addTime(pDelay, pDelay, &delayReq);
+    divTime(pDelay, pDelay, 2); // division by 2
+    normTime(pDelay);
+}
+
+// compute addend tuned by corr_ppb (the arithmetic is kept identical to the original in-place update)
+uint32_t ptp_corr_tune_addend(uint32_t addend, float corr_ppb, float addendPerPpb)
+{
+    addend += corr_ppb * addendPerPpb;
+    return addend;
+}
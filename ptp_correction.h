@@ -0,0 +1,27 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_CORRECTION_H
+#define PTP_CORRECTION_H
+
+#include <stdint.h>
+
+#include "timeutils.h"
+
+// This module holds the arithmetic of the clock correction without any hardware or OS dependency, so that
+// the same code runs on the device and in host tools (see host/ptp_replay.c).
+
+// Data to perform a full synchronization
+struct SyncCycleData {
+    struct TimestampI t1; // Sync transmission time by master clock
+    struct TimestampI t2; // Sync reception time by slave clock
+    struct TimestampI t3; // Delay_Req transmission time by slave clock
+    struct TimestampI t4; // Delay_Resp reception time by master clock
+    int32_t corrFollowUp; // correction field of Follow_Up [ns]
+    int32_t corrDelayResp; // correction field of Delay_Resp [ns]
+};
+
+void ptp_corr_time_difference(struct TimestampI * pD, const struct SyncCycleData * pSync, const struct TimestampI * pOffset); // compute master - slave time difference (d = ((t2 - t1) - (t4 - t3)) / 2 - offset)
+void ptp_corr_mean_path_delay(struct TimestampI * pDelay, const struct SyncCycleData * pSync); // compute mean path delay (((t2 - t1) + (t4 - t3)) / 2)
+uint32_t ptp_corr_tune_addend(uint32_t addend, float corr_ppb, float addendPerPpb); // compute addend tuned by corr_ppb
+
+#endif /* PTP_CORRECTION_H */
@@ -0,0 +1,83 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_domain.h"
+
+#include <stdlib.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+// can the domain take part in voting?
+bool ptp_domain_is_usable(const struct PTPDomain *pDomain)
+{
+    return pDomain->offsetValid && pDomain->bmca.parent.selected
+            && (xTaskGetTickCount() - pDomain->offsetTick) <= pdMS_TO_TICKS(PTP_DOMAIN_VALIDITY_MS);
+}
+
+// compare grandmaster quality of two domains (<0: A is better, >0: B is better)
+static int ptp_domain_compare_quality(const struct PTPDomain *pA, const struct PTPDomain *pB)
+{
+    const struct PTPForeignMaster *pParentA = ptp_bmca_get_parent(&pA->bmca);
+    const struct PTPForeignMaster *pParentB = ptp_bmca_get_parent(&pB->bmca);
+
+    if (pParentA == NULL || pParentB == NULL)
+    {
+        return (pParentA != NULL) ? -1 : ((pParentB != NULL) ? 1 : 0);
+    }
+
+    return ptp_bmca_compare(pParentA, pParentB);
+}
+
+// select domain to drive the clock
+//
+// Every usable domain is supported by the usable domains whose offset estimate lies within
+// PTP_DOMAIN_AGREEMENT_NS of its own. The domain with the largest support is selected, ties are broken by
+// grandmaster quality. A grandmaster disagreeing with the majority thus gets rejected. The active domain is
+// kept if no domain is strictly better and it remains the active one if no domain is usable at all.
+int ptp_domain_vote(struct PTPDomain *pDomains, uint8_t n, int active)
+{
+    bool pUsable[PTP_MAX_DOMAINS];
+    uint8_t i, k;
+
+    // determine usable domains
+    for (i = 0; i < n; i++)
+    {
+        pUsable[i] = ptp_domain_is_usable(&pDomains[i]);
+    }
+
+    // count supporting domains
+    for (i = 0; i < n; i++)
+    {
+        pDomains[i].support = 0;
+        if (!pUsable[i])
+        {
+            continue;
+        }
+
+        for (k = 0; k < n; k++)
+        {
+            if (pUsable[k] && llabs(pDomains[i].offset_ns - pDomains[k].offset_ns) <= PTP_DOMAIN_AGREEMENT_NS)
+            {
+                pDomains[i].support++;
+            }
+        }
+    }
+
+    // select best domain, start from the active one to prefer it on ties
+    int best = (active >= 0 && active < n && pUsable[active]) ? active : -1;
+    for (i = 0; i < n; i++)
+    {
+        if (!pUsable[i] || i == best)
+        {
+            continue;
+        }
+
+        if (best < 0 || pDomains[i].support > pDomains[best].support
+                || (pDomains[i].support == pDomains[best].support && ptp_domain_compare_quality(&pDomains[i], &pDomains[best]) < 0))
+        {
+            best = i;
+        }
+    }
+
+    return (best < 0) ? active : best;
+}
@@ -0,0 +1,72 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_DOMAIN_H
+#define PTP_DOMAIN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ptp.h"
+#include "ptp_bmca.h"
+
+#define PTP_MAX_DOMAINS (3) // maximal number of simultaneously tracked domains
+#define PTP_DOMAIN_AGREEMENT_NS (1000) // domains whose offsets differ less than this are considered to agree
+#define PTP_DOMAIN_VALIDITY_MS (5000) // offset estimates older than this don't take part in voting
+#define PTP_SYNC_RECEIPT_TIMEOUT (3) // number of Sync intervals without Sync before synchronization is reset
+#define PTP_SYNC_RECEIPT_MIN_MS (50) // lower bound of the Sync receipt timeout (absorbs PTP task latency at high Sync rates)
+
+// state machine states
+enum FSMState
+{
+    SIdle, SWaitFollowUp, SWaitDelayResp
+};
+
+struct PTPStats;
+
+// timeout tracked as an OS tick deadline by the PTP task
+struct PTPDeadline {
+    uint32_t tick; // OS tick of expiry
+    bool armed; // deadline is running
+};
+
+// offset averaging of the decimated (high Sync rate) operation
+struct PTPDecimation {
+    int64_t sum_ns; // sum of the offset samples of the current window
+    int64_t sumWeighted_ns; // sum of the offset samples weighted by their index in the window
+    uint8_t cnt; // number of samples in the current window
+    uint8_t delayReqAt; // sample of the current window the Delay_Req is sent after
+    int64_t syncDiff_ns; // t2 - t1 of the last Sync
+    int64_t delay_ns; // smoothed mean path delay
+    bool delayValid; // path delay has been measured
+    bool delayReqPending; // Delay_Req awaiting its Delay_Resp
+    uint32_t delayReqTick; // OS tick of the last Delay_Req
+};
+
+// per-domain synchronization state
+struct PTPDomain {
+    uint8_t domainNumber; // PTP domain number
+    enum FSMState state; // state
+    uint16_t sequenceID, delay_reqSequenceID; // last sequency IDs
+    struct ip_addr syncSrcAddr; // sender of last Sync (Delay_Req destination in hybrid mode)
+    struct SyncCycleData syncData; // full dataset for performing synchronization
+    struct PTPHeader delayReqHeader; // header for sending Delay_Req messages
+    struct pbuf * pDelayReqPBuf; // last Delay_Req sent (holds the TX timestamp)
+    uint32_t delayReqFrameNo; // capture frame number of the last Delay_Req
+    struct PTPDeadline responseDeadline; // Follow_Up and Delay_Resp must arrive before this (dropout detection)
+    struct PTPDeadline syncDeadline; // next Sync must arrive before this
+    uint32_t syncTick; // OS tick of the last Sync from the parent (valid while syncDeadline is armed)
+    struct PTPDecimation decim; // offset averaging state (decimated operation)
+    struct PTPBmcaState bmca; // foreign masters and parent
+    PTP_SERVO_STATE_TYPE servo; // servo instance
+    int64_t offset_ns; // last offset estimate (master - slave)
+    float corr_ppb; // last servo output
+    uint32_t offsetTick; // OS tick of the last offset estimate
+    bool offsetValid; // at least one offset estimate is available
+    uint8_t support; // number of usable domains agreeing with this one (computed by voting)
+    struct PTPStats * pStats; // statistics of the owning instance
+};
+
+int ptp_domain_vote(struct PTPDomain * pDomains, uint8_t n, int active); // select domain to drive the clock (returns index)
+bool ptp_domain_is_usable(const struct PTPDomain * pDomain); // can the domain take part in voting?
+
+#endif /* PTP_DOMAIN_H */
@@ -0,0 +1,79 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_evlog.h"
+
+#include <stddef.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "utils.h"
+#include "ptp_trace.h"
+
+// The producer (PTP task) runs at a higher priority than the consumer (drain task), so the consumer never observes
+// a half-written record: a record only becomes visible when head is advanced after the record has been filled.
+
+// get slot for the next record
+struct PTPEvLogRecord* ptp_evlog_reserve(struct PTPEventLog *pLog)
+{
+    if ((pLog->head - pLog->tail) >= PTP_EVLOG_LENGTH)
+    {
+        pLog->overflows++;
+        return NULL;
+    }
+
+    return &pLog->records[pLog->head & (PTP_EVLOG_LENGTH - 1)];
+}
+
+// publish record filled in the reserved slot
+void ptp_evlog_commit(struct PTPEventLog *pLog)
+{
+    pLog->head++;
+}
+
+// fetch oldest record
+bool ptp_evlog_pop(struct PTPEventLog *pLog, struct PTPEvLogRecord *pRec)
+{
+    if (pLog->tail == pLog->head)
+    {
+        return false;
+    }
+
+    *pRec = pLog->records[pLog->tail & (PTP_EVLOG_LENGTH - 1)];
+    pLog->tail++;
+
+    return true;
+}
+
+// print a line, waiting for room in the output buffer (the text of a popped record must not get lost)
+#define PTP_EVLOG_MSG(...) while (!MSG(__VA_ARGS__)) { vTaskDelay(1); }
+
+// print record in the CLI log format (blocks while the output buffer is full)
+void ptp_evlog_print(const struct PTPEvLogRecord *pRec)
+{
+    if (pRec->flags & PTP_EVLOG_FLAG_LOG_TRACE)
+    {
+        char pLine[PTP_TRACE_LINE_LENGTH];
+        ptp_trace_format(pLine, pRec);
+        PTP_EVLOG_MSG("%s\n", pLine);
+    }
+
+    if (pRec->flags & PTP_EVLOG_FLAG_LOG_CORR)
+    {
+        PTP_EVLOG_MSG("C [Follow_Up]: %d\n", pRec->corrFollowUp);
+        PTP_EVLOG_MSG("C [Del_Resp]: %d\n", pRec->corrDelayResp);
+    }
+
+    // only fine corrections of the active domain are listed (coarse corrections are reported immediately)
+    if ((pRec->flags & (PTP_EVLOG_FLAG_ACTIVE | PTP_EVLOG_FLAG_COARSE | PTP_EVLOG_FLAG_LOG_DEF)) == (PTP_EVLOG_FLAG_ACTIVE | PTP_EVLOG_FLAG_LOG_DEF))
+    {
+        PTP_EVLOG_MSG("%d %d %d %d %d %d %d 0x%X\n", pRec->t[0].sec, pRec->t[0].nanosec, pRec->t[3].sec, pRec->t[3].nanosec, pRec->offset.sec,
+            pRec->offset.nanosec, pRec->offsetTicks, pRec->addend);
+    }
+}
+
+// print ring counters
+void ptp_evlog_print_status(const struct PTPEventLog *pLog)
+{
+    MSG("> Event log: written: %u, pending: %u, dropped: %u\n", pLog->head, pLog->head - pLog->tail, pLog->overflows);
+}
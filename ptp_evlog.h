@@ -0,0 +1,54 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_EVLOG_H
+#define PTP_EVLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PTP_EVLOG_LENGTH (32) // number of records in the ring (power of 2)
+
+// record flags
+#define PTP_EVLOG_FLAG_ACTIVE (1 << 0) // domain was driving the clock
+#define PTP_EVLOG_FLAG_COARSE (1 << 1) // clock was jumped instead of tuned
+#define PTP_EVLOG_FLAG_LOG_DEF (1 << 2) // general logging was on
+#define PTP_EVLOG_FLAG_LOG_CORR (1 << 3) // logging of correction fields was on
+#define PTP_EVLOG_FLAG_LOG_TRACE (1 << 4) // binary tracing was on
+#define PTP_EVLOG_FLAG_DECIMATED (1 << 5) // offset is the window fit of decimated operation (t1..t4 belong to the last sample)
+
+// timestamp as stored in the records
+struct PTPEvLogTime {
+    int32_t sec; // seconds (lower 32 bits)
+    int32_t nanosec; // nanoseconds
+};
+
+// record of a completed synchronization cycle
+struct PTPEvLogRecord {
+    struct PTPEvLogTime t[4]; // t1..t4
+    struct PTPEvLogTime offset; // measured time difference
+    int32_t offsetTicks; // time difference in clock ticks
+    uint32_t addendPrev; // addend before correction
+    uint32_t addend; // addend after correction
+    int32_t ppsOffset; // PPS offset option in effect [ns]
+    int32_t corrFollowUp; // correction field of Follow_Up [ns]
+    int32_t corrDelayResp; // correction field of Delay_Resp [ns]
+    uint16_t sequenceID; // sequenceID of Sync
+    uint8_t domainNumber; // domain the cycle belongs to
+    uint8_t flags; // PTP_EVLOG_FLAG_...
+};
+
+// single producer, single consumer record ring
+struct PTPEventLog {
+    struct PTPEvLogRecord records[PTP_EVLOG_LENGTH]; // record storage
+    volatile uint32_t head; // number of records written (modified by the producer only)
+    volatile uint32_t tail; // number of records consumed (modified by the consumer only)
+    volatile uint32_t overflows; // records dropped due to a full ring
+};
+
+struct PTPEvLogRecord * ptp_evlog_reserve(struct PTPEventLog * pLog); // get slot for the next record (NULL and overflow is counted if the ring is full)
+void ptp_evlog_commit(struct PTPEventLog * pLog); // publish record filled in the reserved slot
+bool ptp_evlog_pop(struct PTPEventLog * pLog, struct PTPEvLogRecord * pRec); // fetch oldest record, returns false if the ring is empty
+void ptp_evlog_print(const struct PTPEvLogRecord * pRec); // print record in the CLI log format (waits for room in the output buffer, records pile up in the ring meanwhile)
+void ptp_evlog_print_status(const struct PTPEventLog * pLog); // print ring counters
+
+#endif /* PTP_EVLOG_H */
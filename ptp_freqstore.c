@@ -0,0 +1,319 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_freqstore.h"
+
+#include <stdlib.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "utils.h"
+#include "cli.h"
+
+// The storage is only accessed by the PTP task, the CLI task only posts requests.
+
+static struct PTPFreqStore *spCliFreqStore; // store the CLI commands operate on
+
+// --------------------------
+
+// CRC-32 (IEEE 802.3, bitwise: records are short and rarely processed)
+static uint32_t ptp_freqstore_crc32(const uint32_t *pWords, uint8_t n)
+{
+    uint32_t crc = 0xffffffff;
+
+    uint8_t i, k;
+    for (i = 0; i < n * 4; i++)
+    {
+        crc ^= (pWords[i / 4] >> ((i % 4) * 8)) & 0xff;
+        for (k = 0; k < 8; k++)
+        {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+        }
+    }
+
+    return ~crc;
+}
+
+// is the addend within PTP_FREQSTORE_MAX_PPM of the nominal one? (rejects frequencies a crystal can't be off by)
+static bool ptp_freqstore_addend_valid(uint32_t addend)
+{
+    uint32_t diff = (addend > PTP_ADDEND_INIT) ? (addend - PTP_ADDEND_INIT) : (PTP_ADDEND_INIT - addend);
+    return addend != 0 && (uint64_t) diff * 1000000 < (uint64_t) PTP_ADDEND_INIT * PTP_FREQSTORE_MAX_PPM;
+}
+
+// get frequency offset of the oscillator corrected by an addend [1E-12] (addend must be valid)
+static int32_t ptp_freqstore_addend_to_ppt(uint32_t addend)
+{
+    return (int32_t) (((int64_t) PTP_ADDEND_INIT - (int64_t) addend) * 1000000000000LL / addend);
+}
+
+// get address of a slot
+static uint32_t ptp_freqstore_slot_addr(uint8_t slot)
+{
+    return PTP_FREQSTORE_BASE + slot * PTP_FREQSTORE_SLOT_SIZE;
+}
+
+// read and check record of a slot
+static bool ptp_freqstore_read_slot(uint8_t slot, struct PTPFreqRecord *pRec)
+{
+    uint32_t pW[PTP_FREQSTORE_RECORD_WORDS];
+    PTP_NVS_READ(ptp_freqstore_slot_addr(slot), pW, sizeof(pW));
+
+    if (pW[0] != PTP_FREQSTORE_MAGIC || pW[1] != PTP_FREQSTORE_VERSION
+            || pW[PTP_FREQSTORE_RECORD_WORDS - 1] != ptp_freqstore_crc32(pW, PTP_FREQSTORE_RECORD_WORDS - 1))
+    {
+        return false;
+    }
+
+    pRec->sequence = pW[2];
+    pRec->addend = pW[3];
+    pRec->freqOffset_ppt = (int32_t) pW[4];
+    pRec->samples = pW[5];
+
+    // reject frequencies a crystal can't be off by (e.g. record of another board type)
+    return ptp_freqstore_addend_valid(pRec->addend);
+}
+
+// write record into a slot and verify it
+static bool ptp_freqstore_write_slot(uint8_t slot, const struct PTPFreqRecord *pRec)
+{
+    uint32_t pW[PTP_FREQSTORE_RECORD_WORDS] = { PTP_FREQSTORE_MAGIC, PTP_FREQSTORE_VERSION, pRec->sequence, pRec->addend,
+                                                (uint32_t) pRec->freqOffset_ppt, pRec->samples, 0, 0 };
+    pW[PTP_FREQSTORE_RECORD_WORDS - 1] = ptp_freqstore_crc32(pW, PTP_FREQSTORE_RECORD_WORDS - 1);
+
+    if (PTP_NVS_WRITE(ptp_freqstore_slot_addr(slot), pW, sizeof(pW)) != 0)
+    {
+        return false;
+    }
+
+    struct PTPFreqRecord check;
+    return ptp_freqstore_read_slot(slot, &check) && check.sequence == pRec->sequence && check.addend == pRec->addend;
+}
+
+// restart lock detection
+static void ptp_freqstore_unlock(struct PTPFreqStore *pF)
+{
+    pF->lock.cnt = 0;
+    pF->lock.addendSum = 0;
+    pF->lock.samples = 0;
+}
+
+// --------------------------
+
+// initialize storage and load the last valid record
+void ptp_freqstore_init(struct PTPFreqStore *pF)
+{
+    pF->size = PTP_NVS_INIT();
+    pF->valid = false;
+    pF->saved = false;
+    ptp_freqstore_unlock(pF);
+
+    if (pF->size < ptp_freqstore_slot_addr(PTP_FREQSTORE_SLOTS))
+    {
+        pF->size = 0;
+        MSG("Frequency store: no storage\n");
+        return;
+    }
+
+    // find the latest valid record
+    struct PTPFreqRecord rec;
+    uint8_t i;
+    for (i = 0; i < PTP_FREQSTORE_SLOTS; i++)
+    {
+        if (ptp_freqstore_read_slot(i, &rec) && (!pF->valid || (int32_t) (rec.sequence - pF->rec.sequence) > 0))
+        {
+            pF->rec = rec;
+            pF->slot = i;
+            pF->valid = true;
+        }
+    }
+
+    if (pF->valid)
+    {
+        int32_t ppt = pF->rec.freqOffset_ppt;
+        MSG("Frequency store: starting on learned frequency (addend: %u, oscillator: %c%u.%03u ppb, record #%u)\n", pF->rec.addend,
+            (ppt < 0) ? '-' : '+', abs(ppt) / 1000, abs(ppt) % 1000, pF->rec.sequence);
+    }
+    else
+    {
+        MSG("Frequency store: no valid record, starting on the nominal frequency\n");
+    }
+}
+
+// get stored addend
+uint32_t ptp_freqstore_get_addend(const struct PTPFreqStore *pF, uint32_t defAddend)
+{
+    return pF->valid ? pF->rec.addend : defAddend;
+}
+
+// feed correction of the clock
+void ptp_freqstore_feed(struct PTPFreqStore *pF, int64_t offset_ns, uint32_t addend)
+{
+    if (offset_ns <= -PTP_FREQSTORE_LOCK_NS || offset_ns >= PTP_FREQSTORE_LOCK_NS)
+    {
+        ptp_freqstore_unlock(pF);
+        return;
+    }
+
+    if (pF->lock.cnt < PTP_FREQSTORE_LOCK_CYCLES)
+    {
+        pF->lock.cnt++;
+        if (pF->lock.cnt == PTP_FREQSTORE_LOCK_CYCLES)
+        {
+            pF->lock.tick = xTaskGetTickCount();
+        }
+        return; // addends of the settling cycles are not averaged
+    }
+
+    pF->lock.addendSum += addend;
+    pF->lock.samples++;
+}
+
+// write the averaged addend
+static void ptp_freqstore_save(struct PTPFreqStore *pF)
+{
+    struct PTPFreqRecord rec;
+    rec.sequence = pF->valid ? (pF->rec.sequence + 1) : 0;
+    rec.addend = (uint32_t) ((pF->lock.addendSum + pF->lock.samples / 2) / pF->lock.samples);
+    rec.samples = pF->lock.samples;
+
+    pF->saveTick = xTaskGetTickCount();
+    pF->saved = true;
+    pF->lock.addendSum = 0;
+    pF->lock.samples = 0;
+
+    // such a record would be rejected when loaded
+    if (!ptp_freqstore_addend_valid(rec.addend))
+    {
+        pF->cnt.skipped++;
+        return;
+    }
+
+    rec.freqOffset_ppt = ptp_freqstore_addend_to_ppt(rec.addend);
+
+    // don't wear the storage with changes below the noise of the estimate
+    if (pF->valid && !pF->saveRequest && abs(rec.freqOffset_ppt - pF->rec.freqOffset_ppt) < PTP_FREQSTORE_MIN_CHANGE_PPB * 1000)
+    {
+        pF->cnt.skipped++;
+        return;
+    }
+
+    // next slot in turn
+    uint8_t slot = pF->valid ? ((pF->slot + 1) % PTP_FREQSTORE_SLOTS) : 0;
+    if (!ptp_freqstore_write_slot(slot, &rec))
+    {
+        pF->cnt.failed++;
+        MSG("Frequency store: writing slot %u failed!\n", slot);
+        return;
+    }
+
+    pF->rec = rec;
+    pF->slot = slot;
+    pF->valid = true;
+    pF->cnt.writes++;
+}
+
+// invalidate every slot
+static void ptp_freqstore_clear(struct PTPFreqStore *pF)
+{
+    uint32_t pW[PTP_FREQSTORE_RECORD_WORDS] = { 0 };
+
+    uint8_t i;
+    for (i = 0; i < PTP_FREQSTORE_SLOTS; i++)
+    {
+        if (PTP_NVS_WRITE(ptp_freqstore_slot_addr(i), pW, sizeof(pW)) != 0)
+        {
+            pF->cnt.failed++;
+        }
+    }
+
+    pF->valid = false;
+}
+
+// write record if due
+void ptp_freqstore_periodic(struct PTPFreqStore *pF)
+{
+    if (pF->size == 0)
+    {
+        pF->saveRequest = pF->clearRequest = false;
+        return;
+    }
+
+    if (pF->clearRequest)
+    {
+        ptp_freqstore_clear(pF);
+        pF->clearRequest = false;
+    }
+
+    uint32_t now = xTaskGetTickCount();
+    bool locked = (pF->lock.cnt == PTP_FREQSTORE_LOCK_CYCLES) && (pF->lock.samples > 0);
+    bool due = locked && (now - pF->lock.tick) >= pdMS_TO_TICKS(PTP_FREQSTORE_FIRST_SAVE_S * 1000)
+            && (!pF->saved || (now - pF->saveTick) >= pdMS_TO_TICKS(PTP_FREQSTORE_SAVE_INTERVAL_S * 1000));
+
+    if (due || (pF->saveRequest && locked))
+    {
+        ptp_freqstore_save(pF);
+    }
+
+    pF->saveRequest = false;
+}
+
+// --------------------------
+
+static int CB_freqstore(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPFreqStore *pF = spCliFreqStore;
+
+    if (argc > 0)
+    {
+        if (!strcmp(ppArgs[0], "save"))
+        {
+            pF->saveRequest = true;
+        }
+        else if (!strcmp(ppArgs[0], "clear"))
+        {
+            pF->clearRequest = true;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    if (pF->size == 0)
+    {
+        MSG("> Frequency store: no storage\n");
+        return 0;
+    }
+
+    if (pF->valid)
+    {
+        int32_t ppt = pF->rec.freqOffset_ppt;
+        MSG("> Record #%u (slot %u): addend: %u, oscillator: %c%u.%03u ppb, %u cycles averaged\n", pF->rec.sequence, pF->slot, pF->rec.addend,
+            (ppt < 0) ? '-' : '+', abs(ppt) / 1000, abs(ppt) % 1000, pF->rec.samples);
+    }
+    else
+    {
+        MSG("> No valid record\n");
+    }
+
+    MSG("> Locked: %s, samples: %u, writes: %u, skipped: %u, failed: %u\n", (pF->lock.cnt == PTP_FREQSTORE_LOCK_CYCLES) ? "yes" : "no",
+        pF->lock.samples, pF->cnt.writes, pF->cnt.skipped, pF->cnt.failed);
+
+    return 0;
+}
+
+// cli commands (sorted)
+static const struct CliCommand spCliCmds[] = {
+    { "ptp freqstore", "[save|clear] \t\t\tQuery learned frequency record, save it now (if locked) or invalidate it", 0, CB_freqstore },
+};
+
+static struct CliCommandTable sCliTable = CLI_COMMAND_TABLE(spCliCmds);
+
+// register CLI commands operating on the passed store
+void ptp_freqstore_register_cli_commands(struct PTPFreqStore *pF)
+{
+    spCliFreqStore = pF;
+
+    cli_register_table(&sCliTable);
+}
@@ -0,0 +1,82 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_FREQSTORE_H
+#define PTP_FREQSTORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ptp.h"
+
+// Learned oscillator frequency kept in non-volatile storage
+//
+// Once the servo has stayed within PTP_FREQSTORE_LOCK_NS for PTP_FREQSTORE_FIRST_SAVE_S, the addend averaged
+// over the locked cycles is written to the storage (PTP_NVS_...() of the port), then again every
+// PTP_FREQSTORE_SAVE_INTERVAL_S if it has moved more than PTP_FREQSTORE_MIN_CHANGE_PPB. ptp_init() starts the
+// clock on the stored addend, so after a reboot the servo only has to remove the phase error instead of
+// learning the frequency offset of the crystal from scratch.
+//
+// Records are written round-robin into PTP_FREQSTORE_SLOTS slots of PTP_FREQSTORE_SLOT_SIZE bytes (one EEPROM
+// block each, so wear is spread over the blocks), the valid record having the highest sequence number is used.
+// A record is valid if its magic, version and checksum match and its addend is within PTP_FREQSTORE_MAX_PPM
+// of the nominal one. Record layout (32-bit words):
+//
+// 0: magic (PTP_FREQSTORE_MAGIC)
+// 1: format version
+// 2: sequence number
+// 3: addend (averaged over the locked cycles)
+// 4: frequency offset of the oscillator relative to nominal [1E-12] (int32)
+// 5: number of cycles averaged
+// 6: reserved (0)
+// 7: checksum (CRC-32 of words 0..6)
+
+#define PTP_FREQSTORE_MAGIC (0x46505450) // "PTPF"
+#define PTP_FREQSTORE_VERSION (1) // format version
+#define PTP_FREQSTORE_BASE (0) // address of the first slot in the storage
+#define PTP_FREQSTORE_SLOT_SIZE (64) // size of a slot (an EEPROM block of the TM4C1294) [bytes]
+#define PTP_FREQSTORE_SLOTS (16) // number of slots used round-robin
+#define PTP_FREQSTORE_RECORD_WORDS (8) // size of a record [words]
+#define PTP_FREQSTORE_LOCK_NS (1000) // the servo is considered locked while the time error stays within this
+#define PTP_FREQSTORE_LOCK_CYCLES (16) // consecutive cycles within PTP_FREQSTORE_LOCK_NS needed for lock
+#define PTP_FREQSTORE_FIRST_SAVE_S (600) // time spent locked before the first save
+#define PTP_FREQSTORE_SAVE_INTERVAL_S (3600) // time between saves
+#define PTP_FREQSTORE_MIN_CHANGE_PPB (10) // smaller frequency changes are not written
+#define PTP_FREQSTORE_MAX_PPM (200) // records farther from the nominal frequency are rejected
+
+// stored record
+struct PTPFreqRecord {
+    uint32_t sequence; // sequence number
+    uint32_t addend; // averaged addend
+    int32_t freqOffset_ppt; // frequency offset of the oscillator [1E-12]
+    uint32_t samples; // number of cycles averaged
+};
+
+// frequency store state (every field is valid zero-filled: no storage)
+struct PTPFreqStore {
+    uint32_t size; // size of the storage (0: no storage)
+    bool valid; // rec holds a valid record
+    struct PTPFreqRecord rec; // last valid record
+    uint8_t slot; // slot of the last valid record
+    struct {
+        uint16_t cnt; // consecutive cycles within PTP_FREQSTORE_LOCK_NS
+        uint32_t tick; // OS tick the lock has been reached at
+        uint64_t addendSum; // sum of the addends since lock or last save
+        uint32_t samples; // number of addends summed
+    } lock; // lock detection and averaging
+    uint32_t saveTick; // OS tick of the last save of this run
+    bool saved; // a save has been made (or skipped for a small change) in this run
+    volatile bool saveRequest, clearRequest; // requests of the CLI (served by the PTP task)
+    struct {
+        uint32_t writes; // records written
+        uint32_t skipped; // saves skipped (frequency hasn't changed enough)
+        uint32_t failed; // writes failed or not verified
+    } cnt; // counters
+};
+
+void ptp_freqstore_init(struct PTPFreqStore * pF); // initialize storage and load the last valid record
+uint32_t ptp_freqstore_get_addend(const struct PTPFreqStore * pF, uint32_t defAddend); // get stored addend (defAddend if there's no valid record)
+void ptp_freqstore_feed(struct PTPFreqStore * pF, int64_t offset_ns, uint32_t addend); // feed time error and addend of a correction of the clock
+void ptp_freqstore_periodic(struct PTPFreqStore * pF); // write record if due (call from the PTP task)
+void ptp_freqstore_register_cli_commands(struct PTPFreqStore * pF); // register CLI commands operating on the passed store
+
+#endif /* PTP_FREQSTORE_H */
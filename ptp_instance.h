@@ -0,0 +1,92 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_INSTANCE_H
+#define PTP_INSTANCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ptp.h"
+#include "ptp_domain.h"
+#include "ptp_unicast.h"
+#include "ptp_master.h"
+#include "ptp_evlog.h"
+#include "ptp_stats.h"
+#include "ptp_metrics.h"
+#include "ptp_capture.h"
+#include "ptp_telemetry.h"
+#include "ptp_freqstore.h"
+
+// receive and processing load counters
+struct PTPLoadCounters {
+    uint32_t rxPackets; // received packets
+    uint32_t rxBytes; // received bytes
+    uint64_t cycles; // CPU cycles spent in packet processing
+    uint32_t blockedCycles; // cycles spent blocked inside processing of the current packet
+    uint32_t startTick; // OS tick of last reset
+};
+
+// request changing state of the synchronization path (applied by ptp_handle_request() in the PTP task)
+enum PTPRequestCode {
+    PTPRQ_RESET = 0, // reset PTP subsystem
+    PTPRQ_SET_DOMAINS, // set tracked domains (and reset)
+    PTPRQ_SET_DECIMATION, // set number of Follow_Ups averaged per servo run
+    PTPRQ_RESET_METRICS, // restart quality metrics
+    PTPRQ_RESET_STATS, // clear statistics
+    PTPRQ_SET_MODE, // set transport mode
+    PTPRQ_RESET_LOAD // reset receive and processing load counters
+};
+
+struct PTPRequest {
+    enum PTPRequestCode code; // request
+    uint8_t pDomainNumbers[PTP_MAX_DOMAINS]; // PTPRQ_SET_DOMAINS: tracked domain numbers
+    uint8_t domainCnt; // PTPRQ_SET_DOMAINS: number of tracked domains
+    uint8_t decimation; // PTPRQ_SET_DECIMATION: Follow_Ups per servo run
+    enum PTPTransportMode mode; // PTPRQ_SET_MODE: transport mode
+};
+
+// complete state of a PTP engine instance (every field is valid zero-filled)
+struct PTPInstance {
+    struct PTPDomain domains[PTP_MAX_DOMAINS]; // tracked domains
+    uint8_t domainCnt; // number of tracked domains
+    int activeDomain; // index of domain driving the hardware clock
+
+    struct {
+        struct TimestampI offset; // PPS signal offset
+        enum PTPTransportMode mode; // transport mode (kept across reinitialization)
+        uint8_t pDomainNumbers[PTP_MAX_DOMAINS]; // tracked domain numbers (kept across reinitialization)
+        uint8_t domainCnt; // number of tracked domains (0: only domain 0 is tracked)
+        uint8_t decimation; // Follow_Ups averaged per servo run (0, 1: full synchronization cycle per Sync) (kept across reinitialization)
+    } options; // PPS subsystem options
+
+    struct PTPLoadCounters load; // receive and processing load counters
+    struct PTPStats stats; // message, state machine and timing statistics
+    struct PTPMetrics metrics; // synchronization quality metrics of the clock
+    struct PTPCapture capture; // last frames sent and received (kept across reinitialization)
+    struct PTPTelemetry telemetry; // binary stream of synchronization cycles (kept across reinitialization)
+    struct PTPUnicastState unicast; // unicast negotiation state
+    struct PTPMaster master; // master operation state (kept across reinitialization)
+    struct PTPEventLog evlog; // records of synchronization cycles
+    struct PTPFreqStore freqStore; // learned oscillator frequency in non-volatile storage
+
+    struct {
+        bool paused; // transport is paused (link lost)
+        uint32_t pauseTick; // OS tick of pausing
+        uint32_t resumeTick; // OS tick of resuming
+        bool relockPending; // time error hasn't got below PTP_RELOCK_NS since resuming
+        uint32_t linkUpTick; // OS tick of the last link-up
+        bool firstSyncPending; // no Sync has been processed since link-up
+    } transport; // transport state (kept across reinitialization)
+
+    uint64_t clockIdentity; // clockIdentity calculated from MAC address
+    struct ip_addr defPTPAddr; // default PTP IP address
+    struct udp_pcb ** pPCBs; // PCBs for sending packets
+    uint32_t addend; // value of addend register
+    fnPTPRequestHook pRequestHook; // passes requests of the CLI to the PTP task (NULL: applied in place) (kept across reinitialization)
+
+    bool logEn; // general logging enabled
+    bool logCorr; // logging of correction fields enabled
+    bool logTrace; // binary tracing of synchronization cycles enabled
+};
+
+#endif /* PTP_INSTANCE_H */
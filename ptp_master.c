@@ -0,0 +1,990 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_master.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "utils.h"
+#include "cli.h"
+
+#define PTP_MASTER_TS_PENDING (0xffffffff) // time_ns of a Sync pbuf until the MAC writes the TX timestamp back
+
+static struct PTPMaster *spCliMaster; // master the CLI commands operate on
+
+static const char *spMsgNames[PTPMM_N] = { "Sync", "Follow_Up", "Delay_Resp", "Announce" };
+static const char *spGrantNames[PTPUC_N] = { "Announce", "Sync", "Delay_Resp" };
+
+// --------------------------
+
+// get interval belonging to a log2 message interval in 1/256 OS ticks
+static uint32_t ptp_master_interval_q8(int8_t logInterval)
+{
+    uint32_t interval = configTICK_RATE_HZ << 8;
+    return (logInterval >= 0) ? (interval << logInterval) : (interval >> -logInterval);
+}
+
+// is the passed OS tick reached? (wrap-around safe)
+static bool ptp_master_due(uint32_t now, uint32_t due)
+{
+    return (int32_t) (now - due) >= 0;
+}
+
+// account processing cost of a message
+static void ptp_master_account(struct PTPMaster *pM, enum PTPMasterMsg kind, uint32_t start)
+{
+    pM->cost[kind].cycles += PTP_CYCLE_COUNTER() - start;
+    pM->cost[kind].cnt++;
+    pM->cnt.sent[kind]++;
+}
+
+// get average processing cost of a message kind in cycles (0: not measured yet)
+static uint32_t ptp_master_avg_cost(const struct PTPMaster *pM, enum PTPMasterMsg kind)
+{
+    return (pM->cost[kind].cnt > 0) ? (uint32_t) (pM->cost[kind].cycles / pM->cost[kind].cnt) : 0;
+}
+
+// are the log2 Sync and Announce intervals supported?
+static bool ptp_master_rates_valid(int8_t logSync, int8_t logAnnounce)
+{
+    return logSync >= PTP_MASTER_MIN_LOG_SYNC && logSync <= PTP_MASTER_MAX_LOG_SYNC && logAnnounce >= PTP_MASTER_MIN_LOG_SYNC
+            && logAnnounce <= PTP_MASTER_MAX_LOG_SYNC;
+}
+
+// get logMessageInterval field of a message (unicast messages carry 0x7F)
+static uint8_t ptp_master_log_interval(int8_t logInterval, bool unicast)
+{
+    return unicast ? 0x7f : (uint8_t) logInterval;
+}
+
+// print IP address
+static void ptp_master_print_addr(const struct ip_addr *pAddr)
+{
+    MSG("%u.%u.%u.%u", ip4_addr1(pAddr), ip4_addr2(pAddr), ip4_addr3(pAddr), ip4_addr4(pAddr));
+}
+
+// print configuration, counters and slave table
+static void ptp_master_print_status(const struct PTPMaster *pM)
+{
+    MSG("> Master: %s, domain: %u, Sync: 2^%d s, Announce: 2^%d s, multicast: %s\n", pM->config.enabled ? "on" : "off", pM->domainNumber,
+        pM->config.logSync, pM->config.logAnnounce, pM->config.multicast ? "on" : "off");
+    MSG("  Sent: Sync %u, Follow_Up %u, Delay_Resp %u, Announce %u\n", pM->cnt.sent[PTPMMSync], pM->cnt.sent[PTPMMFollow_Up],
+        pM->cnt.sent[PTPMMDelay_Resp], pM->cnt.sent[PTPMMAnnounce]);
+    MSG("  TX timestamp timeouts: %u, pipeline full: %u, intervals skipped: %u, grants denied: %u\n", pM->cnt.tsTimeouts, pM->cnt.pipelineFull,
+        pM->cnt.skipped, pM->cnt.grantsDenied);
+
+    uint8_t i, k;
+    for (i = 0; i < PTP_MASTER_MAX_SLAVES; i++)
+    {
+        const struct PTPMasterSlave *pS = &pM->slaves[i];
+        if (!pS->used)
+        {
+            continue;
+        }
+
+        MSG("  ");
+        ptp_master_print_addr(&pS->addr);
+        MSG(":%s", pS->isStatic ? " static" : "");
+
+        for (k = 0; k < PTPUC_N; k++)
+        {
+            if (pS->granted[k])
+            {
+                MSG(" %s (%u s)", spGrantNames[k], pS->duration[k]);
+            }
+        }
+
+        MSG("\n");
+    }
+}
+
+// estimate how many slaves can be served at the passed Sync rate, the limiting resource is returned in ppLimit
+static uint32_t ptp_master_capacity(const struct PTPMaster *pM, uint32_t syncRate, bool multicast, const char **ppLimit)
+{
+    uint32_t cSync = ptp_master_avg_cost(pM, PTPMMSync) + ptp_master_avg_cost(pM, PTPMMFollow_Up);
+    uint32_t cDelayResp = ptp_master_avg_cost(pM, PTPMMDelay_Resp);
+    uint32_t cAnnounce = ptp_master_avg_cost(pM, PTPMMAnnounce);
+    float announceRate = (float) (configTICK_RATE_HZ << 8) / ptp_master_interval_q8(pM->config.logAnnounce);
+
+    // every slave sends a Delay_Req after every Follow_Up
+    float wireSync = syncRate * (float) (PTP_SYNC_PCKT_SIZE + PTP_FOLLOW_UP_PCKT_SIZE + 2 * PTP_MASTER_FRAME_OVERHEAD);
+    float wireDelayResp = syncRate * (float) (PTP_DELAY_RESP_PCKT_SIZE + PTP_MASTER_FRAME_OVERHEAD);
+    float wireAnnounce = announceRate * (PTP_ANNOUNCE_PCKT_SIZE + PTP_MASTER_FRAME_OVERHEAD);
+    float budgetCycles = PTP_CYCLE_FREQ_HZ / 100.0f * PTP_MASTER_CPU_BUDGET_PERCENT;
+    float budgetBytes = PTP_MASTER_LINK_RATE_BPS / 8.0f;
+
+    float nCpu, nLink, nTable;
+    if (multicast)
+    {
+        // Sync, Follow_Up and Announce are sent once, Delay_Resp per slave
+        nCpu = (budgetCycles - syncRate * (float) cSync - announceRate * cAnnounce) / (syncRate * (float) cDelayResp);
+        nLink = (budgetBytes - wireSync - wireAnnounce) / wireDelayResp;
+        nTable = 1E9f;
+    }
+    else
+    {
+        // every message is sent per slave, Syncs of an interval occupy a pipeline slot each
+        nCpu = budgetCycles / (syncRate * (float) (cSync + cDelayResp) + announceRate * cAnnounce);
+        nLink = budgetBytes / (wireSync + wireDelayResp + wireAnnounce);
+        nTable = (PTP_MASTER_MAX_SLAVES < PTP_MASTER_TX_PIPELINE) ? PTP_MASTER_MAX_SLAVES : PTP_MASTER_TX_PIPELINE;
+    }
+
+    float n = nCpu;
+    *ppLimit = "CPU";
+    if (nLink < n)
+    {
+        n = nLink;
+        *ppLimit = "link";
+    }
+    if (nTable < n)
+    {
+        n = nTable;
+        *ppLimit = "table";
+    }
+
+    return (n > 0) ? (uint32_t) n : 0;
+}
+
+// print estimated slave capacities for the supported Sync rates
+static void ptp_master_print_bench(const struct PTPMaster *pM)
+{
+    uint8_t k;
+    for (k = 0; k < PTPMM_N; k++)
+    {
+        if (pM->cost[k].cnt == 0)
+        {
+            MSG("> No %s has been sent yet, run the master with at least one slave first!\n", spMsgNames[k]);
+            return;
+        }
+    }
+
+    MSG("> Cycles/message:");
+    for (k = 0; k < PTPMM_N; k++)
+    {
+        MSG(" %s %u", spMsgNames[k], ptp_master_avg_cost(pM, (enum PTPMasterMsg) k));
+    }
+    MSG(" (%u%% CPU, %u Mbit/s link budget)\n", PTP_MASTER_CPU_BUDGET_PERCENT, PTP_MASTER_LINK_RATE_BPS / 1000000);
+
+    MSG("Sync [Hz] | mcast slaves | ucast slaves\n");
+
+    int8_t logSync;
+    for (logSync = 0; logSync >= PTP_MASTER_MIN_LOG_SYNC; logSync--)
+    {
+        const char *pMcastLimit, *pUcastLimit;
+        uint32_t syncRate = 1 << -logSync;
+        uint32_t nMcast = ptp_master_capacity(pM, syncRate, true, &pMcastLimit);
+        uint32_t nUcast = ptp_master_capacity(pM, syncRate, false, &pUcastLimit);
+        MSG("%9u | %6u (%s) | %6u (%s)\n", syncRate, nMcast, pMcastLimit, nUcast, pUcastLimit);
+    }
+}
+
+static int CB_bench(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    ptp_master_print_bench(spCliMaster);
+    return 0;
+}
+
+static int CB_mode(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPMaster *pM = spCliMaster;
+
+    if (argc > 0)
+    {
+        bool en;
+        if (!strcmp(ppArgs[0], "on"))
+        {
+            en = true;
+        }
+        else if (!strcmp(ppArgs[0], "off"))
+        {
+            en = false;
+        }
+        else
+        {
+            return -1;
+        }
+
+        if (pM->request.mode)
+        {
+            MSG("> Previous mode change is still pending!\n");
+            return 0;
+        }
+
+        // applied by the PTP task
+        pM->request.enable = en;
+        pM->request.mode = true;
+
+        MSG("> Master: %s\n", en ? "on" : "off");
+        return 0;
+    }
+
+    ptp_master_print_status(pM);
+    return 0;
+}
+
+static int CB_rate(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPMaster *pM = spCliMaster;
+
+    if (argc > 0)
+    {
+        int8_t logSync = atoi(ppArgs[0]);
+        int8_t logAnnounce = (argc > 1) ? atoi(ppArgs[1]) : pM->config.logAnnounce;
+        if (!ptp_master_rates_valid(logSync, logAnnounce))
+        {
+            MSG("> Sync interval must be between 2^%d and 2^%d s!\n", PTP_MASTER_MIN_LOG_SYNC, PTP_MASTER_MAX_LOG_SYNC);
+            return 0;
+        }
+
+        if (pM->request.rates)
+        {
+            MSG("> Previous rate change is still pending!\n");
+            return 0;
+        }
+
+        // applied by the PTP task
+        pM->request.logSync = logSync;
+        pM->request.logAnnounce = logAnnounce;
+        pM->request.rates = true;
+
+        MSG("> Master: Sync: 2^%d s, Announce: 2^%d s\n", logSync, logAnnounce);
+        return 0;
+    }
+
+    ptp_master_print_status(pM);
+    return 0;
+}
+
+static int CB_slave(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPMaster *pM = spCliMaster;
+
+    struct ip_addr addr;
+    addr.addr = ipaddr_addr(ppArgs[1]);
+    if (addr.addr == IPADDR_NONE)
+    {
+        return -1;
+    }
+
+    bool add;
+    if (!strcmp(ppArgs[0], "add"))
+    {
+        add = true;
+    }
+    else if (!strcmp(ppArgs[0], "del"))
+    {
+        add = false;
+    }
+    else
+    {
+        return -1;
+    }
+
+    if (pM->request.slave)
+    {
+        MSG("> Previous slave change is still pending!\n");
+        return 0;
+    }
+
+    // applied by the PTP task
+    pM->request.addSlave = add;
+    pM->request.slaveAddr = addr;
+    pM->request.slave = true;
+
+    return 0;
+}
+
+// cli commands (sorted)
+static const struct CliCommand spCliCmds[] = {
+    { "ptp master bench", "\t\t\tEstimate slave capacity per Sync rate from the measured message costs", 0, CB_bench },
+    { "ptp master mode", "[on|off] \t\t\tTurn on or off master operation or print its state", 0, CB_mode },
+    { "ptp master rate", "[logSync [logAnn]] \t\t\tSet or query log2 Sync and Announce intervals", 0, CB_rate },
+    { "ptp master slave", "{add|del} ip \t\t\tAdd or remove a static unicast slave", 2, CB_slave },
+};
+
+static struct CliCommandTable sCliTable = CLI_COMMAND_TABLE(spCliCmds);
+
+// register cli commands operating on the passed master
+void ptp_master_register_cli_commands(struct PTPMaster *pM)
+{
+    spCliMaster = pM;
+
+    cli_register_table(&sCliTable);
+}
+
+// --------------------------
+
+// initialize master (configuration and static slaves of a zero-filled or already initialized state are kept)
+void ptp_master_init(struct PTPMaster *pM, struct udp_pcb *pPCBs[], uint64_t clockIdentity, uint8_t domainNumber)
+{
+    pM->pPCBs = pPCBs;
+    pM->clockIdentity = clockIdentity;
+    pM->domainNumber = domainNumber;
+    pM->mcastAddr.addr = ipaddr_addr(PTP_IGMP_DEFAULT);
+
+    if (!pM->configured)
+    {
+        pM->config.enabled = false;
+        pM->config.multicast = true;
+        pM->config.logSync = PTP_MASTER_DEFAULT_LOG_SYNC;
+        pM->config.logAnnounce = PTP_MASTER_DEFAULT_LOG_ANNOUNCE;
+        memset(pM->slaves, 0, sizeof(pM->slaves));
+        pM->configured = true;
+    }
+
+    // Syncs of a previous run are released by the next poll
+    pM->request.release = true;
+
+    // negotiated slaves don't survive reinitialization
+    uint8_t i;
+    for (i = 0; i < PTP_MASTER_MAX_SLAVES; i++)
+    {
+        memset(pM->slaves[i].granted, 0, sizeof(pM->slaves[i].granted));
+        pM->slaves[i].used = pM->slaves[i].isStatic;
+    }
+
+    memset(&pM->cnt, 0, sizeof(pM->cnt));
+    memset(pM->cost, 0, sizeof(pM->cost));
+
+    pM->syncDue = pM->announceDue = xTaskGetTickCount();
+    pM->syncFrac = 0;
+}
+
+// start/stop master operation (Syncs awaiting their Follow_Up are dropped on stop)
+void ptp_master_enable(struct PTPMaster *pM, bool en)
+{
+    if (en && !pM->config.enabled)
+    {
+        pM->syncDue = pM->announceDue = xTaskGetTickCount(); // start right away
+        pM->syncFrac = 0;
+    }
+    else if (!en)
+    {
+        pM->request.release = true;
+    }
+
+    pM->config.enabled = en;
+}
+
+// is master operation on?
+bool ptp_master_is_enabled(const struct PTPMaster *pM)
+{
+    return pM->config.enabled;
+}
+
+// send messages to the multicast group
+void ptp_master_set_multicast(struct PTPMaster *pM, bool en)
+{
+    pM->config.multicast = en;
+}
+
+// set log2 Sync and Announce intervals
+int ptp_master_set_rates(struct PTPMaster *pM, int8_t logSync, int8_t logAnnounce)
+{
+    if (!ptp_master_rates_valid(logSync, logAnnounce))
+    {
+        return -1;
+    }
+
+    pM->config.logSync = logSync;
+    pM->config.logAnnounce = logAnnounce;
+    return 0;
+}
+
+// find slave by address
+static struct PTPMasterSlave* ptp_master_lookup(struct PTPMaster *pM, const struct ip_addr *pAddr)
+{
+    uint8_t i;
+    for (i = 0; i < PTP_MASTER_MAX_SLAVES; i++)
+    {
+        if (pM->slaves[i].used && ip_addr_cmp(&pM->slaves[i].addr, pAddr))
+        {
+            return &pM->slaves[i];
+        }
+    }
+
+    return NULL;
+}
+
+// find or allocate slot of a slave
+static struct PTPMasterSlave* ptp_master_get_slot(struct PTPMaster *pM, const struct ip_addr *pAddr)
+{
+    struct PTPMasterSlave *pS = ptp_master_lookup(pM, pAddr);
+    if (pS != NULL)
+    {
+        return pS;
+    }
+
+    uint8_t i;
+    for (i = 0; i < PTP_MASTER_MAX_SLAVES; i++)
+    {
+        pS = &pM->slaves[i];
+        if (!pS->used)
+        {
+            memset(pS, 0, sizeof(struct PTPMasterSlave));
+            pS->addr = *pAddr;
+            pS->used = true;
+            return pS;
+        }
+    }
+
+    return NULL;
+}
+
+// add static unicast slave
+int ptp_master_add_slave(struct PTPMaster *pM, const struct ip_addr *pAddr)
+{
+    struct PTPMasterSlave *pS = ptp_master_get_slot(pM, pAddr);
+    if (pS == NULL)
+    {
+        return -1;
+    }
+
+    pS->isStatic = true;
+    return 0;
+}
+
+// remove unicast slave (its grants are dropped)
+int ptp_master_remove_slave(struct PTPMaster *pM, const struct ip_addr *pAddr)
+{
+    struct PTPMasterSlave *pS = ptp_master_lookup(pM, pAddr);
+    if (pS == NULL)
+    {
+        return -1;
+    }
+
+    pS->used = false;
+    pS->isStatic = false;
+    return 0;
+}
+
+// does the slave receive the passed message kind?
+static bool ptp_master_serves(const struct PTPMasterSlave *pS, enum PTPUnicastMsg kind)
+{
+    return pS->used && (pS->isStatic || pS->granted[kind]);
+}
+
+// fill in header fields common to every message sent by the master
+static void ptp_master_init_header(const struct PTPMaster *pM, struct PTPHeader *pHeader, enum PTPMessageID messageID, uint16_t len, bool unicast)
+{
+    memset(pHeader, 0, sizeof(struct PTPHeader));
+    pHeader->messageID = messageID;
+    pHeader->versionPTP = 2;
+    pHeader->messageLength = len;
+    pHeader->subdomainNumber = pM->domainNumber;
+    pHeader->flags.PTP_UNICAST = unicast;
+    pHeader->clockIdentity = pM->clockIdentity;
+    pHeader->sourcePortID = 1;
+}
+
+// construct and send a Sync, its pbuf is kept until the TX timestamp arrives
+static void ptp_master_send_sync(struct PTPMaster *pM, const struct ip_addr *pAddr, bool unicast, uint32_t now)
+{
+    uint32_t start = PTP_CYCLE_COUNTER();
+
+    // find a free pipeline slot
+    struct PTPMasterPendingSync *pP = NULL;
+    uint8_t i;
+    for (i = 0; i < PTP_MASTER_TX_PIPELINE && pP == NULL; i++)
+    {
+        if (pM->pending[i].pPBuf == NULL)
+        {
+            pP = &pM->pending[i];
+        }
+    }
+
+    if (pP == NULL)
+    {
+        pM->cnt.pipelineFull++;
+        return;
+    }
+
+    struct pbuf *pPBuf = pbuf_alloc(PBUF_TRANSPORT, PTP_SYNC_PCKT_SIZE, PBUF_RAM);
+    if (pPBuf == NULL)
+    {
+        return;
+    }
+
+    struct PTPHeader header;
+    ptp_master_init_header(pM, &header, PTPIDSync, PTP_SYNC_PCKT_SIZE, unicast);
+    header.flags.PTP_TWO_STEP = true;
+    header.sequenceID = pM->syncSequenceID;
+    header.control = PTPCONSync;
+    header.logMessagePeriod = ptp_master_log_interval(pM->config.logSync, unicast);
+
+    // originTimestamp is an estimate, the precise one is carried by the Follow_Up
+    struct TimestampI origin;
+    PTP_HW_GET_TIME(&origin);
+
+    ptp_construct_binary_header(pPBuf->payload, &header);
+    ptp_write_binary_timestamps(pPBuf->payload, &origin, 1);
+
+    // the MAC overwrites the marker with the TX timestamp
+    pPBuf->time_ns = PTP_MASTER_TS_PENDING;
+    udp_sendto(pM->pPCBs[0], pPBuf, (struct ip_addr*) pAddr, PTP_PORT0);
+
+    pP->pPBuf = pPBuf;
+    pP->addr = *pAddr;
+    pP->sequenceID = pM->syncSequenceID;
+    pP->sendTick = now;
+
+    ptp_master_account(pM, PTPMMSync, start);
+}
+
+// send Follow_Up of a Sync whose TX timestamp has arrived
+static void ptp_master_send_follow_up(struct PTPMaster *pM, struct PTPMasterPendingSync *pP)
+{
+    uint32_t start = PTP_CYCLE_COUNTER();
+
+    struct pbuf *pPBuf = pbuf_alloc(PBUF_TRANSPORT, PTP_FOLLOW_UP_PCKT_SIZE, PBUF_RAM);
+    if (pPBuf == NULL)
+    {
+        return;
+    }
+
+    bool unicast = !ip_addr_cmp(&pP->addr, &pM->mcastAddr);
+
+    struct PTPHeader header;
+    ptp_master_init_header(pM, &header, PTPIDFollow_Up, PTP_FOLLOW_UP_PCKT_SIZE, unicast);
+    header.sequenceID = pP->sequenceID;
+    header.control = PTPCONFollow_Up;
+    header.logMessagePeriod = ptp_master_log_interval(pM->config.logSync, unicast);
+
+    struct TimestampI t1 = { pP->pPBuf->time_s, pP->pPBuf->time_ns };
+    ptp_construct_binary_header(pPBuf->payload, &header);
+    ptp_write_binary_timestamps(pPBuf->payload, &t1, 1);
+
+    udp_sendto(pM->pPCBs[1], pPBuf, &pP->addr, PTP_PORT1);
+    pbuf_free(pPBuf);
+
+    ptp_master_account(pM, PTPMMFollow_Up, start);
+}
+
+// send Follow_Ups of Syncs having their TX timestamp, give up ones waiting for too long
+static void ptp_master_flush_pipeline(struct PTPMaster *pM, uint32_t now)
+{
+    uint8_t i;
+    for (i = 0; i < PTP_MASTER_TX_PIPELINE; i++)
+    {
+        struct PTPMasterPendingSync *pP = &pM->pending[i];
+        if (pP->pPBuf == NULL)
+        {
+            continue;
+        }
+
+        if (pP->pPBuf->time_ns != PTP_MASTER_TS_PENDING)
+        {
+            ptp_master_send_follow_up(pM, pP);
+        }
+        else if ((now - pP->sendTick) >= pdMS_TO_TICKS(PTP_MASTER_TX_TS_TIMEOUT_MS))
+        {
+            pM->cnt.tsTimeouts++;
+        }
+        else
+        {
+            continue;
+        }
+
+        pbuf_free(pP->pPBuf);
+        pP->pPBuf = NULL;
+    }
+}
+
+// construct and send Announce
+static void ptp_master_send_announce(struct PTPMaster *pM, const struct ip_addr *pAddr, bool unicast)
+{
+    uint32_t start = PTP_CYCLE_COUNTER();
+
+    struct pbuf *pPBuf = pbuf_alloc(PBUF_TRANSPORT, PTP_ANNOUNCE_PCKT_SIZE, PBUF_RAM);
+    if (pPBuf == NULL)
+    {
+        return;
+    }
+
+    struct PTPHeader header;
+    ptp_master_init_header(pM, &header, PTPIDAnnounce, PTP_ANNOUNCE_PCKT_SIZE, unicast);
+    header.sequenceID = pM->announceSequenceID;
+    header.control = PTPCONOther;
+    header.logMessagePeriod = ptp_master_log_interval(pM->config.logAnnounce, unicast);
+
+    struct TimestampI origin;
+    PTP_HW_GET_TIME(&origin);
+
+    uint8_t *p = (uint8_t*) pPBuf->payload;
+    memset(p, 0, PTP_ANNOUNCE_PCKT_SIZE);
+    ptp_construct_binary_header(p, &header);
+    ptp_write_binary_timestamps(p, &origin, 1);
+
+    // fill in body (currentUTCOffset and stepsRemoved are zero)
+    uint16_t variance = htons(PTP_MASTER_CLOCK_VARIANCE);
+    p[47] = PTP_MASTER_PRIORITY1;
+    p[48] = PTP_MASTER_CLOCK_CLASS;
+    p[49] = PTP_MASTER_CLOCK_ACCURACY;
+    memcpy(p + 50, &variance, 2);
+    p[52] = PTP_MASTER_PRIORITY2;
+    memcpy(p + 53, &pM->clockIdentity, 8);
+    p[63] = PTP_MASTER_TIME_SOURCE;
+
+    udp_sendto(pM->pPCBs[1], pPBuf, (struct ip_addr*) pAddr, PTP_PORT1);
+    pbuf_free(pPBuf);
+
+    ptp_master_account(pM, PTPMMAnnounce, start);
+}
+
+// free pbufs of the pipeline
+static void ptp_master_release_pipeline(struct PTPMaster *pM)
+{
+    uint8_t i;
+    for (i = 0; i < PTP_MASTER_TX_PIPELINE; i++)
+    {
+        if (pM->pending[i].pPBuf != NULL)
+        {
+            pbuf_free(pM->pending[i].pPBuf);
+            pM->pending[i].pPBuf = NULL;
+        }
+    }
+
+    pM->request.release = false;
+}
+
+// send due messages and pending Follow_Ups
+uint32_t ptp_master_poll(struct PTPMaster *pM)
+{
+    if (pM->request.release)
+    {
+        ptp_master_release_pipeline(pM);
+    }
+
+    if (!pM->config.enabled)
+    {
+        return portMAX_DELAY;
+    }
+
+    uint32_t now = xTaskGetTickCount();
+    uint8_t i;
+
+    // Follow_Ups of Syncs sent by previous calls
+    ptp_master_flush_pipeline(pM, now);
+
+    // Syncs
+    if (ptp_master_due(now, pM->syncDue))
+    {
+        if (pM->config.multicast)
+        {
+            ptp_master_send_sync(pM, &pM->mcastAddr, false, now);
+        }
+
+        for (i = 0; i < PTP_MASTER_MAX_SLAVES; i++)
+        {
+            if (ptp_master_serves(&pM->slaves[i], PTPUCSync))
+            {
+                ptp_master_send_sync(pM, &pM->slaves[i].addr, true, now);
+            }
+        }
+
+        pM->syncSequenceID++;
+
+        // schedule next one keeping the fractional tick, restart timing if the task has fallen behind
+        uint32_t next = pM->syncFrac + ptp_master_interval_q8(pM->config.logSync);
+        pM->syncDue += next >> 8;
+        pM->syncFrac = next & 0xff;
+        if (ptp_master_due(now, pM->syncDue))
+        {
+            pM->cnt.skipped++;
+            pM->syncDue = now + (ptp_master_interval_q8(pM->config.logSync) >> 8);
+            pM->syncFrac = 0;
+        }
+    }
+
+    // Announces
+    if (ptp_master_due(now, pM->announceDue))
+    {
+        if (pM->config.multicast)
+        {
+            ptp_master_send_announce(pM, &pM->mcastAddr, false);
+        }
+
+        for (i = 0; i < PTP_MASTER_MAX_SLAVES; i++)
+        {
+            if (ptp_master_serves(&pM->slaves[i], PTPUCAnnounce))
+            {
+                ptp_master_send_announce(pM, &pM->slaves[i].addr, true);
+            }
+        }
+
+        pM->announceSequenceID++;
+        pM->announceDue += ptp_master_interval_q8(pM->config.logAnnounce) >> 8;
+        if (ptp_master_due(now, pM->announceDue))
+        {
+            pM->announceDue = now + (ptp_master_interval_q8(pM->config.logAnnounce) >> 8);
+        }
+    }
+
+    // TX timestamps are collected on the next tick
+    for (i = 0; i < PTP_MASTER_TX_PIPELINE; i++)
+    {
+        if (pM->pending[i].pPBuf != NULL)
+        {
+            return 1;
+        }
+    }
+
+    uint32_t syncWait = pM->syncDue - now, announceWait = pM->announceDue - now;
+    return (syncWait < announceWait) ? syncWait : announceWait;
+}
+
+// apply changes of the CLI, expire grants
+void ptp_master_periodic(struct PTPMaster *pM)
+{
+    if (pM->request.mode)
+    {
+        ptp_master_enable(pM, pM->request.enable);
+        pM->request.mode = false;
+    }
+
+    if (pM->request.rates)
+    {
+        ptp_master_set_rates(pM, pM->request.logSync, pM->request.logAnnounce);
+        pM->request.rates = false;
+    }
+
+    if (pM->request.slave)
+    {
+        int ret = pM->request.addSlave ? ptp_master_add_slave(pM, &pM->request.slaveAddr) : ptp_master_remove_slave(pM, &pM->request.slaveAddr);
+        if (ret < 0)
+        {
+            MSG("Master: slave table is full or slave not found!\n");
+        }
+
+        pM->request.slave = false;
+    }
+
+    uint32_t now = xTaskGetTickCount();
+
+    uint8_t i, k;
+    for (i = 0; i < PTP_MASTER_MAX_SLAVES; i++)
+    {
+        struct PTPMasterSlave *pS = &pM->slaves[i];
+        if (!pS->used)
+        {
+            continue;
+        }
+
+        bool granted = false;
+        for (k = 0; k < PTPUC_N; k++)
+        {
+            if (pS->granted[k] && (now - pS->grantTick[k]) >= pdMS_TO_TICKS(pS->duration[k] * 1000))
+            {
+                pS->granted[k] = false;
+            }
+
+            granted |= pS->granted[k];
+        }
+
+        // release slot of negotiated slaves without grants
+        if (!granted && !pS->isStatic)
+        {
+            pS->used = false;
+        }
+    }
+}
+
+// answer Delay_Req
+void ptp_master_process_delay_req(struct PTPMaster *pM, struct pbuf *pPBuf, const struct ip_addr *pSrcAddr)
+{
+    uint32_t start = PTP_CYCLE_COUNTER();
+
+    struct PTPHeader req;
+    ptp_extract_header(&req, pPBuf->payload);
+    if (req.subdomainNumber != pM->domainNumber || pPBuf->len < PTP_DELAY_REQ_PCKT_SIZE)
+    {
+        return;
+    }
+
+    struct pbuf *pResp = pbuf_alloc(PBUF_TRANSPORT, PTP_DELAY_RESP_PCKT_SIZE, PBUF_RAM);
+    if (pResp == NULL)
+    {
+        return;
+    }
+
+    // Delay_Resp goes back the way the Delay_Req came
+    bool unicast = req.flags.PTP_UNICAST;
+
+    struct PTPHeader header;
+    ptp_master_init_header(pM, &header, PTPIDDelay_Resp, PTP_DELAY_RESP_PCKT_SIZE, unicast);
+    header.correction_ns = req.correction_ns;
+    header.correction_subns = req.correction_subns;
+    header.sequenceID = req.sequenceID;
+    header.control = PTPCONelay_Resp;
+    header.logMessagePeriod = ptp_master_log_interval(PTP_MASTER_LOG_MIN_DELAY_REQ, unicast);
+
+    // t4 is the RX timestamp of the Delay_Req
+    struct TimestampI t4 = { pPBuf->time_s, pPBuf->time_ns };
+    uint8_t *p = (uint8_t*) pResp->payload;
+    ptp_construct_binary_header(p, &header);
+    ptp_write_binary_timestamps(p, &t4, 1);
+    memcpy(p + 44, ((uint8_t*) pPBuf->payload) + 20, 10); // requestingPortIdentity: sourcePortIdentity of the request
+
+    udp_sendto(pM->pPCBs[1], pResp, unicast ? (struct ip_addr*) pSrcAddr : &pM->mcastAddr, PTP_PORT1);
+    pbuf_free(pResp);
+
+    pM->cnt.delayReqs++;
+    ptp_master_account(pM, PTPMMDelay_Resp, start);
+}
+
+// write GRANT_UNICAST_TRANSMISSION TLV
+static uint8_t* ptp_master_write_grant_tlv(uint8_t *p, enum PTPUnicastMsg kind, int8_t logInterval, uint32_t duration)
+{
+    uint16_t tlvType = htons(PTPTLVGrantUnicast);
+    uint16_t tlvLen = htons(PTP_TLV_GRANT_LENGTH - 4);
+    duration = htonl(duration);
+
+    memcpy(p, &tlvType, 2);
+    memcpy(p + 2, &tlvLen, 2);
+    p[4] = ptp_unicast_msg_type(kind) << 4;
+    p[5] = (uint8_t) logInterval;
+    memcpy(p + 6, &duration, 4);
+    p[10] = 0;
+    p[11] = 0; // renewal not invited
+
+    return p + PTP_TLV_GRANT_LENGTH;
+}
+
+// write ACKNOWLEDGE_CANCEL_UNICAST_TRANSMISSION TLV
+static uint8_t* ptp_master_write_ack_cancel_tlv(uint8_t *p, enum PTPUnicastMsg kind)
+{
+    uint16_t tlvType = htons(PTPTLVAckCancelUnicast);
+    uint16_t tlvLen = htons(PTP_TLV_CANCEL_LENGTH - 4);
+
+    memcpy(p, &tlvType, 2);
+    memcpy(p + 2, &tlvLen, 2);
+    p[4] = ptp_unicast_msg_type(kind) << 4;
+    p[5] = 0;
+
+    return p + PTP_TLV_CANCEL_LENGTH;
+}
+
+// send Signaling message carrying the passed TLVs
+static void ptp_master_send_signaling(struct PTPMaster *pM, const struct ip_addr *pAddr, const uint8_t *pReq, uint8_t *pTLVs, uint16_t tlvLen)
+{
+    uint16_t len = PTP_SIGNALING_BODY_OFFSET + tlvLen;
+
+    struct pbuf *pPBuf = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    if (pPBuf == NULL)
+    {
+        return;
+    }
+
+    struct PTPHeader header;
+    ptp_master_init_header(pM, &header, PTPIDSignaling, len, true);
+    header.sequenceID = pM->signalingSequenceID++;
+    header.control = PTPCONOther;
+    header.logMessagePeriod = 0x7f;
+
+    uint8_t *p = (uint8_t*) pPBuf->payload;
+    ptp_construct_binary_header(p, &header);
+    memcpy(p + PTP_HEADER_LENGTH, pReq + 20, PTP_SIGNALING_BODY_OFFSET - PTP_HEADER_LENGTH); // targetPortIdentity: requesting port
+    memcpy(p + PTP_SIGNALING_BODY_OFFSET, pTLVs, tlvLen);
+
+    udp_sendto(pM->pPCBs[1], pPBuf, (struct ip_addr*) pAddr, PTP_PORT1);
+    pbuf_free(pPBuf);
+}
+
+// grant unicast negotiation requests
+void ptp_master_process_signaling(struct PTPMaster *pM, struct pbuf *pPBuf, const struct ip_addr *pSrcAddr)
+{
+    struct PTPHeader req;
+    ptp_extract_header(&req, pPBuf->payload);
+    if (req.subdomainNumber != pM->domainNumber)
+    {
+        return;
+    }
+
+    uint32_t now = xTaskGetTickCount();
+    uint8_t *p = (uint8_t*) pPBuf->payload;
+    uint16_t msgLen = (req.messageLength < pPBuf->len) ? req.messageLength : pPBuf->len;
+    uint16_t offset = PTP_SIGNALING_BODY_OFFSET;
+
+    struct PTPMasterSlave *pS = ptp_master_lookup(pM, pSrcAddr);
+
+    // responses (a grant or an acknowledgement per message kind)
+    uint8_t pRespTLVs[PTPUC_N * PTP_TLV_GRANT_LENGTH];
+    uint8_t *pResp = pRespTLVs;
+
+    // iterate over TLVs
+    while (offset + 4 <= msgLen)
+    {
+        uint16_t tlvType, tlvLen;
+        memcpy(&tlvType, p + offset, 2);
+        memcpy(&tlvLen, p + offset + 2, 2);
+        tlvType = ntohs(tlvType);
+        tlvLen = ntohs(tlvLen);
+
+        uint8_t *pV = p + offset + 4; // TLV value
+        offset += 4 + tlvLen;
+        if (offset > msgLen || tlvLen < 2 || pResp + PTP_TLV_GRANT_LENGTH > pRespTLVs + sizeof(pRespTLVs))
+        {
+            break;
+        }
+
+        int kind = ptp_unicast_msg_kind(pV[0] >> 4);
+        if (kind < 0)
+        {
+            continue;
+        }
+
+        switch (tlvType)
+        {
+        case PTPTLVRequestUnicast:
+        {
+            if (tlvLen < 6)
+            {
+                break;
+            }
+
+            uint32_t duration;
+            memcpy(&duration, pV + 2, 4);
+            duration = ntohl(duration);
+            if (duration > PTP_MASTER_MAX_GRANT_S)
+            {
+                duration = PTP_MASTER_MAX_GRANT_S;
+            }
+
+            // messages are sent at the rates of the master, Delay_Resps are sent for every Delay_Req
+            int8_t logInterval = (kind == PTPUCAnnounce) ? pM->config.logAnnounce : ((kind == PTPUCSync) ? pM->config.logSync : (int8_t) pV[1]);
+
+            if (pS == NULL)
+            {
+                pS = ptp_master_get_slot(pM, pSrcAddr);
+            }
+
+            if (pS == NULL || duration == 0)
+            {
+                pM->cnt.grantsDenied += (pS == NULL);
+                pResp = ptp_master_write_grant_tlv(pResp, (enum PTPUnicastMsg) kind, logInterval, 0);
+                break;
+            }
+
+            pS->granted[kind] = true;
+            pS->grantTick[kind] = now;
+            pS->duration[kind] = duration;
+            pResp = ptp_master_write_grant_tlv(pResp, (enum PTPUnicastMsg) kind, logInterval, duration);
+            break;
+        }
+        case PTPTLVCancelUnicast:
+            if (pS != NULL)
+            {
+                pS->granted[kind] = false;
+            }
+            pResp = ptp_master_write_ack_cancel_tlv(pResp, (enum PTPUnicastMsg) kind);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (pResp != pRespTLVs)
+    {
+        ptp_master_send_signaling(pM, pSrcAddr, p, pRespTLVs, pResp - pRespTLVs);
+    }
+}
@@ -0,0 +1,130 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_MASTER_H
+#define PTP_MASTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ptp.h"
+#include "ptp_unicast.h"
+
+// Master operation: two-step Sync with hardware TX timestamps, Follow_Up, Delay_Resp and Announce
+//
+// Syncs are not waited for: the pbuf of every Sync is kept in a pipeline slot and its Follow_Up is sent by a
+// later ptp_master_poll() once the MAC has written the TX timestamp back, so several Syncs may be in flight
+// and high Sync rates don't stall the PTP task. Messages go to the multicast group (unless the transport mode
+// is unicast) and to the slaves of the unicast slave table: statically added ones and those having
+// negotiated a grant. Grants are given for the rates of the master.
+//
+// The configuration, the slave table and the pipeline are only written by the PTP task, the CLI task posts requests.
+
+#define PTP_MASTER_MAX_SLAVES (16) // size of the unicast slave table
+#define PTP_MASTER_TX_PIPELINE (16) // Syncs awaiting their TX timestamp
+#define PTP_MASTER_TX_TS_TIMEOUT_MS (100) // Follow_Up is given up if the TX timestamp doesn't arrive in time
+#define PTP_MASTER_MIN_LOG_SYNC (-7) // fastest Sync rate (128 Hz)
+#define PTP_MASTER_MAX_LOG_SYNC (4) // slowest Sync rate
+#define PTP_MASTER_DEFAULT_LOG_SYNC (0) // default log2 Sync interval
+#define PTP_MASTER_DEFAULT_LOG_ANNOUNCE (1) // default log2 Announce interval
+#define PTP_MASTER_LOG_MIN_DELAY_REQ (0) // log2 minimal Delay_Req interval advertised in Delay_Resps
+#define PTP_MASTER_MAX_GRANT_S (300) // longest grant given [s]
+
+// clock properties announced
+#define PTP_MASTER_PRIORITY1 (128)
+#define PTP_MASTER_PRIORITY2 (128)
+#define PTP_MASTER_CLOCK_CLASS (248) // default
+#define PTP_MASTER_CLOCK_ACCURACY (0xFE) // unknown
+#define PTP_MASTER_CLOCK_VARIANCE (0xFFFF) // not computed
+#define PTP_MASTER_TIME_SOURCE (0xA0) // internal oscillator
+
+// capacity estimate
+#define PTP_MASTER_CPU_BUDGET_PERCENT (50) // CPU share available for master traffic
+#define PTP_MASTER_LINK_RATE_BPS (100000000) // Ethernet link rate
+#define PTP_MASTER_FRAME_OVERHEAD (66) // preamble, Ethernet, IPv4, UDP headers, FCS and inter-frame gap [bytes]
+
+// message kinds sent by the master
+enum PTPMasterMsg {
+    PTPMMSync = 0,
+    PTPMMFollow_Up,
+    PTPMMDelay_Resp,
+    PTPMMAnnounce,
+    PTPMM_N
+};
+
+// unicast slave
+struct PTPMasterSlave {
+    struct ip_addr addr; // IP address of slave
+    bool used; // slot is in use
+    bool isStatic; // added by the user (receives Sync and Announce without negotiation)
+    bool granted[PTPUC_N]; // negotiated grants
+    uint32_t grantTick[PTPUC_N]; // OS tick of the grants
+    uint32_t duration[PTPUC_N]; // granted durations [s]
+};
+
+// Sync awaiting its TX timestamp
+struct PTPMasterPendingSync {
+    struct pbuf * pPBuf; // transmitted Sync (NULL: slot is free)
+    struct ip_addr addr; // destination
+    uint16_t sequenceID; // sequenceID of Sync
+    uint32_t sendTick; // OS tick of transmission
+};
+
+// processing cost of a message kind
+struct PTPMasterCost {
+    uint64_t cycles; // CPU cycles spent
+    uint32_t cnt; // number of messages
+};
+
+// master state (configuration and unicast slave table survive reinitialization)
+struct PTPMaster {
+    struct {
+        bool enabled; // master operation enabled
+        bool multicast; // messages are sent to the multicast group
+        int8_t logSync; // log2 Sync interval
+        int8_t logAnnounce; // log2 Announce interval
+    } config; // configuration
+    struct PTPMasterSlave slaves[PTP_MASTER_MAX_SLAVES]; // unicast slave table
+    struct PTPMasterPendingSync pending[PTP_MASTER_TX_PIPELINE]; // Syncs awaiting their TX timestamp
+    uint32_t syncDue, announceDue; // OS tick of the next Sync and Announce
+    uint16_t syncFrac; // fractional tick of the next Sync (1/256 tick)
+    uint16_t syncSequenceID, announceSequenceID, signalingSequenceID; // sequenceIDs
+    struct udp_pcb ** pPCBs; // PCBs for sending packets
+    uint64_t clockIdentity; // own clockIdentity (network byte order)
+    struct ip_addr mcastAddr; // multicast group address
+    uint8_t domainNumber; // domain served
+    bool configured; // configuration has been filled in
+    struct {
+        uint32_t sent[PTPMM_N]; // messages sent
+        uint32_t delayReqs; // Delay_Reqs answered
+        uint32_t tsTimeouts; // Follow_Ups given up (TX timestamp missing)
+        uint32_t pipelineFull; // Syncs not sent for lack of a pipeline slot
+        uint32_t skipped; // Sync intervals skipped (task was late)
+        uint32_t grantsDenied; // grant requests denied (slave table full)
+    } cnt; // counters
+    struct PTPMasterCost cost[PTPMM_N]; // processing cost per message kind
+    struct {
+        volatile bool mode; // start/stop is waiting
+        bool enable; // start (true) or stop (false) master operation
+        volatile bool rates; // new Sync and Announce intervals are waiting
+        int8_t logSync, logAnnounce; // requested log2 Sync and Announce intervals
+        volatile bool slave; // slave table change is waiting
+        bool addSlave; // add (true) or remove (false) the slave
+        struct ip_addr slaveAddr; // address of the slave
+        volatile bool release; // Syncs of the pipeline are to be released
+    } request; // requests of the CLI and reinitialization (served by the PTP task)
+};
+
+void ptp_master_init(struct PTPMaster * pM, struct udp_pcb * pPCBs[], uint64_t clockIdentity, uint8_t domainNumber); // initialize master (configuration and static slaves are kept)
+void ptp_master_enable(struct PTPMaster * pM, bool en); // start/stop master operation (PTP task only)
+bool ptp_master_is_enabled(const struct PTPMaster * pM); // is master operation on?
+void ptp_master_set_multicast(struct PTPMaster * pM, bool en); // send messages to the multicast group (controlled by the transport mode)
+int ptp_master_set_rates(struct PTPMaster * pM, int8_t logSync, int8_t logAnnounce); // set log2 Sync and Announce intervals, returns 0 on success (PTP task only)
+int ptp_master_add_slave(struct PTPMaster * pM, const struct ip_addr * pAddr); // add static unicast slave, returns 0 on success (PTP task only)
+int ptp_master_remove_slave(struct PTPMaster * pM, const struct ip_addr * pAddr); // remove unicast slave, returns 0 on success (PTP task only)
+uint32_t ptp_master_poll(struct PTPMaster * pM); // send due messages and pending Follow_Ups, returns OS ticks until the next call is needed
+void ptp_master_periodic(struct PTPMaster * pM); // apply changes of the CLI, expire grants
+void ptp_master_process_delay_req(struct PTPMaster * pM, struct pbuf * pPBuf, const struct ip_addr * pSrcAddr); // answer Delay_Req
+void ptp_master_process_signaling(struct PTPMaster * pM, struct pbuf * pPBuf, const struct ip_addr * pSrcAddr); // grant unicast negotiation requests
+void ptp_master_register_cli_commands(struct PTPMaster * pM); // register CLI commands operating on the passed master
+
+#endif /* PTP_MASTER_H */
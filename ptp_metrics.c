@@ -0,0 +1,225 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_metrics.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+#include "utils.h"
+#include "timeutils.h"
+
+// Samples are the time error (offset) values of the clock. Rolling statistics are computed over the last
+// PTP_METRICS_WINDOW samples. Stability metrics are evaluated at m = 2^k sample intervals:
+//
+// - overlapping Allan deviation: ADEV^2 = sum((x[i+2m] - 2x[i+m] + x[i])^2) / (2 tau^2 N_d),
+// - TDEV: TVAR = sum((moving sum of m second differences)^2) / (6 m^2 N_s),
+// - MTIE: maximum peak-to-peak time error over every window of m + 1 samples.
+//
+// Every update costs O(OCTAVES) operations plus amortized O(1) deque operations per window, memory is fixed.
+
+// --------------------------
+
+// initialize deque on storage reserved from the pool
+static uint16_t ptp_metrics_deque_init(struct PTPMetricsDeque *pD, uint16_t offset, uint16_t capacity)
+{
+    pD->offset = offset;
+    pD->mask = capacity - 1;
+    pD->head = pD->tail = 0;
+    return offset + capacity;
+}
+
+// push the current sample into a deque tracking the maximum (sign = 1) or minimum (sign = -1) of the last
+// span + 1 samples, returns the extremum
+static int32_t ptp_metrics_deque_update(struct PTPMetrics *pM, struct PTPMetricsDeque *pD, const int32_t *pValues, uint16_t valMask,
+                                        uint16_t span, int sign)
+{
+    uint16_t *pIdx = &pM->pDequePool[pD->offset];
+    int32_t v = pValues[pM->n & valMask];
+
+    // drop samples falling out of the window
+    while (pD->head != pD->tail && (uint16_t) (pM->n - pIdx[pD->head & pD->mask]) > span)
+    {
+        pD->head++;
+    }
+
+    // drop samples that can never be the extremum again
+    while (pD->head != pD->tail && sign * pValues[pIdx[(pD->tail - 1) & pD->mask] & valMask] <= sign * v)
+    {
+        pD->tail--;
+    }
+
+    pIdx[pD->tail & pD->mask] = (uint16_t) pM->n;
+    pD->tail++;
+
+    return pValues[pIdx[pD->head & pD->mask] & valMask];
+}
+
+// --------------------------
+
+// drop every sample
+void ptp_metrics_reset(struct PTPMetrics *pM)
+{
+    memset(pM, 0, sizeof(struct PTPMetrics));
+
+    // distribute deque storage
+    uint16_t offset = 0;
+    offset = ptp_metrics_deque_init(&pM->offset.min, offset, PTP_METRICS_WINDOW);
+    offset = ptp_metrics_deque_init(&pM->offset.max, offset, PTP_METRICS_WINDOW);
+    offset = ptp_metrics_deque_init(&pM->delay.min, offset, PTP_METRICS_WINDOW);
+    offset = ptp_metrics_deque_init(&pM->delay.max, offset, PTP_METRICS_WINDOW);
+
+    uint8_t k;
+    for (k = 0; k < PTP_METRICS_OCTAVES; k++)
+    {
+        offset = ptp_metrics_deque_init(&pM->octaves[k].min, offset, 2 << k);
+        offset = ptp_metrics_deque_init(&pM->octaves[k].max, offset, 2 << k);
+    }
+}
+
+// offset sample at index i (valid for the last PTP_METRICS_HIST_LEN samples)
+#define X(pM, i) ((pM)->pOffset[(i) & (PTP_METRICS_HIST_LEN - 1)])
+
+// update rolling statistics with the sample stored at index n
+static void ptp_metrics_update_rolling(struct PTPMetrics *pM, struct PTPMetricsRolling *pR, const int32_t *pValues, uint16_t valMask)
+{
+    int64_t v = pValues[pM->n & valMask];
+    pR->sum += v;
+    pR->sumSq += v * v;
+
+    // remove sample leaving the window
+    if (pM->n >= PTP_METRICS_WINDOW)
+    {
+        int64_t old = pValues[(pM->n - PTP_METRICS_WINDOW) & valMask];
+        pR->sum -= old;
+        pR->sumSq -= old * old;
+    }
+
+    ptp_metrics_deque_update(pM, &pR->min, pValues, valMask, PTP_METRICS_WINDOW - 1, -1);
+    ptp_metrics_deque_update(pM, &pR->max, pValues, valMask, PTP_METRICS_WINDOW - 1, 1);
+}
+
+// clamp sample to the processed range
+static int32_t ptp_metrics_clamp(int64_t v)
+{
+    return (v > PTP_METRICS_CLAMP_NS) ? PTP_METRICS_CLAMP_NS : ((v < -PTP_METRICS_CLAMP_NS) ? -PTP_METRICS_CLAMP_NS : (int32_t) v);
+}
+
+// process a new sample
+void ptp_metrics_add(struct PTPMetrics *pM, int64_t offset_ns, int64_t delay_ns, uint32_t tick)
+{
+    uint32_t n = pM->n;
+
+    // store sample
+    X(pM, n) = ptp_metrics_clamp(offset_ns);
+    pM->pDelay[n & (PTP_METRICS_WINDOW - 1)] = ptp_metrics_clamp(delay_ns);
+
+    if (n == 0)
+    {
+        pM->firstTick = tick;
+    }
+    pM->lastTick = tick;
+
+    // rolling statistics
+    ptp_metrics_update_rolling(pM, &pM->offset, pM->pOffset, PTP_METRICS_HIST_LEN - 1);
+    ptp_metrics_update_rolling(pM, &pM->delay, pM->pDelay, PTP_METRICS_WINDOW - 1);
+
+    // stability metrics
+    uint8_t k;
+    for (k = 0; k < PTP_METRICS_OCTAVES; k++)
+    {
+        struct PTPMetricsOctave *pO = &pM->octaves[k];
+        uint32_t m = 1 << k;
+
+        // MTIE over the last m + 1 samples
+        int32_t min = ptp_metrics_deque_update(pM, &pO->min, pM->pOffset, PTP_METRICS_HIST_LEN - 1, m, -1);
+        int32_t max = ptp_metrics_deque_update(pM, &pO->max, pM->pOffset, PTP_METRICS_HIST_LEN - 1, m, 1);
+        if (n >= m && (max - min) > pO->mtie)
+        {
+            pO->mtie = max - min;
+        }
+
+        if (n < 2 * m)
+        {
+            continue;
+        }
+
+        // ADEV: second difference ending at the current sample
+        int64_t d = (int64_t) X(pM, n) - 2 * (int64_t) X(pM, n - m) + X(pM, n - 2 * m);
+        pO->adevSum += (double) (d * d);
+        pO->adevCnt++;
+
+        // TDEV: moving sum of the last m second differences
+        pO->tdevMovSum += d;
+        if (n >= 3 * m)
+        {
+            pO->tdevMovSum -= (int64_t) X(pM, n - m) - 2 * (int64_t) X(pM, n - 2 * m) + X(pM, n - 3 * m);
+        }
+
+        if (n >= 3 * m - 1)
+        {
+            pO->tdevSum += (double) pO->tdevMovSum * (double) pO->tdevMovSum;
+            pO->tdevCnt++;
+        }
+    }
+
+    pM->n++;
+}
+
+// print rolling statistics of a quantity
+static void ptp_metrics_print_rolling(const char *pName, const struct PTPMetrics *pM, const struct PTPMetricsRolling *pR,
+                                      const int32_t *pValues, uint16_t valMask)
+{
+    uint32_t cnt = (pM->n < PTP_METRICS_WINDOW) ? pM->n : PTP_METRICS_WINDOW;
+    float mean = (float) pR->sum / cnt;
+    float rms = sqrtf((float) pR->sumSq / cnt);
+    int32_t min = pValues[pM->pDequePool[pR->min.offset + (pR->min.head & pR->min.mask)] & valMask];
+    int32_t max = pValues[pM->pDequePool[pR->max.offset + (pR->max.head & pR->max.mask)] & valMask];
+
+    char pL[96];
+    sprintf(pL, "mean: %.1f, RMS: %.1f, min: %d, max: %d", mean, rms, min, max);
+    MSG("> %s [ns]: %s\n", pName, pL);
+}
+
+// print rolling statistics and stability metrics
+void ptp_metrics_print(const struct PTPMetrics *pM)
+{
+    if (pM->n < 2)
+    {
+        MSG("> No samples collected yet.\n");
+        return;
+    }
+
+    // sampling interval
+    float tau0 = (pM->lastTick - pM->firstTick) / ((float) configTICK_RATE_HZ * (pM->n - 1));
+
+    char pL[96];
+    sprintf(pL, "%u samples, tau0: %.3f s, window: %u samples", pM->n, tau0, PTP_METRICS_WINDOW);
+    MSG("> Metrics: %s\n", pL);
+
+    ptp_metrics_print_rolling("Offset", pM, &pM->offset, pM->pOffset, PTP_METRICS_HIST_LEN - 1);
+    ptp_metrics_print_rolling("Path delay", pM, &pM->delay, pM->pDelay, PTP_METRICS_WINDOW - 1);
+
+    MSG(">   tau [s]         ADEV   TDEV [ns]   MTIE [ns]\n");
+
+    uint8_t k;
+    for (k = 0; k < PTP_METRICS_OCTAVES; k++)
+    {
+        const struct PTPMetricsOctave *pO = &pM->octaves[k];
+        uint32_t m = 1 << k;
+
+        if (pM->n <= m)
+        {
+            break;
+        }
+
+        float tau = m * tau0;
+        float adev = (pO->adevCnt > 0) ? sqrt(pO->adevSum / (2.0 * pO->adevCnt)) / (tau * NANO_PREFIX_F) : 0;
+        float tdev = (pO->tdevCnt > 0) ? sqrt(pO->tdevSum / (6.0 * m * m * pO->tdevCnt)) : 0;
+
+        sprintf(pL, "%9.3f %12.3e %11.1f %11d", tau, adev, tdev, pO->mtie);
+        MSG("> %s\n", pL);
+    }
+}
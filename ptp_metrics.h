@@ -0,0 +1,55 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_METRICS_H
+#define PTP_METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PTP_METRICS_OCTAVES (7) // number of evaluated averaging factors (tau = 1, 2, 4 ... 64 sample intervals)
+#define PTP_METRICS_HIST_LEN (256) // offset history length (power of 2, must exceed 3 * 2^(OCTAVES - 1))
+#define PTP_METRICS_WINDOW (64) // number of samples rolling statistics are computed over (power of 2)
+#define PTP_METRICS_CLAMP_NS (100000000) // samples are clamped into +-CLAMP_NS to keep integer sums from overflowing
+#define PTP_METRICS_DEQUE_POOL (4 * PTP_METRICS_WINDOW + 2 * ((2 << PTP_METRICS_OCTAVES) - 2)) // deque storage
+
+// monotonic deque of sample indices (tracks the extremum of a sliding window)
+struct PTPMetricsDeque {
+    uint16_t offset; // start of storage in the pool
+    uint16_t mask; // capacity - 1 (capacity is a power of 2)
+    uint16_t head, tail; // read and write counters
+};
+
+// rolling statistics of a quantity
+struct PTPMetricsRolling {
+    int64_t sum; // sum of samples in the window
+    int64_t sumSq; // sum of squared samples in the window
+    struct PTPMetricsDeque min, max; // window extrema
+};
+
+// stability metrics at a single averaging factor
+struct PTPMetricsOctave {
+    double adevSum; // sum of squared second differences
+    uint32_t adevCnt; // number of second differences
+    int64_t tdevMovSum; // moving sum of the last m second differences
+    double tdevSum; // sum of squared moving sums
+    uint32_t tdevCnt; // number of moving sums
+    struct PTPMetricsDeque min, max; // extrema of the last m + 1 samples
+    int32_t mtie; // largest peak-to-peak time error seen in a window
+};
+
+// online synchronization quality metrics
+struct PTPMetrics {
+    int32_t pOffset[PTP_METRICS_HIST_LEN]; // offset (time error) history [ns]
+    int32_t pDelay[PTP_METRICS_WINDOW]; // path delay history [ns]
+    uint16_t pDequePool[PTP_METRICS_DEQUE_POOL]; // storage of the deques
+    uint32_t n; // number of samples processed
+    struct PTPMetricsRolling offset, delay; // rolling statistics
+    struct PTPMetricsOctave octaves[PTP_METRICS_OCTAVES]; // stability metrics
+    uint32_t firstTick, lastTick; // OS ticks of first and last sample (for computing the sampling interval)
+};
+
+void ptp_metrics_reset(struct PTPMetrics * pM); // drop every sample
+void ptp_metrics_add(struct PTPMetrics * pM, int64_t offset_ns, int64_t delay_ns, uint32_t tick); // process a new sample
+void ptp_metrics_print(const struct PTPMetrics * pM); // print rolling statistics and stability metrics
+
+#endif /* PTP_METRICS_H */
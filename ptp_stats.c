@@ -0,0 +1,114 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_stats.h"
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "utils.h"
+
+// clear every counter
+void ptp_stats_reset(struct PTPStats *pStats)
+{
+    memset(pStats, 0, sizeof(struct PTPStats));
+    pStats->startTick = xTaskGetTickCount();
+}
+
+// index of the highest set bit plus one (0 for 0)
+static uint8_t ptp_stats_log2_bucket(uint32_t value)
+{
+    uint8_t k = 0, shift;
+
+    // binary search for the highest set bit
+    for (shift = 16; shift > 0; shift >>= 1)
+    {
+        if (value >= (1u << shift))
+        {
+            value >>= shift;
+            k += shift;
+        }
+    }
+
+    return k + value;
+}
+
+// record a value in a histogram
+void ptp_stats_hist_add(struct PTPHistogram *pHist, uint32_t value)
+{
+    uint8_t k = ptp_stats_log2_bucket(value);
+    pHist->buckets[(k < PTP_STATS_HIST_BUCKETS) ? k : (PTP_STATS_HIST_BUCKETS - 1)]++;
+
+    if (value > pHist->max)
+    {
+        pHist->max = value;
+    }
+}
+
+// switch state machine of a domain and count transition
+void ptp_stats_transition(struct PTPStats *pStats, struct PTPDomain *pDomain, enum FSMState state)
+{
+    pStats->transitions[pDomain->state][state]++;
+    pDomain->state = state;
+}
+
+// print non-empty buckets of a histogram
+static void ptp_stats_hist_print(const char *pName, const struct PTPHistogram *pHist)
+{
+    uint32_t total = 0;
+    uint8_t k;
+    for (k = 0; k < PTP_STATS_HIST_BUCKETS; k++)
+    {
+        total += pHist->buckets[k];
+    }
+
+    MSG("> %s: %u samples, max: %u\n", pName, total, pHist->max);
+
+    for (k = 0; k < PTP_STATS_HIST_BUCKETS; k++)
+    {
+        if (pHist->buckets[k] == 0)
+        {
+            continue;
+        }
+
+        if (k == 0)
+        {
+            MSG("    0: %u\n", pHist->buckets[k]);
+        }
+        else
+        {
+            MSG("    %u..%u: %u\n", 1u << (k - 1), (k == PTP_STATS_HIST_BUCKETS - 1) ? 0xffffffff : ((1u << k) - 1), pHist->buckets[k]);
+        }
+    }
+}
+
+// print counters and histograms
+void ptp_stats_print(const struct PTPStats *pStats)
+{
+    static const char *spStateNames[] = { "IDLE", "WAITFOLLOWUP", "WAITDELAYRESP" };
+
+    MSG("> PTP statistics of the last %u s\n", (xTaskGetTickCount() - pStats->startTick) / configTICK_RATE_HZ);
+    MSG("> RX: Sync: %u, Follow_Up: %u, Delay_Resp: %u (foreign: %u), Announce: %u, Signaling: %u\n", pStats->rxMsgs[PTPIDSync],
+        pStats->rxMsgs[PTPIDFollow_Up], pStats->rxMsgs[PTPIDDelay_Resp], pStats->rxForeignDelayResp, pStats->rxMsgs[PTPIDAnnounce],
+        pStats->rxMsgs[PTPIDSignaling]);
+    MSG("> RX dropped: too short: %u, untracked domain: %u, not from parent: %u\n", pStats->rxShort, pStats->rxUntracked, pStats->rxNotParent);
+    MSG("> TX: Delay_Req: %u, failed: %u\n", pStats->txDelayReq, pStats->txFailed);
+    MSG("> Timeouts: response: %u, Sync receipt: %u, Announce receipt: %u, sequence mismatches: %u\n", pStats->timeouts, pStats->syncTimeouts,
+        pStats->announceTimeouts, pStats->seqMismatch);
+
+    uint8_t i, k;
+    for (i = 0; i < PTP_STATS_FSM_STATES; i++)
+    {
+        for (k = 0; k < PTP_STATS_FSM_STATES; k++)
+        {
+            if (pStats->transitions[i][k] != 0)
+            {
+                MSG("> %s -> %s: %u\n", spStateNames[i], spStateNames[k], pStats->transitions[i][k]);
+            }
+        }
+    }
+
+    ptp_stats_hist_print("Processing time [cycles]", &pStats->procCycles);
+    ptp_stats_hist_print("RX timestamp to servo update [ns]", &pStats->rxToServoNs);
+}
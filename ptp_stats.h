@@ -0,0 +1,45 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_STATS_H
+#define PTP_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ptp_domain.h"
+
+#define PTP_STATS_MSG_TYPES (16) // number of messageType values (4 bits)
+#define PTP_STATS_HIST_BUCKETS (32) // number of log2 histogram buckets
+#define PTP_STATS_FSM_STATES (SWaitDelayResp + 1) // number of state machine states
+
+// log2 histogram (bucket k counts values in [2^(k-1), 2^k), bucket 0 counts zeros)
+struct PTPHistogram {
+    uint32_t buckets[PTP_STATS_HIST_BUCKETS]; // bucket counters
+    uint32_t max; // largest value recorded
+};
+
+// message, state machine and timing statistics of an instance
+struct PTPStats {
+    uint32_t rxMsgs[PTP_STATS_MSG_TYPES]; // received messages by messageType
+    uint32_t rxShort; // messages dropped for being shorter than the minimum length of their type
+    uint32_t rxUntracked; // messages of untracked domains
+    uint32_t rxForeignDelayResp; // Delay_Resps addressed to other slaves
+    uint32_t rxNotParent; // messages dropped for not originating from the parent
+    uint32_t txDelayReq; // Delay_Reqs sent
+    uint32_t txFailed; // messages could not be sent (no buffer)
+    uint32_t transitions[PTP_STATS_FSM_STATES][PTP_STATS_FSM_STATES]; // state transitions [from][to]
+    uint32_t timeouts; // response timeouts (Follow_Up or Delay_Resp missing)
+    uint32_t syncTimeouts; // Sync receipt timeouts
+    uint32_t announceTimeouts; // Announce receipt timeouts (foreign masters expired)
+    uint32_t seqMismatch; // Follow_Ups and own Delay_Resps with unexpected sequenceID
+    struct PTPHistogram procCycles; // execution time of ptp_process_packet() [CPU cycles]
+    struct PTPHistogram rxToServoNs; // time from RX hardware timestamp to servo update [ns]
+    uint32_t startTick; // OS tick of last reset
+};
+
+void ptp_stats_reset(struct PTPStats * pStats); // clear every counter
+void ptp_stats_hist_add(struct PTPHistogram * pHist, uint32_t value); // record a value in a histogram
+void ptp_stats_transition(struct PTPStats * pStats, struct PTPDomain * pDomain, enum FSMState state); // switch state machine of a domain and count transition
+void ptp_stats_print(const struct PTPStats * pStats); // print counters and histograms
+
+#endif /* PTP_STATS_H */
@@ -0,0 +1,262 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_telemetry.h"
+
+#include <stdlib.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "utils.h"
+#include "cli.h"
+
+// Records are appended and sent by the PTP task, the CLI task only changes the configuration.
+
+static struct PTPTelemetry *spCliTelemetry; // stream the CLI commands operate on
+
+// --------------------------
+
+static void ptp_telemetry_put32(uint8_t *pBuf, uint32_t v)
+{
+    pBuf[0] = v;
+    pBuf[1] = v >> 8;
+    pBuf[2] = v >> 16;
+    pBuf[3] = v >> 24;
+}
+
+static uint32_t ptp_telemetry_get32(const uint8_t *pBuf)
+{
+    return pBuf[0] | (pBuf[1] << 8) | (pBuf[2] << 16) | ((uint32_t) pBuf[3] << 24);
+}
+
+// serialize record
+void ptp_telemetry_encode(uint8_t *pBuf, const struct PTPTelemetryRecord *pRec)
+{
+    uint32_t corr;
+    memcpy(&corr, &pRec->corr_ppb, 4);
+
+    ptp_telemetry_put32(pBuf + 0, (uint64_t) pRec->offset_ns);
+    ptp_telemetry_put32(pBuf + 4, (uint64_t) pRec->offset_ns >> 32);
+    ptp_telemetry_put32(pBuf + 8, pRec->t1_s);
+    ptp_telemetry_put32(pBuf + 12, pRec->t1_ns);
+    ptp_telemetry_put32(pBuf + 16, pRec->delay_ns);
+    ptp_telemetry_put32(pBuf + 20, corr);
+    ptp_telemetry_put32(pBuf + 24, pRec->addend);
+    ptp_telemetry_put32(pBuf + 28, pRec->servoState);
+    pBuf[32] = pRec->sequenceID;
+    pBuf[33] = pRec->sequenceID >> 8;
+    pBuf[34] = pRec->domainNumber;
+    pBuf[35] = pRec->flags;
+}
+
+// deserialize record
+void ptp_telemetry_decode(struct PTPTelemetryRecord *pRec, const uint8_t *pBuf)
+{
+    uint32_t corr = ptp_telemetry_get32(pBuf + 20);
+
+    pRec->offset_ns = (int64_t) (ptp_telemetry_get32(pBuf + 0) | ((uint64_t) ptp_telemetry_get32(pBuf + 4) << 32));
+    pRec->t1_s = ptp_telemetry_get32(pBuf + 8);
+    pRec->t1_ns = ptp_telemetry_get32(pBuf + 12);
+    pRec->delay_ns = ptp_telemetry_get32(pBuf + 16);
+    memcpy(&pRec->corr_ppb, &corr, 4);
+    pRec->addend = ptp_telemetry_get32(pBuf + 24);
+    pRec->servoState = ptp_telemetry_get32(pBuf + 28);
+    pRec->sequenceID = pBuf[32] | (pBuf[33] << 8);
+    pRec->domainNumber = pBuf[34];
+    pRec->flags = pBuf[35];
+}
+
+// check and deserialize datagram header
+bool ptp_telemetry_decode_header(struct PTPTelemetryHeader *pHeader, const uint8_t *pBuf, uint16_t len)
+{
+    if (len < PTP_TELEMETRY_HEADER_SIZE || ptp_telemetry_get32(pBuf) != PTP_TELEMETRY_MAGIC)
+    {
+        return false;
+    }
+
+    pHeader->version = pBuf[4];
+    pHeader->recordSize = pBuf[5];
+    pHeader->recordCnt = pBuf[6] | (pBuf[7] << 8);
+    pHeader->sequence = ptp_telemetry_get32(pBuf + 8);
+    memcpy(&pHeader->clockIdentity, pBuf + 12, 8);
+
+    // newer versions may only append fields to the records
+    return pHeader->version >= PTP_TELEMETRY_VERSION && pHeader->recordSize >= PTP_TELEMETRY_RECORD_SIZE
+            && len >= PTP_TELEMETRY_HEADER_SIZE + pHeader->recordCnt * pHeader->recordSize;
+}
+
+// --------------------------
+
+// set identity of the sender
+void ptp_telemetry_init(struct PTPTelemetry *pT, uint64_t clockIdentity)
+{
+    pT->clockIdentity = clockIdentity;
+    pT->recordCnt = 0;
+}
+
+// start or stop streaming
+void ptp_telemetry_enable(struct PTPTelemetry *pT, const struct ip_addr *pAddr, uint16_t port)
+{
+    pT->config.enabled = false;
+    pT->recordCnt = 0; // records in the batch are dropped
+
+    if (pAddr != NULL)
+    {
+        pT->config.addr = *pAddr;
+        pT->config.port = port;
+        pT->config.enabled = true;
+    }
+}
+
+// is streaming on?
+bool ptp_telemetry_is_enabled(const struct PTPTelemetry *pT)
+{
+    return pT->config.enabled;
+}
+
+// send batch
+static void ptp_telemetry_send(struct PTPTelemetry *pT, struct udp_pcb *pPCB)
+{
+    uint16_t len = PTP_TELEMETRY_HEADER_SIZE + pT->recordCnt * PTP_TELEMETRY_RECORD_SIZE;
+
+    // fill in header
+    uint8_t *p = pT->pBatch;
+    ptp_telemetry_put32(p, PTP_TELEMETRY_MAGIC);
+    p[4] = PTP_TELEMETRY_VERSION;
+    p[5] = PTP_TELEMETRY_RECORD_SIZE;
+    p[6] = pT->recordCnt;
+    p[7] = pT->recordCnt >> 8;
+    ptp_telemetry_put32(p + 8, pT->sequence++);
+    memcpy(p + 12, &pT->clockIdentity, 8);
+
+    struct pbuf *pPBuf = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    if (pPBuf == NULL)
+    {
+        pT->cnt.failed++;
+    }
+    else
+    {
+        memcpy(pPBuf->payload, pT->pBatch, len);
+        if (udp_sendto(pPCB, pPBuf, &pT->config.addr, pT->config.port) == ERR_OK)
+        {
+            pT->cnt.datagrams++;
+            pT->cnt.records += pT->recordCnt;
+        }
+        else
+        {
+            pT->cnt.failed++;
+        }
+        pbuf_free(pPBuf);
+    }
+
+    pT->recordCnt = 0;
+}
+
+// append record
+void ptp_telemetry_add(struct PTPTelemetry *pT, const struct PTPTelemetryRecord *pRec, struct udp_pcb *pPCB)
+{
+    if (!pT->config.enabled)
+    {
+        pT->recordCnt = 0;
+        return;
+    }
+
+    if (pT->recordCnt == 0)
+    {
+        pT->batchTick = xTaskGetTickCount();
+    }
+
+    ptp_telemetry_encode(pT->pBatch + PTP_TELEMETRY_HEADER_SIZE + pT->recordCnt * PTP_TELEMETRY_RECORD_SIZE, pRec);
+    pT->recordCnt++;
+
+    if (pT->recordCnt == PTP_TELEMETRY_BATCH)
+    {
+        ptp_telemetry_send(pT, pPCB);
+    }
+}
+
+// apply configuration of the CLI, send aged batch
+void ptp_telemetry_periodic(struct PTPTelemetry *pT, struct udp_pcb *pPCB)
+{
+    if (pT->request.config)
+    {
+        ptp_telemetry_enable(pT, pT->request.enable ? &pT->request.addr : NULL, pT->request.port);
+        pT->request.config = false;
+    }
+
+    if (pT->config.enabled && pT->recordCnt > 0 && (xTaskGetTickCount() - pT->batchTick) >= pdMS_TO_TICKS(PTP_TELEMETRY_MAX_AGE_MS))
+    {
+        ptp_telemetry_send(pT, pPCB);
+    }
+}
+
+// --------------------------
+
+static int CB_telemetry(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPTelemetry *pT = spCliTelemetry;
+
+    if (argc > 0)
+    {
+        struct ip_addr addr = { 0 };
+        bool enable = strcmp(ppArgs[0], "off");
+        if (enable)
+        {
+            addr.addr = ipaddr_addr(ppArgs[0]);
+            if (addr.addr == IPADDR_NONE)
+            {
+                return -1;
+            }
+        }
+
+        if (pT->request.config)
+        {
+            MSG("> Previous telemetry change is still pending!\n");
+            return 0;
+        }
+
+        // applied by the PTP task
+        pT->request.enable = enable;
+        pT->request.addr = addr;
+        pT->request.port = (argc > 1) ? atoi(ppArgs[1]) : PTP_TELEMETRY_PORT;
+        pT->request.config = true;
+
+        if (enable)
+        {
+            MSG("> Telemetry: %u.%u.%u.%u:%u\n", ip4_addr1(&addr), ip4_addr2(&addr), ip4_addr3(&addr), ip4_addr4(&addr), pT->request.port);
+        }
+        else
+        {
+            MSG("> Telemetry: off\n");
+        }
+        return 0;
+    }
+
+    if (pT->config.enabled)
+    {
+        MSG("> Telemetry: %u.%u.%u.%u:%u, ", ip4_addr1(&pT->config.addr), ip4_addr2(&pT->config.addr), ip4_addr3(&pT->config.addr),
+            ip4_addr4(&pT->config.addr), pT->config.port);
+    }
+    else
+    {
+        MSG("> Telemetry: off, ");
+    }
+    MSG("records: %u, datagrams: %u, failed: %u\n", pT->cnt.records, pT->cnt.datagrams, pT->cnt.failed);
+
+    return 0;
+}
+
+// cli commands (sorted)
+static const struct CliCommand spCliCmds[] = {
+    { "ptp telemetry", "[ip [port]|off] \t\t\tStream synchronization cycles to a collector or query stream state", 0, CB_telemetry },
+};
+
+static struct CliCommandTable sCliTable = CLI_COMMAND_TABLE(spCliCmds);
+
+// register CLI commands operating on the passed stream
+void ptp_telemetry_register_cli_commands(struct PTPTelemetry *pT)
+{
+    spCliTelemetry = pT;
+
+    cli_register_table(&sCliTable);
+}
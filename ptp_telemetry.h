@@ -0,0 +1,108 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_TELEMETRY_H
+#define PTP_TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ptp.h"
+
+// Binary telemetry stream of synchronization cycles
+//
+// Every completed cycle is serialized into a fixed-size little-endian record. Records are batched and sent
+// in UDP datagrams to a collector once a batch is full or its oldest record gets PTP_TELEMETRY_MAX_AGE_MS old,
+// so a datagram typically carries tens of cycles. Datagram layout:
+//
+//  0..3: magic (PTP_TELEMETRY_MAGIC)
+//     4: format version
+//     5: record size
+//  6..7: number of records (uint16)
+//  8..11: datagram sequence number (uint32, gaps show lost datagrams)
+// 12..19: clockIdentity of the sender (network byte order)
+//   20..: records
+//
+// Record layout:
+//
+//  0..7: offset (master - slave) [ns] (int64)
+//  8..15: t1 (uint32 seconds, uint32 nanoseconds)
+// 16..19: mean path delay [ns] (int32)
+// 20..23: servo output [ppb] (IEEE 754 float)
+// 24..27: addend after correction (uint32)
+// 28..31: servo state (PTP_SERVO_GET_STATE(), int32)
+// 32..33: sequenceID of Sync (uint16)
+//     34: domainNumber
+//     35: flags (PTP_TELEMETRY_FLAG_...)
+
+#define PTP_TELEMETRY_MAGIC (0x54505450) // "PTPT"
+#define PTP_TELEMETRY_VERSION (1) // format version
+#define PTP_TELEMETRY_HEADER_SIZE (20) // size of the datagram header
+#define PTP_TELEMETRY_RECORD_SIZE (36) // size of a serialized record
+#define PTP_TELEMETRY_BATCH (32) // maximal number of records in a datagram
+#define PTP_TELEMETRY_MAX_AGE_MS (2000) // records are sent at the latest after this time
+#define PTP_TELEMETRY_PORT (5556) // default collector port
+#define PTP_TELEMETRY_MAX_DATAGRAM (PTP_TELEMETRY_HEADER_SIZE + PTP_TELEMETRY_BATCH * PTP_TELEMETRY_RECORD_SIZE)
+
+// record flags
+#define PTP_TELEMETRY_FLAG_ACTIVE (1 << 0) // domain was driving the clock
+#define PTP_TELEMETRY_FLAG_COARSE (1 << 1) // clock was jumped instead of tuned
+
+// synchronization cycle record
+struct PTPTelemetryRecord {
+    int64_t offset_ns; // offset (master - slave)
+    uint32_t t1_s, t1_ns; // t1 (origin timestamp of Sync)
+    int32_t delay_ns; // mean path delay
+    float corr_ppb; // servo output
+    uint32_t addend; // addend after correction
+    int32_t servoState; // servo specific state summary
+    uint16_t sequenceID; // sequenceID of Sync
+    uint8_t domainNumber; // domain the cycle belongs to
+    uint8_t flags; // PTP_TELEMETRY_FLAG_...
+};
+
+// datagram header
+struct PTPTelemetryHeader {
+    uint8_t version; // format version
+    uint8_t recordSize; // record size
+    uint16_t recordCnt; // number of records
+    uint32_t sequence; // datagram sequence number
+    uint64_t clockIdentity; // clockIdentity of the sender (network byte order)
+};
+
+// telemetry stream state (every field is valid zero-filled: streaming is off)
+struct PTPTelemetry {
+    struct {
+        struct ip_addr addr; // collector address
+        uint16_t port; // collector port
+        bool enabled; // streaming is on
+    } config; // configuration
+    uint8_t pBatch[PTP_TELEMETRY_MAX_DATAGRAM]; // datagram under construction
+    uint16_t recordCnt; // records in the batch
+    uint32_t batchTick; // OS tick of the oldest record of the batch
+    uint32_t sequence; // sequence number of the next datagram
+    uint64_t clockIdentity; // own clockIdentity (network byte order)
+    struct {
+        uint32_t records; // records sent
+        uint32_t datagrams; // datagrams sent
+        uint32_t failed; // datagrams that could not be sent
+    } cnt; // counters
+    struct {
+        volatile bool config; // configuration change is waiting
+        bool enable; // start (true) or stop (false) streaming
+        struct ip_addr addr; // collector address
+        uint16_t port; // collector port
+    } request; // requests of the CLI (served by the PTP task)
+};
+
+void ptp_telemetry_init(struct PTPTelemetry * pT, uint64_t clockIdentity); // set identity of the sender (configuration is kept)
+void ptp_telemetry_enable(struct PTPTelemetry * pT, const struct ip_addr * pAddr, uint16_t port); // start streaming to a collector (NULL address: stop), pending records are dropped (PTP task only)
+bool ptp_telemetry_is_enabled(const struct PTPTelemetry * pT); // is streaming on?
+void ptp_telemetry_add(struct PTPTelemetry * pT, const struct PTPTelemetryRecord * pRec, struct udp_pcb * pPCB); // append record (a full batch is sent right away)
+void ptp_telemetry_periodic(struct PTPTelemetry * pT, struct udp_pcb * pPCB); // apply configuration of the CLI, send batch holding records older than PTP_TELEMETRY_MAX_AGE_MS
+void ptp_telemetry_register_cli_commands(struct PTPTelemetry * pT); // register CLI commands operating on the passed stream
+
+void ptp_telemetry_encode(uint8_t * pBuf, const struct PTPTelemetryRecord * pRec); // serialize record
+void ptp_telemetry_decode(struct PTPTelemetryRecord * pRec, const uint8_t * pBuf); // deserialize record
+bool ptp_telemetry_decode_header(struct PTPTelemetryHeader * pHeader, const uint8_t * pBuf, uint16_t len); // check and deserialize datagram header
+
+#endif /* PTP_TELEMETRY_H */
@@ -0,0 +1,159 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_trace.h"
+
+#include <string.h>
+
+// --------------------------
+
+static void ptp_trace_put32(uint8_t *pBuf, uint32_t v)
+{
+    pBuf[0] = v;
+    pBuf[1] = v >> 8;
+    pBuf[2] = v >> 16;
+    pBuf[3] = v >> 24;
+}
+
+static uint32_t ptp_trace_get32(const uint8_t *pBuf)
+{
+    return pBuf[0] | (pBuf[1] << 8) | (pBuf[2] << 16) | ((uint32_t) pBuf[3] << 24);
+}
+
+// --------------------------
+
+// serialize record
+void ptp_trace_encode(uint8_t *pBuf, const struct PTPEvLogRecord *pRec)
+{
+    uint8_t i;
+    for (i = 0; i < 4; i++)
+    {
+        ptp_trace_put32(pBuf + 8 * i, pRec->t[i].sec);
+        ptp_trace_put32(pBuf + 8 * i + 4, pRec->t[i].nanosec);
+    }
+
+    ptp_trace_put32(pBuf + 32, pRec->corrFollowUp);
+    ptp_trace_put32(pBuf + 36, pRec->corrDelayResp);
+    ptp_trace_put32(pBuf + 40, pRec->addendPrev);
+    ptp_trace_put32(pBuf + 44, pRec->addend);
+    ptp_trace_put32(pBuf + 48, pRec->ppsOffset);
+    pBuf[52] = pRec->sequenceID;
+    pBuf[53] = pRec->sequenceID >> 8;
+    pBuf[54] = pRec->domainNumber;
+    pBuf[55] = pRec->flags;
+    ptp_trace_put32(pBuf + 56, pRec->offset.sec);
+    ptp_trace_put32(pBuf + 60, pRec->offset.nanosec);
+}
+
+// deserialize record
+void ptp_trace_decode(struct PTPEvLogRecord *pRec, const uint8_t *pBuf)
+{
+    memset(pRec, 0, sizeof(struct PTPEvLogRecord));
+
+    uint8_t i;
+    for (i = 0; i < 4; i++)
+    {
+        pRec->t[i].sec = ptp_trace_get32(pBuf + 8 * i);
+        pRec->t[i].nanosec = ptp_trace_get32(pBuf + 8 * i + 4);
+    }
+
+    pRec->corrFollowUp = ptp_trace_get32(pBuf + 32);
+    pRec->corrDelayResp = ptp_trace_get32(pBuf + 36);
+    pRec->addendPrev = ptp_trace_get32(pBuf + 40);
+    pRec->addend = ptp_trace_get32(pBuf + 44);
+    pRec->ppsOffset = ptp_trace_get32(pBuf + 48);
+    pRec->sequenceID = pBuf[52] | (pBuf[53] << 8);
+    pRec->domainNumber = pBuf[54];
+    pRec->flags = pBuf[55];
+    pRec->offset.sec = ptp_trace_get32(pBuf + 56);
+    pRec->offset.nanosec = ptp_trace_get32(pBuf + 60);
+}
+
+// format trace header line (PTP_TRACE_HEADER_LENGTH characters needed)
+void ptp_trace_format_header(char *pLine, float addendPerPpb)
+{
+    static const char spHex[] = "0123456789ABCDEF";
+    uint32_t bits;
+    memcpy(&bits, &addendPerPpb, sizeof(bits));
+
+    strcpy(pLine, PTP_TRACE_HEADER_PREFIX " ");
+    pLine += sizeof(PTP_TRACE_HEADER_PREFIX " ") - 1;
+    *(pLine++) = '0' + PTP_TRACE_VERSION;
+    *(pLine++) = ' ';
+
+    int8_t i;
+    for (i = 7; i >= 0; i--)
+    {
+        *(pLine++) = spHex[(bits >> (4 * i)) & 0x0F];
+    }
+    *pLine = '\0';
+}
+
+// format record as a trace line (PTP_TRACE_LINE_LENGTH characters needed)
+void ptp_trace_format(char *pLine, const struct PTPEvLogRecord *pRec)
+{
+    static const char spHex[] = "0123456789ABCDEF";
+    uint8_t pBin[PTP_TRACE_RECORD_SIZE];
+
+    ptp_trace_encode(pBin, pRec);
+
+    strcpy(pLine, PTP_TRACE_RECORD_PREFIX " ");
+    pLine += sizeof(PTP_TRACE_RECORD_PREFIX " ") - 1;
+
+    uint8_t i;
+    for (i = 0; i < PTP_TRACE_RECORD_SIZE; i++)
+    {
+        pLine[2 * i] = spHex[pBin[i] >> 4];
+        pLine[2 * i + 1] = spHex[pBin[i] & 0x0F];
+    }
+    pLine[2 * PTP_TRACE_RECORD_SIZE] = '\0';
+}
+
+// value of a hexadecimal digit (-1 if not a digit)
+static int ptp_trace_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    else if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    else if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    else
+    {
+        return -1;
+    }
+}
+
+// parse trace record line
+bool ptp_trace_parse_line(struct PTPEvLogRecord *pRec, const char *pLine)
+{
+    static const char spPrefix[] = PTP_TRACE_RECORD_PREFIX " ";
+    uint8_t pBin[PTP_TRACE_RECORD_SIZE];
+
+    if (strncmp(pLine, spPrefix, sizeof(spPrefix) - 1))
+    {
+        return false;
+    }
+    pLine += sizeof(spPrefix) - 1;
+
+    uint8_t i;
+    for (i = 0; i < PTP_TRACE_RECORD_SIZE; i++)
+    {
+        int hi = ptp_trace_hex_digit(pLine[2 * i]);
+        int lo = (hi < 0) ? -1 : ptp_trace_hex_digit(pLine[2 * i + 1]);
+        if (lo < 0)
+        {
+            return false; // truncated or corrupted line
+        }
+
+        pBin[i] = (hi << 4) | lo;
+    }
+
+    ptp_trace_decode(pRec, pBin);
+    return true;
+}
@@ -0,0 +1,44 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_TRACE_H
+#define PTP_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ptp_evlog.h"
+
+// Binary trace of synchronization cycles
+//
+// Each event log record is serialized into a fixed-size little-endian record and printed as a line of
+// hexadecimal digits prefixed by PTP_TRACE_RECORD_PREFIX, so that traces can be cut out of a plain serial
+// console capture. A header line (PTP_TRACE_HEADER_PREFIX, format version, addend tuning per ppb as IEEE 754
+// bits) is printed when tracing is turned on. Formatting and parsing are free of any hardware or OS dependency,
+// so the module is shared with the host tools. Record layout:
+//
+//  0..31: t1..t4 (int32 seconds, int32 nanoseconds each)
+// 32..35: correction field of Follow_Up [ns] (int32)
+// 36..39: correction field of Delay_Resp [ns] (int32)
+// 40..43: addend before correction (uint32)
+// 44..47: addend after correction (uint32)
+// 48..51: PPS offset [ns] (int32)
+// 52..53: sequenceID (uint16)
+//     54: domainNumber
+//     55: flags (PTP_EVLOG_FLAG_...)
+// 56..63: time difference fed to the servo (int32 seconds, int32 nanoseconds; only decimated records
+//         need it, the others are recomputed from t1..t4)
+
+#define PTP_TRACE_VERSION (2) // trace format version (single digit)
+#define PTP_TRACE_RECORD_SIZE (64) // size of a serialized record
+#define PTP_TRACE_HEADER_PREFIX "#TH"
+#define PTP_TRACE_RECORD_PREFIX "#T"
+#define PTP_TRACE_HEADER_LENGTH (sizeof(PTP_TRACE_HEADER_PREFIX " 0 ") + 8) // buffer size needed for a header line
+#define PTP_TRACE_LINE_LENGTH (sizeof(PTP_TRACE_RECORD_PREFIX " ") + 2 * PTP_TRACE_RECORD_SIZE) // buffer size needed for a record line
+
+void ptp_trace_encode(uint8_t * pBuf, const struct PTPEvLogRecord * pRec); // serialize record
+void ptp_trace_decode(struct PTPEvLogRecord * pRec, const uint8_t * pBuf); // deserialize record (offset in ticks is left zero)
+void ptp_trace_format_header(char * pLine, float addendPerPpb); // format trace header line
+void ptp_trace_format(char * pLine, const struct PTPEvLogRecord * pRec); // format record as a trace line
+bool ptp_trace_parse_line(struct PTPEvLogRecord * pRec, const char * pLine); // parse trace record line, returns false if the line is not a record
+
+#endif /* PTP_TRACE_H */
@@ -0,0 +1,548 @@
+/* (C) András Wiesner, 2021 */
+
+#include "ptp_unicast.h"
+#include "ptp_bmca.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "utils.h"
+#include "cli.h"
+
+static struct PTPUnicastState *spCliState; // state the CLI commands operate on
+
+// PTP message types belonging to negotiated message kinds
+static const uint8_t spMsgTypes[PTPUC_N] = { PTPIDAnnounce, PTPIDSync, PTPIDDelay_Resp };
+static const char *spMsgNames[PTPUC_N] = { "Announce", "Sync", "Delay_Resp" };
+
+// --------------------------
+
+// print IP address
+static void ptp_unicast_print_addr(const struct ip_addr *pAddr)
+{
+    MSG("%u.%u.%u.%u", ip4_addr1(pAddr), ip4_addr2(pAddr), ip4_addr3(pAddr), ip4_addr4(pAddr));
+}
+
+// print configuration and grant states
+static void ptp_unicast_print_status(const struct PTPUnicastState *pU)
+{
+    static const char *spStateNames[] = { "none", "requested", "granted", "denied" };
+
+    MSG("> Unicast: %s, intervals: Announce 2^%d s, Sync 2^%d s, Delay_Resp 2^%d s, duration: %u s\n", pU->config.enabled ? "on" : "off",
+        pU->config.logInterval[PTPUCAnnounce], pU->config.logInterval[PTPUCSync], pU->config.logInterval[PTPUCDelay_Resp], pU->config.duration);
+
+    uint8_t i, k;
+    for (i = 0; i < PTP_UNICAST_MAX_MASTERS; i++)
+    {
+        const struct PTPUnicastMaster *pM = &pU->masters[i];
+        if (!pM->used)
+        {
+            continue;
+        }
+
+        MSG("  ");
+        ptp_unicast_print_addr(&pM->addr);
+        MSG(":");
+
+        for (k = 0; k < PTPUC_N; k++)
+        {
+            const struct PTPUnicastGrant *pG = &pM->grants[k];
+            MSG(" %s: %s", spMsgNames[k], spStateNames[pG->state]);
+            if (pG->state == UGGranted)
+            {
+                MSG(" (2^%d s, %u s)", pG->logInterval, pG->duration);
+            }
+        }
+
+        MSG("\n");
+    }
+}
+
+// is the log2 message interval requestable?
+static bool ptp_unicast_log_interval_valid(int logInterval)
+{
+    return logInterval >= PTP_UNICAST_MIN_LOG_INTERVAL && logInterval <= PTP_UNICAST_MAX_LOG_INTERVAL;
+}
+
+static int CB_master(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPUnicastState *pU = spCliState;
+
+    struct ip_addr addr;
+    addr.addr = ipaddr_addr(ppArgs[1]);
+    if (addr.addr == IPADDR_NONE)
+    {
+        return -1;
+    }
+
+    bool add;
+    if (!strcmp(ppArgs[0], "add"))
+    {
+        add = true;
+    }
+    else if (!strcmp(ppArgs[0], "del"))
+    {
+        add = false;
+    }
+    else
+    {
+        return -1;
+    }
+
+    if (pU->request.master)
+    {
+        MSG("> Previous master change is still pending!\n");
+        return 0;
+    }
+
+    // applied by the PTP task
+    pU->request.addMaster = add;
+    pU->request.masterAddr = addr;
+    pU->request.master = true;
+
+    return 0;
+}
+
+static int CB_params(const CliToken_Type *ppArgs, uint8_t argc)
+{
+    struct PTPUnicastState *pU = spCliState;
+
+    if (argc >= 4)
+    {
+        int logAnn = atoi(ppArgs[0]), logSync = atoi(ppArgs[1]), logDResp = atoi(ppArgs[2]), duration = atoi(ppArgs[3]);
+        if (!ptp_unicast_log_interval_valid(logAnn) || !ptp_unicast_log_interval_valid(logSync) || !ptp_unicast_log_interval_valid(logDResp))
+        {
+            MSG("> Intervals must be between 2^%d and 2^%d s!\n", PTP_UNICAST_MIN_LOG_INTERVAL, PTP_UNICAST_MAX_LOG_INTERVAL);
+            return 0;
+        }
+
+        if (duration < PTP_UNICAST_MIN_DURATION_S || duration > PTP_UNICAST_MAX_DURATION_S)
+        {
+            MSG("> Duration must be between %u and %u s!\n", PTP_UNICAST_MIN_DURATION_S, PTP_UNICAST_MAX_DURATION_S);
+            return 0;
+        }
+
+        if (pU->request.params)
+        {
+            MSG("> Previous parameter change is still pending!\n");
+            return 0;
+        }
+
+        // applied by the PTP task
+        pU->request.logInterval[PTPUCAnnounce] = logAnn;
+        pU->request.logInterval[PTPUCSync] = logSync;
+        pU->request.logInterval[PTPUCDelay_Resp] = logDResp;
+        pU->request.duration = duration;
+        pU->request.params = true;
+
+        MSG("> Requested intervals: Announce 2^%d s, Sync 2^%d s, Delay_Resp 2^%d s, duration: %u s\n", pU->request.logInterval[PTPUCAnnounce],
+            pU->request.logInterval[PTPUCSync], pU->request.logInterval[PTPUCDelay_Resp], pU->request.duration);
+        return 0;
+    }
+
+    ptp_unicast_print_status(pU);
+    return 0;
+}
+
+// cli commands (sorted)
+static const struct CliCommand spCliCmds[] = {
+    { "ptp unicast master", "{add|del} ip \t\t\tAdd or remove a candidate unicast master", 2, CB_master },
+    { "ptp unicast params", "[ann sync dresp dur] \t\t\tSet or query log2 intervals, grant duration and grants", 0, CB_params },
+};
+
+static struct CliCommandTable sCliTable = CLI_COMMAND_TABLE(spCliCmds);
+
+// register cli commands operating on the passed state
+void ptp_unicast_register_cli_commands(struct PTPUnicastState *pU)
+{
+    spCliState = pU;
+
+    cli_register_table(&sCliTable);
+}
+
+// --------------------------
+
+// initialize unicast negotiation (configuration and candidate masters of a zero-filled or already initialized state are kept)
+void ptp_unicast_init(struct PTPUnicastState *pU, struct udp_pcb *pPCBs[], uint64_t clockIdentity)
+{
+    pU->pPCBs = pPCBs;
+    pU->clockIdentity = clockIdentity;
+
+    if (!pU->configured)
+    {
+        pU->config.enabled = false;
+        pU->config.logInterval[PTPUCAnnounce] = PTP_UNICAST_DEFAULT_LOG_ANNOUNCE;
+        pU->config.logInterval[PTPUCSync] = PTP_UNICAST_DEFAULT_LOG_SYNC;
+        pU->config.logInterval[PTPUCDelay_Resp] = PTP_UNICAST_DEFAULT_LOG_DELAY_RESP;
+        pU->config.duration = PTP_UNICAST_DEFAULT_DURATION_S;
+        memset(pU->masters, 0, sizeof(pU->masters));
+        pU->configured = true;
+    }
+
+    // grants don't survive reinitialization
+    uint8_t i;
+    for (i = 0; i < PTP_UNICAST_MAX_MASTERS; i++)
+    {
+        memset(pU->masters[i].grants, 0, sizeof(pU->masters[i].grants));
+    }
+}
+
+// enable/disable unicast negotiation (grants are cancelled in the next periodic run)
+void ptp_unicast_enable(struct PTPUnicastState *pU, bool en)
+{
+    pU->config.enabled = en;
+}
+
+// is unicast operation enabled?
+bool ptp_unicast_is_enabled(const struct PTPUnicastState *pU)
+{
+    return pU->config.enabled;
+}
+
+// find candidate master by address
+static struct PTPUnicastMaster* ptp_unicast_lookup(struct PTPUnicastState *pU, struct ip_addr *pAddr)
+{
+    uint8_t i;
+    for (i = 0; i < PTP_UNICAST_MAX_MASTERS; i++)
+    {
+        if (pU->masters[i].used && ip_addr_cmp(&pU->masters[i].addr, pAddr))
+        {
+            return &pU->masters[i];
+        }
+    }
+
+    return NULL;
+}
+
+// add candidate master
+int ptp_unicast_add_master(struct PTPUnicastState *pU, struct ip_addr *pAddr)
+{
+    if (ptp_unicast_lookup(pU, pAddr) != NULL)
+    {
+        return 0;
+    }
+
+    uint8_t i;
+    for (i = 0; i < PTP_UNICAST_MAX_MASTERS; i++)
+    {
+        struct PTPUnicastMaster *pM = &pU->masters[i];
+        if (!pM->used)
+        {
+            memset(pM->grants, 0, sizeof(pM->grants));
+            pM->addr = *pAddr;
+            pU->removePending[i] = false;
+            pM->used = true;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// remove candidate master (slot is released after its grants are cancelled)
+int ptp_unicast_remove_master(struct PTPUnicastState *pU, struct ip_addr *pAddr)
+{
+    struct PTPUnicastMaster *pM = ptp_unicast_lookup(pU, pAddr);
+    if (pM == NULL)
+    {
+        return -1;
+    }
+
+    pU->removePending[pM - pU->masters] = true;
+    return 0;
+}
+
+// write REQUEST_UNICAST_TRANSMISSION TLV
+static uint8_t* ptp_unicast_write_request_tlv(const struct PTPUnicastState *pU, uint8_t *p, enum PTPUnicastMsg kind)
+{
+    uint16_t tlvType = htons(PTPTLVRequestUnicast);
+    uint16_t tlvLen = htons(PTP_TLV_REQUEST_LENGTH - 4);
+    uint32_t duration = htonl(pU->config.duration);
+
+    memcpy(p, &tlvType, 2);
+    memcpy(p + 2, &tlvLen, 2);
+    p[4] = spMsgTypes[kind] << 4;
+    p[5] = (uint8_t) pU->config.logInterval[kind];
+    memcpy(p + 6, &duration, 4);
+
+    return p + PTP_TLV_REQUEST_LENGTH;
+}
+
+// write CANCEL_UNICAST_TRANSMISSION or ACKNOWLEDGE_CANCEL_UNICAST_TRANSMISSION TLV
+static uint8_t* ptp_unicast_write_cancel_tlv(uint8_t *p, enum PTPTLVType type, enum PTPUnicastMsg kind)
+{
+    uint16_t tlvType = htons(type);
+    uint16_t tlvLen = htons(PTP_TLV_CANCEL_LENGTH - 4);
+
+    memcpy(p, &tlvType, 2);
+    memcpy(p + 2, &tlvLen, 2);
+    p[4] = spMsgTypes[kind] << 4;
+    p[5] = 0;
+
+    return p + PTP_TLV_CANCEL_LENGTH;
+}
+
+// construct and send Signaling message carrying the passed TLVs
+static void ptp_unicast_send_signaling(struct PTPUnicastState *pU, struct ip_addr *pAddr, uint8_t domainNumber, uint8_t *pTLVs, uint16_t tlvLen)
+{
+    struct PTPHeader header;
+    uint16_t len = PTP_SIGNALING_BODY_OFFSET + tlvLen;
+
+    // fill in header fields
+    memset(&header, 0, sizeof(header));
+    header.messageID = PTPIDSignaling;
+    header.versionPTP = 2;
+    header.messageLength = len;
+    header.subdomainNumber = domainNumber;
+    header.flags.PTP_UNICAST = true;
+    header.clockIdentity = pU->clockIdentity;
+    header.sourcePortID = 1;
+    header.sequenceID = pU->signalingSequenceID++;
+    header.control = PTPCONOther;
+    header.logMessagePeriod = 0x7f;
+
+    // allocate pbuf
+    struct pbuf *pPBuf = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    if (pPBuf == NULL)
+    {
+        return;
+    }
+
+    uint8_t *p = (uint8_t*) pPBuf->payload;
+    memset(p, 0, len);
+    ptp_construct_binary_header(p, &header);
+    memset(p + PTP_HEADER_LENGTH, 0xff, PTP_SIGNALING_BODY_OFFSET - PTP_HEADER_LENGTH); // targetPortIdentity: all ports
+    memcpy(p + PTP_SIGNALING_BODY_OFFSET, pTLVs, tlvLen);
+
+    // Signaling is a general message
+    udp_sendto(pU->pPCBs[1], pPBuf, pAddr, PTP_PORT1);
+    pbuf_free(pPBuf);
+}
+
+// advance grant state machine, TLVs to be sent are written to p
+static uint8_t* ptp_unicast_update_grant(const struct PTPUnicastState *pU, uint8_t *p, struct PTPUnicastGrant *pG, enum PTPUnicastMsg kind, bool wanted, uint32_t now)
+{
+    uint32_t retry = pdMS_TO_TICKS(PTP_UNICAST_RETRY_S * 1000);
+
+    // cancel grant if not needed anymore
+    if (!wanted)
+    {
+        if (pG->state == UGGranted || pG->state == UGRequested)
+        {
+            p = ptp_unicast_write_cancel_tlv(p, PTPTLVCancelUnicast, kind);
+        }
+
+        pG->state = UGNone;
+        return p;
+    }
+
+    bool request = false;
+    switch (pG->state)
+    {
+    case UGNone:
+        request = true;
+        break;
+    case UGRequested:
+    case UGDenied:
+        request = (now - pG->reqTick) >= retry;
+        break;
+    case UGGranted:
+    {
+        uint32_t elapsed = now - pG->grantTick;
+        uint32_t duration = pG->duration * configTICK_RATE_HZ; // duration is capped, doesn't overflow
+        if (elapsed >= duration)
+        {
+            pG->state = UGNone; // grant has expired
+            request = true;
+        }
+        else
+        {
+            request = (elapsed >= (duration / PTP_UNICAST_RENEW_DEN) * PTP_UNICAST_RENEW_NUM) && ((now - pG->reqTick) >= retry); // renewal
+        }
+        break;
+    }
+    }
+
+    if (request)
+    {
+        p = ptp_unicast_write_request_tlv(pU, p, kind);
+        pG->reqTick = now;
+        if (pG->state != UGGranted)
+        {
+            pG->state = UGRequested;
+        }
+    }
+
+    return p;
+}
+
+// apply master table and parameter changes posted by the CLI
+static void ptp_unicast_serve_requests(struct PTPUnicastState *pU)
+{
+    if (pU->request.master)
+    {
+        int ret = pU->request.addMaster ? ptp_unicast_add_master(pU, &pU->request.masterAddr) : ptp_unicast_remove_master(pU, &pU->request.masterAddr);
+        if (ret < 0)
+        {
+            MSG("Unicast: master table is full or master not found!\n");
+        }
+
+        pU->request.master = false;
+    }
+
+    if (pU->request.params)
+    {
+        memcpy(pU->config.logInterval, pU->request.logInterval, sizeof(pU->config.logInterval));
+        pU->config.duration = pU->request.duration;
+        pU->request.params = false;
+    }
+}
+
+// apply changes of the CLI, request, renew or cancel grants
+void ptp_unicast_periodic(struct PTPUnicastState *pU, const struct PTPForeignMaster *pParent, uint8_t domainNumber)
+{
+    ptp_unicast_serve_requests(pU);
+
+    uint32_t now = xTaskGetTickCount();
+    pU->domainNumber = domainNumber;
+
+    uint8_t i, k;
+    for (i = 0; i < PTP_UNICAST_MAX_MASTERS; i++)
+    {
+        struct PTPUnicastMaster *pM = &pU->masters[i];
+        if (!pM->used)
+        {
+            continue;
+        }
+
+        bool active = pU->config.enabled && !pU->removePending[i];
+        bool parent = (pParent != NULL) && ip_addr_cmp(&pParent->addr, &pM->addr);
+
+        // Announces are requested from every candidate to feed the BMCA, Sync and Delay_Resp only from the parent
+        uint8_t pTLVs[PTPUC_N * PTP_TLV_REQUEST_LENGTH];
+        uint8_t *p = pTLVs;
+        for (k = 0; k < PTPUC_N; k++)
+        {
+            p = ptp_unicast_update_grant(pU, p, &pM->grants[k], (enum PTPUnicastMsg) k, active && (k == PTPUCAnnounce || parent), now);
+        }
+
+        if (p != pTLVs)
+        {
+            ptp_unicast_send_signaling(pU, &pM->addr, pU->domainNumber, pTLVs, p - pTLVs);
+        }
+
+        // release slot if removal was requested
+        if (pU->removePending[i])
+        {
+            pM->used = false;
+            pU->removePending[i] = false;
+        }
+    }
+}
+
+// get PTP message type of negotiated message kind
+uint8_t ptp_unicast_msg_type(enum PTPUnicastMsg kind)
+{
+    return spMsgTypes[kind];
+}
+
+// get negotiated message kind of PTP message type
+int ptp_unicast_msg_kind(uint8_t messageType)
+{
+    uint8_t k;
+    for (k = 0; k < PTPUC_N; k++)
+    {
+        if (spMsgTypes[k] == messageType)
+        {
+            return k;
+        }
+    }
+
+    return -1;
+}
+
+// process received Signaling message
+void ptp_unicast_process_signaling(struct PTPUnicastState *pU, struct PTPHeader *pHeader, void *pPayload, uint16_t len, struct ip_addr *pSrcAddr)
+{
+    struct PTPUnicastMaster *pM = ptp_unicast_lookup(pU, pSrcAddr);
+    if (pM == NULL)
+    {
+        return;
+    }
+
+    uint32_t now = xTaskGetTickCount();
+    uint8_t *p = (uint8_t*) pPayload;
+    uint16_t msgLen = (pHeader->messageLength < len) ? pHeader->messageLength : len;
+    uint16_t offset = PTP_SIGNALING_BODY_OFFSET;
+
+    // acknowledgements of cancellations
+    uint8_t pAckTLVs[PTPUC_N * PTP_TLV_CANCEL_LENGTH];
+    uint8_t *pAck = pAckTLVs;
+
+    // iterate over TLVs
+    while (offset + 4 <= msgLen)
+    {
+        uint16_t tlvType, tlvLen;
+        memcpy(&tlvType, p + offset, 2);
+        memcpy(&tlvLen, p + offset + 2, 2);
+        tlvType = ntohs(tlvType);
+        tlvLen = ntohs(tlvLen);
+
+        uint8_t *pV = p + offset + 4; // TLV value
+        offset += 4 + tlvLen;
+        if (offset > msgLen || tlvLen < 2)
+        {
+            break;
+        }
+
+        int kind = ptp_unicast_msg_kind(pV[0] >> 4);
+        if (kind < 0)
+        {
+            continue;
+        }
+
+        struct PTPUnicastGrant *pG = &pM->grants[kind];
+
+        switch (tlvType)
+        {
+        case PTPTLVGrantUnicast:
+        {
+            if (tlvLen < 8 || pG->state == UGNone)
+            {
+                break;
+            }
+
+            uint32_t duration;
+            memcpy(&duration, pV + 2, 4);
+            duration = ntohl(duration);
+
+            if (duration > 0)
+            {
+                pG->state = UGGranted;
+                pG->logInterval = (int8_t) pV[1];
+                pG->duration = MIN(duration, PTP_UNICAST_MAX_DURATION_S);
+                pG->grantTick = now;
+            }
+            else if (pG->state != UGGranted) // a denied renewal leaves the running grant intact
+            {
+                pG->state = UGDenied;
+            }
+            break;
+        }
+        case PTPTLVCancelUnicast:
+            pG->state = UGNone;
+            if (pAck < pAckTLVs + sizeof(pAckTLVs))
+            {
+                pAck = ptp_unicast_write_cancel_tlv(pAck, PTPTLVAckCancelUnicast, (enum PTPUnicastMsg) kind);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (pAck != pAckTLVs)
+    {
+        ptp_unicast_send_signaling(pU, pSrcAddr, pHeader->subdomainNumber, pAckTLVs, pAck - pAckTLVs);
+    }
+}
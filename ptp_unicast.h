@@ -0,0 +1,102 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef PTP_UNICAST_H
+#define PTP_UNICAST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ptp.h"
+#include "ptp_bmca.h"
+
+#define PTP_UNICAST_MAX_MASTERS (4) // maximal number of candidate master IP addresses
+#define PTP_UNICAST_DEFAULT_DURATION_S (60) // default requested grant duration [s]
+#define PTP_UNICAST_MIN_DURATION_S (10) // shortest grant duration requested [s]
+#define PTP_UNICAST_MAX_DURATION_S (1000) // longest grant duration requested or accepted (longer grants are renewed as if they were this long) [s]
+#define PTP_UNICAST_MIN_LOG_INTERVAL (-7) // shortest message interval requested (log2 s)
+#define PTP_UNICAST_MAX_LOG_INTERVAL (7) // longest message interval requested (log2 s)
+#define PTP_UNICAST_DEFAULT_LOG_ANNOUNCE (1) // default requested Announce interval (log2 s)
+#define PTP_UNICAST_DEFAULT_LOG_SYNC (0) // default requested Sync interval (log2 s)
+#define PTP_UNICAST_DEFAULT_LOG_DELAY_RESP (0) // default requested Delay_Resp interval (log2 s)
+#define PTP_UNICAST_RETRY_S (4) // retry interval after a denied or unanswered request [s]
+#define PTP_UNICAST_RENEW_NUM (3) // grants are renewed after RENEW_NUM/RENEW_DEN of their duration
+#define PTP_UNICAST_RENEW_DEN (4)
+
+#define PTP_SIGNALING_BODY_OFFSET (44) // header + targetPortIdentity
+#define PTP_TLV_REQUEST_LENGTH (10) // REQUEST_UNICAST_TRANSMISSION TLV length including type and length fields
+#define PTP_TLV_GRANT_LENGTH (12) // GRANT_UNICAST_TRANSMISSION TLV length including type and length fields
+#define PTP_TLV_CANCEL_LENGTH (6) // CANCEL/ACKNOWLEDGE_CANCEL TLV length including type and length fields
+
+// Signaling TLV types
+enum PTPTLVType {
+    PTPTLVRequestUnicast = 0x0004,
+    PTPTLVGrantUnicast = 0x0005,
+    PTPTLVCancelUnicast = 0x0006,
+    PTPTLVAckCancelUnicast = 0x0007
+};
+
+// negotiated message kinds
+enum PTPUnicastMsg {
+    PTPUCAnnounce = 0,
+    PTPUCSync,
+    PTPUCDelay_Resp,
+    PTPUC_N
+};
+
+// grant states
+enum PTPGrantState {
+    UGNone, UGRequested, UGGranted, UGDenied
+};
+
+// unicast transmission grant
+struct PTPUnicastGrant {
+    enum PTPGrantState state; // grant state
+    int8_t logInterval; // granted interval (log2 s)
+    uint32_t duration; // granted duration [s]
+    uint32_t grantTick; // OS tick of the grant reception
+    uint32_t reqTick; // OS tick of the last request
+};
+
+// candidate unicast master
+struct PTPUnicastMaster {
+    struct ip_addr addr; // IP address of master
+    struct PTPUnicastGrant grants[PTPUC_N]; // grants per message kind
+    bool used; // slot is in use
+};
+
+// unicast negotiation state of an instance
+struct PTPUnicastState {
+    struct {
+        bool enabled; // unicast operation enabled
+        int8_t logInterval[PTPUC_N]; // requested message intervals
+        uint32_t duration; // requested grant duration
+    } config; // configuration
+    struct PTPUnicastMaster masters[PTP_UNICAST_MAX_MASTERS]; // candidate masters
+    bool removePending[PTP_UNICAST_MAX_MASTERS]; // master is to be removed after its grants are cancelled
+    struct {
+        volatile bool master; // master table change is waiting
+        bool addMaster; // add (true) or remove (false) the master
+        struct ip_addr masterAddr; // address of the master
+        volatile bool params; // new intervals and duration are waiting
+        int8_t logInterval[PTPUC_N]; // requested message intervals
+        uint32_t duration; // requested grant duration
+    } request; // requests of the CLI (served by the PTP task)
+    struct udp_pcb ** pPCBs; // PCBs for sending packets
+    uint64_t clockIdentity; // own clockIdentity (network byte order)
+    uint16_t signalingSequenceID; // sequenceID of Signaling messages
+    uint8_t domainNumber; // domain negotiation is performed in (domain of the active parent)
+    bool configured; // configuration has been filled in (survives reinitialization)
+};
+
+void ptp_unicast_init(struct PTPUnicastState * pU, struct udp_pcb * pPCBs[], uint64_t clockIdentity); // initialize unicast negotiation
+void ptp_unicast_register_cli_commands(struct PTPUnicastState * pU); // register CLI commands operating on the passed state
+void ptp_unicast_enable(struct PTPUnicastState * pU, bool en); // enable/disable unicast negotiation (controlled by the transport mode)
+bool ptp_unicast_is_enabled(const struct PTPUnicastState * pU); // is unicast negotiation enabled?
+int ptp_unicast_add_master(struct PTPUnicastState * pU, struct ip_addr * pAddr); // add candidate master, returns 0 on success (PTP task only)
+int ptp_unicast_remove_master(struct PTPUnicastState * pU, struct ip_addr * pAddr); // remove candidate master (grants are cancelled), returns 0 on success (PTP task only)
+void ptp_unicast_periodic(struct PTPUnicastState * pU, const struct PTPForeignMaster * pParent, uint8_t domainNumber); // apply changes of the CLI, request, renew or cancel grants (Sync and Delay_Resp are requested from the parent only)
+uint8_t ptp_unicast_msg_type(enum PTPUnicastMsg kind); // get PTP message type of negotiated message kind
+int ptp_unicast_msg_kind(uint8_t messageType); // get negotiated message kind of PTP message type (-1: not negotiable)
+void ptp_unicast_process_signaling(struct PTPUnicastState * pU, struct PTPHeader * pHeader, void * pPayload, uint16_t len, struct ip_addr * pSrcAddr); // process received Signaling message
+
+#endif /* PTP_UNICAST_H */
@@ -15,10 +15,6 @@ static float D_FACTOR = 2.0 * 0.476;
 
 // ----------------------------------
 
-static int32_t dt_prev; // clock difference measured in previous iteration (needed for differentiation)
-
-// ----------------------------------
-
 static int CB_params(const CliToken_Type *ppArgs, uint8_t argc)
 {
     // set if parameters passed after command
@@ -35,35 +31,44 @@ static int CB_params(const CliToken_Type *ppArgs, uint8_t argc)
     return 0;
 }
 
+static const struct CliCommand spCliCmds[] = {
+    { "ptp servo params", "[Kp Kd] \t\t\tSet or query K_p and K_d servo parameters", 0, CB_params },
+};
+
+static struct CliCommandTable sCliTable = CLI_COMMAND_TABLE(spCliCmds);
+
 static void pd_ctrl_register_cli_commands() {
-    cli_register_command("ptp servo params [Kp Kd] \t\t\tSet or query K_p and K_d servo parameters", 3, 0, CB_params);
+    cli_register_table(&sCliTable);
 }
 
 void pd_ctrl_init() {
-    pd_ctrl_reset();
     pd_ctrl_register_cli_commands();
 }
 
-void pd_ctrl_reset() {
-    dt_prev = 0;
+void pd_ctrl_reset(struct PdCtrlState * pS) {
+    pS->dt_prev = 0;
 }
 
-float pd_ctrl_run(int32_t dt) {
-    if (dt_prev == 0) {
-        dt_prev = dt;
+float pd_ctrl_run(struct PdCtrlState * pS, int32_t dt) {
+    if (pS->dt_prev == 0) {
+        pS->dt_prev = dt;
         return 0;
     }
 
     // calculate difference
-    int32_t d_D = dt - dt_prev;
+    int32_t d_D = dt - pS->dt_prev;
 
     // calculate output (run the PD controller)
     float corr_ppb = -(dt * P_FACTOR + d_D * D_FACTOR);
 
     // store error value (time difference) for use in next iteration
-    dt_prev = dt;
+    pS->dt_prev = dt;
 
     return corr_ppb;
 }
 
+int32_t pd_ctrl_get_state(const struct PdCtrlState * pS) {
+    return pS->dt_prev;
+}
+
 // ----------------------------------
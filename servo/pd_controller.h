@@ -5,8 +5,14 @@
 
 #include <stdint.h>
 
+// state of a PD controller instance
+struct PdCtrlState {
+    int32_t dt_prev; // clock difference measured in previous iteration (needed for differentiation)
+};
+
 void pd_ctrl_init(); // initialize PD controller
-void pd_ctrl_reset(); // reset controller
-float pd_ctrl_run(int32_t dt); // run the controller (input: time error in nanosec)
+void pd_ctrl_reset(struct PdCtrlState * pS); // reset controller instance
+float pd_ctrl_run(struct PdCtrlState * pS, int32_t dt); // run the controller instance (input: time error in nanosec)
+int32_t pd_ctrl_get_state(const struct PdCtrlState * pS); // get state summary (time error of the previous iteration)
 
 #endif /* SERVO_PD_CONTROLLER_H_ */
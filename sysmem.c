@@ -0,0 +1,113 @@
+/* (C) András Wiesner, 2021 */
+
+#include "sysmem.h"
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "utils.h"
+#include "cli.h"
+
+// registered subsystem
+struct SysMemEntry
+{
+    const char * pSubsystem; // name of subsystem
+    const char * pTaskName; // name of its task (NULL: no task)
+    uint32_t stackWords; // static stack size (0: allocated on the heap)
+    size_t staticBytes; // other static memory (control blocks, queues, buffers)
+};
+
+static struct SysMemEntry spEntries[SYSMEM_MAX_ENTRIES];
+static volatile uint8_t sEntryCnt; // number of registered subsystems
+
+static TaskStatus_t spTaskStatus[SYSMEM_MAX_TASKS]; // task states gathered by the report (only used by the CLI task)
+
+// register memory of a subsystem
+void SYSMEM_register(const char * pSubsystem, const char * pTaskName, uint32_t stackWords, size_t staticBytes) {
+    if (sEntryCnt >= SYSMEM_MAX_ENTRIES) {
+        MSG("Memory budget of '%s' not registered, table is full!\n", pSubsystem);
+        return;
+    }
+
+    struct SysMemEntry * pE = &spEntries[sEntryCnt];
+    pE->pSubsystem = pSubsystem;
+    pE->pTaskName = pTaskName;
+    pE->stackWords = stackWords;
+    pE->staticBytes = staticBytes;
+    sEntryCnt++; // entry is complete when it gets counted
+}
+
+// look up task state by name (NULL: task doesn't exist)
+static const TaskStatus_t * SYSMEM_findTask(const char * pName, uint32_t taskCnt) {
+    uint32_t i;
+    for (i = 0; i < taskCnt; i++) {
+        if (!strcmp(spTaskStatus[i].pcTaskName, pName)) {
+            return &spTaskStatus[i];
+        }
+    }
+
+    return NULL;
+}
+
+// ---------------------------
+
+static int CB_mem(const CliToken_Type *ppArgs, uint8_t argc) {
+    uint32_t taskCnt = uxTaskGetSystemState(spTaskStatus, SYSMEM_MAX_TASKS, NULL);
+    uint32_t stackTotal = 0, staticTotal = 0;
+
+    // registered subsystems
+    uint8_t i;
+    for (i = 0; i < sEntryCnt; i++) {
+        const struct SysMemEntry * pE = &spEntries[i];
+        uint32_t stackBytes = pE->stackWords * sizeof(StackType_t);
+        const TaskStatus_t * pT = (pE->pTaskName != NULL) ? SYSMEM_findTask(pE->pTaskName, taskCnt) : NULL;
+
+        MSG("> %s: ", pE->pSubsystem);
+        if (pE->pTaskName == NULL) {
+            // no task
+        } else if (pT == NULL) {
+            MSG("task '%s' not running, stack: %u B, ", pE->pTaskName, stackBytes);
+        } else if (pE->stackWords == 0) {
+            MSG("task '%s', stack on heap (min. free: %u B), ", pE->pTaskName, pT->usStackHighWaterMark * sizeof(StackType_t));
+        } else {
+            uint32_t used = stackBytes - pT->usStackHighWaterMark * sizeof(StackType_t);
+            MSG("task '%s', stack: %u B (max. used: %u B, %u %%), ", pE->pTaskName, stackBytes, used, used * 100 / stackBytes);
+        }
+        MSG("other: %u B\n", pE->staticBytes);
+
+        stackTotal += stackBytes;
+        staticTotal += stackBytes + pE->staticBytes;
+    }
+
+    // tasks not belonging to any subsystem (e.g. created by a library)
+    uint32_t k;
+    for (k = 0; k < taskCnt; k++) {
+        bool known = false;
+        for (i = 0; i < sEntryCnt && !known; i++) {
+            known = (spEntries[i].pTaskName != NULL) && !strcmp(spEntries[i].pTaskName, spTaskStatus[k].pcTaskName);
+        }
+
+        if (!known) {
+            MSG("> Task '%s': min. free stack: %u B\n", spTaskStatus[k].pcTaskName, spTaskStatus[k].usStackHighWaterMark * sizeof(StackType_t));
+        }
+    }
+
+    MSG("> Static total: %u B (stacks: %u B), heap: %u B (free: %u B, min. free: %u B)\n", staticTotal, stackTotal, configTOTAL_HEAP_SIZE,
+        xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize());
+
+    return 0;
+}
+
+static const struct CliCommand spCliCmds[] = {
+    { "sys mem", "\t\t\tPrint memory budget per subsystem, stack high-water marks and heap usage", 0, CB_mem },
+};
+
+static struct CliCommandTable sCliTable = CLI_COMMAND_TABLE(spCliCmds);
+
+// register memory report commands
+void SYSMEM_registerCliCommands() {
+    cli_register_table(&sCliTable);
+}
@@ -0,0 +1,24 @@
+/* (C) András Wiesner, 2021 */
+
+#ifndef SRC_SYSMEM
+#define SRC_SYSMEM
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Memory budget
+//
+// Tasks, queues and buffers of the application are allocated statically, so RAM use is fixed at link time and
+// doesn't depend on uptime (the heap only serves the tcpip thread and the mailboxes of lwIP, created once).
+// Subsystems register their stacks and other static memory here, the report adds the stack high-water mark of
+// every task measured by the kernel, so stack sizes can be trimmed to the measured need plus a margin.
+
+#define SYSMEM_MAX_ENTRIES (16) // number of subsystems that can be registered
+#define SYSMEM_MAX_TASKS (16) // number of tasks listed in the report
+
+// register memory of a subsystem (pTaskName: name of its task or NULL, stackWords: static stack size, 0 if allocated on the heap)
+void SYSMEM_register(const char * pSubsystem, const char * pTaskName, uint32_t stackWords, size_t staticBytes);
+
+void SYSMEM_registerCliCommands(); // register memory report commands
+
+#endif /* SRC_SYSMEM */
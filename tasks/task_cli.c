@@ -5,44 +5,65 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "FreeRTOS.h"
+#include "message_buffer.h"
+
 #include "cli.h"
+#include "sysmem.h"
 
 // ----- TASK PROPERTIES -----
 static TaskHandle_t sTH; // task handle
 static uint8_t sPrio = 5; // priority
-static uint16_t sStkSize = 2048; // stack size
+static StackType_t spStack[2048]; // stack
+static StaticTask_t sTCB; // task control block
+static const char * spName = "cli"; // task name
 void task_cli(void *pParam); // taszk routine function
 // ---------------------------
 
-// structure for defining cli commands
-struct CliCommand
-{
-    CliToken_Type ppTok[MAX_TOKEN_N]; // tokens
-    uint8_t tokCnt; // number of tokens in command without arguments
-    uint8_t minArgCnt; // minimal number of parameters
-    char pHelp[MAX_HELP_LEN]; // help line
-    fnCliCallback pCB; // processing callback function
-};
+static struct CliCommandTable * spCliTables; // registered command tables
+
+#define CLI_BUF_LENGTH (128)
+#define TOK_ARR_LEN (16)
 
-#define CLI_MAX_CMD_CNT (16) // limit on number of separate commands
-static struct CliCommand spCliCmds[CLI_MAX_CMD_CNT];
-static uint8_t sCliCmdCnt;
+// line editor (operating in the UART interrupt)
+#define CLI_HISTORY_LENGTH (8) // number of lines kept in history
+#define CLI_LINE_FIFO_SIZE (2 * (CLI_BUF_LENGTH + sizeof(size_t))) // completed lines waiting for processing
+
+static struct
+{
+    char pLine[CLI_BUF_LENGTH]; // line being edited
+    uint8_t len; // length of the line
+    char ppHistory[CLI_HISTORY_LENGTH][CLI_BUF_LENGTH]; // previous lines (fixed arena, ring order)
+    uint8_t histHead; // index of the next history slot to be written
+    uint8_t histCnt; // number of lines stored in history
+    uint8_t histPos; // history position while browsing (0: editing a new line)
+    uint8_t escState; // escape sequence parsing state
+    char lastChar; // previous character (for CR-LF handling)
+} sEditor;
+
+static MessageBufferHandle_t sLineFIFO; // completed lines
+static StaticMessageBuffer_t sLineFIFOMem; // message buffer control block
+static uint8_t spLineFIFOStorage[CLI_LINE_FIFO_SIZE + 1]; // message buffer storage (one byte is never used)
 
 // ---------------------------
 
 
+static bool cli_line_input(char c); // line editor processing received characters
+
 // register and initialize task
 void reg_task_cli()
 {
-    BaseType_t result = xTaskCreate(task_cli, "cli", sStkSize, NULL, sPrio,
-                                    &sTH);
-    if (result != pdPASS)
-    { // taszk létrehozása
-        MSG("Failed to create task! (errcode: %d)\n", result);
-    }
+    // create FIFO of completed lines and start receiving characters
+    sLineFIFO = xMessageBufferCreateStatic(CLI_LINE_FIFO_SIZE, spLineFIFOStorage, &sLineFIFOMem);
+    UART_setRxCallback(cli_line_input);
+
+    sTH = xTaskCreateStatic(task_cli, spName, sizeof(spStack) / sizeof(StackType_t), NULL, sPrio, spStack, &sTCB);
+
+    SYSMEM_register("CLI", spName, sizeof(spStack) / sizeof(StackType_t), sizeof(sTCB) + sizeof(sEditor) + sizeof(sLineFIFOMem) + sizeof(spLineFIFOStorage));
 
     // ----------------------
-    sCliCmdCnt = 0;
+    UART_registerCliCommands(); // serial output statistics
+    SYSMEM_registerCliCommands(); // memory budget
 }
 
 // remove task fro
@@ -53,53 +74,245 @@ void unreg_task_cli()
 
 // ---------------------------
 
-#define CLI_BUF_LENGTH (128)
-#define TOK_ARR_LEN (16)
-
-static void tokenize_cli_line(char *pLine, CliToken_Type ppTok[],
-                              uint32_t tokMaxLen, uint32_t tokMaxCnt,
-                              uint32_t *pTokCnt)
+// replace the line being edited (e.g. by a line from history)
+static void cli_line_replace(const char *pNew)
 {
-    uint32_t len = strlen(pLine);
+    static const char pClear[] = "\r\033[K"; // carriage return, erase line
 
-    // copy to prevent modifying original one
-    static char pLineCpy[CLI_BUF_LENGTH];
-    strcpy(pLineCpy, pLine);
+    sEditor.len = strlen(pNew);
+    memcpy(sEditor.pLine, pNew, sEditor.len);
 
-    *pTokCnt = 0;
+    UART_sendFromISR(pClear, sizeof(pClear) - 1);
+    UART_sendFromISR(sEditor.pLine, sEditor.len);
+}
 
-    // prevent processing if input is empty
-    if (len == 0 || tokMaxCnt == 0)
+// step in history (dir: +1 older, -1 newer)
+static void cli_line_browse_history(int dir)
+{
+    int pos = sEditor.histPos + dir;
+    if (pos < 0 || pos > sEditor.histCnt)
     {
         return;
     }
 
-    // first token
-    char *pTok = strtok(pLineCpy, " ");
-    strncpy(&ppTok[0][0], pTok, tokMaxLen);
-    (*pTokCnt)++;
+    sEditor.histPos = pos;
+    if (pos == 0)
+    {
+        cli_line_replace("");
+    }
+    else
+    {
+        cli_line_replace(sEditor.ppHistory[(sEditor.histHead + CLI_HISTORY_LENGTH - pos) % CLI_HISTORY_LENGTH]);
+    }
+}
 
-    // further tokens
-    while ((*pTokCnt < tokMaxCnt) && (pTok != NULL))
+// line is complete: store in history and pass it to the CLI task
+static bool cli_line_complete()
+{
+    BaseType_t woken = pdFALSE;
+
+    UART_sendFromISR("\r\n", 2);
+
+    if (sEditor.len > 0)
     {
-        pTok = strtok(NULL, " ");
+        // store in history
+        memcpy(sEditor.ppHistory[sEditor.histHead], sEditor.pLine, sEditor.len);
+        sEditor.ppHistory[sEditor.histHead][sEditor.len] = '\0';
+        sEditor.histHead = (sEditor.histHead + 1) % CLI_HISTORY_LENGTH;
+        if (sEditor.histCnt < CLI_HISTORY_LENGTH)
+        {
+            sEditor.histCnt++;
+        }
+
+        // lines are dropped if the CLI task is lagging behind
+        xMessageBufferSendFromISR(sLineFIFO, sEditor.pLine, sEditor.len, &woken);
+    }
+
+    sEditor.len = 0;
+    sEditor.histPos = 0;
+
+    return woken == pdTRUE;
+}
+
+// line editor: process a received character (called from the UART interrupt)
+static bool cli_line_input(char c)
+{
+    bool woken = false;
+    char last = sEditor.lastChar;
+    sEditor.lastChar = c;
 
-        if (pTok != NULL)
+    // escape sequences (only cursor up/down are interpreted)
+    if (sEditor.escState == 1)
+    {
+        sEditor.escState = (c == '[') ? 2 : 0;
+        return false;
+    }
+    else if (sEditor.escState == 2)
+    {
+        sEditor.escState = 0;
+        if (c == 'A')
+        {
+            cli_line_browse_history(1);
+        }
+        else if (c == 'B')
         {
-            strncpy(&ppTok[*pTokCnt][0], pTok, tokMaxLen); // store token
-            (*pTokCnt)++; // increment processed token count
+            cli_line_browse_history(-1);
         }
+        return false;
     }
 
+    switch (c)
+    {
+    case '\033': // ESC
+        sEditor.escState = 1;
+        break;
+    case '\n':
+        if (last == '\r') // CR-LF
+        {
+            break;
+        }
+        // no break
+    case '\r':
+        woken = cli_line_complete();
+        break;
+    case '\b':
+    case 0x7f: // backspace, DEL
+        if (sEditor.len > 0)
+        {
+            sEditor.len--;
+            UART_sendFromISR("\b \b", 3);
+        }
+        break;
+    case 0x15: // Ctrl+U: erase line
+    case 0x03: // Ctrl+C: drop line
+        sEditor.histPos = 0;
+        cli_line_replace("");
+        break;
+    default:
+        // store and echo printable characters
+        if (c >= ' ' && c < 0x7f && sEditor.len < CLI_BUF_LENGTH - 1)
+        {
+            sEditor.pLine[sEditor.len++] = c;
+            UART_sendFromISR(&c, 1);
+        }
+        break;
+    }
+
+    return woken;
+}
+
+// ---------------------------
+
+// split line into tokens in place (separators get overwritten by terminating zeros), returns the token count
+static uint32_t tokenize_cli_line(char *pLine, CliToken_Type ppTok[], uint32_t tokMaxCnt)
+{
+    uint32_t tokCnt = 0;
+
+    while (tokCnt < tokMaxCnt)
+    {
+        // skip separators
+        while (*pLine == ' ')
+        {
+            pLine++;
+        }
+
+        if (*pLine == '\0')
+        {
+            break;
+        }
+
+        // store token and find its end
+        ppTok[tokCnt++] = pLine;
+        while (*pLine != ' ' && *pLine != '\0')
+        {
+            pLine++;
+        }
+
+        if (*pLine == '\0')
+        {
+            break;
+        }
+
+        *(pLine++) = '\0';
+    }
+
+    return tokCnt;
+}
+
+// compare command tokens to the first tokens of the line (<0: command precedes the line, 0: every command
+// token matches, >0: command follows the line), the number of command tokens is returned on match
+static int cli_compare_command(const char *pCmd, const CliToken_Type *ppTok, uint32_t tokCnt, uint32_t *pCmdTokCnt)
+{
+    uint32_t k;
+    for (k = 0; k < tokCnt; k++)
+    {
+        const char *pTok = ppTok[k];
+
+        // compare a single token
+        while (*pCmd != ' ' && *pCmd != '\0' && *pCmd == *pTok)
+        {
+            pCmd++;
+            pTok++;
+        }
+
+        bool cmdTokEnd = (*pCmd == ' ' || *pCmd == '\0');
+        if (!cmdTokEnd || *pTok != '\0')
+        {
+            // tokens differ, the shorter one precedes
+            return (cmdTokEnd ? 0 : (uint8_t) *pCmd) - (uint8_t) *pTok;
+        }
+
+        // last command token matched
+        if (*pCmd == '\0')
+        {
+            *pCmdTokCnt = k + 1;
+            return 0;
+        }
+
+        pCmd++; // skip separator
+    }
+
+    return 1; // line is shorter than the command
+}
+
+// look up command matching the beginning of the line
+static const struct CliCommand* cli_lookup_command(const CliToken_Type *ppTok, uint32_t tokCnt, uint32_t *pCmdTokCnt)
+{
+    const struct CliCommandTable *pTable;
+    for (pTable = spCliTables; pTable != NULL; pTable = pTable->pNext)
+    {
+        // binary search in sorted table
+        int lo = 0, hi = (int) pTable->cmdCnt - 1;
+        while (lo <= hi)
+        {
+            int mid = (lo + hi) / 2;
+            int cmp = cli_compare_command(pTable->pCmds[mid].pCmd, ppTok, tokCnt, pCmdTokCnt);
+
+            if (cmp == 0)
+            {
+                return &pTable->pCmds[mid];
+            }
+            else if (cmp < 0)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid - 1;
+            }
+        }
+    }
+
+    return NULL;
 }
 
 static void process_cli_line(char *pLine)
 {
     CliToken_Type ppTok[TOK_ARR_LEN];
-    uint32_t tokCnt = 0;
+    uint32_t len = strlen(pLine);
 
     // tokenize line received from user input
-    tokenize_cli_line(pLine, ppTok, MAX_TOK_LEN, TOK_ARR_LEN, &tokCnt);
+    uint32_t tokCnt = tokenize_cli_line(pLine, ppTok, TOK_ARR_LEN);
 
     if (tokCnt == 0)
     {
@@ -113,55 +326,54 @@ static void process_cli_line(char *pLine)
     {
         MSG("\n\n? \t Print this help\n");
 
-        uint8_t i;
-        for (i = 0; i < sCliCmdCnt; i++) {
-            MSG("%s\n", spCliCmds[i].pHelp);
+        const struct CliCommandTable *pTable;
+        for (pTable = spCliTables; pTable != NULL; pTable = pTable->pNext)
+        {
+            uint16_t i;
+            for (i = 0; i < pTable->cmdCnt; i++)
+            {
+                MSG("%s %s\n", pTable->pCmds[i].pCmd, pTable->pCmds[i].pHelp);
+            }
         }
 
         MSG("\n\n");
 
         ret = 0;
-    } else {
+    }
+    else
+    {
         // lookup command
-        uint8_t i, k = 0, matchCnt = 0;
-        int8_t n = -1;
-        for (i = 0; i < sCliCmdCnt; i++) {
-            matchCnt = 0;
-
-            for (k = 0; k < spCliCmds[i].tokCnt && k < tokCnt; k++) {
-                if (strcmp(ppTok[k], spCliCmds[i].ppTok[k])) {
-                    break;
-                } else {
-                    matchCnt++;
-                    if (matchCnt == spCliCmds[i].tokCnt) {
-                        n = i;
-                        break;
-                    }
-                }
-            }
-
-            if (n != -1) {
-                break;
-            }
-        }
+        uint32_t cmdTokCnt = 0;
+        const struct CliCommand *pCmd = cli_lookup_command(ppTok, tokCnt, &cmdTokCnt);
 
         // call command callback function
-        if (n < 0) {
-            ret = -1;
-        } else {
-            struct CliCommand * pCmd = &spCliCmds[n];
-            uint8_t argc = tokCnt - pCmd->tokCnt;
-
-            if (argc < pCmd->minArgCnt) {
-                MSG("Insufficient parameters, see help! (?)\n", pLine);
-            } else {
-                ret = pCmd->pCB(&ppTok[pCmd->tokCnt], argc);
+        if (pCmd != NULL)
+        {
+            uint8_t argc = tokCnt - cmdTokCnt;
+
+            if (argc < pCmd->minArgCnt)
+            {
+                MSG("Insufficient parameters, see help! (?)\n");
+            }
+            else
+            {
+                ret = pCmd->pCB(&ppTok[cmdTokCnt], argc);
             }
         }
     }
 
     if (ret < 0)
     {
+        // restore separators for printing the line
+        uint32_t i;
+        for (i = 0; i < len; i++)
+        {
+            if (pLine[i] == '\0')
+            {
+                pLine[i] = ' ';
+            }
+        }
+
         MSG("Unknown command or bad parameter: '%s', see help! (?)\n", pLine);
     }
 }
@@ -173,64 +385,42 @@ void task_cli(void *pParam)
 
     while (1)
     {
-        UARTgets(pBuf, CLI_BUF_LENGTH);
+        // sleep until a complete line has been received
+        size_t len = xMessageBufferReceive(sLineFIFO, pBuf, CLI_BUF_LENGTH, portMAX_DELAY);
+        pBuf[len] = '\0';
         process_cli_line(pBuf);
     }
 }
 
-static void cli_remove_command(int cmdIdx) {
-    if (cmdIdx + 1 > sCliCmdCnt || cmdIdx < 0) {
-        return;
-    }
+// register a table of commands (registering the same table again has no effect)
+void cli_register_table(struct CliCommandTable *pTable)
+{
+    // check ordering, binary search relies on it
+    uint16_t i;
+    for (i = 1; i < pTable->cmdCnt; i++)
+    {
+        const char *pPrev = pTable->pCmds[i - 1].pCmd, *pCmd = pTable->pCmds[i].pCmd;
+        size_t prevLen = strlen(pPrev);
 
-    uint8_t i;
-    for (i = cmdIdx; i < sCliCmdCnt - 1; i++) {
-        memcpy(&spCliCmds[i], &spCliCmds[i + 1], sizeof(struct CliCommand));
+        if (strcmp(pPrev, pCmd) >= 0 || (!strncmp(pPrev, pCmd, prevLen) && pCmd[prevLen] == ' '))
+        {
+            MSG("CLI table of '%s' is unsorted or ambiguous, not registered!\n", pCmd);
+            return;
+        }
     }
 
-    sCliCmdCnt--;
-}
-
-void cli_register_command(char *pCmdParsHelp, uint8_t cmdTokCnt, uint8_t minArgCnt, fnCliCallback pCB) {
-    struct CliCommand *pCmd = &spCliCmds[sCliCmdCnt];
-
-    // tokenize the first part of the line (run until cmkTokCnt tokens have been fetched)
-    uint32_t tokCnt = 0;
-    tokenize_cli_line(pCmdParsHelp, pCmd->ppTok, MAX_TOK_LEN, (cmdTokCnt > TOK_ARR_LEN ? TOK_ARR_LEN : cmdTokCnt), &tokCnt);
-    pCmd->tokCnt = (uint8_t) tokCnt;
-
-    // store minimal argument count parameter
-    pCmd->minArgCnt = minArgCnt;
-
-    // copy help line
-    strncpy(pCmd->pHelp, pCmdParsHelp, MAX_HELP_LEN);
-
-    // store callback function pointer
-    pCmd->pCB = pCB;
-
-    // increase the amount of commands stored
-    sCliCmdCnt++;
-
-    // clean up if the same command has been registered before
-    uint8_t i, t;
-    int duplicate_idx = -1;
-    for (i = 0; i < (sCliCmdCnt - 1); i++) {
-        if (spCliCmds[i].tokCnt == cmdTokCnt) {
-            for (t = 0; t < cmdTokCnt; t++) {
-                if (strcmp(spCliCmds[i].ppTok[t], pCmd->ppTok[t])) {
-                    break;
-                }
-            }
-
-            if (t == cmdTokCnt) {
-                duplicate_idx = i;
-                break;
-            }
+    // append to the list of tables
+    struct CliCommandTable **ppTable = &spCliTables;
+    while (*ppTable != NULL)
+    {
+        if (*ppTable == pTable)
+        {
+            return;
         }
-    }
 
-    if (duplicate_idx > -1) {
-        cli_remove_command(duplicate_idx);
+        ppTable = &(*ppTable)->pNext;
     }
-}
 
+    pTable->pNext = NULL;
+    *ppTable = pTable;
+}
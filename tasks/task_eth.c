@@ -5,10 +5,14 @@
 
 #include "user_tasks.h"
 
+#include "sysmem.h"
+
 // ----- TASK PROPERTIES -----
 static TaskHandle_t sTH; // task handle
 static uint8_t sPrio = 5; // priority
-static uint16_t sStkSize = 4096; // stack size
+static StackType_t spStack[4096]; // stack
+static StaticTask_t sTCB; // task control block
+static const char * spName = "Eth_usr"; // task name
 void task_eth(void * pParam); // task routine function
 // ---------------------------
 
@@ -20,16 +24,42 @@ typedef union {
 static struct {
 	IPAddrUnion ipAddr; // ip-address
 	bool isConnected; // are we connected to a network?
+	volatile uint32_t linkUpTick; // OS tick of the last link-up
 } sState;
 
+// notification bits (events are delivered from the tcpip thread)
+#define ETH_NOTIFY_LINK (1 << 0) // link state has changed
+#define ETH_NOTIFY_ADDR (1 << 1) // interface status or address has changed (DHCP bound, lease lost etc.)
+
+// wake up task to reevaluate the connection state
+static void eth_notify(uint32_t bits) {
+	if (sTH != NULL) {
+		xTaskNotify(sTH, bits, eSetBits);
+	}
+}
+
+// link state of the interface has changed
+static void eth_link_cb(struct netif * pNetif) {
+	if (netif_is_link_up(pNetif)) {
+		sState.linkUpTick = xTaskGetTickCount();
+	}
+
+	eth_notify(ETH_NOTIFY_LINK);
+}
+
+// status (up/down, address) of the interface has changed
+static void eth_status_cb(struct netif * pNetif) {
+	eth_notify(ETH_NOTIFY_ADDR);
+}
+
 void setup();
 
 // register task
 void reg_task_eth() {
-	BaseType_t result = xTaskCreate(task_eth, "Eth_usr", sStkSize, NULL, sPrio, &sTH);
-	if (result != pdPASS) { // error handling
-    	UARTprintf("Failed to create task! (errcode: %d)\n", result);
-	}
+	sTH = xTaskCreateStatic(task_eth, spName, sizeof(spStack) / sizeof(StackType_t), NULL, sPrio, spStack, &sTCB);
+
+	SYSMEM_register("Ethernet", spName, sizeof(spStack) / sizeof(StackType_t), sizeof(sTCB) + sizeof(sState));
+	SYSMEM_register("lwIP", TCPIP_THREAD_NAME, 0, MEM_SIZE + PBUF_POOL_SIZE * PBUF_POOL_BUFSIZE); // heap and pbuf pool (control pools not counted)
 
 	setup(); // setup
 }
@@ -43,15 +73,25 @@ void setup_in_tcpip_thread(void * pArg) {
     LocatorMACAddrSet(pui8MAC);
 
     LocatorAppTitleSet("ClockSync2");
+
+    // get notified of link and address changes (the interface is created by now)
+    netif_set_link_callback(netif_default, eth_link_cb);
+    netif_set_status_callback(netif_default, eth_status_cb);
+    if (netif_is_link_up(netif_default)) {
+        sState.linkUpTick = xTaskGetTickCount();
+    }
+    eth_notify(ETH_NOTIFY_LINK | ETH_NOTIFY_ADDR);
 }
 
 // Ethernet event handling (DHCP connection successful, disconnected from the network etc.)
 void eth_client_event_handler(uint32_t ui32Event, void *pvData, uint32_t ui32Param) {
-	return;
+	if (ui32Event == ETH_CLIENT_EVENT_DHCP || ui32Event == ETH_CLIENT_EVENT_DISCONNECT) {
+		eth_notify(ETH_NOTIFY_ADDR);
+	}
 }
 
 void setup() {
-	UARTprintf("Setting up eth_task...\r\n");
+	MSG("Setting up eth_task...\r\n");
 
 	// fetch MAC-address
 	uint32_t pUser[2];
@@ -68,9 +108,9 @@ void setup() {
     pMAC[5] = ((pUser[1] >> 16) & 0xff);
 
     // print MAC array to the user
-    UARTprintf("MAC-address: %02x:%02x:%02x:%02x:%02x:%02x\r\n", pMAC[0], pMAC[1], pMAC[2], pMAC[3], pMAC[4], pMAC[5]);
+    MSG("MAC-address: %02x:%02x:%02x:%02x:%02x:%02x\r\n", pMAC[0], pMAC[1], pMAC[2], pMAC[3], pMAC[4], pMAC[5]);
 
-    UARTprintf("Setup done!\r\n");
+    MSG("Setup done!\r\n");
 
     // set Ethernet interrupt priority low
     ROM_IntPrioritySet(INT_EMAC0, 0xE0);
@@ -86,39 +126,48 @@ void setup() {
     sState.isConnected = false;
 }
 
-#define PRINT_IP(ip) UARTprintf("IP-address: %d.%d.%d.%d\r\n", (ip & 0xFF), ((ip >> 8) & 0xFF), ((ip >> 16) & 0xFF), ((ip >> 24) & 0xFF));
+#define PRINT_IP(ip) MSG("IP-address: %d.%d.%d.%d\r\n", (ip & 0xFF), ((ip >> 8) & 0xFF), ((ip >> 16) & 0xFF), ((ip >> 24) & 0xFF));
 #define IP_ADDR_VALID(ip) (ip != 0 && ip != ~0)
 
 void task_eth(void * pParam) {
 	uint32_t currentIP = 0; // current IP address
+	uint32_t events = 0; // notifications received
 
 	// FŐCIKLUS
 	while (1) {
-		vTaskDelay(pdMS_TO_TICKS(500)); // delay between pollings
+		// sleep until the tcpip thread reports a change
+		xTaskNotifyWait(0, ~0, &events, portMAX_DELAY);
+
+		if (events & ETH_NOTIFY_LINK) {
+			MSG("Link %s\n", netif_is_link_up(netif_default) ? "up" : "down");
+		}
 
-		currentIP = lwIPLocalIPAddrGet(); // query IP address
+		// connected: link is up and an address has been assigned
+		currentIP = netif_is_link_up(netif_default) ? lwIPLocalIPAddrGet() : 0;
 
 		// hif we were not up before but now we have received an IP address
 		if (sState.isConnected == false && IP_ADDR_VALID(currentIP)) {
 			sState.isConnected = true;
+			sState.ipAddr.qword = currentIP;
 
 			// print IP address
-			UARTprintf("Connected! ");
+			MSG("Connected (%u ms after link-up)! ", (xTaskGetTickCount() - sState.linkUpTick) * 1000 / configTICK_RATE_HZ);
 			PRINT_IP(currentIP);
 
-			// start PTP task
-			UARTprintf("Starting PTP-task!\n");
-			reg_task_ptp();
+			// start PTP task or resume it
+			MSG("Starting PTP-task!\n");
+			reg_task_ptp(sState.linkUpTick);
 
 		} else if (sState.isConnected == true && !IP_ADDR_VALID(currentIP)) { // if we have disconnected from the network
 
-		    UARTprintf("Disconnected!\n");
+		    MSG("Disconnected!\n");
 
 			sState.isConnected = false;
+			sState.ipAddr.qword = 0;
 
-			// stop PTP task
-			UARTprintf("Stopping PTP-task!\n");
-			unreg_task_ptp();
+			// pause PTP task (servo and clock state are kept for a quick relock)
+			MSG("Pausing PTP-task!\n");
+			pause_task_ptp();
 
 		} else { // we are connected
 			// Todo ...
@@ -0,0 +1,42 @@
+/* (C) András Wiesner, 2021 */
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "user_tasks.h"
+
+#include "ptp_evlog.h"
+#include "sysmem.h"
+
+// ----- TASK PROPERTIES -----
+static TaskHandle_t sTH; // task handle
+static uint8_t sPrio = 2; // priority (below the PTP task producing the records)
+static StackType_t spStack[1024]; // stack
+static StaticTask_t sTCB; // task control block
+static const char * spName = "evlog"; // task name
+void task_evlog(void * pParam); // task routine function
+// ---------------------------
+
+#define EVLOG_DRAIN_PERIOD_MS (50) // ring polling period (a ring of PTP_EVLOG_LENGTH records covers 2 s at 16 Hz Sync)
+
+// register event log drain task
+void reg_task_evlog(struct PTPEventLog * pLog) {
+    sTH = xTaskCreateStatic(task_evlog, spName, sizeof(spStack) / sizeof(StackType_t), pLog, sPrio, spStack, &sTCB);
+
+    SYSMEM_register("Event log", spName, sizeof(spStack) / sizeof(StackType_t), sizeof(sTCB)); // ring is part of the PTP instance
+}
+
+// task routine: format records outside of the synchronization path
+void task_evlog(void * pParam) {
+    struct PTPEventLog * pLog = (struct PTPEventLog *) pParam;
+    struct PTPEvLogRecord rec;
+
+    while (1) {
+        // empty the ring
+        while (ptp_evlog_pop(pLog, &rec)) {
+            ptp_evlog_print(&rec);
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(EVLOG_DRAIN_PERIOD_MS));
+    }
+}
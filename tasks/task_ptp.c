@@ -1,61 +1,86 @@
 /* (C) András Wiesner, 2020 */
 
+#include <string.h>
+
 #include "FreeRTOS.h"
 #include "task.h"
 
 #include "user_tasks.h"
 
 #include "ptp.h"
+#include "ptp_instance.h"
+
+#include "sysmem.h"
 
 #include "lwip/igmp.h"
 
 // ----- TASK PROPERTIES -----
 static TaskHandle_t sTH; // task handle
 static uint8_t sPrio = 5; // priority
-static uint16_t sStkSize = 8192; // stack size
+static StackType_t spStack[8192]; // stack
+static StaticTask_t sTCB; // task control block
+static const char * spName = "PTP_usr"; // task name
 void task_ptp(void * pParam); // task routine function
 // ---------------------------
 
-// udp control blocks
-static struct udp_pcb * spPTP_pcb[2];
+// udp control blocks (preallocated, never passed to udp_remove())
+static struct udp_pcb spPTP_pcbMem[2];
+static struct udp_pcb * spPTP_pcb[2] = { &spPTP_pcbMem[0], &spPTP_pcbMem[1] };
+
+// PTP engine instance and the arena it is allocated from
+#define PTP_ARENA_SIZE (sizeof(struct PTPInstance) + PTP_ARENA_ALIGN)
+static uint64_t spPTPArenaMem[(PTP_ARENA_SIZE + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+static struct PTPArena sPTPArena;
+static struct PTPInstance * spPTPInst = NULL;
 
 // callback function receiveing data from udp "sockets"
 void ptp_recv_cb(void * pArg, struct udp_pcb * pPCB, struct pbuf *pP, ip_addr_t * pAddr, uint16_t port);
 
+// kinds of control items
+enum PacketFIFOControl {
+    PFC_PAUSE, // pause transport (link lost)
+    PFC_RESUME, // resume transport (link restored)
+    PFC_ENGINE // request of the CLI (reset, domain change etc.)
+};
+
+// element of the packet FIFO
+struct PacketFIFOItem {
+    struct pbuf * pPBuf; // received packet (NULL: control item)
+    struct ip_addr srcAddr; // sender's IP address
+    enum PacketFIFOControl control; // control item: kind
+    uint32_t linkUpTick; // control item: OS tick of link-up (resume only)
+    struct PTPRequest engineReq; // control item: request to the engine (PFC_ENGINE only)
+};
+
 // FIFO for incoming packets
 #define PACKET_FIFO_LENGTH (32)
 static QueueHandle_t sPacketFIFO;
+static StaticQueue_t sPacketFIFOMem; // queue control block
+static uint8_t spPacketFIFOStorage[PACKET_FIFO_LENGTH * sizeof(struct PacketFIFOItem)]; // queue storage
+
+static uint32_t sLinkUpTick; // OS tick of the link-up the task has been started at
 
 // create udp listeners
 void create_ptp_listeners() {
     // create packet FIFO
-    sPacketFIFO = xQueueCreate(PACKET_FIFO_LENGTH, sizeof(struct pbuf *));
+    sPacketFIFO = xQueueCreateStatic(PACKET_FIFO_LENGTH, sizeof(struct PacketFIFOItem), spPacketFIFOStorage, &sPacketFIFOMem);
+
+    // initialize PCBs the way udp_new() does
+    uint8_t i;
+    for (i = 0; i < 2; i++) {
+        memset(spPTP_pcb[i], 0, sizeof(struct udp_pcb));
+        spPTP_pcb[i]->ttl = UDP_TTL;
+    }
 
     // listening on the port 319
-    spPTP_pcb[0] = udp_new();
     udp_bind(spPTP_pcb[0], IP_ADDR_ANY, PTP_PORT0);
     udp_recv(spPTP_pcb[0], ptp_recv_cb, NULL);
 
     // listening on the port 320
-    spPTP_pcb[1] = udp_new();
     udp_bind(spPTP_pcb[1], IP_ADDR_ANY, PTP_PORT1);
     udp_recv(spPTP_pcb[1], ptp_recv_cb, NULL);
 }
 
-// remove listeners
-void destroy_ptp_listeners() {
-	// disconnect UDP "sockets"
-    udp_disconnect(spPTP_pcb[0]);
-    udp_disconnect(spPTP_pcb[1]);
-
-    // destroy UDP sockets
-    udp_remove(spPTP_pcb[0]);
-    udp_remove(spPTP_pcb[1]);
-
-    // destroy packet FIFO
-    vQueueDelete(sPacketFIFO);
-}
-
 // join PTP IGMP groups
 void join_ptp_igmp_groups() {
     // join group for default set of messages (everything except for peer delay)
@@ -78,47 +103,109 @@ void leave_ptp_igmp_groups() {
     igmp_leavegroup(&netif_default->ip_addr, &addr_PTP_IGMP);
 }
 
-// register PTP task and initialize
-void reg_task_ptp() {
+// pass transport control item to the PTP task (handled in order with the packets already queued)
+static void ptp_task_control(bool pause, uint32_t linkUpTick) {
+    struct PacketFIFOItem item = { NULL, { 0 }, pause ? PFC_PAUSE : PFC_RESUME, linkUpTick };
+    xQueueSend(sPacketFIFO, &item, portMAX_DELAY);
+}
+
+// pass request of the CLI to the PTP task, so the synchronization path is only changed by the task running it
+static void ptp_task_engine_request(struct PTPInstance * pInst, const struct PTPRequest * pReq) {
+    struct PacketFIFOItem item = { NULL, { 0 }, PFC_ENGINE, 0 };
+    item.engineReq = *pReq;
+    xQueueSend(sPacketFIFO, &item, portMAX_DELAY);
+}
+
+// register PTP task and initialize on the first call, resume transport on later ones
+void reg_task_ptp(uint32_t linkUpTick) {
     join_ptp_igmp_groups(); // enter PTP IGMP groups
+
+    // task, listeners and instance are kept for the whole runtime, so servo and clock state survive link flaps
+    if (spPTPInst != NULL) {
+        ptp_task_control(false, linkUpTick);
+        return;
+    }
+
+    sLinkUpTick = linkUpTick;
+
     create_ptp_listeners(); // create listeners
 
-    ptp_init(spPTP_pcb); // initialize PTP subsystem
+    // create PTP instance
+    ptp_arena_init(&sPTPArena, spPTPArenaMem, sizeof(spPTPArenaMem));
+    spPTPInst = ptp_create_instance(&sPTPArena);
+    ptp_set_request_hook(spPTPInst, ptp_task_engine_request);
+    ptp_register_cli_commands(spPTPInst);
+    reg_task_evlog(ptp_get_event_log(spPTPInst)); // drain task lives as long as the instance
+
+    ptp_init(spPTPInst, spPTP_pcb); // initialize PTP subsystem
 
     // create task
-    BaseType_t result = xTaskCreate(task_ptp, "PTP_usr", sStkSize, NULL, sPrio, &sTH);
-    if (result != pdPASS) {
-    	MSG("Failed to create task! (errcode: %d)\n", result);
-    }
+    sTH = xTaskCreateStatic(task_ptp, spName, sizeof(spStack) / sizeof(StackType_t), NULL, sPrio, spStack, &sTCB);
+
+    SYSMEM_register("PTP", spName, sizeof(spStack) / sizeof(StackType_t),
+                    sizeof(sTCB) + sizeof(sPacketFIFOMem) + sizeof(spPacketFIFOStorage) + sizeof(spPTPArenaMem) + sizeof(spPTP_pcbMem));
 }
 
-// unregister PTP task
-void unreg_task_ptp() {
-	vTaskDelete(sTH); // taszk törlése
+// pause PTP transport on link loss (task, servo and learned addend are kept)
+void pause_task_ptp() {
+    if (spPTPInst == NULL) {
+        return;
+    }
 
-	leave_ptp_igmp_groups(); // kilépés az IGMP csoportokból
-	destroy_ptp_listeners(); // figyelők törlése
+    leave_ptp_igmp_groups(); // kilépés az IGMP csoportokból
+    ptp_task_control(true, 0);
 }
 
 // callback for packet reception on port 319 and 320
 void ptp_recv_cb(void * pArg, struct udp_pcb * pPCB, struct pbuf *pP, ip_addr_t * pAddr, uint16_t port) {
-    xQueueSend(sPacketFIFO, &pP, portMAX_DELAY);
+    struct PacketFIFOItem item = { pP, *pAddr }; // source address is only valid inside the callback
+    xQueueSend(sPacketFIFO, &item, portMAX_DELAY);
 }
 
 // taszk függvénye
 void task_ptp(void * pParam) {
-    // pointer of received packet (assigned subsequently)
-    struct pbuf * pPBuf;
+    // received packet (assigned subsequently)
+    struct PacketFIFOItem item;
+
+    // time of last housekeeping
+    TickType_t lastPeriodic = xTaskGetTickCount();
+
+    ptp_mark_link_up(spPTPInst, sLinkUpTick);
     
     while (1) {
-        // pop packet from FIFO
-        xQueueReceive(sPacketFIFO, &pPBuf, portMAX_DELAY);
+        // handle expired timeouts and send due master messages, wake up for the nearest deadline and for housekeeping even if no packets are coming
+        TickType_t elapsed = xTaskGetTickCount() - lastPeriodic;
+        TickType_t wait = (elapsed < pdMS_TO_TICKS(PTP_PERIODIC_INTERVAL_MS)) ? (pdMS_TO_TICKS(PTP_PERIODIC_INTERVAL_MS) - elapsed) : 0;
+        TickType_t pollWait = ptp_poll(spPTPInst);
+        if (pollWait < wait) {
+            wait = pollWait;
+        }
 
-        // process packet
-        ptp_process_packet(pPBuf);
-        
-        // release pbuf resources
-        pbuf_free(pPBuf);
+        // pop packet from FIFO
+        if (xQueueReceive(sPacketFIFO, &item, wait) == pdPASS) {
+            if (item.pPBuf == NULL) { // link lost or restored, CLI request
+                if (item.control == PFC_PAUSE) {
+                    ptp_pause(spPTPInst);
+                } else if (item.control == PFC_RESUME) {
+                    ptp_resume(spPTPInst);
+                    ptp_mark_link_up(spPTPInst, item.linkUpTick);
+                } else {
+                    ptp_handle_request(spPTPInst, &item.engineReq);
+                }
+            } else {
+                // process packet
+                ptp_process_packet(spPTPInst, item.pPBuf, &item.srcAddr);
+
+                // release pbuf resources
+                pbuf_free(item.pPBuf);
+            }
+        }
+
+        // run housekeeping if due
+        if ((xTaskGetTickCount() - lastPeriodic) >= pdMS_TO_TICKS(PTP_PERIODIC_INTERVAL_MS)) {
+            lastPeriodic = xTaskGetTickCount();
+            ptp_periodic(spPTPInst);
+        }
     }
 }
 
@@ -33,9 +33,12 @@
 extern uint32_t g_ui32SysClock;
 
 void reg_task_eth(); // register ETH task
-void reg_task_ptp(); // register PTP task
-void unreg_task_ptp();  // unregister PTP task
+void reg_task_ptp(uint32_t linkUpTick); // register PTP task (resumes transport if it's already running), linkUpTick: OS tick the link came up at
+void pause_task_ptp(); // pause PTP transport (task and synchronization state are kept)
 void reg_task_cli(); // register CLI task
 void unreg_task_cli(); // unregister CLI task
 
+struct PTPEventLog;
+void reg_task_evlog(struct PTPEventLog * pLog); // register event log drain task
+
 #endif /* TASKS_USER_TASKS_H_ */
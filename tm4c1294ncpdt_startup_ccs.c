@@ -63,8 +63,8 @@ extern void xPortSysTickHandler(void);
 // lwIP...
 extern void lwIPEthernetIntHandler(void);
 
-// UARTStdio...
-extern void UARTStdioIntHandler(void);
+// buffered UART output...
+extern void UART_intHandler(void);
 
 
 //*****************************************************************************
@@ -99,7 +99,7 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // GPIO Port C
     IntDefaultHandler,                      // GPIO Port D
     IntDefaultHandler,                      // GPIO Port E
-	UARTStdioIntHandler,                    // UART0 Rx and Tx
+	UART_intHandler,                        // UART0 Rx and Tx
     IntDefaultHandler,                      // UART1 Rx and Tx
     IntDefaultHandler,                      // SSI0 Rx and Tx
     IntDefaultHandler,                      // I2C0 Master and Slave
@@ -4,17 +4,59 @@
 
 #include <string.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
 
 #include "driverlib/uart.h"
 #include "driverlib/gpio.h"
 #include "driverlib/pin_map.h"
+#include "driverlib/interrupt.h"
 #include "utils.h"
 #include "hw_memmap.h"
+#include "inc/hw_ints.h"
 
 #include "utils/uartstdio.h"
+#include "utils/ustdlib.h"
+
+#include "hw_port/ptp_port_tiva_tm4c1294.h"
+#include "cli.h"
+#include "sysmem.h"
 
 extern uint32_t g_ui32SysClock;
 
+#define UART_CYCLE_COUNTER() ptphw_cycle_counter()
+#define UART_CYCLE_FREQ_HZ (120000000)
+
+// Transmit buffer
+//
+// Producers reserve space in a short critical section, copy their data outside of it and publish the
+// data when the last concurrent producer has finished copying. The interrupt handler only sends published data.
+// Nobody ever waits for the serial line: messages not fitting into the buffer are dropped as a whole and counted.
+static uint8_t spTxBuf[UART_TX_BUFFER_SIZE];
+static volatile uint32_t sTxReserved; // bytes reserved by producers
+static volatile uint32_t sTxCommitted; // bytes ready for transmission
+static volatile uint32_t sTxRead; // bytes moved into the hardware FIFO (modified with interrupts masked only)
+static uint32_t sTxWriters; // number of producers copying into the buffer
+
+static fnUARTRxCallback spRxCB = NULL; // consumer of received characters
+
+// transmission statistics
+static struct
+{
+    uint32_t msgs; // messages enqueued
+    uint32_t bytes; // bytes enqueued
+    uint32_t droppedMsgs; // messages dropped
+    uint32_t droppedBytes; // bytes dropped
+    uint32_t maxLevel; // buffer high-water mark
+    uint64_t cycles; // CPU cycles spent on formatting, enqueuing and in the interrupt
+    uint32_t startTick; // OS tick of last reset
+} sTxStats;
+
+#define UART_TX_IDX(i) ((i) & (UART_TX_BUFFER_SIZE - 1))
+
 void UART_init() {
     EnableWaitPeripheral(SYSCTL_PERIPH_GPIOA); // enable GPIOA
 	EnableWaitPeripheral(SYSCTL_PERIPH_UART0); // enable UART0
@@ -24,25 +66,198 @@ void UART_init() {
 	GPIOPinConfigure(GPIO_PA1_U0TX);
 
 	UARTClockSourceSet(UART0_BASE, UART_CLOCK_SYSTEM);
-	UARTStdioConfig(0, 115200, g_ui32SysClock);
+	UARTStdioConfig(0, 115200, g_ui32SysClock); // port configuration (UARTStdio functions are only used in fatal error handlers)
+
+	// interrupt must be masked by critical sections
+	IntPrioritySet(INT_UART0, configKERNEL_INTERRUPT_PRIORITY);
+
+	// enable cycle counter for load measurement
+	ptphw_cycle_counter_enable();
+	sTxStats.startTick = xTaskGetTickCount();
+
+	SYSMEM_register("UART", NULL, 0, sizeof(spTxBuf) + sizeof(sTxStats));
+}
+
+// move published data into the hardware FIFO (call with the UART interrupt masked or from the interrupt)
+static void UART_primeTx() {
+    while (sTxRead != sTxCommitted && UARTSpaceAvail(UART0_BASE)) {
+        UARTCharPutNonBlocking(UART0_BASE, spTxBuf[UART_TX_IDX(sTxRead)]);
+        sTxRead++;
+    }
+
+    // the TX interrupt fires when the FIFO has drained below its trigger level
+    if (sTxRead != sTxCommitted) {
+        UARTIntEnable(UART0_BASE, UART_INT_TX);
+    } else {
+        UARTIntDisable(UART0_BASE, UART_INT_TX);
+    }
+}
+
+// copy data into the transmit buffer, '\n' is extended to "\r\n" if crlf is true
+// (the UART interrupt is masked in critical sections, so from there the buffer is accessed without them)
+static bool UART_enqueue(const char * pData, uint32_t length, bool crlf, uint32_t startCycle, bool fromISR) {
+    // compute space needed
+    uint32_t n = length, i;
+    if (crlf) {
+        for (i = 0; i < length; i++) {
+            n += (pData[i] == '\n');
+        }
+    }
+
+    // reserve space
+    if (!fromISR) {
+        taskENTER_CRITICAL();
+    }
+    bool fits = n <= (UART_TX_BUFFER_SIZE - (sTxReserved - sTxRead));
+    uint32_t pos = sTxReserved;
+    if (fits) {
+        sTxReserved += n;
+        sTxWriters++;
+    } else {
+        sTxStats.droppedMsgs++;
+        sTxStats.droppedBytes += n;
+    }
+
+    if (!fromISR) {
+        taskEXIT_CRITICAL();
+    }
+
+    if (!fits) {
+        return false;
+    }
+
+    // copy data
+    for (i = 0; i < length; i++) {
+        if (crlf && pData[i] == '\n') {
+            spTxBuf[UART_TX_IDX(pos++)] = '\r';
+        }
+        spTxBuf[UART_TX_IDX(pos++)] = pData[i];
+    }
+
+    // publish data if no other producer is in progress and start transmission
+    if (!fromISR) {
+        taskENTER_CRITICAL();
+    }
+
+    if (--sTxWriters == 0) {
+        sTxCommitted = sTxReserved;
+    }
+
+    uint32_t level = sTxReserved - sTxRead;
+    if (level > sTxStats.maxLevel) {
+        sTxStats.maxLevel = level;
+    }
+
+    sTxStats.msgs++;
+    sTxStats.bytes += n;
+
+    UART_primeTx();
+
+    sTxStats.cycles += UART_CYCLE_COUNTER() - startCycle;
+
+    if (!fromISR) {
+        taskEXIT_CRITICAL();
+    }
+
+    return true;
 }
 
-void UART_send(uint8_t * pBuffer, uint32_t length) {
+bool UART_send(uint8_t * pBuffer, uint32_t length) {
  	if (length == 0) {
 		length = strlen((char *) pBuffer);
 	}
 
-	uint32_t transmitted = 0;
+    return UART_enqueue((const char *) pBuffer, length, false, UART_CYCLE_COUNTER(), false);
+}
 
-	while (transmitted != length) {
-		bool ret = UARTCharPutNonBlocking(UART0_BASE, pBuffer[transmitted]);
+bool UART_sendFromISR(const char * pBuffer, uint32_t length) {
+    return UART_enqueue(pBuffer, length, false, UART_CYCLE_COUNTER(), true);
+}
 
-		if (ret == true) {
-			transmitted++;
-		}
-	}   
+void UART_setRxCallback(fnUARTRxCallback pCB) {
+    spRxCB = pCB;
 }
 
-void UART_sendStr(char * pBuffer) {
-    UART_send((uint8_t *) pBuffer, 0);
+bool UART_sendStr(char * pBuffer) {
+    return UART_send((uint8_t *) pBuffer, 0);
+}
+
+bool UART_printf(const char * pFmt, ...) {
+    uint32_t start = UART_CYCLE_COUNTER();
+    char pMsg[UART_MSG_MAX_LEN];
+
+    va_list args;
+    va_start(args, pFmt);
+    int len = uvsnprintf(pMsg, sizeof(pMsg), pFmt, args);
+    va_end(args);
+
+    // truncated messages are sent as far as they fit
+    if (len > (int) sizeof(pMsg) - 1) {
+        len = sizeof(pMsg) - 1;
+    } else if (len < 0) {
+        return false;
+    }
+
+    return UART_enqueue(pMsg, len, true, start, false);
+}
+
+void UART_intHandler() {
+    uint32_t start = UART_CYCLE_COUNTER();
+    uint32_t ints = UARTIntStatus(UART0_BASE, true);
+    UARTIntClear(UART0_BASE, ints);
+
+    // reception: hand characters over to the consumer (received characters are discarded if there's none)
+    bool yield = false;
+    if (ints & (UART_INT_RX | UART_INT_RT)) {
+        while (UARTCharsAvail(UART0_BASE)) {
+            char c = (char) UARTCharGetNonBlocking(UART0_BASE);
+            if (spRxCB != NULL) {
+                yield |= spRxCB(c);
+            }
+        }
+    }
+
+    // transmission (echoes written by the consumer are sent immediately)
+    UART_primeTx();
+
+    sTxStats.cycles += UART_CYCLE_COUNTER() - start;
+
+    portYIELD_FROM_ISR(yield);
+}
+
+// ---------------------------
+
+static int CB_stats(const CliToken_Type *ppArgs, uint8_t argc) {
+    if (argc > 0 && !strcmp(ppArgs[0], "reset")) {
+        taskENTER_CRITICAL();
+        memset(&sTxStats, 0, sizeof(sTxStats));
+        sTxStats.startTick = xTaskGetTickCount();
+        taskEXIT_CRITICAL();
+        return 0;
+    }
+
+    float elapsed = (xTaskGetTickCount() - sTxStats.startTick) / (float) configTICK_RATE_HZ;
+    if (elapsed <= 0) {
+        return 0;
+    }
+
+    char pL[64];
+    sprintf(pL, "%.1f s, CPU: %.4f %%", elapsed, (100.0f * sTxStats.cycles) / (elapsed * UART_CYCLE_FREQ_HZ));
+    MSG("> UART TX: %s\n", pL);
+    MSG("> Messages: %u (%u B), dropped: %u (%u B), max. buffer level: %u/%u B, cycles/message: %u\n", sTxStats.msgs, sTxStats.bytes,
+        sTxStats.droppedMsgs, sTxStats.droppedBytes, sTxStats.maxLevel, UART_TX_BUFFER_SIZE,
+        sTxStats.msgs ? (uint32_t) (sTxStats.cycles / sTxStats.msgs) : 0);
+
+    return 0;
+}
+
+static const struct CliCommand spCliCmds[] = {
+    { "uart stats", "[reset] \t\t\tPrint or reset serial output statistics", 0, CB_stats },
+};
+
+static struct CliCommandTable sCliTable = CLI_COMMAND_TABLE(spCliCmds);
+
+// register transmit statistics commands
+void UART_registerCliCommands() {
+    cli_register_table(&sCliTable);
 }
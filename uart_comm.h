@@ -4,13 +4,29 @@
 #define SRC_UART_COMM
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#define UART_TX_BUFFER_SIZE (4096) // size of the transmit buffer (power of 2)
+#define UART_MSG_MAX_LEN (192) // maximal length of a formatted message
 
 // UART initialization
 void UART_init();
 
-// send data through UART
+// send data through UART (non-blocking, data is dropped if the transmit buffer is full)
 // - if length = 0, then pBuffer-t is treated as a null-terminated string
-void UART_send(uint8_t * pBuffer, uint32_t length);
-void UART_sendStr(char * pBuffer);
+// - these functions may be called from any task but not from interrupts
+bool UART_send(uint8_t * pBuffer, uint32_t length);
+bool UART_sendStr(char * pBuffer);
+bool UART_printf(const char * pFmt, ...); // formatted output ('\n' is extended to "\r\n")
+
+// reception: characters are passed to a callback from the interrupt
+typedef bool (*fnUARTRxCallback)(char c); // return true if a higher priority task has been woken
+void UART_setRxCallback(fnUARTRxCallback pCB); // set consumer of received characters
+bool UART_sendFromISR(const char * pBuffer, uint32_t length); // send data from the reception callback (e.g. echo)
+
+// UART0 interrupt handler
+void UART_intHandler();
+
+void UART_registerCliCommands(); // register transmit statistics commands
 
 #endif /* SRC_UART_COMM */
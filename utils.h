@@ -8,6 +8,7 @@
 #include "driverlib/sysctl.h"
 
 #include "utils/uartstdio.h"
+#include "uart_comm.h"
 
 #define EnableWaitPeripheral(x) { if(!SysCtlPeripheralReady(x)) { SysCtlPeripheralEnable(x); \
 	while (!SysCtlPeripheralReady(x)) {}; }}
@@ -34,10 +35,14 @@
     #define ntohs(a)    htons((a))
 #endif
 
-#define MSG(...) UARTprintf(__VA_ARGS__)
+#define MSG(...) UART_printf(__VA_ARGS__)
 
-#define CLILOG(en, ...) { if (en) UARTprintf(__VA_ARGS__); }
+#define CLILOG(en, ...) { if (en) UART_printf(__VA_ARGS__); }
 
 #define LIMIT(x,l) (x < -l ? -l : (x > l ? l : x))
 
+#ifndef MIN
+    #define MIN(a,b) (((a) < (b)) ? (a) : (b))
+#endif
+
 #endif /* SRC_UTILS_H_ */